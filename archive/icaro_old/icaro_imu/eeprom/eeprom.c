@@ -1,7 +1,22 @@
+#include <stddef.h>
 #include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #include "eeprom.h"
 
+static uint16_t estimator_state_crc(const struct estimator_state *state)
+{
+    const uint8_t *bytes = (const uint8_t *)state;
+    uint16_t crc = 0xFFFF;
+    uint8_t i;
+    
+    for (i = 0; i < offsetof(struct estimator_state, crc); i++)
+    {
+        crc = _crc_ccitt_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
 void mpu6050_read_cal_values(int16_t* values)
 {
     values[0] = eeprom_read_word((uint16_t*)AX_OFFSET_ADDRESS);
@@ -24,3 +39,35 @@ void mpu6050_save_cal_values(int16_t* values)
     eeprom_write_word((uint16_t*)GZ_OFFSET_ADDRESS, values[5]);
 }
 
+/**
+ * Read the estimator state record.
+ *
+ * @param state Container for the record
+ * @return 1 if the record is present and valid, 0 otherwise
+ */
+uint8_t estimator_state_read(struct estimator_state *state)
+{
+    eeprom_read_block(state, (const void*)ESTIMATOR_STATE_ADDRESS, sizeof(*state));
+    
+    return state->version == ESTIMATOR_STATE_VERSION &&
+        state->length == sizeof(*state) &&
+        state->crc == estimator_state_crc(state);
+}
+
+/**
+ * Write the estimator state record.
+ *
+ * eeprom_update_block() only erases and writes the bytes that changed, so
+ * an unchanged field costs no write cycles.
+ *
+ * @param state Record to save, version, length and crc are filled in
+ */
+void estimator_state_save(struct estimator_state *state)
+{
+    state->version = ESTIMATOR_STATE_VERSION;
+    state->length = sizeof(*state);
+    state->crc = estimator_state_crc(state);
+    
+    eeprom_update_block(state, (void*)ESTIMATOR_STATE_ADDRESS, sizeof(*state));
+}
+
@@ -1,6 +1,8 @@
 #ifndef __EEPROM_H_
 #define __EEPROM_H_
 
+#include <stdint.h>
+
 #define AX_OFFSET_ADDRESS 0     // two bytes
 #define AY_OFFSET_ADDRESS 2     // two bytes
 #define AZ_OFFSET_ADDRESS 4     // two bytes
@@ -8,7 +10,30 @@
 #define GY_OFFSET_ADDRESS 8     // two bytes
 #define GZ_OFFSET_ADDRESS 10    // two bytes
 
+#define ESTIMATOR_STATE_ADDRESS 12  // sizeof(struct estimator_state) bytes
+#define ESTIMATOR_STATE_VERSION 2
+
+#define FLIGHT_RECORDER_ADDRESS 64  // reason, count, FLIGHT_RECORDER_ENTRIES entries
+
+/**
+ * Learned estimator state kept across power cycles: the raw magnetometer
+ * range seen on each axis, the hard-iron offsets are its middle. The range
+ * is kept rather than the offsets so learning goes on from it after a
+ * restart instead of from a partial swing. Protected by a version, its own
+ * size and a CRC16 so a blank, old or torn record is ignored.
+ */
+struct estimator_state
+{
+    uint8_t version;
+    uint8_t length;
+    int16_t mag_min[3];
+    int16_t mag_max[3];
+    uint16_t crc;
+};
+
 void mpu6050_read_cal_values(int16_t *values);
 void mpu6050_save_cal_values(int16_t *values);
+uint8_t estimator_state_read(struct estimator_state *state);
+void estimator_state_save(struct estimator_state *state);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,214 @@
+/**
+ * Fixed-point biquad filter bank between sensor read and fusion.
+ *
+ * Same arrangement as the rpi-poc float bank, up to BIQUAD_MAX_STAGES second
+ * order sections with their own coefficients per axis, but sized for the AVR:
+ * coefficients are worked out in float once at set-up and kept as Q14 int16,
+ * each section runs in direct form I on the raw int16 readings with a 32 bit
+ * accumulator, first order error feedback of the truncated bits (so low
+ * cutoffs don't stall on a dead band) and saturation back to int16.
+ *
+ * Coefficients from the RBJ audio EQ cookbook:
+ * https://www.w3.org/TR/audio-eq-cookbook/
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "biquad.h"
+
+#define BIQUAD_SHIFT 14
+#define BIQUAD_ONE (1L << BIQUAD_SHIFT)
+
+struct biquad_section {
+    int16_t b0, b1, b2, a1, a2; // Q14, normalised by a0
+    int16_t x1, x2, y1, y2;
+    int16_t error;              // bits dropped by the last shift
+};
+
+struct biquad_section sections[BIQUAD_MAX_STAGES][BIQUAD_AXES];
+uint8_t stage_count = 0;
+
+static int16_t biquad_q14(float value)
+{
+    float scaled = value * BIQUAD_ONE;
+    
+    if(scaled > 32767.0f) {
+        return 32767;
+    }
+    if(scaled < -32768.0f) {
+        return -32768;
+    }
+    return (int16_t)lrintf(scaled);
+}
+
+static void biquad_set(uint8_t stage, uint8_t axis, float b0, float b1, float b2, float a0, float a1, float a2)
+{
+    struct biquad_section *s;
+    
+    if(stage >= BIQUAD_MAX_STAGES || axis >= BIQUAD_AXES) {
+        return;
+    }
+    
+    // the state is left alone, so a section can be retuned while running
+    s = &sections[stage][axis];
+    s->b0 = biquad_q14(b0 / a0);
+    s->b1 = biquad_q14(b1 / a0);
+    s->b2 = biquad_q14(b2 / a0);
+    s->a1 = biquad_q14(a1 / a0);
+    s->a2 = biquad_q14(a2 / a0);
+    
+    if(stage >= stage_count) {
+        stage_count = stage + 1;
+    }
+}
+
+/**
+ * Set every section of every axis to passthrough and clear the state.
+ */
+void biquad_init(void)
+{
+    uint8_t stage, axis;
+    
+    memset(sections, 0, sizeof(sections));
+    for(stage = 0; stage < BIQUAD_MAX_STAGES; stage++) {
+        for(axis = 0; axis < BIQUAD_AXES; axis++) {
+            sections[stage][axis].b0 = BIQUAD_ONE;
+        }
+    }
+    stage_count = 0;
+}
+
+/**
+ * Clear the filter state, keeps the coefficients.
+ */
+void biquad_reset(void)
+{
+    uint8_t stage, axis;
+    
+    for(stage = 0; stage < BIQUAD_MAX_STAGES; stage++) {
+        for(axis = 0; axis < BIQUAD_AXES; axis++) {
+            struct biquad_section *s = &sections[stage][axis];
+            s->x1 = s->x2 = s->y1 = s->y2 = s->error = 0;
+        }
+    }
+}
+
+/**
+ * Make one section of one axis a passthrough.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ */
+void biquad_set_passthrough(uint8_t stage, uint8_t axis)
+{
+    biquad_set(stage, axis, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+}
+
+/**
+ * Make one section of one axis a second order low-pass.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ * @param sample_freq Sample frequency in Hz
+ * @param cutoff Cutoff frequency in Hz
+ * @param q Quality factor, 0.7071 for Butterworth
+ */
+void biquad_set_lowpass(uint8_t stage, uint8_t axis, float sample_freq, float cutoff, float q)
+{
+    float w0 = 2.0f * (float)M_PI * cutoff / sample_freq;
+    float cosw0 = cos(w0);
+    float alpha = sin(w0) / (2.0f * q);
+    
+    biquad_set(stage, axis,
+        (1.0f - cosw0) * 0.5f, 1.0f - cosw0, (1.0f - cosw0) * 0.5f,
+        1.0f + alpha, -2.0f * cosw0, 1.0f - alpha);
+}
+
+/**
+ * Make one section of one axis a notch.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ * @param sample_freq Sample frequency in Hz
+ * @param center Notch center frequency in Hz
+ * @param q Quality factor, center frequency over bandwidth
+ */
+void biquad_set_notch(uint8_t stage, uint8_t axis, float sample_freq, float center, float q)
+{
+    float w0 = 2.0f * (float)M_PI * center / sample_freq;
+    float cosw0 = cos(w0);
+    float alpha = sin(w0) / (2.0f * q);
+    
+    biquad_set(stage, axis,
+        1.0f, -2.0f * cosw0, 1.0f,
+        1.0f + alpha, -2.0f * cosw0, 1.0f - alpha);
+}
+
+/**
+ * Filter one sample of raw readings in place.
+ *
+ * @param sample gx, gy, gz, ax, ay, az
+ */
+void biquad_apply(int16_t *sample)
+{
+    uint8_t stage, axis;
+    
+    for(axis = 0; axis < BIQUAD_AXES; axis++) {
+        int16_t x = sample[axis];
+        
+        for(stage = 0; stage < stage_count; stage++) {
+            struct biquad_section *s = &sections[stage][axis];
+            int32_t acc = s->error;
+            int16_t y;
+            
+            acc += (int32_t)s->b0 * x;
+            acc += (int32_t)s->b1 * s->x1;
+            acc += (int32_t)s->b2 * s->x2;
+            acc -= (int32_t)s->a1 * s->y1;
+            acc -= (int32_t)s->a2 * s->y2;
+            
+            s->error = acc & (BIQUAD_ONE - 1);
+            acc >>= BIQUAD_SHIFT;
+            if(acc > 32767) {
+                acc = 32767;
+            } else if(acc < -32768) {
+                acc = -32768;
+            }
+            y = acc;
+            
+            s->x2 = s->x1;
+            s->x1 = x;
+            s->y2 = s->y1;
+            s->y1 = y;
+            x = y;
+        }
+        sample[axis] = x;
+    }
+}
+
+#ifdef BIQUAD_BENCH
+#include <avr/io.h>
+
+/**
+ * Time one biquad_apply() with Timer1 running at the CPU clock.
+ *
+ * @return CPU cycles spent in biquad_apply()
+ */
+uint16_t biquad_bench(void)
+{
+    int16_t sample[BIQUAD_AXES] = {1000, -1000, 500, 16384, 0, -16384};
+    uint8_t tccr1b = TCCR1B;
+    uint16_t tcnt1 = TCNT1;
+    uint16_t cycles;
+    
+    TCCR1B = (1 << CS10);
+    TCNT1 = 0;
+    biquad_apply(sample);
+    cycles = TCNT1;
+    TCCR1B = tccr1b;
+    TCNT1 = tcnt1;
+    
+    return cycles;
+}
+#endif
@@ -0,0 +1,27 @@
+#ifndef __BIQUAD_H_
+#define __BIQUAD_H_
+
+#include <stdint.h>
+
+#define BIQUAD_AXES 6
+#define BIQUAD_MAX_STAGES 2
+
+#define BIQUAD_GX 0
+#define BIQUAD_GY 1
+#define BIQUAD_GZ 2
+#define BIQUAD_AX 3
+#define BIQUAD_AY 4
+#define BIQUAD_AZ 5
+
+void biquad_init(void);
+void biquad_reset(void);
+void biquad_set_passthrough(uint8_t stage, uint8_t axis);
+void biquad_set_lowpass(uint8_t stage, uint8_t axis, float sample_freq, float cutoff, float q);
+void biquad_set_notch(uint8_t stage, uint8_t axis, float sample_freq, float center, float q);
+void biquad_apply(int16_t *sample);
+
+#ifdef BIQUAD_BENCH
+uint16_t biquad_bench(void);
+#endif
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * Reduced fixed-point gyro vibration analyzer with dynamic notch tracking.
+ *
+ * AVR version of the rpi-poc analyzer: a Q15 radix-2 FFT of SPECTRUM_SIZE
+ * Hann windowed samples, one gyro axis per frame in turn, tracking the
+ * strongest peak into the notch section of the biquad bank. One slice of
+ * work per spectrum_update() call (window, one FFT pass, peak search) and
+ * every slice is timed with micros() against SPECTRUM_BUDGET_US, so an
+ * overrun of the main loop shows up in spectrum_get_overruns().
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "icaro/timer/timer.h"
+
+#include "spectrum.h"
+#include "biquad.h"
+
+#define SPECTRUM_HALF (SPECTRUM_SIZE / 2)
+#define SPECTRUM_MIN_BIN 3        // skip DC and slow body motion
+#define SPECTRUM_PEAK_RATIO 4     // peak power over mean power
+#define SPECTRUM_NOTCH_Q 2.0f
+
+enum spectrum_state {
+    SPECTRUM_IDLE,
+    SPECTRUM_WINDOW,
+    SPECTRUM_FFT,
+    SPECTRUM_PEAK
+};
+
+int16_t ring[SPECTRUM_SIZE][SPECTRUM_AXES];
+int16_t re[SPECTRUM_SIZE], im[SPECTRUM_SIZE];
+int16_t window[SPECTRUM_SIZE];      // Q15
+int16_t cos_table[SPECTRUM_HALF];   // Q15
+int16_t sin_table[SPECTRUM_HALF];   // Q15
+
+float center[SPECTRUM_AXES];
+float filter_freq;
+uint8_t ring_head = 0, since_frame = 0, fft_length, frame_axis = 0, notch;
+enum spectrum_state state = SPECTRUM_IDLE;
+uint16_t worst_us = 0, overruns = 0;
+
+static int16_t spectrum_q15(float value)
+{
+    return value >= 1.0f ? 32767 : (int16_t)lrintf(value * 32768.0f);
+}
+
+static int16_t spectrum_mul(int16_t a, int16_t b)
+{
+    return ((int32_t)a * b) >> 15;
+}
+
+/**
+ * Set up the tables and start tracking.
+ *
+ * @param sample_freq Main loop (and biquad bank) sample frequency in Hz
+ * @param notch_stage Biquad section to retune
+ */
+void spectrum_init(float sample_freq, uint8_t notch_stage)
+{
+    uint8_t i;
+    
+    memset(ring, 0, sizeof(ring));
+    memset(center, 0, sizeof(center));
+    ring_head = 0;
+    since_frame = 0;
+    frame_axis = 0;
+    state = SPECTRUM_IDLE;
+    worst_us = 0;
+    overruns = 0;
+    
+    filter_freq = sample_freq;
+    notch = notch_stage;
+    
+    for(i = 0; i < SPECTRUM_SIZE; i++) {
+        window[i] = spectrum_q15(0.5f - 0.5f * cos(2.0f * M_PI * i / SPECTRUM_SIZE));
+    }
+    for(i = 0; i < SPECTRUM_HALF; i++) {
+        cos_table[i] = spectrum_q15(cos(2.0f * M_PI * i / SPECTRUM_SIZE));
+        sin_table[i] = spectrum_q15(sin(2.0f * M_PI * i / SPECTRUM_SIZE));
+    }
+}
+
+/**
+ * @return Tracked notch center in Hz, 0 until a peak has been seen
+ */
+float spectrum_get_peak(uint8_t axis)
+{
+    return axis < SPECTRUM_AXES ? center[axis] : 0.0f;
+}
+
+/**
+ * @return Longest slice so far in microseconds
+ */
+uint16_t spectrum_get_worst_us(void)
+{
+    return worst_us;
+}
+
+/**
+ * @return Slices that took longer than SPECTRUM_BUDGET_US
+ */
+uint16_t spectrum_get_overruns(void)
+{
+    return overruns;
+}
+
+static uint8_t spectrum_bit_reverse(uint8_t i)
+{
+    uint8_t j = 0, bits;
+    
+    for(bits = 1; bits < SPECTRUM_SIZE; bits <<= 1) {
+        j = (j << 1) | ((i & bits) ? 1 : 0);
+    }
+    return j;
+}
+
+/**
+ * Window the ring of the current axis, oldest first, in bit reversed order.
+ */
+static void spectrum_window(void)
+{
+    uint8_t n;
+    
+    for(n = 0; n < SPECTRUM_SIZE; n++) {
+        uint8_t j = spectrum_bit_reverse(n);
+        re[j] = spectrum_mul(ring[(ring_head + n) & (SPECTRUM_SIZE - 1)][frame_axis], window[n]);
+        im[j] = 0;
+    }
+}
+
+/**
+ * One radix-2 decimation in time pass, halved to stay in range.
+ */
+static void spectrum_fft_pass(uint8_t length)
+{
+    uint8_t half = length / 2;
+    uint8_t step = SPECTRUM_SIZE / length;
+    uint8_t i, j;
+    
+    for(i = 0; i < SPECTRUM_SIZE; i += length) {
+        for(j = 0; j < half; j++) {
+            int16_t c = cos_table[j * step], s = sin_table[j * step];
+            uint8_t a = i + j, b = i + j + half;
+            int16_t tr = (((int32_t)re[b] * c + (int32_t)im[b] * s) >> 15) >> 1;
+            int16_t ti = (((int32_t)im[b] * c - (int32_t)re[b] * s) >> 15) >> 1;
+            int16_t ar = re[a] >> 1, ai = im[a] >> 1;
+            
+            re[a] = ar + tr;
+            im[a] = ai + ti;
+            re[b] = ar - tr;
+            im[b] = ai - ti;
+        }
+    }
+}
+
+/**
+ * Find the strongest peak of the current axis and move its notch onto it.
+ */
+static void spectrum_track(void)
+{
+    int32_t power[SPECTRUM_HALF];
+    int32_t mean = 0, best = 0;
+    uint8_t k, peak = 0;
+    float freq, bin_width = filter_freq / SPECTRUM_SIZE;
+    
+    for(k = 1; k < SPECTRUM_HALF; k++) {
+        power[k] = (int32_t)re[k] * re[k] + (int32_t)im[k] * im[k];
+    }
+    for(k = SPECTRUM_MIN_BIN; k < SPECTRUM_HALF - 1; k++) {
+        mean += power[k] / (SPECTRUM_HALF - 1 - SPECTRUM_MIN_BIN);
+        if(power[k] > best && power[k] > power[k - 1] && power[k] >= power[k + 1]) {
+            best = power[k];
+            peak = k;
+        }
+    }
+    
+    if(peak == 0 || best < SPECTRUM_PEAK_RATIO * mean) {
+        return;
+    }
+    
+    // parabolic interpolation between bins
+    {
+        float left = power[peak - 1], mid = power[peak], right = power[peak + 1];
+        float curve = left - 2.0f * mid + right;
+        freq = (peak + (curve < 0.0f ? 0.5f * (left - right) / curve : 0.0f)) * bin_width;
+    }
+    
+    if(center[frame_axis] == 0.0f) {
+        center[frame_axis] = freq;
+    } else {
+        center[frame_axis] += 0.3f * (freq - center[frame_axis]);
+    }
+    biquad_set_notch(notch, BIQUAD_GX + frame_axis, filter_freq, center[frame_axis], SPECTRUM_NOTCH_Q);
+}
+
+/**
+ * Feed one gyro sample and do the next slice of analysis work.
+ *
+ * @param gyro gx, gy, gz before filtering, so the notch doesn't hide the
+ *             peak it tracks
+ */
+void spectrum_update(const int16_t *gyro)
+{
+    unsigned long start = micros();
+    uint16_t elapsed;
+    
+    ring[ring_head][0] = gyro[0];
+    ring[ring_head][1] = gyro[1];
+    ring[ring_head][2] = gyro[2];
+    ring_head = (ring_head + 1) & (SPECTRUM_SIZE - 1);
+    if(since_frame < SPECTRUM_SIZE) {
+        since_frame++;
+    }
+    
+    switch(state) {
+        case SPECTRUM_IDLE:
+            // each axis gets a fresh half frame
+            if(since_frame >= SPECTRUM_HALF) {
+                since_frame = 0;
+                state = SPECTRUM_WINDOW;
+            }
+            break;
+        case SPECTRUM_WINDOW:
+            spectrum_window();
+            fft_length = 2;
+            state = SPECTRUM_FFT;
+            break;
+        case SPECTRUM_FFT:
+            spectrum_fft_pass(fft_length);
+            fft_length <<= 1;
+            if(fft_length > SPECTRUM_SIZE) {
+                state = SPECTRUM_PEAK;
+            }
+            break;
+        case SPECTRUM_PEAK:
+            spectrum_track();
+            frame_axis = (frame_axis + 1) % SPECTRUM_AXES;
+            state = SPECTRUM_IDLE;
+            break;
+    }
+    
+    elapsed = micros() - start;
+    if(elapsed > worst_us) {
+        worst_us = elapsed;
+    }
+    if(elapsed > SPECTRUM_BUDGET_US) {
+        overruns++;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __SPECTRUM_H_
+#define __SPECTRUM_H_
+
+#include <stdint.h>
+
+#define SPECTRUM_SIZE 32         // samples per frame, power of two
+#define SPECTRUM_AXES 3          // gx, gy, gz, one axis analysed per frame
+#define SPECTRUM_BUDGET_US 1000  // longest slice the main loop can take
+
+void spectrum_init(float sample_freq, uint8_t notch_stage);
+void spectrum_update(const int16_t *gyro);
+float spectrum_get_peak(uint8_t axis);
+uint16_t spectrum_get_worst_us(void);
+uint16_t spectrum_get_overruns(void);
+
+#endif
@@ -16,13 +16,25 @@
 
 #include "mahony.h"
 #include <math.h>
+#include <stdint.h>
 
 //-------------------------------------------------------------------------------------------
 // Definitions
 
 #define DEFAULT_SAMPLE_FREQ	72.0f	// sample frequency in Hz
-#define twoKpDef	2.0f * 5.0f //(2.0f * 0.5f)	// 2 * proportional gain
+// build with -DMAHONY_TUNED_GAINS to use the gains written by tuning/autotune
+#ifdef MAHONY_TUNED_GAINS
+#include "mahony_gains.h"
+#endif
+#ifndef twoKpDef
+#define twoKpDef	(2.0f * 0.5f)	// 2 * proportional gain once the gain schedule is done
+#endif
+#ifndef twoKiDef
 #define twoKiDef	0.0f // (2.0f * 0.0f)	// 2 * integral gain
+#endif
+#define twoKpStartDef	(2.0f * 5.0f)	// 2 * proportional gain right after alignment
+#define DEFAULT_GAIN_SCHEDULE_TIME	5.0f	// seconds to decay from start to cruise gain
+#define DEFAULT_CORRECTION_DIVIDER	4	// accel/mag correction every n gyro samples
 
 static	float twoKp;		// 2 * proportional gain (Kp)
 static	float twoKi;		// 2 * integral gain (Ki)
@@ -31,8 +43,15 @@ static	float integralFBx, integralFBy, integralFBz;  // integral error terms sca
 static	float invSampleFreq;
 static	float roll, pitch, yaw;
 static	char anglesComputed;
+static	float fbx, fby, fbz;	// feedback held between decimated corrections (rad/s)
+static	uint8_t correctionDivider;
+static	uint8_t samplesSinceCorrection;
+static	char aligned;	// quaternion initialised from accel/mag
+static	float twoKpStart, twoKpCruise;	// gain schedule end points
+static	float gainScheduleTime, scheduleTime;
 float invSqrt(float x);
 void computeAngles();
+static void mahony_schedule_gain(float dt);
 
 //============================================================================================
 // Functions
@@ -42,8 +61,13 @@ void computeAngles();
 
 void mahony_init()
 {
-    twoKp = twoKpDef;	// 2 * proportional gain (Kp)
+    twoKpStart = twoKpStartDef;
+    twoKpCruise = twoKpDef;
+    gainScheduleTime = DEFAULT_GAIN_SCHEDULE_TIME;
+    scheduleTime = 0.0f;
+    twoKp = twoKpStart;	// 2 * proportional gain (Kp)
     twoKi = twoKiDef;	// 2 * integral gain (Ki)
+    aligned = 0;
     q0 = 1.0f;
     q1 = 0.0f;
     q2 = 0.0f;
@@ -51,12 +75,97 @@ void mahony_init()
     integralFBx = 0.0f;
     integralFBy = 0.0f;
     integralFBz = 0.0f;
+    fbx = 0.0f;
+    fby = 0.0f;
+    fbz = 0.0f;
     anglesComputed = 0;
     invSampleFreq = 1.0f / DEFAULT_SAMPLE_FREQ;
+    correctionDivider = DEFAULT_CORRECTION_DIVIDER;
+    samplesSinceCorrection = 0;
 }
 
 void begin(float sampleFrequency) { invSampleFreq = 1.0f / sampleFrequency; }
 
+//-------------------------------------------------------------------------------------------
+// Initial alignment
+//
+// Sets the quaternion straight from one accel/mag sample instead of letting
+// the filter converge from the identity with a high gain: roll and pitch
+// from the gravity vector, yaw from the tilt compensated magnetic field.
+// Without a valid magnetometer sample yaw is left at zero.
+
+void mahony_align(float ax, float ay, float az, float mx, float my, float mz)
+{
+    float alignRoll, alignPitch, alignYaw = 0.0f;
+    float sr, cr, sp, cp, sy, cy;
+
+    alignRoll = atan2f(ay, az);
+    alignPitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+
+    if(!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f))) {
+        // Rotate the magnetic field back to the horizontal plane
+        float sinRoll = sinf(alignRoll), cosRoll = cosf(alignRoll);
+        float sinPitch = sinf(alignPitch), cosPitch = cosf(alignPitch);
+        float hx = mx * cosPitch + (my * sinRoll + mz * cosRoll) * sinPitch;
+        float hy = my * cosRoll - mz * sinRoll;
+        alignYaw = atan2f(-hy, hx);
+    }
+
+    sr = sinf(0.5f * alignRoll);
+    cr = cosf(0.5f * alignRoll);
+    sp = sinf(0.5f * alignPitch);
+    cp = cosf(0.5f * alignPitch);
+    sy = sinf(0.5f * alignYaw);
+    cy = cosf(0.5f * alignYaw);
+    q0 = cr * cp * cy + sr * sp * sy;
+    q1 = sr * cp * cy - cr * sp * sy;
+    q2 = cr * sp * cy + sr * cp * sy;
+    q3 = cr * cp * sy - sr * sp * cy;
+
+    integralFBx = 0.0f;
+    integralFBy = 0.0f;
+    integralFBz = 0.0f;
+    fbx = 0.0f;
+    fby = 0.0f;
+    fbz = 0.0f;
+    samplesSinceCorrection = 0;
+    scheduleTime = 0.0f;
+    twoKp = twoKpStart;
+    aligned = 1;
+    anglesComputed = 0;
+}
+
+//-------------------------------------------------------------------------------------------
+// Gain schedule
+//
+// After alignment the proportional gain ramps linearly from twoKpStart down
+// to twoKpCruise over gainScheduleTime seconds of filter time.
+
+void mahony_set_gain_schedule(float startGain, float cruiseGain, float seconds)
+{
+    twoKpStart = startGain;
+    twoKpCruise = cruiseGain;
+    gainScheduleTime = seconds;
+    scheduleTime = 0.0f;
+    twoKp = seconds > 0.0f ? startGain : cruiseGain;
+}
+
+static void mahony_schedule_gain(float dt)
+{
+    if(!aligned || scheduleTime >= gainScheduleTime) return;
+    scheduleTime += dt;
+    if(scheduleTime >= gainScheduleTime) {
+        twoKp = twoKpCruise;
+        } else {
+        twoKp = twoKpStart + (twoKpCruise - twoKpStart) * (scheduleTime / gainScheduleTime);
+    }
+}
+
+uint8_t mahony_ready()
+{
+    return aligned && scheduleTime >= gainScheduleTime;
+}
+
 void mahony_update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz)
 {
     float recipNorm;
@@ -73,6 +182,13 @@ void mahony_update(float gx, float gy, float gz, float ax, float ay, float az, f
         return;
     }
 
+    // Initialise from the first valid accel/mag sample
+    if(!aligned && !((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+        mahony_align(ax, ay, az, mx, my, mz);
+        return;
+    }
+    mahony_schedule_gain(invSampleFreq);
+
     // Convert gyroscope degrees/sec to radians/sec
     gx *= 0.0174533f;
     gy *= 0.0174533f;
@@ -178,6 +294,13 @@ void mahony_updateIMU(float gx, float gy, float gz, float ax, float ay, float az
     float halfex, halfey, halfez;
     float qa, qb, qc;
 
+    // Initialise tilt from the first valid accelerometer sample
+    if(!aligned && !((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))) {
+        mahony_align(ax, ay, az, 0.0f, 0.0f, 0.0f);
+        return;
+    }
+    mahony_schedule_gain(invSampleFreq);
+
     // Convert gyroscope degrees/sec to radians/sec
     gx *= 0.0174533f;
     gy *= 0.0174533f;
@@ -246,6 +369,162 @@ void mahony_updateIMU(float gx, float gy, float gz, float ax, float ay, float az
     anglesComputed = 0;
 }
 
+//-------------------------------------------------------------------------------------------
+// Multi-rate update
+//
+// mahony_propagate() only integrates the gyro plus the feedback held from the
+// last correction, so it can run on every sample. mahony_correct() does the
+// accel/mag normalisations, the magnetic reference rotation and the cross
+// products, and is run at a lower rate or when the magnetometer has new data.
+
+void mahony_propagate(float gx, float gy, float gz)
+{
+    float recipNorm;
+    float qa, qb, qc;
+
+    mahony_schedule_gain(invSampleFreq);
+
+    // Convert gyroscope degrees/sec to radians/sec and apply held feedback
+    gx = gx * 0.0174533f + fbx;
+    gy = gy * 0.0174533f + fby;
+    gz = gz * 0.0174533f + fbz;
+
+    // Integrate rate of change of quaternion
+    gx *= (0.5f * invSampleFreq);		// pre-multiply common factors
+    gy *= (0.5f * invSampleFreq);
+    gz *= (0.5f * invSampleFreq);
+    qa = q0;
+    qb = q1;
+    qc = q2;
+    q0 += (-qb * gx - qc * gy - q3 * gz);
+    q1 += (qa * gx + qc * gz - q3 * gy);
+    q2 += (qa * gy - qb * gz + q3 * gx);
+    q3 += (qa * gz + qb * gy - qc * gx);
+
+    // Normalise quaternion
+    recipNorm = invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+    q0 *= recipNorm;
+    q1 *= recipNorm;
+    q2 *= recipNorm;
+    q3 *= recipNorm;
+    anglesComputed = 0;
+    if(samplesSinceCorrection < 255) samplesSinceCorrection++;
+}
+
+void mahony_correct(float ax, float ay, float az, float mx, float my, float mz)
+{
+    float recipNorm;
+    float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+    float hx, hy, bx, bz;
+    float halfvx, halfvy, halfvz, halfwx, halfwy, halfwz;
+    float halfex, halfey, halfez;
+    float correctionPeriod;
+
+    // Integral feedback covers every sample propagated since the last correction
+    correctionPeriod = invSampleFreq * (samplesSinceCorrection > 0 ? samplesSinceCorrection : 1);
+    samplesSinceCorrection = 0;
+
+    // Without a valid accelerometer measurement there is nothing to correct
+    // against, keep integrating the gyro with the integral term only
+    if((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)) {
+        fbx = integralFBx;
+        fby = integralFBy;
+        fbz = integralFBz;
+        return;
+    }
+
+    // Initialise from the first valid accel sample, tilt only while there is
+    // no mag sample yet; the mag feedback brings yaw in once there is
+    if(!aligned) {
+        mahony_align(ax, ay, az, mx, my, mz);
+        return;
+    }
+
+    // Normalise accelerometer measurement
+    recipNorm = invSqrt(ax * ax + ay * ay + az * az);
+    ax *= recipNorm;
+    ay *= recipNorm;
+    az *= recipNorm;
+
+    // Estimated direction of gravity
+    q0q0 = q0 * q0;
+    q0q1 = q0 * q1;
+    q0q2 = q0 * q2;
+    q1q3 = q1 * q3;
+    q2q3 = q2 * q3;
+    q3q3 = q3 * q3;
+    halfvx = q1q3 - q0q2;
+    halfvy = q0q1 + q2q3;
+    halfvz = q0q0 - 0.5f + q3q3;
+
+    // Error is cross product between estimated and measured direction of gravity
+    halfex = (ay * halfvz - az * halfvy);
+    halfey = (az * halfvx - ax * halfvz);
+    halfez = (ax * halfvy - ay * halfvx);
+
+    // Add magnetic field error when the magnetometer measurement is valid
+    // (avoids NaN in magnetometer normalisation)
+    if(!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f))) {
+
+        // Normalise magnetometer measurement
+        recipNorm = invSqrt(mx * mx + my * my + mz * mz);
+        mx *= recipNorm;
+        my *= recipNorm;
+        mz *= recipNorm;
+
+        q0q3 = q0 * q3;
+        q1q1 = q1 * q1;
+        q1q2 = q1 * q2;
+        q2q2 = q2 * q2;
+
+        // Reference direction of Earth's magnetic field
+        hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+        hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+        bx = sqrtf(hx * hx + hy * hy);
+        bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+        // Estimated direction of magnetic field
+        halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+        halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+        halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+        halfex += (my * halfwz - mz * halfwy);
+        halfey += (mz * halfwx - mx * halfwz);
+        halfez += (mx * halfwy - my * halfwx);
+    }
+
+    // Compute integral feedback if enabled
+    if(twoKi > 0.0f) {
+        // integral error scaled by Ki
+        integralFBx += twoKi * halfex * correctionPeriod;
+        integralFBy += twoKi * halfey * correctionPeriod;
+        integralFBz += twoKi * halfez * correctionPeriod;
+        } else {
+        integralFBx = 0.0f;	// prevent integral windup
+        integralFBy = 0.0f;
+        integralFBz = 0.0f;
+    }
+
+    // Hold integral and proportional feedback until the next correction
+    fbx = integralFBx + twoKp * halfex;
+    fby = integralFBy + twoKp * halfey;
+    fbz = integralFBz + twoKp * halfez;
+}
+
+void mahony_set_correction_divider(uint8_t divider)
+{
+    correctionDivider = divider > 0 ? divider : 1;
+}
+
+void mahony_update_multirate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, uint8_t magFresh)
+{
+    // Correct on fresh magnetometer data or once every correctionDivider samples
+    if(magFresh || samplesSinceCorrection >= correctionDivider) {
+        mahony_correct(ax, ay, az, mx, my, mz);
+    }
+    mahony_propagate(gx, gy, gz);
+}
+
 //-------------------------------------------------------------------------------------------
 // Fast inverse square-root
 // See: http://en.wikipedia.org/wiki/Fast_inverse_square_root
@@ -13,12 +13,21 @@
 #ifndef MahonyAHRS_h
 #define MahonyAHRS_h
 
+#include <stdint.h>
+
 //----------------------------------------------------------------------------------------------------
 // Variable declaration
 
 void mahony_init(void);
+void mahony_align(float ax, float ay, float az, float mx, float my, float mz);
+void mahony_set_gain_schedule(float startGain, float cruiseGain, float seconds);
+uint8_t mahony_ready(void);
 void mahony_update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
 void mahony_updateIMU(float gx, float gy, float gz, float ax, float ay, float az);
+void mahony_propagate(float gx, float gy, float gz);
+void mahony_correct(float ax, float ay, float az, float mx, float my, float mz);
+void mahony_set_correction_divider(uint8_t divider);
+void mahony_update_multirate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, uint8_t magFresh);
 float getRoll();
 float getPitch();
 float getYaw();
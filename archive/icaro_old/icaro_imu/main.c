@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -9,15 +11,20 @@
 #include "icaro/twi/i2cdevlib.h"
 #include "icaro/float.h"
 #include "icaro/imu.h"
+#include "icaro/loop_stats/loop_stats.h"
 
 #include "eeprom/eeprom.h"
 #include "sensors/mpu6050.h"
 #include "sensors/mpu6050_registers.h"
 #include "sensors/hcm5883l.h"
 #include "mahony/mahony.h"
+#include "filter/biquad.h"
+#include "filter/spectrum.h"
+#include "recorder/flight_recorder.h"
 
 #ifdef DEBUG
 #include "icaro/uart/uart.h"
+#include "icaro/fmt/fmt.h"
 char DEBUG_BUFFER[150] = {0};
 #endif
 
@@ -29,22 +36,62 @@ uint8_t REGISTER[IMU_REGISTER_LENGTH] = {0};
 int16_t gx, gy, gz, ax, ay, az, mx, my, mz;
 long last = 0L;
 long now = 0L;
+long last_checkpoint = 0L;
+
+// EEPROM cells last ~100k writes, at most one checkpoint every 10 minutes
+// and only when something moved keeps the record alive for years
+#define ESTIMATOR_CHECKPOINT_INTERVAL 600000L  // ms
+struct estimator_state saved_state;
+
+// the main loop runs at ~72 Hz
+#define FILTER_SAMPLE_FREQ 72.0f
+#define GYRO_CUTOFF 25.0f
+#define ACCEL_CUTOFF 10.0f
+#define NOTCH_STAGE 1 // retuned by the vibration analyzer
+
+// main loop phases timed with -DLOOP_STATS
+#define LOOP_PHASE_SENSORS 0  // IMU and mag reads
+#define LOOP_PHASE_FUSION 1   // analyzer, filters and Mahony
+#define LOOP_PHASE_RECORDER 2 // recorder, registers and checkpoint
+#define LOOP_PHASE_OUTPUT 3   // LED and debug UART
 
 void calculate_roll_pitch_yaw()
 {
     mpu6050_get_motion_6(&ax, &ay, &az, &gx, &gy, &gz);
-    hcm5883l_get_heading(&mx, &my, &mz);
-    
-    mahony_update(
-    gx * 0.001,
-    gy * 0.001,
-    gz * 0.001,
-    ax * 0.001,
-    ay * 0.001,
-    az * 0.001,
+    
+    // only read the magnetometer when it has a new sample, that also
+    // triggers the accel/mag correction step
+    uint8_t mag_fresh = hcm5883l_data_ready();
+    if (mag_fresh) {
+        hcm5883l_get_heading(&mx, &my, &mz);
+    }
+    LOOP_STATS_MARK(LOOP_PHASE_SENSORS);
+    
+    // low-pass the raw readings before fusion, frame vibration otherwise
+    // aliases into the attitude
+    int16_t sample[BIQUAD_AXES] = {gx, gy, gz, ax, ay, az};
+    spectrum_update(sample);
+    biquad_apply(sample);
+    
+    mahony_update_multirate(
+    sample[BIQUAD_GX] * 0.001,
+    sample[BIQUAD_GY] * 0.001,
+    sample[BIQUAD_GZ] * 0.001,
+    sample[BIQUAD_AX] * 0.001,
+    sample[BIQUAD_AY] * 0.001,
+    sample[BIQUAD_AZ] * 0.001,
     mx * 0.001,
     my * 0.001,
-    mz * 0.001);
+    mz * 0.001,
+    mag_fresh);
+    LOOP_STATS_MARK(LOOP_PHASE_FUSION);
+
+    // raw readings, the recorder is about what the sensor saw
+    int16_t raw[BIQUAD_AXES] = {gx, gy, gz, ax, ay, az};
+    flight_recorder_record(raw, getRoll(), getPitch(), getYaw(), mag_fresh ? FLIGHT_RECORDER_MAG_FRESH : 0);
+
+    // ready once aligned and the start-up gain has decayed to cruise
+    REGISTER[IMU_STATUS_ADDRESS] = mahony_ready() ? IMU_STATUS_READY_TO_START : IMU_STATUS_INITIALIZING;
 
     f.m_float = getRoll();
     REGISTER[IMU_ROLL_ADDRESS] = f.m_bytes[0];
@@ -65,6 +112,41 @@ void calculate_roll_pitch_yaw()
     REGISTER[IMU_YAW_ADDRESS + 3] = f.m_bytes[3];
 }
 
+#ifdef LOOP_STATS
+static void set_register_u16(uint8_t address, uint16_t value)
+{
+    REGISTER[address] = value & 0xff;
+    REGISTER[address + 1] = value >> 8;
+}
+
+/**
+ * Loop timing of the last full window to the registers, once per window.
+ */
+void publish_loop_stats(void)
+{
+    static uint16_t published = 0;
+    const struct loop_stats_summary *stats = loop_stats_get();
+    uint8_t i;
+    
+    if (stats->windows == published) {
+        return;
+    }
+    set_register_u16(IMU_LOOP_MIN_ADDRESS, stats->min_us);
+    set_register_u16(IMU_LOOP_MEAN_ADDRESS, stats->mean_us);
+    set_register_u16(IMU_LOOP_MAX_ADDRESS, stats->max_us);
+    set_register_u16(IMU_LOOP_JITTER_MIN_ADDRESS, stats->jitter_min_us);
+    set_register_u16(IMU_LOOP_JITTER_MAX_ADDRESS, stats->jitter_max_us);
+    set_register_u16(IMU_LOOP_JITTER_MEAN_ADDRESS, stats->jitter_mean_us);
+    for (i = 0; i < LOOP_STATS_PHASES; i++) {
+        set_register_u16(IMU_LOOP_PHASE_ADDRESS + 2 * i, stats->phase_mean_us[i]);
+    }
+    for (i = 0; i < LOOP_STATS_BUCKETS; i++) {
+        set_register_u16(IMU_LOOP_HISTOGRAM_ADDRESS + 2 * i, stats->buckets[i]);
+    }
+    published = stats->windows;
+}
+#endif
+
 void calibrate_gyro_accel(void)
 {
     int16_t values[6] = {0};
@@ -90,6 +172,29 @@ void calibrate_gyro_accel(void)
     mpu6050_set_z_gyro_offset(values[5]);
 }
 
+/**
+* Save the learned mag range if it grew since the last checkpoint.
+*/
+void checkpoint_estimator_state(void)
+{
+    struct estimator_state state;
+    uint8_t changed = 0;
+    uint8_t i;
+    
+    hcm5883l_get_range(state.mag_min, state.mag_max);
+    
+    for (i = 0; i < 3; i++) {
+        if (state.mag_min[i] != saved_state.mag_min[i] || state.mag_max[i] != saved_state.mag_max[i]) {
+            changed = 1;
+        }
+    }
+    
+    if (changed) {
+        estimator_state_save(&state);
+        saved_state = state;
+    }
+}
+
 void setup(void)
 {
     DDRB |= (1 << STATUS_LED);
@@ -102,6 +207,57 @@ void setup(void)
     #ifdef DEBUG
     uart_init(UART_BAUD_SELECT(UART_BAUD_RATE, F_CPU));
     uart_puts("setup finish\n");
+    
+    struct flight_recorder_entry entries[FLIGHT_RECORDER_ENTRIES];
+    uint8_t reason;
+    uint8_t count = flight_recorder_read(entries, &reason);
+    if (count) {
+        char *p = fmt_str(DEBUG_BUFFER, "flight recorder: last dump trigger ");
+        p = fmt_hex(p, reason);
+        p = fmt_str(p, ", ");
+        p = fmt_uint(p, count);
+        fmt_str(p, " entries\n");
+        uart_puts(DEBUG_BUFFER);
+    }
+    #endif
+}
+
+void setup_filters(void)
+{
+    uint8_t axis;
+    
+    biquad_init();
+    for (axis = BIQUAD_GX; axis <= BIQUAD_GZ; axis++) {
+        biquad_set_lowpass(0, axis, FILTER_SAMPLE_FREQ, GYRO_CUTOFF, 0.7071f);
+    }
+    for (axis = BIQUAD_AX; axis <= BIQUAD_AZ; axis++) {
+        biquad_set_lowpass(0, axis, FILTER_SAMPLE_FREQ, ACCEL_CUTOFF, 0.7071f);
+    }
+    spectrum_init(FILTER_SAMPLE_FREQ, NOTCH_STAGE);
+    flight_recorder_init();
+    
+    #ifdef LOOP_STATS
+    loop_stats_init(1000000.0f / FILTER_SAMPLE_FREQ);
+    #endif
+    
+    #if defined(DEBUG) && defined(BIQUAD_BENCH)
+    fmt_str(fmt_uint(fmt_str(DEBUG_BUFFER, "biquad_apply "), biquad_bench()), " cycles\n");
+    uart_puts(DEBUG_BUFFER);
+    #endif
+    
+    #if defined(DEBUG) && defined(FMT_BENCH)
+    {
+        uint32_t fmt_cycles, sprintf_cycles;
+        char *p;
+        
+        fmt_bench(&fmt_cycles, &sprintf_cycles);
+        p = fmt_str(DEBUG_BUFFER, "rpy line fmt ");
+        p = fmt_uint(p, fmt_cycles);
+        p = fmt_str(p, " cycles, sprintf ");
+        p = fmt_uint(p, sprintf_cycles);
+        fmt_str(p, " cycles\n");
+        uart_puts(DEBUG_BUFFER);
+    }
     #endif
 }
 
@@ -121,36 +277,120 @@ void setup_sensors(void)
     mpu6050_set_x_gyro_offset(values[3]);
     mpu6050_set_y_gyro_offset(values[4]);
     mpu6050_set_z_gyro_offset(values[5]);
+    
+    if (estimator_state_read(&saved_state)) {
+        hcm5883l_set_range(saved_state.mag_min, saved_state.mag_max);
+    } else {
+        // not the raw bytes of a blank or torn record, the checkpoint compares
+        // against it
+        memset(&saved_state, 0, sizeof(saved_state));
+    }
 }
 
+#ifdef DEBUG
+/**
+ * Attitude, raw sensors and notch state to the UART, the lines sprintf
+ * used to build, without vfprintf and its float support in flash.
+ */
+void print_debug(void)
+{
+    int16_t raw[9] = {gx, gy, gz, ax, ay, az, mx, my, mz};
+    char *p;
+    uint8_t i;
+    
+    p = fmt_str(DEBUG_BUFFER, "rpy ");
+    p = fmt_float(p, getRoll(), 6);
+    p = fmt_char(p, '\t');
+    p = fmt_float(p, getPitch(), 6);
+    p = fmt_char(p, '\t');
+    p = fmt_float(p, getYaw(), 6);
+    for (i = 0; i < 9; i++) {
+        p = fmt_char(p, '\t');
+        p = fmt_int(p, raw[i]);
+    }
+    fmt_char(p, '\n');
+    uart_puts(DEBUG_BUFFER);
+    
+    p = fmt_str(DEBUG_BUFFER, "notch ");
+    for (i = 0; i < 3; i++) {
+        p = fmt_float(p, spectrum_get_peak(i), 6);
+        p = fmt_char(p, '\t');
+    }
+    p = fmt_str(p, "worst ");
+    p = fmt_uint(p, spectrum_get_worst_us());
+    p = fmt_str(p, " us\toverruns ");
+    p = fmt_uint(p, spectrum_get_overruns());
+    fmt_char(p, '\n');
+    uart_puts(DEBUG_BUFFER);
+    
+    #ifdef LOOP_STATS
+    {
+        const struct loop_stats_summary *stats = loop_stats_get();
+        
+        p = fmt_str(DEBUG_BUFFER, "loop ");
+        p = fmt_uint(p, stats->min_us);
+        p = fmt_char(p, '/');
+        p = fmt_uint(p, stats->mean_us);
+        p = fmt_char(p, '/');
+        p = fmt_uint(p, stats->max_us);
+        p = fmt_str(p, " us\tjitter ");
+        p = fmt_int(p, stats->jitter_min_us);
+        p = fmt_char(p, '/');
+        p = fmt_uint(p, stats->jitter_mean_us);
+        p = fmt_char(p, '/');
+        p = fmt_int(p, stats->jitter_max_us);
+        p = fmt_str(p, " us\tphases");
+        for (i = 0; i < LOOP_STATS_PHASES; i++) {
+            p = fmt_char(p, ' ');
+            p = fmt_uint(p, stats->phase_mean_us[i]);
+        }
+        p = fmt_str(p, "\thist");
+        for (i = 0; i < LOOP_STATS_BUCKETS; i++) {
+            p = fmt_char(p, ' ');
+            p = fmt_uint(p, stats->buckets[i]);
+        }
+        fmt_char(p, '\n');
+        uart_puts(DEBUG_BUFFER);
+    }
+    #endif
+}
+#endif
+
 int main(void)
 {
     setup();
    
     setup_sensors();
+    setup_filters();
     //calibrate_gyro_accel();
     mahony_init();
     
     while (1)
     {
+        LOOP_STATS_BEGIN();
         now = millis();
         
         calculate_roll_pitch_yaw();
+        flight_recorder_service();
+        
+        if ((now - last_checkpoint) > ESTIMATOR_CHECKPOINT_INTERVAL && mahony_ready()) {
+            checkpoint_estimator_state();
+            last_checkpoint = now;
+        }
+        LOOP_STATS_MARK(LOOP_PHASE_RECORDER);
         
         if ((now - last) > 100) {
             PORTB ^= (1 << STATUS_LED);
             #ifdef DEBUG
-            sprintf(DEBUG_BUFFER, "rpy %f\t%f\t%f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
-                getRoll(),
-                getPitch(),
-                getYaw(),
-                gx, gy, gz,
-                ax, ay, az,
-                mx, my, mz);
-            uart_puts(DEBUG_BUFFER);
+            print_debug();
             #endif
             last = now;
         }
+        #ifdef LOOP_STATS
+        publish_loop_stats();
+        #endif
+        LOOP_STATS_MARK(LOOP_PHASE_OUTPUT);
+        LOOP_STATS_END();
     }
 }
 
@@ -0,0 +1,255 @@
+/**
+ * In-RAM flight recorder.
+ *
+ * AVR version of the rpi-poc recorder: the last FLIGHT_RECORDER_ENTRIES
+ * loop iterations are kept in a small ring of compact entries. When a
+ * trigger fires recording goes on for FLIGHT_RECORDER_POST entries, then the
+ * ring freezes and flight_recorder_service() copies it to EEPROM one byte per
+ * main loop iteration, only when the EEPROM is idle, so the loop never waits
+ * on the ~3.4 ms write cycle. Under DEBUG every entry is also sent over the
+ * UART. The recorder re-arms once the dump is done.
+ *
+ * The reason byte is cleared first and written last, so a dump torn by a
+ * power loss reads back as no dump at all.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <math.h>
+#include <avr/eeprom.h>
+
+#include "flight_recorder.h"
+#include "../eeprom/eeprom.h"
+
+#ifdef DEBUG
+#include "icaro/uart/uart.h"
+#include "icaro/fmt/fmt.h"
+#endif
+
+#define SATURATION_LIMIT 32000
+#define ATTITUDE_JUMP 200  // tenths of a degree between two iterations
+
+#define DUMP_ENTRIES_ADDRESS (FLIGHT_RECORDER_ADDRESS + 2)
+#define DUMP_END (2 + FLIGHT_RECORDER_ENTRIES * sizeof(struct flight_recorder_entry))
+
+struct flight_recorder_entry recorder_ring[FLIGHT_RECORDER_ENTRIES];
+uint8_t recorder_head = 0, recorder_count = 0;
+uint8_t recorder_armed = 1, recorder_frozen = 0, recorder_post = 0;
+uint8_t recorder_reason = 0, recorder_dumps = 0;
+uint16_t recorder_eeprom_pos = 0;  // next byte of the EEPROM image
+#ifdef DEBUG
+uint8_t recorder_uart_pos = 0;     // next entry sent over the UART
+#endif
+
+/**
+ * Clear the ring and arm the recorder.
+ */
+void flight_recorder_init(void)
+{
+    recorder_head = 0;
+    recorder_count = 0;
+    recorder_armed = 1;
+    recorder_frozen = 0;
+    recorder_post = 0;
+    recorder_dumps = 0;
+}
+
+static int16_t flight_recorder_decidegrees(float degrees)
+{
+    return (int16_t)lrintf(degrees * 10.0f);
+}
+
+static struct flight_recorder_entry *flight_recorder_entry_at(uint8_t index)
+{
+    // oldest first
+    uint8_t slot = recorder_count < FLIGHT_RECORDER_ENTRIES ? index : recorder_head + index;
+    
+    if (slot >= FLIGHT_RECORDER_ENTRIES) {
+        slot -= FLIGHT_RECORDER_ENTRIES;
+    }
+    return &recorder_ring[slot];
+}
+
+/**
+ * Fire a trigger, the ring freezes FLIGHT_RECORDER_POST entries later.
+ * Ignored while a previous dump is still pending.
+ *
+ * @param reason FLIGHT_RECORDER_* trigger reason
+ */
+void flight_recorder_trigger(uint8_t reason)
+{
+    if (!recorder_armed) {
+        return;
+    }
+    
+    recorder_armed = 0;
+    recorder_reason = reason;
+    recorder_post = FLIGHT_RECORDER_POST;
+}
+
+/**
+ * Record one loop iteration.
+ *
+ * @param raw gx, gy, gz, ax, ay, az as read from the sensor
+ * @param roll Roll after the iteration in degrees
+ * @param pitch Pitch after the iteration in degrees
+ * @param yaw Yaw after the iteration in degrees
+ * @param flags FLIGHT_RECORDER_MAG_FRESH
+ */
+void flight_recorder_record(const int16_t *raw, float roll, float pitch, float yaw, uint8_t flags)
+{
+    struct flight_recorder_entry *entry;
+    uint8_t reason = 0;
+    uint8_t i;
+    
+    if (recorder_frozen) {
+        return;
+    }
+    
+    entry = &recorder_ring[recorder_head];
+    for (i = 0; i < 3; i++) {
+        entry->gyro[i] = raw[i];
+        entry->accel[i] = raw[i + 3];
+        if (abs(raw[i]) >= SATURATION_LIMIT || abs(raw[i + 3]) >= SATURATION_LIMIT) {
+            reason |= FLIGHT_RECORDER_SATURATION;
+        }
+    }
+    entry->rpy[0] = flight_recorder_decidegrees(roll);
+    entry->rpy[1] = flight_recorder_decidegrees(pitch);
+    entry->rpy[2] = flight_recorder_decidegrees(yaw);
+    entry->flags = flags;
+    
+    // compare with the previous entry, angles wrap at +-180 degrees
+    if (recorder_count > 0) {
+        struct flight_recorder_entry *previous = &recorder_ring[recorder_head ? recorder_head - 1 : FLIGHT_RECORDER_ENTRIES - 1];
+        for (i = 0; i < 3; i++) {
+            int16_t delta = entry->rpy[i] - previous->rpy[i];
+            if (delta > 1800) {
+                delta -= 3600;
+            } else if (delta < -1800) {
+                delta += 3600;
+            }
+            if (abs(delta) > ATTITUDE_JUMP) {
+                reason |= FLIGHT_RECORDER_ATTITUDE_JUMP;
+            }
+        }
+    }
+    
+    if (++recorder_head == FLIGHT_RECORDER_ENTRIES) {
+        recorder_head = 0;
+    }
+    if (recorder_count < FLIGHT_RECORDER_ENTRIES) {
+        recorder_count++;
+    }
+    
+    if (reason) {
+        flight_recorder_trigger(reason);
+    }
+    if (!recorder_armed && --recorder_post == 0) {
+        recorder_frozen = 1;
+        recorder_eeprom_pos = recorder_dumps < FLIGHT_RECORDER_EEPROM_DUMPS ? 0 : DUMP_END + 1;
+        #ifdef DEBUG
+        recorder_uart_pos = 0;
+        #endif
+    }
+}
+
+static uint8_t flight_recorder_image_byte(uint16_t pos)
+{
+    uint8_t index;
+    
+    if (pos == 1) {
+        return recorder_count;
+    }
+    pos -= 2;
+    index = pos / sizeof(struct flight_recorder_entry);
+    if (index >= recorder_count) {
+        return 0xFF;
+    }
+    return ((const uint8_t *)flight_recorder_entry_at(index))[pos % sizeof(struct flight_recorder_entry)];
+}
+
+/**
+ * Move a frozen ring out a little at a time, call once per main loop
+ * iteration. Does nothing while recording.
+ */
+void flight_recorder_service(void)
+{
+    uint8_t done = 1;
+    
+    if (!recorder_frozen) {
+        return;
+    }
+    
+    // reason byte cleared at 0, image 1..DUMP_END - 1, reason at DUMP_END
+    if (recorder_eeprom_pos <= DUMP_END) {
+        done = 0;
+        if (eeprom_is_ready()) {
+            uint8_t *address = (uint8_t *)FLIGHT_RECORDER_ADDRESS + recorder_eeprom_pos;
+            if (recorder_eeprom_pos == 0) {
+                eeprom_update_byte(address, 0);
+            } else if (recorder_eeprom_pos == DUMP_END) {
+                eeprom_update_byte((uint8_t *)FLIGHT_RECORDER_ADDRESS, recorder_reason);
+                recorder_dumps++;
+            } else {
+                eeprom_update_byte(address, flight_recorder_image_byte(recorder_eeprom_pos));
+            }
+            recorder_eeprom_pos++;
+        }
+    }
+    
+    #ifdef DEBUG
+    if (recorder_uart_pos < recorder_count) {
+        char line[80];
+        char *p;
+        uint8_t i;
+        struct flight_recorder_entry *e = flight_recorder_entry_at(recorder_uart_pos);
+        
+        done = 0;
+        p = fmt_str(line, "fr ");
+        p = fmt_hex(p, recorder_reason);
+        p = fmt_char(p, ' ');
+        p = fmt_uint(p, recorder_uart_pos);
+        for (i = 0; i < 3; i++) {
+            p = fmt_int(fmt_char(p, '\t'), e->gyro[i]);
+        }
+        for (i = 0; i < 3; i++) {
+            p = fmt_int(fmt_char(p, '\t'), e->accel[i]);
+        }
+        for (i = 0; i < 3; i++) {
+            p = fmt_int(fmt_char(p, '\t'), e->rpy[i]);
+        }
+        p = fmt_uint(fmt_char(p, '\t'), e->flags);
+        fmt_char(p, '\n');
+        uart_puts(line);
+        recorder_uart_pos++;
+    }
+    #endif
+    
+    if (done) {
+        recorder_frozen = 0;
+        recorder_armed = 1;
+    }
+}
+
+/**
+ * Read the last dump back from EEPROM.
+ *
+ * @param entries Container for FLIGHT_RECORDER_ENTRIES entries, oldest first
+ * @param reason Trigger reason of the dump
+ * @return Number of entries, 0 if there is no complete dump
+ */
+uint8_t flight_recorder_read(struct flight_recorder_entry *entries, uint8_t *reason)
+{
+    uint8_t count;
+    
+    *reason = eeprom_read_byte((const uint8_t *)FLIGHT_RECORDER_ADDRESS);
+    count = eeprom_read_byte((const uint8_t *)FLIGHT_RECORDER_ADDRESS + 1);
+    if (*reason == 0 || *reason == 0xFF || count > FLIGHT_RECORDER_ENTRIES) {
+        return 0;
+    }
+    
+    eeprom_read_block(entries, (const void *)DUMP_ENTRIES_ADDRESS, count * sizeof(struct flight_recorder_entry));
+    return count;
+}
@@ -0,0 +1,36 @@
+#ifndef __FLIGHT_RECORDER_H_
+#define __FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+#define FLIGHT_RECORDER_ENTRIES 12      // ~170 ms at 72 Hz
+#define FLIGHT_RECORDER_POST 4          // entries kept after the trigger
+#define FLIGHT_RECORDER_EEPROM_DUMPS 4  // per power cycle, EEPROM wear
+
+// trigger reasons
+#define FLIGHT_RECORDER_SATURATION 0x01    // raw gyro or accel at full scale
+#define FLIGHT_RECORDER_ATTITUDE_JUMP 0x04 // attitude moved faster than the airframe can
+#define FLIGHT_RECORDER_MANUAL 0x08
+
+// entry flags
+#define FLIGHT_RECORDER_MAG_FRESH 0x01
+
+/**
+ * One loop iteration as the recorder keeps it, the raw readings and the
+ * attitude after them in tenths of a degree.
+ */
+struct flight_recorder_entry
+{
+    int16_t gyro[3];
+    int16_t accel[3];
+    int16_t rpy[3];
+    uint8_t flags;
+};
+
+void flight_recorder_init(void);
+void flight_recorder_record(const int16_t *raw, float roll, float pitch, float yaw, uint8_t flags);
+void flight_recorder_trigger(uint8_t reason);
+void flight_recorder_service(void);
+uint8_t flight_recorder_read(struct flight_recorder_entry *entries, uint8_t *reason);
+
+#endif
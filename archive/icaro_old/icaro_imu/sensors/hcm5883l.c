@@ -6,8 +6,13 @@
 #include "./hcm5883l.h"
 #include "./hcm5883l_registers.h"
 
+#define MAG_CAL_MIN_SPAN 400  // counts each axis must swing before an offset is learned
+
 uint8_t mode;
 uint8_t mag_buffer[6];
+int16_t mag_offset[3] = {0};
+int16_t mag_min[3] = {INT16_MAX, INT16_MAX, INT16_MAX};
+int16_t mag_max[3] = {INT16_MIN, INT16_MIN, INT16_MIN};
 
 /** Set magnetic field gain value.
 * @param gain New magnetic field gain value
@@ -58,6 +63,26 @@ void hcm5883l_init()
 	set_mode(HMC5883L_MODE_SINGLE);
 }
 
+/** Get data ready status.
+* This bit is set when data is written to all six data registers, and cleared
+* when the device initiates a write to the data output registers and after one
+* or more of the data output registers are written to.
+* @return Data ready status
+* @see HMC5883L_STATUS
+* @see HMC5883L_STATUS_READY_BIT
+*/
+uint8_t hcm5883l_data_ready()
+{
+	uint8_t status = 0;
+	i2c_read_bytes(
+        HMC5883L_ADDRESS,
+        HMC5883L_STATUS,
+        &status,
+        1
+    );
+	return (status >> HMC5883L_STATUS_READY_BIT) & 1;
+}
+
 /** Get 3-axis heading measurements.
 * In the event the ADC reading overflows or underflows for the given channel,
 * or if there is a math overflow during the bias measurement, this data
@@ -87,4 +112,70 @@ void hcm5883l_get_heading(int16_t *x, int16_t *y, int16_t *z)
 	*x = (((int16_t)mag_buffer[0]) << 8) | mag_buffer[1];
 	*y = (((int16_t)mag_buffer[4]) << 8) | mag_buffer[5];
 	*z = (((int16_t)mag_buffer[2]) << 8) | mag_buffer[3];
+	
+	hcm5883l_learn_offset(0, *x);
+	hcm5883l_learn_offset(1, *y);
+	hcm5883l_learn_offset(2, *z);
+	
+	*x -= mag_offset[0];
+	*y -= mag_offset[1];
+	*z -= mag_offset[2];
+}
+
+static void hcm5883l_update_offset(uint8_t axis)
+{
+	if ((int32_t)mag_max[axis] - mag_min[axis] > MAG_CAL_MIN_SPAN)
+	{
+		mag_offset[axis] = ((int32_t)mag_max[axis] + mag_min[axis]) / 2;
+	}
+}
+
+/** Track the hard-iron offset of one axis.
+* The offset is the middle of the raw range seen so far, once the range is
+* wide enough to mean the board has actually been rotated. Overflow readings
+* (-4096) are skipped.
+* @param axis 0, 1 or 2 for x, y, z
+* @param raw Raw axis reading
+*/
+void hcm5883l_learn_offset(uint8_t axis, int16_t raw)
+{
+	if (raw == -4096)
+	{
+		return;
+	}
+	if (raw < mag_min[axis]) mag_min[axis] = raw;
+	if (raw > mag_max[axis]) mag_max[axis] = raw;
+	hcm5883l_update_offset(axis);
+}
+
+/** Set the learned range, e.g. restored from EEPROM.
+* Learning goes on from it, so the offsets only move once the board swings
+* past what it had seen before.
+* @param min x, y, z lowest raw readings
+* @param max x, y, z highest raw readings
+*/
+void hcm5883l_set_range(const int16_t *min, const int16_t *max)
+{
+	uint8_t i;
+	for (i = 0; i < 3; i++)
+	{
+		mag_min[i] = min[i];
+		mag_max[i] = max[i];
+		mag_offset[i] = 0;
+		hcm5883l_update_offset(i);
+	}
+}
+
+/** Get the learned range, the offsets are its middle.
+* @param min Container for x, y, z lowest raw readings
+* @param max Container for x, y, z highest raw readings
+*/
+void hcm5883l_get_range(int16_t *min, int16_t *max)
+{
+	uint8_t i;
+	for (i = 0; i < 3; i++)
+	{
+		min[i] = mag_min[i];
+		max[i] = mag_max[i];
+	}
 }
\ No newline at end of file
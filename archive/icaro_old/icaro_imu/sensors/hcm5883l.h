@@ -4,6 +4,10 @@
 void hcm5883l_init();
 void set_gain(uint8_t gain);
 void set_mode(uint8_t new_mode);
+uint8_t hcm5883l_data_ready();
 void hcm5883l_get_heading(int16_t *x, int16_t *y, int16_t *z);
+void hcm5883l_learn_offset(uint8_t axis, int16_t raw);
+void hcm5883l_set_range(const int16_t *min, const int16_t *max);
+void hcm5883l_get_range(int16_t *min, int16_t *max);
 
 #endif
\ No newline at end of file
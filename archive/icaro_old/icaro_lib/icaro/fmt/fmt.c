@@ -0,0 +1,188 @@
+/**
+ * Fixed format number to text, see fmt.h.
+ *
+ * The AVR has no divide instruction and a 32 bit division by 10 is a
+ * libgcc call of several hundred cycles, so digits come from subtracting
+ * powers of ten instead: at most 9 subtractions of a 32 bit constant per
+ * digit, and the 16 bit values the sensors give skip the upper powers.
+ */
+
+#include <stdint.h>
+
+#include "fmt.h"
+
+static const uint32_t fmt_powers[10] = {
+    1000000000UL, 100000000UL, 10000000UL, 1000000UL, 100000UL,
+    10000UL, 1000UL, 100UL, 10UL, 1UL
+};
+
+static const float fmt_scales[FMT_FLOAT_DECIMALS + 1] = {
+    1.0f, 10.0f, 100.0f, 1000.0f, 10000.0f, 100000.0f, 1000000.0f
+};
+
+char *fmt_char(char *out, char c)
+{
+    *out++ = c;
+    *out = '\0';
+    return out;
+}
+
+char *fmt_str(char *out, const char *text)
+{
+    while (*text) {
+        *out++ = *text++;
+    }
+    *out = '\0';
+    return out;
+}
+
+/**
+ * Digits of value, zero padded to width.
+ */
+static char *fmt_digits(char *out, uint32_t value, uint8_t width)
+{
+    uint8_t i = 0;
+    uint8_t started = 0;
+    
+    for (i = 0; i < 10; i++) {
+        uint32_t power = fmt_powers[i];
+        char digit = '0';
+        
+        if (!started && value < power && 10 - i > width) {
+            continue;
+        }
+        while (value >= power) {
+            value -= power;
+            digit++;
+        }
+        *out++ = digit;
+        started = 1;
+    }
+    *out = '\0';
+    return out;
+}
+
+char *fmt_uint(char *out, uint32_t value)
+{
+    return fmt_digits(out, value, 1);
+}
+
+char *fmt_int(char *out, int32_t value)
+{
+    if (value < 0) {
+        *out++ = '-';
+        return fmt_digits(out, -(uint32_t)value, 1);
+    }
+    return fmt_digits(out, value, 1);
+}
+
+/**
+ * Lower case, no prefix, like %x.
+ */
+char *fmt_hex(char *out, uint16_t value)
+{
+    int8_t shift;
+    uint8_t started = 0;
+    
+    for (shift = 12; shift >= 0; shift -= 4) {
+        uint8_t nibble = (value >> shift) & 0xf;
+        
+        if (nibble || started || shift == 0) {
+            *out++ = "0123456789abcdef"[nibble];
+            started = 1;
+        }
+    }
+    *out = '\0';
+    return out;
+}
+
+/**
+ * Like %.*f.
+ *
+ * @param out At least FMT_FLOAT_SIZE(decimals) bytes
+ * @param value Value, "nan", "inf" and "ovf" past FMT_FLOAT_MAX
+ * @param decimals 0 to FMT_FLOAT_DECIMALS
+ */
+char *fmt_float(char *out, float value, uint8_t decimals)
+{
+    uint32_t integer, fraction;
+    float scaled;
+    
+    if (decimals > FMT_FLOAT_DECIMALS) {
+        decimals = FMT_FLOAT_DECIMALS;
+    }
+    if (value != value) {
+        return fmt_str(out, "nan");
+    }
+    if (value < 0.0f) {
+        *out++ = '-';
+        value = -value;
+    }
+    if (value >= FMT_FLOAT_MAX) {
+        return fmt_str(out, value > 3.4e38f ? "inf" : "ovf");
+    }
+    
+    integer = (uint32_t)value;
+    scaled = (value - integer) * fmt_scales[decimals] + 0.5f;
+    fraction = (uint32_t)scaled;
+    if (fraction >= (uint32_t)fmt_scales[decimals]) {
+        fraction -= (uint32_t)fmt_scales[decimals];
+        integer++;
+    }
+    
+    out = fmt_digits(out, integer, 1);
+    if (decimals == 0) {
+        return out;
+    }
+    *out++ = '.';
+    return fmt_digits(out, fraction, decimals);
+}
+
+#ifdef FMT_BENCH
+#include <stdio.h>
+#include <avr/io.h>
+
+/**
+ * Time the rpy debug line built both ways, Timer1 at the CPU clock / 8 so
+ * the sprintf one fits the 16 bit counter. Link with -Wl,-u,vfprintf -lprintf_flt or
+ * sprintf prints '?' for the floats and looks cheap.
+ *
+ * @param fmt_cycles CPU cycles with the fmt_* functions
+ * @param sprintf_cycles CPU cycles with sprintf
+ */
+void fmt_bench(uint32_t *fmt_cycles, uint32_t *sprintf_cycles)
+{
+    static const int16_t values[9] = {-250, 16384, -3, 7, 8191, 120, -340, 55, 1};
+    char line[150];
+    char *p;
+    uint8_t tccr1b = TCCR1B;
+    uint16_t tcnt1 = TCNT1;
+    uint8_t i;
+    
+    TCCR1B = (1 << CS11);
+    TCNT1 = 0;
+    p = fmt_str(line, "rpy ");
+    p = fmt_float(p, 12.345f, 6);
+    p = fmt_char(p, '\t');
+    p = fmt_float(p, -1.5f, 6);
+    p = fmt_char(p, '\t');
+    p = fmt_float(p, 179.9f, 6);
+    for (i = 0; i < 9; i++) {
+        p = fmt_char(p, '\t');
+        p = fmt_int(p, values[i]);
+    }
+    p = fmt_char(p, '\n');
+    *fmt_cycles = (uint32_t)TCNT1 * 8;
+    
+    TCNT1 = 0;
+    sprintf(line, "rpy %f\t%f\t%f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
+        12.345f, -1.5f, 179.9f,
+        values[0], values[1], values[2],
+        values[3], values[4], values[5],
+        values[6], values[7], values[8]);
+    *sprintf_cycles = (uint32_t)TCNT1 * 8;
+    
+    TCCR1B = tccr1b;
+    TCNT1 = tcnt1;
+}
+#endif
@@ -0,0 +1,40 @@
+#ifndef __FMT_H_
+#define __FMT_H_
+
+#include <stdint.h>
+
+/**
+ * Fixed format number to text for the debug UART.
+ *
+ * Every function writes at out, terminates the text and returns a pointer
+ * to the terminating '\0', so calls chain:
+ *
+ *   p = fmt_float(DEBUG_BUFFER, getRoll(), 3);
+ *   p = fmt_char(p, '\t');
+ *
+ * No format string, no varargs and no libm. With every sprintf of the
+ * firmware replaced, vfprintf and -lprintf_flt drop out of the link; compare
+ * avr-size of the two builds to see the flash it saves.
+ *
+ * Floats print with up to FMT_FLOAT_DECIMALS decimals, a float carries about
+ * 7 significant digits so the last of them can be off by one against
+ * printf. Magnitudes from FMT_FLOAT_MAX print as "ovf".
+ */
+
+#define FMT_FLOAT_MAX 4294967040.0f
+#define FMT_FLOAT_DECIMALS 6
+#define FMT_INT_SIZE 12 // "-2147483648" and the '\0'
+#define FMT_FLOAT_SIZE(decimals) (13 + (decimals)) // "-4294967040.", the decimals and the '\0'
+
+char *fmt_char(char *out, char c);
+char *fmt_str(char *out, const char *text);
+char *fmt_uint(char *out, uint32_t value);
+char *fmt_int(char *out, int32_t value);
+char *fmt_hex(char *out, uint16_t value);
+char *fmt_float(char *out, float value, uint8_t decimals);
+
+#ifdef FMT_BENCH
+void fmt_bench(uint32_t *fmt_cycles, uint32_t *sprintf_cycles);
+#endif
+
+#endif
@@ -13,4 +13,15 @@
 #define  IMU_PITCH_ADDRESS 5
 #define  IMU_YAW_ADDRESS 9
 
+// main loop timing of the last window, LOOP_STATS builds only, see
+// loop_stats.h. uint16 little endian, microseconds.
+#define IMU_LOOP_MIN_ADDRESS 13
+#define IMU_LOOP_MEAN_ADDRESS 15
+#define IMU_LOOP_MAX_ADDRESS 17
+#define IMU_LOOP_JITTER_MIN_ADDRESS 19      // int16
+#define IMU_LOOP_JITTER_MAX_ADDRESS 21      // int16
+#define IMU_LOOP_JITTER_MEAN_ADDRESS 23
+#define IMU_LOOP_PHASE_ADDRESS 25           // 4 phase means
+#define IMU_LOOP_HISTOGRAM_ADDRESS 33       // 8 bucket counts
+
 #endif
\ No newline at end of file
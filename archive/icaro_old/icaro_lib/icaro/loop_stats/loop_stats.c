@@ -0,0 +1,170 @@
+/**
+ * Main loop iteration timing, see loop_stats.h.
+ *
+ * An iteration costs three to six micros() calls, a 16 bit division for
+ * the histogram bucket and some 32 bit adds; the 32 bit divisions of the
+ * means only run once per window. micros() counts in steps of 4 us at
+ * 16 MHz, short phases read as 0 or 4.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "icaro/timer/timer.h"
+
+#include "loop_stats.h"
+
+uint32_t period_us;
+uint16_t bucket_us;
+unsigned long start_us, mark_us, previous_start_us;
+
+// window being filled
+uint16_t iterations, jitter_count;
+uint32_t total_us, min_us, max_us;
+uint32_t jitter_total_us;
+int32_t jitter_min_us, jitter_max_us;
+uint32_t phase_total_us[LOOP_STATS_PHASES];
+uint16_t buckets[LOOP_STATS_BUCKETS];
+
+struct loop_stats_summary summary;
+
+static uint16_t loop_stats_saturate(uint32_t us)
+{
+    return us > 0xffff ? 0xffff : us;
+}
+
+static int16_t loop_stats_saturate_signed(int32_t us)
+{
+    if (us > 32767) {
+        return 32767;
+    }
+    return us < -32768 ? -32768 : us;
+}
+
+static void loop_stats_reset(void)
+{
+    uint8_t i;
+
+    iterations = 0;
+    jitter_count = 0;
+    total_us = 0;
+    min_us = 0xffffffffUL;
+    max_us = 0;
+    jitter_total_us = 0;
+    jitter_min_us = 0x7fffffffL;
+    jitter_max_us = -0x7fffffffL;
+    for (i = 0; i < LOOP_STATS_PHASES; i++) {
+        phase_total_us[i] = 0;
+    }
+    memset(buckets, 0, sizeof(buckets));
+}
+
+/**
+ * Sum the full window up and start the next one.
+ */
+static void loop_stats_publish(void)
+{
+    uint8_t i;
+
+    summary.windows++;
+    summary.min_us = loop_stats_saturate(min_us);
+    summary.mean_us = loop_stats_saturate(total_us / iterations);
+    summary.max_us = loop_stats_saturate(max_us);
+    if (jitter_count) {
+        summary.jitter_min_us = loop_stats_saturate_signed(jitter_min_us);
+        summary.jitter_max_us = loop_stats_saturate_signed(jitter_max_us);
+        summary.jitter_mean_us = loop_stats_saturate(jitter_total_us / jitter_count);
+    }
+    for (i = 0; i < LOOP_STATS_PHASES; i++) {
+        summary.phase_mean_us[i] = loop_stats_saturate(phase_total_us[i] / iterations);
+    }
+    memcpy(summary.buckets, buckets, sizeof(buckets));
+    loop_stats_reset();
+}
+
+/**
+ * @param period Target iteration period in microseconds, below 32 ms
+ */
+void loop_stats_init(uint32_t period)
+{
+    period_us = period;
+    bucket_us = 2 * period / LOOP_STATS_BUCKETS;
+    previous_start_us = 0;
+    memset(&summary, 0, sizeof(summary));
+    loop_stats_reset();
+}
+
+/**
+ * An iteration starts, at the top of the loop.
+ */
+void loop_stats_begin(void)
+{
+    start_us = micros();
+    mark_us = start_us;
+
+    // the first iteration has nothing to be jitter against
+    if (previous_start_us) {
+        int32_t jitter = (int32_t)(start_us - previous_start_us - period_us);
+
+        if (jitter < jitter_min_us) {
+            jitter_min_us = jitter;
+        }
+        if (jitter > jitter_max_us) {
+            jitter_max_us = jitter;
+        }
+        jitter_total_us += labs(jitter);
+        jitter_count++;
+    }
+    previous_start_us = start_us;
+}
+
+/**
+ * A phase ends, it ran from the previous mark or the start.
+ *
+ * @param phase 0 to LOOP_STATS_PHASES - 1
+ */
+void loop_stats_mark(uint8_t phase)
+{
+    unsigned long now = micros();
+
+    phase_total_us[phase] += now - mark_us;
+    mark_us = now;
+}
+
+/**
+ * The iteration is done.
+ */
+void loop_stats_end(void)
+{
+    uint32_t elapsed = micros() - start_us;
+    uint16_t bucket = LOOP_STATS_BUCKETS - 1;
+
+    // below two periods fits 16 bits. The bucket width is rounded down,
+    // the few us it loses at the top go to the top bucket.
+    if (elapsed < 2 * period_us) {
+        bucket = (uint16_t)elapsed / bucket_us;
+        if (bucket > LOOP_STATS_BUCKETS - 1) {
+            bucket = LOOP_STATS_BUCKETS - 1;
+        }
+    }
+    buckets[bucket]++;
+
+    total_us += elapsed;
+    if (elapsed < min_us) {
+        min_us = elapsed;
+    }
+    if (elapsed > max_us) {
+        max_us = elapsed;
+    }
+    if (++iterations == LOOP_STATS_WINDOW) {
+        loop_stats_publish();
+    }
+}
+
+/**
+ * @return Summary of the last full window, all zero before the first
+ */
+const struct loop_stats_summary *loop_stats_get(void)
+{
+    return &summary;
+}
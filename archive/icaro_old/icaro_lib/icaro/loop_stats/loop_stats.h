@@ -0,0 +1,57 @@
+#ifndef __LOOP_STATS_H_
+#define __LOOP_STATS_H_
+
+#include <stdint.h>
+
+/**
+ * Main loop iteration timing.
+ *
+ * The loop stamps micros() when an iteration starts, at the end of each of
+ * its phases and when it is done. Over a window of LOOP_STATS_WINDOW
+ * iterations this keeps min/mean/max of the iteration time, the mean of
+ * each phase, a histogram of the iteration time and the jitter of the
+ * start to start interval against the target period. When a window is
+ * full it is summed up in a struct loop_stats_summary, which the IMU
+ * registers and the debug UART show, and a new window starts; sums of a
+ * bounded window fit 32 bits and the numbers stay current.
+ *
+ * The histogram spans two periods, LOOP_STATS_BUCKETS buckets from 0, the
+ * top one takes anything longer.
+ *
+ * Built with -DLOOP_STATS the LOOP_STATS_* macros call in, without they
+ * are empty and the loop carries no instrumentation at all.
+ */
+
+#define LOOP_STATS_PHASES 4
+#define LOOP_STATS_BUCKETS 8
+#define LOOP_STATS_WINDOW 256  // iterations, ~3.5 s at 72 Hz
+
+/**
+ * Last full window, times in microseconds, saturated to 16 bits.
+ */
+struct loop_stats_summary {
+    uint16_t windows;                       // summaries so far, changes with every new one
+    uint16_t min_us, mean_us, max_us;       // iteration, start to done
+    int16_t jitter_min_us, jitter_max_us;   // start to start less the period
+    uint16_t jitter_mean_us;                // mean absolute
+    uint16_t phase_mean_us[LOOP_STATS_PHASES];
+    uint16_t buckets[LOOP_STATS_BUCKETS];
+};
+
+void loop_stats_init(uint32_t period_us);
+void loop_stats_begin(void);
+void loop_stats_mark(uint8_t phase);
+void loop_stats_end(void);
+const struct loop_stats_summary *loop_stats_get(void);
+
+#ifdef LOOP_STATS
+#define LOOP_STATS_BEGIN() loop_stats_begin()
+#define LOOP_STATS_MARK(phase) loop_stats_mark(phase)
+#define LOOP_STATS_END() loop_stats_end()
+#else
+#define LOOP_STATS_BEGIN()
+#define LOOP_STATS_MARK(phase)
+#define LOOP_STATS_END()
+#endif
+
+#endif
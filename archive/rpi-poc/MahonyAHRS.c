@@ -27,23 +27,49 @@
 
 #include "MahonyAHRS.h"
 #include <math.h>
+#include <stdint.h>
 
 //-------------------------------------------------------------------------------------------
 // Definitions
 
 #define DEFAULT_SAMPLE_FREQ 512.0f // sample frequency in Hz
+// build with -DMAHONY_TUNED_GAINS to use the gains written by tuning/autotune
+#ifdef MAHONY_TUNED_GAINS
+#include "mahony_gains.h"
+#endif
+#ifndef twoKpDef
 #define twoKpDef (2.0f * 0.5f)	   // 2 * proportional gain
+#endif
+#ifndef twoKiDef
 #define twoKiDef (2.0f * 0.0f)	   // 2 * integral gain
+#endif
+#define twoKpStartDef (2.0f * 5.0f) // 2 * proportional gain right after alignment
+#define DEFAULT_GAIN_SCHEDULE_TIME 5.0f // seconds to decay from start to cruise gain
+#define DEFAULT_CORRECTION_DIVIDER 8 // accel/mag correction every n gyro samples
+
+// build with -DMAHONY_THREAD_LOCAL to give every thread its own filter, the
+// analysis tools run one per worker
+#ifdef MAHONY_THREAD_LOCAL
+#define MAHONY_STATE __thread
+#else
+#define MAHONY_STATE
+#endif
 
 // Variables
 
-float twoKp = twoKpDef;											  // 2 * proportional gain (Kp)
-float twoKi = twoKiDef;											  // 2 * integral gain (Ki)
-float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;				  // quaternion of sensor frame relative to auxiliary frame
-float integralFBx = 0.0f, integralFBy = 0.0f, integralFBz = 0.0f; // integral error terms scaled by Ki
-float invSampleFreq;
-float roll, pitch, yaw;
-char anglesComputed = 1.0f / DEFAULT_SAMPLE_FREQ;
+MAHONY_STATE float twoKp = twoKpDef;											  // 2 * proportional gain (Kp)
+MAHONY_STATE float twoKi = twoKiDef;											  // 2 * integral gain (Ki)
+MAHONY_STATE float q0 = 1.0f, q1 = 0.0f, q2 = 0.0f, q3 = 0.0f;				  // quaternion of sensor frame relative to auxiliary frame
+MAHONY_STATE float integralFBx = 0.0f, integralFBy = 0.0f, integralFBz = 0.0f; // integral error terms scaled by Ki
+MAHONY_STATE float invSampleFreq = 1.0f / DEFAULT_SAMPLE_FREQ;
+static MAHONY_STATE float roll, pitch, yaw;
+MAHONY_STATE char anglesComputed = 0;
+MAHONY_STATE float fbx = 0.0f, fby = 0.0f, fbz = 0.0f;						  // feedback held between decimated corrections (rad/s)
+MAHONY_STATE unsigned int correctionDivider = DEFAULT_CORRECTION_DIVIDER;
+MAHONY_STATE unsigned int samplesSinceCorrection = 0;
+MAHONY_STATE char aligned = 0;												  // quaternion initialised from accel/mag
+MAHONY_STATE float twoKpStart = twoKpStartDef, twoKpCruise = twoKpDef;		  // gain schedule end points
+MAHONY_STATE float gainScheduleTime = DEFAULT_GAIN_SCHEDULE_TIME, scheduleTime = 0.0f;
 
 //============================================================================================
 // Functions
@@ -54,16 +80,142 @@ char anglesComputed = 1.0f / DEFAULT_SAMPLE_FREQ;
 
 float mahony_invSqrt(float x)
 {
+	// int32_t rather than long, long is 64 bits wide on 64-bit hosts
+	union
+	{
+		float f;
+		int32_t i;
+	} u;
 	float halfx = 0.5f * x;
-	float y = x;
-	long i = *(long *)&y;
-	i = 0x5f3759df - (i >> 1);
-	y = *(float *)&i;
+	float y;
+	u.f = x;
+	u.i = 0x5f3759df - (u.i >> 1);
+	y = u.f;
 	y = y * (1.5f - (halfx * y * y));
 	y = y * (1.5f - (halfx * y * y));
 	return y;
 }
 
+//-------------------------------------------------------------------------------------------
+// Reset filter state
+
+void mahony_init()
+{
+	twoKpStart = twoKpStartDef;
+	twoKpCruise = twoKpDef;
+	gainScheduleTime = DEFAULT_GAIN_SCHEDULE_TIME;
+	scheduleTime = 0.0f;
+	twoKp = twoKpStart;
+	twoKi = twoKiDef;
+	aligned = 0;
+	q0 = 1.0f;
+	q1 = 0.0f;
+	q2 = 0.0f;
+	q3 = 0.0f;
+	integralFBx = 0.0f;
+	integralFBy = 0.0f;
+	integralFBz = 0.0f;
+	fbx = 0.0f;
+	fby = 0.0f;
+	fbz = 0.0f;
+	invSampleFreq = 1.0f / DEFAULT_SAMPLE_FREQ;
+	correctionDivider = DEFAULT_CORRECTION_DIVIDER;
+	samplesSinceCorrection = 0;
+	anglesComputed = 0;
+}
+
+void mahony_set_sample_frequency(float sampleFrequency)
+{
+	invSampleFreq = 1.0f / sampleFrequency;
+}
+
+//-------------------------------------------------------------------------------------------
+// Initial alignment
+//
+// Sets the quaternion straight from one accel/mag sample instead of letting
+// the filter converge from the identity: roll and pitch from the gravity
+// vector, yaw from the tilt compensated magnetic field. Without a valid
+// magnetometer sample yaw is left at zero.
+
+void mahony_align(float ax, float ay, float az, float mx, float my, float mz)
+{
+	float alignRoll, alignPitch, alignYaw = 0.0f;
+	float sr, cr, sp, cp, sy, cy;
+
+	alignRoll = atan2f(ay, az);
+	alignPitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+
+	if (!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)))
+	{
+		// Rotate the magnetic field back to the horizontal plane
+		float sinRoll = sinf(alignRoll), cosRoll = cosf(alignRoll);
+		float sinPitch = sinf(alignPitch), cosPitch = cosf(alignPitch);
+		float hx = mx * cosPitch + (my * sinRoll + mz * cosRoll) * sinPitch;
+		float hy = my * cosRoll - mz * sinRoll;
+		alignYaw = atan2f(-hy, hx);
+	}
+
+	sr = sinf(0.5f * alignRoll);
+	cr = cosf(0.5f * alignRoll);
+	sp = sinf(0.5f * alignPitch);
+	cp = cosf(0.5f * alignPitch);
+	sy = sinf(0.5f * alignYaw);
+	cy = cosf(0.5f * alignYaw);
+	q0 = cr * cp * cy + sr * sp * sy;
+	q1 = sr * cp * cy - cr * sp * sy;
+	q2 = cr * sp * cy + sr * cp * sy;
+	q3 = cr * cp * sy - sr * sp * cy;
+
+	integralFBx = 0.0f;
+	integralFBy = 0.0f;
+	integralFBz = 0.0f;
+	fbx = 0.0f;
+	fby = 0.0f;
+	fbz = 0.0f;
+	samplesSinceCorrection = 0;
+	scheduleTime = 0.0f;
+	twoKp = twoKpStart;
+	aligned = 1;
+	anglesComputed = 0;
+}
+
+//-------------------------------------------------------------------------------------------
+// Gain schedule
+//
+// After alignment the proportional gain ramps linearly from twoKpStart down
+// to twoKpCruise over gainScheduleTime seconds of filter time: fast settling
+// right after start-up, less accelerometer noise once flying.
+
+void mahony_set_gain_schedule(float startGain, float cruiseGain, float seconds)
+{
+	twoKpStart = startGain;
+	twoKpCruise = cruiseGain;
+	gainScheduleTime = seconds;
+	scheduleTime = 0.0f;
+	twoKp = seconds > 0.0f ? startGain : cruiseGain;
+}
+
+static void mahony_schedule_gain(float dt)
+{
+	if (!aligned || scheduleTime >= gainScheduleTime)
+		return;
+	scheduleTime += dt;
+	if (scheduleTime >= gainScheduleTime)
+		twoKp = twoKpCruise;
+	else
+		twoKp = twoKpStart + (twoKpCruise - twoKpStart) * (scheduleTime / gainScheduleTime);
+}
+
+void mahony_set_integral_gain(float gain)
+{
+	twoKi = gain;
+}
+
+char mahony_ready()
+{
+	return aligned && scheduleTime >= gainScheduleTime;
+}
+
 //-------------------------------------------------------------------------------------------
 // AHRS algorithm update
 
@@ -84,6 +236,14 @@ void mahony_update(float gx, float gy, float gz, float ax, float ay, float az, f
 		return;
 	}
 
+	// Initialise from the first valid accel/mag sample
+	if (!aligned && !((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
+	{
+		mahony_align(ax, ay, az, mx, my, mz);
+		return;
+	}
+	mahony_schedule_gain(invSampleFreq);
+
 	// Convert gyroscope degrees/sec to radians/sec
 	gx *= 0.0174533f;
 	gy *= 0.0174533f;
@@ -193,6 +353,14 @@ void mahony_update_imu(float gx, float gy, float gz, float ax, float ay, float a
 	float halfex, halfey, halfez;
 	float qa, qb, qc;
 
+	// Initialise tilt from the first valid accelerometer sample
+	if (!aligned && !((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f)))
+	{
+		mahony_align(ax, ay, az, 0.0f, 0.0f, 0.0f);
+		return;
+	}
+	mahony_schedule_gain(invSampleFreq);
+
 	// Convert gyroscope degrees/sec to radians/sec
 	gx *= 0.0174533f;
 	gy *= 0.0174533f;
@@ -265,6 +433,169 @@ void mahony_update_imu(float gx, float gy, float gz, float ax, float ay, float a
 	anglesComputed = 0;
 }
 
+//-------------------------------------------------------------------------------------------
+// Multi-rate update
+//
+// mahony_propagate() is the cheap part of the filter: it integrates the gyro
+// plus the feedback computed by the last correction and renormalises. It is
+// meant to run at the full IMU rate. mahony_correct() does the expensive part
+// (normalisations, magnetic reference rotation, cross products) and only
+// refreshes the held feedback, so it can run at a lower rate.
+
+void mahony_propagate(float gx, float gy, float gz)
+{
+	float recipNorm;
+	float qa, qb, qc;
+
+	mahony_schedule_gain(invSampleFreq);
+
+	// Convert gyroscope degrees/sec to radians/sec and apply held feedback
+	gx = gx * 0.0174533f + fbx;
+	gy = gy * 0.0174533f + fby;
+	gz = gz * 0.0174533f + fbz;
+
+	// Integrate rate of change of quaternion
+	gx *= (0.5f * invSampleFreq); // pre-multiply common factors
+	gy *= (0.5f * invSampleFreq);
+	gz *= (0.5f * invSampleFreq);
+	qa = q0;
+	qb = q1;
+	qc = q2;
+	q0 += (-qb * gx - qc * gy - q3 * gz);
+	q1 += (qa * gx + qc * gz - q3 * gy);
+	q2 += (qa * gy - qb * gz + q3 * gx);
+	q3 += (qa * gz + qb * gy - qc * gx);
+
+	// Normalise quaternion
+	recipNorm = mahony_invSqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+	q0 *= recipNorm;
+	q1 *= recipNorm;
+	q2 *= recipNorm;
+	q3 *= recipNorm;
+	anglesComputed = 0;
+	samplesSinceCorrection++;
+}
+
+void mahony_correct(float ax, float ay, float az, float mx, float my, float mz)
+{
+	float recipNorm;
+	float q0q0, q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+	float hx, hy, bx, bz;
+	float halfvx, halfvy, halfvz, halfwx, halfwy, halfwz;
+	float halfex, halfey, halfez;
+	float correctionPeriod;
+
+	// Integral feedback covers every sample propagated since the last correction
+	correctionPeriod = invSampleFreq * (samplesSinceCorrection > 0 ? samplesSinceCorrection : 1);
+	samplesSinceCorrection = 0;
+
+	// Without a valid accelerometer measurement there is nothing to correct
+	// against, keep integrating the gyro with the integral term only
+	if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))
+	{
+		fbx = integralFBx;
+		fby = integralFBy;
+		fbz = integralFBz;
+		return;
+	}
+
+	// Initialise from the first valid accel sample, tilt only while there is
+	// no mag sample yet; the mag feedback brings yaw in once there is
+	if (!aligned)
+	{
+		mahony_align(ax, ay, az, mx, my, mz);
+		return;
+	}
+
+	// Normalise accelerometer measurement
+	recipNorm = mahony_invSqrt(ax * ax + ay * ay + az * az);
+	ax *= recipNorm;
+	ay *= recipNorm;
+	az *= recipNorm;
+
+	// Estimated direction of gravity
+	q0q0 = q0 * q0;
+	q0q1 = q0 * q1;
+	q0q2 = q0 * q2;
+	q1q3 = q1 * q3;
+	q2q3 = q2 * q3;
+	q3q3 = q3 * q3;
+	halfvx = q1q3 - q0q2;
+	halfvy = q0q1 + q2q3;
+	halfvz = q0q0 - 0.5f + q3q3;
+
+	// Error is cross product between estimated and measured direction of gravity
+	halfex = (ay * halfvz - az * halfvy);
+	halfey = (az * halfvx - ax * halfvz);
+	halfez = (ax * halfvy - ay * halfvx);
+
+	// Add magnetic field error when the magnetometer measurement is valid
+	// (avoids NaN in magnetometer normalisation)
+	if (!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)))
+	{
+		// Normalise magnetometer measurement
+		recipNorm = mahony_invSqrt(mx * mx + my * my + mz * mz);
+		mx *= recipNorm;
+		my *= recipNorm;
+		mz *= recipNorm;
+
+		q0q3 = q0 * q3;
+		q1q1 = q1 * q1;
+		q1q2 = q1 * q2;
+		q2q2 = q2 * q2;
+
+		// Reference direction of Earth's magnetic field
+		hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+		hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+		bx = sqrtf(hx * hx + hy * hy);
+		bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+		// Estimated direction of magnetic field
+		halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+		halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+		halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+		halfex += (my * halfwz - mz * halfwy);
+		halfey += (mz * halfwx - mx * halfwz);
+		halfez += (mx * halfwy - my * halfwx);
+	}
+
+	// Compute integral feedback if enabled
+	if (twoKi > 0.0f)
+	{
+		// integral error scaled by Ki
+		integralFBx += twoKi * halfex * correctionPeriod;
+		integralFBy += twoKi * halfey * correctionPeriod;
+		integralFBz += twoKi * halfez * correctionPeriod;
+	}
+	else
+	{
+		integralFBx = 0.0f; // prevent integral windup
+		integralFBy = 0.0f;
+		integralFBz = 0.0f;
+	}
+
+	// Hold integral and proportional feedback until the next correction
+	fbx = integralFBx + twoKp * halfex;
+	fby = integralFBy + twoKp * halfey;
+	fbz = integralFBz + twoKp * halfez;
+}
+
+void mahony_set_correction_divider(unsigned int divider)
+{
+	correctionDivider = divider > 0 ? divider : 1;
+}
+
+void mahony_update_multirate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, char magFresh)
+{
+	// Correct on fresh magnetometer data or once every correctionDivider samples
+	if (magFresh || samplesSinceCorrection >= correctionDivider)
+	{
+		mahony_correct(ax, ay, az, mx, my, mz);
+	}
+	mahony_propagate(gx, gy, gz);
+}
+
 //-------------------------------------------------------------------------------------------
 
 void mahony_compute_angles()
@@ -296,6 +627,21 @@ float mahony_get_yaw()
 	return yaw * 57.29578f + 180.0f;
 }
 
+void mahony_get_integral_feedback(float *feedback)
+{
+	feedback[0] = integralFBx;
+	feedback[1] = integralFBy;
+	feedback[2] = integralFBz;
+}
+
+void mahony_get_quaternion(float *q)
+{
+	q[0] = q0;
+	q[1] = q1;
+	q[2] = q2;
+	q[3] = q3;
+}
+
 float mahony_get_roll_radians()
 {
 	if (!anglesComputed)
@@ -20,13 +20,25 @@
 
 //--------------------------------------------------------------------------------------------
 
+void mahony_init();
+void mahony_set_sample_frequency(float sampleFrequency);
+void mahony_align(float ax, float ay, float az, float mx, float my, float mz);
+void mahony_set_gain_schedule(float startGain, float cruiseGain, float seconds);
+void mahony_set_integral_gain(float gain);
+char mahony_ready();
 void mahony_update(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz);
 void mahony_update_imu(float gx, float gy, float gz, float ax, float ay, float az);
+void mahony_propagate(float gx, float gy, float gz);
+void mahony_correct(float ax, float ay, float az, float mx, float my, float mz);
+void mahony_set_correction_divider(unsigned int divider);
+void mahony_update_multirate(float gx, float gy, float gz, float ax, float ay, float az, float mx, float my, float mz, char magFresh);
 float mahony_get_roll();
 float mahony_get_pitch();
 float mahony_get_yaw();
 float mahony_get_roll_radians();
 float mahony_get_pitch_radians();
 float mahony_get_yaw_radians();
+void mahony_get_quaternion(float *q);
+void mahony_get_integral_feedback(float *feedback);
 
 #endif
@@ -0,0 +1,548 @@
+/**
+ * Fleet-wide analysis of binary sensor logs.
+ *
+ * Maps every log given, cuts them into blocks of BLOCK_RECORDS records and
+ * spreads the blocks over a work-stealing pool of threads, one per core by
+ * default. Every block is analysed on its own into a partial result:
+ *
+ *  - gyro bias against temperature, from the samples where the vehicle is
+ *    still, in 1 degree C bins and as a least squares line per axis,
+ *  - gyro noise spectrum, Welch average of Hann windowed FFT_SIZE frames,
+ *  - I2C error, FIFO overflow and fresh magnetometer sample counts,
+ *  - estimator divergence events: the attitude from estimator_update() (the
+ *    vehicle's biquads, notch tracker and fusion, built with their
+ *    *_THREAD_LOCAL flags so every worker has its own estimator) tilted more
+ *    than DIVERGENCE_ANGLE from the measured gravity for DIVERGENCE_TIME
+ *    while the vehicle is still.
+ *
+ * The estimator of each block is restarted WARMUP_SECONDS before the block
+ * and converges on those samples before anything is scored, so blocks are
+ * independent of each other. The partial results are merged in block order
+ * once every block is done, so the report does not depend on the number of
+ * threads or on which thread ran what.
+ *
+ * usage: analyze [-t threads] [-b block_records] log...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "work_pool.h"
+#include "../MahonyAHRS.h"
+#include "../estimator/estimator.h"
+#include "../log/sensor_log.h"
+
+#define BLOCK_RECORDS 65536
+#define WARMUP_SECONDS 8.0f
+#define FFT_SIZE 128
+#define FFT_BINS (FFT_SIZE / 2 + 1)
+#define TEMP_MIN -10 // degrees C, lowest bin
+#define TEMP_BINS 80
+#define MIN_TEMP_SPREAD 2.0    // degrees C standard deviation needed for a fit
+#define STILL_RATE 5.0f        // deg/s, gyro magnitude below which the vehicle is still
+#define STILL_ACCEL 0.05f      // g, accel magnitude this close to 1 g
+#define DIVERGENCE_ANGLE 10.0f // deg between estimated and measured gravity
+#define DIVERGENCE_TIME 0.5f   // s
+#define MIN_PERIOD_RATIO 0.5f  // as in estimator.c
+#define MAX_PERIOD_RATIO 2.0f
+
+struct log_entry
+{
+    const char *path;
+    struct sensor_log_file file;
+};
+
+/**
+ * Partial result of one block, or the sum of several.
+ */
+struct block_stats
+{
+    size_t records;
+    size_t i2cErrors;
+    size_t fifoOverflows;
+    size_t magSamples;
+
+    // still samples by temperature bin: count, gx, gy, gz sums in deg/s
+    double tempBins[TEMP_BINS][4];
+    // least squares over every still sample: n, sum t, sum t^2, sum g, sum t g
+    double n, sumT, sumT2, sumG[3], sumTG[3];
+    double stillSquares[3]; // for the noise RMS around the bias
+
+    double spectrum[3][FFT_BINS];
+    size_t frames;
+
+    size_t scored; // records the divergence check ran on
+    size_t divergences;
+    double divergedSeconds;
+    float worstError; // deg
+};
+
+struct block
+{
+    size_t log;
+    size_t first;
+    size_t count;
+    struct block_stats stats;
+};
+
+struct analysis
+{
+    struct log_entry *logs;
+    size_t logCount;
+    struct block *blocks;
+    size_t blockCount;
+};
+
+/**
+ * In place radix-2 complex FFT.
+ */
+static void fft(double *re, double *im, int n)
+{
+    int i, j, length;
+
+    for (i = 1, j = 0; i < n; i++)
+    {
+        int bit = n >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+        if (i < j)
+        {
+            double t = re[i];
+            re[i] = re[j];
+            re[j] = t;
+            t = im[i];
+            im[i] = im[j];
+            im[j] = t;
+        }
+    }
+
+    for (length = 2; length <= n; length <<= 1)
+    {
+        double angle = -2.0 * M_PI / length;
+        for (i = 0; i < n; i += length)
+        {
+            for (j = 0; j < length / 2; j++)
+            {
+                double wr = cos(angle * j), wi = sin(angle * j);
+                double *ur = &re[i + j], *ui = &im[i + j];
+                double *vr = &re[i + j + length / 2], *vi = &im[i + j + length / 2];
+                double tr = *vr * wr - *vi * wi;
+                double ti = *vr * wi + *vi * wr;
+
+                *vr = *ur - tr;
+                *vi = *ui - ti;
+                *ur += tr;
+                *ui += ti;
+            }
+        }
+    }
+}
+
+/**
+ * Add the power spectrum of one frame of each gyro axis.
+ */
+static void add_spectrum(struct block_stats *stats, const struct sensor_log_file *log, size_t first, float gyroScale)
+{
+    double re[FFT_SIZE], im[FFT_SIZE];
+    int axis, i;
+
+    for (axis = 0; axis < 3; axis++)
+    {
+        double mean = 0.0;
+
+        for (i = 0; i < FFT_SIZE; i++)
+            mean += sensor_log_record_at(log, first + i)->gyro[axis];
+        mean /= FFT_SIZE;
+
+        for (i = 0; i < FFT_SIZE; i++)
+        {
+            double window = 0.5 - 0.5 * cos(2.0 * M_PI * i / FFT_SIZE);
+            re[i] = (sensor_log_record_at(log, first + i)->gyro[axis] - mean) * gyroScale * window;
+            im[i] = 0.0;
+        }
+        fft(re, im, FFT_SIZE);
+        for (i = 0; i < FFT_BINS; i++)
+            stats->spectrum[axis][i] += re[i] * re[i] + im[i] * im[i];
+    }
+    stats->frames++;
+}
+
+/**
+ * Analyse one block, runs on any worker.
+ */
+static void analyze_block(void *context, size_t task, int worker)
+{
+    struct analysis *analysis = context;
+    struct block *block = &analysis->blocks[task];
+    struct block_stats *stats = &block->stats;
+    const struct sensor_log_file *log = &analysis->logs[block->log].file;
+    const struct sensor_log_header *header = log->header;
+    float gyroScale = header->gyro_range / 32768.0f;   // deg/s per LSB
+    float accelScale = header->accel_range / 32768.0f; // g per LSB
+    float nominalPeriod = 1.0f / header->gyro_rate;
+    size_t warmup = (size_t)(WARMUP_SECONDS * header->gyro_rate);
+    size_t start = block->first > warmup ? block->first - warmup : 0;
+    size_t end = block->first + block->count, i;
+    uint64_t lastTime = 0;
+    float divergedFor = 0.0f;
+    int scoring = 0;
+
+    (void)worker;
+    memset(stats, 0, sizeof(*stats));
+    stats->records = block->count;
+
+    // fresh estimator, filters included
+    estimator_init(header->gyro_rate);
+
+    for (i = start; i < end; i++)
+    {
+        const struct sensor_log_record *r = sensor_log_record_at(log, i);
+        float period = nominalPeriod;
+        float gyro[3], accel[3], rate, norm;
+        float q[4], gravity[3], cosError;
+        int axis, still;
+
+        estimator_update(r);
+
+        // the step the estimator integrated, for the divergence timer
+        if (lastTime != 0)
+        {
+            period = (r->time - lastTime) * 1e-9f;
+            if (period < MIN_PERIOD_RATIO * nominalPeriod || period > MAX_PERIOD_RATIO * nominalPeriod)
+                period = nominalPeriod;
+        }
+        lastTime = r->time;
+
+        // warm-up samples belong to the previous block
+        if (i < block->first)
+            continue;
+        // the first block waits for the start-up gain to settle
+        if (!scoring && (block->first > 0 || mahony_ready()))
+            scoring = 1;
+
+        if (r->flags & SENSOR_LOG_I2C_ERROR)
+            stats->i2cErrors++;
+        if (r->flags & SENSOR_LOG_FIFO_OVERFLOW)
+            stats->fifoOverflows++;
+        if (r->flags & SENSOR_LOG_MAG_FRESH)
+            stats->magSamples++;
+
+        for (axis = 0; axis < 3; axis++)
+        {
+            gyro[axis] = r->gyro[axis] * gyroScale;
+            accel[axis] = r->accel[axis] * accelScale;
+        }
+        rate = sqrtf(gyro[0] * gyro[0] + gyro[1] * gyro[1] + gyro[2] * gyro[2]);
+        norm = sqrtf(accel[0] * accel[0] + accel[1] * accel[1] + accel[2] * accel[2]);
+        still = rate < STILL_RATE && fabsf(norm - 1.0f) < STILL_ACCEL && !(r->flags & SENSOR_LOG_I2C_ERROR);
+
+        if (still)
+        {
+            double t = r->temp / 340.0 + 36.53;
+            int bin = (int)floor(t) - TEMP_MIN;
+
+            if (bin >= 0 && bin < TEMP_BINS)
+            {
+                stats->tempBins[bin][0] += 1.0;
+                for (axis = 0; axis < 3; axis++)
+                    stats->tempBins[bin][axis + 1] += gyro[axis];
+            }
+            stats->n += 1.0;
+            stats->sumT += t;
+            stats->sumT2 += t * t;
+            for (axis = 0; axis < 3; axis++)
+            {
+                stats->sumG[axis] += gyro[axis];
+                stats->sumTG[axis] += t * gyro[axis];
+                stats->stillSquares[axis] += (double)gyro[axis] * gyro[axis];
+            }
+        }
+
+        if (!scoring)
+            continue;
+        stats->scored++;
+
+        // gravity in the sensor frame from the attitude against the accel
+        mahony_get_quaternion(q);
+        gravity[0] = 2.0f * (q[1] * q[3] - q[0] * q[2]);
+        gravity[1] = 2.0f * (q[0] * q[1] + q[2] * q[3]);
+        gravity[2] = q[0] * q[0] - q[1] * q[1] - q[2] * q[2] + q[3] * q[3];
+        cosError = norm > 0.0f ? (gravity[0] * accel[0] + gravity[1] * accel[1] + gravity[2] * accel[2]) / norm : 1.0f;
+        cosError = fminf(fmaxf(cosError, -1.0f), 1.0f);
+
+        if (still)
+        {
+            float error = acosf(cosError) * 57.29578f;
+
+            if (error > stats->worstError)
+                stats->worstError = error;
+            if (error > DIVERGENCE_ANGLE)
+            {
+                divergedFor += period;
+                if (divergedFor >= DIVERGENCE_TIME && divergedFor - period < DIVERGENCE_TIME)
+                    stats->divergences++;
+                if (divergedFor >= DIVERGENCE_TIME)
+                    stats->divergedSeconds += period;
+            }
+            else
+            {
+                divergedFor = 0.0f;
+            }
+        }
+    }
+
+    for (i = block->first; i + FFT_SIZE <= end; i += FFT_SIZE)
+        add_spectrum(stats, log, i, gyroScale);
+}
+
+static void merge_stats(struct block_stats *total, const struct block_stats *part)
+{
+    int axis, i;
+
+    total->records += part->records;
+    total->i2cErrors += part->i2cErrors;
+    total->fifoOverflows += part->fifoOverflows;
+    total->magSamples += part->magSamples;
+    for (i = 0; i < TEMP_BINS; i++)
+    {
+        for (axis = 0; axis < 4; axis++)
+            total->tempBins[i][axis] += part->tempBins[i][axis];
+    }
+    total->n += part->n;
+    total->sumT += part->sumT;
+    total->sumT2 += part->sumT2;
+    for (axis = 0; axis < 3; axis++)
+    {
+        total->sumG[axis] += part->sumG[axis];
+        total->sumTG[axis] += part->sumTG[axis];
+        total->stillSquares[axis] += part->stillSquares[axis];
+        for (i = 0; i < FFT_BINS; i++)
+            total->spectrum[axis][i] += part->spectrum[axis][i];
+    }
+    total->frames += part->frames;
+    total->scored += part->scored;
+    total->divergences += part->divergences;
+    total->divergedSeconds += part->divergedSeconds;
+    total->worstError = fmaxf(total->worstError, part->worstError);
+}
+
+/**
+ * @return Frequency of the strongest spectrum bin of an axis above 2 bins
+ */
+static float spectrum_peak(const struct block_stats *stats, int axis, float sampleFreq)
+{
+    int i, best = 2;
+
+    for (i = 2; i < FFT_BINS; i++)
+    {
+        if (stats->spectrum[axis][i] > stats->spectrum[axis][best])
+            best = i;
+    }
+    return best * sampleFreq / FFT_SIZE;
+}
+
+static void report_log(const struct log_entry *log, const struct block_stats *s)
+{
+    float rate = log->file.header->gyro_rate;
+
+    printf("%s: %zu records, %.1f s, i2c errors %.3f/1000, fifo overflows %zu, mag %.1f Hz\n",
+           log->path, s->records, s->records / rate, s->records ? s->i2cErrors * 1000.0 / s->records : 0.0,
+           s->fifoOverflows, s->records ? s->magSamples * rate / s->records : 0.0);
+    printf("  still %.1f s, bias %+.3f %+.3f %+.3f deg/s, divergences %zu (%.1f s, worst %.1f deg)",
+           s->n / rate,
+           s->n > 0 ? s->sumG[0] / s->n : 0.0, s->n > 0 ? s->sumG[1] / s->n : 0.0, s->n > 0 ? s->sumG[2] / s->n : 0.0,
+           s->divergences, s->divergedSeconds, s->worstError);
+    if (s->frames > 0)
+        printf(", noise peaks %.0f %.0f %.0f Hz",
+               spectrum_peak(s, 0, rate), spectrum_peak(s, 1, rate), spectrum_peak(s, 2, rate));
+    printf("\n");
+    if (s->records > 0 && s->scored == 0)
+        printf("  WARNING: the estimator never settled, no divergence was scored\n");
+}
+
+static void report_fleet(const struct block_stats *s, float spectrumRate, size_t spectrumLogs, size_t logCount)
+{
+    int axis, i;
+
+    printf("\nfleet: %zu records, i2c errors %.3f/1000, fifo overflows %zu, divergences %zu (%.1f s, worst %.1f deg)\n",
+           s->records, s->records ? s->i2cErrors * 1000.0 / s->records : 0.0, s->fifoOverflows,
+           s->divergences, s->divergedSeconds, s->worstError);
+    if (s->scored < s->records)
+        printf("  divergences scored on %zu of %zu records\n", s->scored, s->records);
+
+    printf("\ngyro bias against temperature (still samples, deg/s)\n");
+    printf("  temp_C\tsamples\tgx\tgy\tgz\n");
+    for (i = 0; i < TEMP_BINS; i++)
+    {
+        double n = s->tempBins[i][0];
+        if (n > 0)
+            printf("  %d\t%.0f\t%+.4f\t%+.4f\t%+.4f\n", i + TEMP_MIN, n,
+                   s->tempBins[i][1] / n, s->tempBins[i][2] / n, s->tempBins[i][3] / n);
+    }
+    if (s->n > 1 && s->sumT2 / s->n - (s->sumT / s->n) * (s->sumT / s->n) > MIN_TEMP_SPREAD * MIN_TEMP_SPREAD)
+    {
+        double denominator = s->n * s->sumT2 - s->sumT * s->sumT;
+
+        printf("  fit: bias = a + b * (temp - 25 C)\n");
+        for (axis = 0; axis < 3; axis++)
+        {
+            double slope = (s->n * s->sumTG[axis] - s->sumT * s->sumG[axis]) / denominator;
+            double intercept = (s->sumG[axis] - slope * s->sumT) / s->n;
+            double mean = s->sumG[axis] / s->n;
+
+            printf("  g%c: a %+.4f deg/s, b %+.5f deg/s/C, still noise %.4f deg/s rms\n", 'x' + axis,
+                   intercept + slope * 25.0, slope, sqrt(fmax(s->stillSquares[axis] / s->n - mean * mean, 0.0)));
+        }
+    }
+    else
+    {
+        printf("  not enough temperature spread for a fit, still noise");
+        for (axis = 0; axis < 3 && s->n > 0; axis++)
+        {
+            double mean = s->sumG[axis] / s->n;
+            printf(" %.4f", sqrt(fmax(s->stillSquares[axis] / s->n - mean * mean, 0.0)));
+        }
+        printf(" deg/s rms\n");
+    }
+
+    if (s->frames == 0)
+        return;
+    printf("\ngyro noise spectrum at %.0f Hz (%zu of %zu logs, %zu frames), deg/s rms per bin\n",
+           spectrumRate, spectrumLogs, logCount, s->frames);
+    printf("  freq_Hz\tgx\tgy\tgz\n");
+    for (i = 1; i < FFT_BINS; i++)
+    {
+        // Hann window power gain is 3/8, rms of a bin from its power
+        printf("  %.1f", i * spectrumRate / FFT_SIZE);
+        for (axis = 0; axis < 3; axis++)
+            printf("\t%.4f", sqrt(2.0 * s->spectrum[axis][i] / s->frames / (0.375 * FFT_SIZE * FFT_SIZE)));
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct analysis analysis;
+    struct block_stats *logTotals, *fleet;
+    struct work_pool_stats poolStats;
+    struct timespec start, end;
+    long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t blockRecords = BLOCK_RECORDS, records = 0, b, l, spectrumLogs = 0;
+    float spectrumRate = 0.0f;
+    double elapsed;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "t:b:")) != -1)
+    {
+        switch (opt)
+        {
+        case 't':
+            threadCount = atol(optarg);
+            break;
+        case 'b':
+            blockRecords = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-t threads] [-b block_records] log...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc || blockRecords < FFT_SIZE)
+    {
+        fprintf(stderr, "usage: %s [-t threads] [-b block_records] log...\n", argv[0]);
+        return 1;
+    }
+    if (threadCount < 1)
+        threadCount = 1;
+
+    memset(&analysis, 0, sizeof(analysis));
+    analysis.logs = calloc(argc - optind, sizeof(*analysis.logs));
+    for (l = 0; l < (size_t)(argc - optind); l++)
+    {
+        struct log_entry *log = &analysis.logs[analysis.logCount];
+
+        log->path = argv[optind + l];
+        if (sensor_log_map(log->path, &log->file) < 0)
+            continue;
+        analysis.blockCount += (log->file.count + blockRecords - 1) / blockRecords;
+        records += log->file.count;
+        analysis.logCount++;
+    }
+    if (analysis.logCount == 0)
+        return 1;
+
+    analysis.blocks = calloc(analysis.blockCount, sizeof(*analysis.blocks));
+    logTotals = calloc(analysis.logCount, sizeof(*logTotals));
+    fleet = calloc(1, sizeof(*fleet));
+    if (!analysis.blocks || !logTotals || !fleet)
+    {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    for (l = 0, b = 0; l < analysis.logCount; l++)
+    {
+        size_t first;
+
+        for (first = 0; first < analysis.logs[l].file.count; first += blockRecords)
+        {
+            analysis.blocks[b].log = l;
+            analysis.blocks[b].first = first;
+            analysis.blocks[b].count = analysis.logs[l].file.count - first < blockRecords ? analysis.logs[l].file.count - first : blockRecords;
+            b++;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (work_pool_run(threadCount, analysis.blockCount, analyze_block, &analysis, &poolStats) < 0)
+    {
+        fprintf(stderr, "failed to start the work pool\n");
+        return 1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+    // merge in block order, the sums come out the same whatever ran where
+    for (b = 0; b < analysis.blockCount; b++)
+        merge_stats(&logTotals[analysis.blocks[b].log], &analysis.blocks[b].stats);
+
+    for (l = 0; l < analysis.logCount; l++)
+    {
+        float rate = analysis.logs[l].file.header->gyro_rate;
+        struct block_stats spectrum;
+
+        report_log(&analysis.logs[l], &logTotals[l]);
+
+        // spectra only add up at one sample rate, the first log's
+        if (spectrumLogs == 0)
+            spectrumRate = rate;
+        spectrum = logTotals[l];
+        if (rate != spectrumRate)
+        {
+            memset(spectrum.spectrum, 0, sizeof(spectrum.spectrum));
+            spectrum.frames = 0;
+        }
+        else
+        {
+            spectrumLogs++;
+        }
+        merge_stats(fleet, &spectrum);
+    }
+    report_fleet(fleet, spectrumRate, spectrumLogs, analysis.logCount);
+
+    fprintf(stderr, "%zu logs, %zu records in %zu blocks on %ld threads in %.3f s, %.1f M records/s, %zu steals (%zu blocks)\n",
+            analysis.logCount, records, analysis.blockCount, threadCount, elapsed, records / elapsed * 1e-6,
+            poolStats.steals, poolStats.stolen_tasks);
+
+    for (l = 0; l < analysis.logCount; l++)
+        sensor_log_unmap(&analysis.logs[l].file);
+    free(analysis.blocks);
+    free(analysis.logs);
+    free(logTotals);
+    free(fleet);
+    return 0;
+}
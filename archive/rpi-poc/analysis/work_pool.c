@@ -0,0 +1,194 @@
+/**
+ * Work-stealing thread pool over a fixed set of numbered tasks.
+ *
+ * Tasks 0 to tasks - 1 are split into one contiguous range per worker, so
+ * neighbouring tasks (the blocks of one log) run on the same core in file
+ * order. A worker takes tasks from the front of its own range; once that is
+ * empty it steals the back half of the fullest range left. Tasks are never
+ * added while running, so when no range has anything left the run is over.
+ *
+ * Each range has its own lock, taken once per task by its owner and only
+ * contended by a thief, so with tasks of a millisecond or more the pool
+ * costs nothing measurable and scales to every core.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "work_pool.h"
+
+struct work_range
+{
+    pthread_mutex_t lock;
+    size_t next; // first task not taken
+    size_t end;  // one past the last task
+} __attribute__((aligned(64)));
+
+struct work_worker
+{
+    struct work_pool *pool;
+    int id;
+    pthread_t thread;
+};
+
+struct work_pool
+{
+    struct work_range *ranges;
+    int workers;
+    work_pool_task run;
+    void *context;
+    size_t steals, stolenTasks;
+};
+
+static int work_pool_take(struct work_range *range, size_t *task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&range->lock);
+    if (range->next < range->end)
+    {
+        // stores are atomic for the unlocked peek of the thieves
+        *task = range->next;
+        __atomic_store_n(&range->next, *task + 1, __ATOMIC_RELAXED);
+        found = 1;
+    }
+    pthread_mutex_unlock(&range->lock);
+    return found;
+}
+
+/**
+ * Move the back half of the fullest other range to the thief's own range.
+ *
+ * @return 1 if something was stolen, 0 if every range is empty
+ */
+static int work_pool_steal(struct work_pool *pool, int thief)
+{
+    struct work_range *own = &pool->ranges[thief];
+
+    while (1)
+    {
+        struct work_range *victim = NULL;
+        size_t most = 0, first, end;
+        int i;
+
+        // unlocked peek, the counts are only a hint and rechecked below
+        for (i = 0; i < pool->workers; i++)
+        {
+            size_t next = __atomic_load_n(&pool->ranges[i].next, __ATOMIC_RELAXED);
+            size_t last = __atomic_load_n(&pool->ranges[i].end, __ATOMIC_RELAXED);
+
+            if (i != thief && last > next && last - next > most)
+            {
+                most = last - next;
+                victim = &pool->ranges[i];
+            }
+        }
+        if (!victim)
+            return 0;
+
+        pthread_mutex_lock(&victim->lock);
+        if (victim->next >= victim->end)
+        {
+            // emptied since the peek, look again
+            pthread_mutex_unlock(&victim->lock);
+            continue;
+        }
+        end = victim->end;
+        first = victim->next + (end - victim->next) / 2;
+        __atomic_store_n(&victim->end, first, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&victim->lock);
+
+        // a single task left is taken whole, first == next in that case
+        pthread_mutex_lock(&own->lock);
+        __atomic_store_n(&own->next, first, __ATOMIC_RELAXED);
+        __atomic_store_n(&own->end, end, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&own->lock);
+
+        __atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool->stolenTasks, end - first, __ATOMIC_RELAXED);
+        return 1;
+    }
+}
+
+static void *work_pool_worker(void *arg)
+{
+    struct work_worker *worker = arg;
+    struct work_pool *pool = worker->pool;
+    size_t task;
+
+    do
+    {
+        while (work_pool_take(&pool->ranges[worker->id], &task))
+            pool->run(pool->context, task, worker->id);
+    } while (work_pool_steal(pool, worker->id));
+
+    return NULL;
+}
+
+/**
+ * Run every task once on a pool of threads and wait for all of them.
+ *
+ * @param workers Number of threads, the calling thread is one of them
+ * @param tasks Number of tasks
+ * @param run Called once for every task
+ * @param context Passed to run
+ * @param stats Filled in if not NULL
+ * @return 0 on success, -1 if the threads could not be started
+ */
+int work_pool_run(int workers, size_t tasks, work_pool_task run, void *context, struct work_pool_stats *stats)
+{
+    struct work_pool pool;
+    struct work_worker *threads;
+    int i, started;
+
+    if (workers < 1)
+        workers = 1;
+
+    memset(&pool, 0, sizeof(pool));
+    pool.workers = workers;
+    pool.run = run;
+    pool.context = context;
+    pool.ranges = aligned_alloc(64, workers * sizeof(*pool.ranges));
+    threads = calloc(workers, sizeof(*threads));
+    if (!pool.ranges || !threads)
+    {
+        free(pool.ranges);
+        free(threads);
+        return -1;
+    }
+
+    for (i = 0; i < workers; i++)
+    {
+        pthread_mutex_init(&pool.ranges[i].lock, NULL);
+        pool.ranges[i].next = tasks * i / workers;
+        pool.ranges[i].end = tasks * (i + 1) / workers;
+        threads[i].pool = &pool;
+        threads[i].id = i;
+    }
+
+    for (started = 1; started < workers; started++)
+    {
+        if (pthread_create(&threads[started].thread, NULL, work_pool_worker, &threads[started]) != 0)
+        {
+            // the workers that did start steal the ranges of the others
+            fprintf(stderr, "work pool: started %d of %d threads\n", started, workers);
+            break;
+        }
+    }
+    work_pool_worker(&threads[0]);
+    for (i = 1; i < started; i++)
+        pthread_join(threads[i].thread, NULL);
+
+    for (i = 0; i < workers; i++)
+        pthread_mutex_destroy(&pool.ranges[i].lock);
+    if (stats)
+    {
+        stats->steals = pool.steals;
+        stats->stolen_tasks = pool.stolenTasks;
+    }
+    free(pool.ranges);
+    free(threads);
+    return 0;
+}
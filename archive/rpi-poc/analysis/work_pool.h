@@ -0,0 +1,26 @@
+#ifndef __WORK_POOL_H_
+#define __WORK_POOL_H_
+
+#include <stddef.h>
+
+/**
+ * Run one task.
+ *
+ * @param context Caller data given to work_pool_run()
+ * @param task Task number
+ * @param worker Number of the worker running it, 0 to workers - 1
+ */
+typedef void (*work_pool_task)(void *context, size_t task, int worker);
+
+/**
+ * Counters of one run, for scaling reports.
+ */
+struct work_pool_stats
+{
+    size_t steals;       // successful steals
+    size_t stolen_tasks; // tasks moved by them
+};
+
+int work_pool_run(int workers, size_t tasks, work_pool_task run, void *context, struct work_pool_stats *stats);
+
+#endif
@@ -1,41 +1,228 @@
+/**
+ * Telemetry over a named FIFO, never in the way of the loop.
+ *
+ * Frames are encoded straight into a ring of COMM_RING_FRAMES slots and the
+ * ring is drained with non-blocking writes. A slow reader fills the ring and
+ * the oldest frames are overwritten, so a reader always gets the latest
+ * data. Without a reader the FIFO cannot be opened for writing, opening is
+ * retried every COMM_RECONNECT_NS and frames keep going into the ring; a
+ * reader that goes away (EPIPE) closes our end and the same retry picks up
+ * the next one. Writes stay below PIPE_BUF, so a write is atomic and a
+ * frame is never split across a full pipe.
+ */
+
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <limits.h>
 #include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
-#include <stdarg.h>
 
 #include "comm.h"
+#include "../metrics/counters.h"
+
+struct comm_slot
+{
+    uint16_t size;
+    uint8_t data[FRAME_MAX_SIZE];
+};
+
+int fd = -1;
+const char *commPath = NULL;
+uint16_t commSequence = 0;
+struct comm_slot commRing[COMM_RING_FRAMES];
+unsigned long commHead = 0; // frames queued
+unsigned long commTail = 0; // frames written or dropped
+uint64_t commLastAttempt = 0;
+struct comm_stats commStats;
 
-int fd;
+static uint64_t comm_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
 
-void comm_open()
+static void comm_connect()
 {
-    mkfifo("/tmp/myfifo", 0666);
-    if ((fd = open("/tmp/myfifo", O_WRONLY)) < 0)
+    uint64_t now = comm_now();
+
+    if (commLastAttempt != 0 && now - commLastAttempt < COMM_RECONNECT_NS)
+        return;
+    commLastAttempt = now;
+
+    // fails with ENXIO while no reader has the FIFO open
+    fd = open(commPath, O_WRONLY | O_NONBLOCK);
+    if (fd >= 0)
     {
-        err("open")
+        commStats.reconnects++;
+        commStats.connected = 1;
     }
 }
 
-void comm_write(char *format, ...)
+static void comm_disconnect()
 {
-    char buffer[512];
-    va_list args;
-    va_start(args, format);
-    vsprintf(buffer, format, args);
+    close(fd);
+    fd = -1;
+    commStats.disconnects++;
+    commStats.connected = 0;
+}
 
-    if (write(fd, buffer, strlen(buffer)) != strlen(buffer))
+/**
+ * Create the FIFO. Returns right away, a reader can attach at any time.
+ *
+ * @param path FIFO path, COMM_FIFO
+ */
+void comm_open(const char *path)
+{
+    if (mkfifo(path, 0666) < 0 && errno != EEXIST)
     {
-        err("write");
+        err("mkfifo")
     }
+    // a reader going away must not kill the process
+    signal(SIGPIPE, SIG_IGN);
 
-    va_end(args);
+    commPath = path;
+    commSequence = 0;
+    commHead = commTail = 0;
+    commLastAttempt = 0;
+    memset(&commStats, 0, sizeof(commStats));
+    comm_connect();
 }
 
+/**
+ * Write what the pipe takes, never blocks.
+ */
+void comm_flush()
+{
+    if (fd < 0)
+        comm_connect();
+
+    while (fd >= 0 && commTail != commHead)
+    {
+        struct iovec iov[COMM_WRITE_FRAMES];
+        size_t bytes = 0;
+        int count = 0;
+        ssize_t written;
+
+        while (count < COMM_WRITE_FRAMES && commTail + count != commHead)
+        {
+            struct comm_slot *slot = &commRing[(commTail + count) & (COMM_RING_FRAMES - 1)];
+
+            if (bytes + slot->size > PIPE_BUF)
+                break;
+            iov[count].iov_base = slot->data;
+            iov[count].iov_len = slot->size;
+            bytes += slot->size;
+            count++;
+        }
+
+        written = writev(fd, iov, count);
+        if (written < 0)
+        {
+            if (errno == EPIPE)
+                comm_disconnect();
+            // EAGAIN, the pipe is full: the ring holds the frames
+            return;
+        }
+        // all or nothing below PIPE_BUF
+        commTail += count;
+        commStats.sent_frames += count;
+    }
+}
+
+/**
+ * Ring slot for the next frame, the oldest frame goes if the ring is full.
+ */
+static struct comm_slot *comm_reserve()
+{
+    if (commHead - commTail == COMM_RING_FRAMES)
+    {
+        commTail++;
+        commStats.dropped_frames++;
+        counter_add(COUNTER_DROPPED_TELEMETRY, 1);
+    }
+    return &commRing[commHead & (COMM_RING_FRAMES - 1)];
+}
+
+static void comm_commit()
+{
+    commHead++;
+    comm_flush();
+}
+
+/**
+ * Send one binary frame, see frame.h.
+ *
+ * @param type FRAME_* type
+ * @param payload Payload
+ * @param length Payload size
+ */
+void comm_send(uint8_t type, const void *payload, uint8_t length)
+{
+    struct comm_slot *slot = comm_reserve();
+
+    slot->size = frame_encode(slot->data, type, commSequence++, payload, length);
+    comm_commit();
+}
+
+void comm_send_attitude(uint64_t time, const float *q, float roll, float pitch, float yaw)
+{
+    struct comm_slot *slot = comm_reserve();
+
+    slot->size = frame_encode_attitude(slot->data, commSequence++, time, q, roll, pitch, yaw);
+    comm_commit();
+}
+
+void comm_send_raw_imu(const struct sensor_log_record *record)
+{
+    struct comm_slot *slot = comm_reserve();
+
+    slot->size = frame_encode_raw_imu(slot->data, commSequence++, record);
+    comm_commit();
+}
+
+void comm_send_status(const struct frame_status *status)
+{
+    struct comm_slot *slot = comm_reserve();
+
+    slot->size = frame_encode_status(slot->data, commSequence++, status);
+    comm_commit();
+}
+
+#ifdef LOOP_STATS
+void comm_send_loop_stats(const struct frame_loop_stats *stats)
+{
+    struct comm_slot *slot = comm_reserve();
+
+    slot->size = frame_encode_loop_stats(slot->data, commSequence++, stats);
+    comm_commit();
+}
+#endif
+
+/**
+ * Read the counters.
+ */
+void comm_get_stats(struct comm_stats *stats)
+{
+    *stats = commStats;
+    stats->queued = commHead - commTail;
+}
+
+/**
+ * Write what the reader takes without waiting, then close.
+ */
 void comm_close()
 {
-    close(fd);
+    comm_flush();
+    if (fd >= 0)
+        close(fd);
+    fd = -1;
 }
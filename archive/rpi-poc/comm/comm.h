@@ -1,10 +1,40 @@
 #ifndef __COMM_H_
 #define __COMM_H_
 
+#include <stdint.h>
+
+#include "frame.h"
+
 #define err(mess) { fprintf(stderr,"Error: %s.", mess); exit(1); }
 
-void comm_open();
-void comm_write(char *, ...);
+#define COMM_FIFO "/tmp/myfifo"
+#define COMM_RING_FRAMES 256       // frames queued while the reader is slow or away, power of 2
+#define COMM_RECONNECT_NS 200000000ULL // between attempts to open the FIFO without a reader
+#define COMM_WRITE_FRAMES 16       // frames per write, at most PIPE_BUF bytes
+
+/**
+ * Telemetry counters, see comm_get_stats().
+ */
+struct comm_stats
+{
+    uint64_t sent_frames;
+    uint64_t dropped_frames;   // oldest frames overwritten in a full ring
+    uint64_t reconnects;       // times a reader attached
+    uint64_t disconnects;      // times a reader went away
+    unsigned int queued;       // frames waiting in the ring
+    int connected;
+};
+
+void comm_open(const char *path);
+void comm_send(uint8_t type, const void *payload, uint8_t length);
+void comm_send_attitude(uint64_t time, const float *q, float roll, float pitch, float yaw);
+void comm_send_raw_imu(const struct sensor_log_record *record);
+void comm_send_status(const struct frame_status *status);
+#ifdef LOOP_STATS
+void comm_send_loop_stats(const struct frame_loop_stats *stats);
+#endif
+void comm_flush();
+void comm_get_stats(struct comm_stats *stats);
 void comm_close();
 
 #endif
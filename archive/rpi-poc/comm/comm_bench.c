@@ -0,0 +1,186 @@
+/**
+ * Telemetry FIFO under a slow reader that comes and goes.
+ *
+ * A child process attaches to the FIFO, reads slower than frames are
+ * produced, detaches, stays away, and attaches again. The parent sends a raw
+ * IMU and an attitude frame per sample at a fixed rate, the way main -t
+ * does, and times every send. The send must stay in the microseconds while
+ * the reader is slow or gone; what the reader cannot take is counted as
+ * dropped on our side and shows up as sequence gaps on its side, never as
+ * corrupt frames.
+ *
+ * usage: comm_bench [-r rate_hz] [-t seconds] [-k reader_kB_per_s]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "comm.h"
+
+#define BENCH_FIFO "/tmp/comm_bench.fifo"
+#define READER_ATTACHED_NS 5000000000ULL
+#define READER_AWAY_NS 500000000ULL
+#define READER_CHUNK 512
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec t = {ns / 1000000000ULL, ns % 1000000000ULL};
+
+    nanosleep(&t, NULL);
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Attach, read at readerRate bytes/s, detach, stay away, until killed.
+ * Reports to stderr at SIGTERM.
+ */
+volatile sig_atomic_t readerRunning = 1;
+
+static void reader_stop(int signal)
+{
+    (void)signal;
+    readerRunning = 0;
+}
+
+static void reader(double readerRate)
+{
+    struct frame_decoder decoder;
+    uint64_t frames = 0, lost = 0, crcErrors = 0, skipped = 0, sessions = 0;
+    uint8_t buffer[READER_CHUNK];
+
+    signal(SIGTERM, reader_stop);
+    while (readerRunning)
+    {
+        uint64_t until;
+        int fd = open(BENCH_FIFO, O_RDONLY | O_NONBLOCK);
+
+        if (fd < 0)
+        {
+            perror(BENCH_FIFO);
+            exit(1);
+        }
+        sessions++;
+        frame_decoder_init(&decoder);
+        until = now_ns() + READER_ATTACHED_NS;
+        while (readerRunning && now_ns() < until)
+        {
+            ssize_t size = read(fd, buffer, sizeof(buffer));
+
+            if (size > 0)
+                frame_decoder_push(&decoder, buffer, size, NULL, NULL);
+            sleep_ns((uint64_t)(sizeof(buffer) / readerRate * 1e9));
+        }
+        close(fd);
+
+        frames += decoder.frames;
+        lost += decoder.lost_frames;
+        crcErrors += decoder.crc_errors;
+        skipped += decoder.skipped_bytes;
+        if (readerRunning)
+            sleep_ns(READER_AWAY_NS);
+    }
+    fprintf(stderr, "reader: %llu sessions, %llu frames, %llu lost in sessions, %llu crc errors, %llu bytes skipped\n",
+            (unsigned long long)sessions, (unsigned long long)frames, (unsigned long long)lost,
+            (unsigned long long)crcErrors, (unsigned long long)skipped);
+    exit(crcErrors != 0);
+}
+
+int main(int argc, char **argv)
+{
+    double rate = 1000.0, seconds = 12.0, readerRate = 48.0 * 1024.0;
+    struct sensor_log_record record;
+    struct comm_stats stats;
+    float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    uint64_t *latency, period, next;
+    size_t count, i;
+    int opt, status;
+    pid_t child;
+
+    while ((opt = getopt(argc, argv, "r:t:k:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'k':
+            readerRate = atof(optarg) * 1024.0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-t seconds] [-k reader_kB_per_s]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    count = (size_t)(rate * seconds);
+    period = (uint64_t)(1e9 / rate);
+    latency = malloc(count * sizeof(*latency));
+    if (!latency || count == 0)
+        return 1;
+    memset(&record, 0, sizeof(record));
+
+    // writer first: the reader attaches after we are already sending
+    unlink(BENCH_FIFO);
+    comm_open(BENCH_FIFO);
+    child = fork();
+    if (child == 0)
+        reader(readerRate);
+
+    next = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        uint64_t start;
+
+        next += period;
+        record.time = next;
+        record.gyro[0] = i;
+        start = now_ns();
+        comm_send_raw_imu(&record);
+        comm_send_attitude(record.time, q, 0.1f, 0.2f, 0.3f);
+        latency[i] = now_ns() - start;
+
+        if (now_ns() < next)
+            sleep_ns(next - now_ns());
+    }
+    comm_get_stats(&stats);
+    comm_close();
+
+    kill(child, SIGTERM);
+    waitpid(child, &status, 0);
+
+    qsort(latency, count, sizeof(*latency), compare);
+    printf("%zu samples at %.0f Hz, 2 frames each (%.0f kB/s), reader takes %.0f kB/s\n", count, rate,
+           rate * (2 * FRAME_HEADER_SIZE + 2 * FRAME_CRC_SIZE + sizeof(struct frame_raw_imu) + sizeof(struct frame_attitude)) / 1024.0,
+           readerRate / 1024.0);
+    printf("send p50 %.2f us, p99 %.2f us, max %.2f us\n", latency[count / 2] * 1e-3,
+           latency[count * 99 / 100] * 1e-3, latency[count - 1] * 1e-3);
+    printf("writer: %llu frames sent, %llu dropped, %llu readers attached, %llu went away\n",
+           (unsigned long long)stats.sent_frames, (unsigned long long)stats.dropped_frames,
+           (unsigned long long)stats.reconnects, (unsigned long long)stats.disconnects);
+
+    unlink(BENCH_FIFO);
+    free(latency);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
@@ -0,0 +1,136 @@
+/**
+ * Fixed format number to text, see fmt.h.
+ *
+ * fmt_float() works on the exact value of the float: the integer part fits
+ * 32 bits and the fraction times 10^decimals is exact in a double (24
+ * significant bits times 5^decimals, at most 21 bits, the 2^decimals only
+ * moves the exponent), so rounding it half to even gives the digits glibc's
+ * printf gives, at a fraction of the cost.
+ */
+
+#include "fmt.h"
+
+static const double fmtPowers[FMT_FLOAT_DECIMALS + 1] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9
+};
+
+char *fmt_char(char *out, char c)
+{
+    *out++ = c;
+    *out = '\0';
+    return out;
+}
+
+char *fmt_str(char *out, const char *text)
+{
+    while (*text)
+        *out++ = *text++;
+    *out = '\0';
+    return out;
+}
+
+/**
+ * Digits of value, zero padded to width.
+ */
+static char *fmt_digits(char *out, uint32_t value, int width)
+{
+    char digits[10];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    while (count < width)
+        digits[count++] = '0';
+    while (count)
+        *out++ = digits[--count];
+    *out = '\0';
+    return out;
+}
+
+char *fmt_uint(char *out, uint32_t value)
+{
+    return fmt_digits(out, value, 1);
+}
+
+char *fmt_int(char *out, int32_t value)
+{
+    if (value < 0)
+    {
+        *out++ = '-';
+        return fmt_digits(out, -(uint32_t)value, 1);
+    }
+    return fmt_digits(out, value, 1);
+}
+
+/**
+ * Lower case, no prefix, like %x.
+ */
+char *fmt_hex(char *out, uint32_t value)
+{
+    char digits[8];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = "0123456789abcdef"[value & 0xf];
+        value >>= 4;
+    } while (value);
+    while (count)
+        *out++ = digits[--count];
+    *out = '\0';
+    return out;
+}
+
+/**
+ * Like %.*f.
+ *
+ * @param out At least FMT_FLOAT_SIZE(decimals) bytes
+ * @param value Value, "nan", "inf" and "ovf" past FMT_FLOAT_MAX
+ * @param decimals 0 to FMT_FLOAT_DECIMALS
+ */
+char *fmt_float(char *out, float value, int decimals)
+{
+    double v = value, scaled, rounded;
+    uint32_t integer, fraction;
+
+    if (decimals < 0)
+        decimals = 0;
+    if (decimals > FMT_FLOAT_DECIMALS)
+        decimals = FMT_FLOAT_DECIMALS;
+
+    if (v != v)
+        return fmt_str(out, "nan");
+    if (__builtin_signbit(v))
+    {
+        *out++ = '-';
+        v = -v;
+    }
+    if (v >= FMT_FLOAT_MAX)
+        return fmt_str(out, v > 3.5e38 ? "inf" : "ovf");
+
+    integer = (uint32_t)v;
+    scaled = (v - integer) * fmtPowers[decimals];
+
+    // half to even on the exact value, as printf does, even in the last
+    // digit printed
+    rounded = (double)(uint32_t)scaled;
+    if (scaled - rounded > 0.5 || (scaled - rounded == 0.5 && ((decimals ? (uint32_t)rounded : integer) & 1)))
+        rounded += 1.0;
+    fraction = (uint32_t)rounded;
+    if (rounded >= fmtPowers[decimals])
+    {
+        fraction = 0;
+        if (integer == UINT32_MAX)
+            return fmt_str(out, "ovf");
+        integer++;
+    }
+
+    out = fmt_digits(out, integer, 1);
+    if (decimals == 0)
+        return out;
+    *out++ = '.';
+    return fmt_digits(out, fraction, decimals);
+}
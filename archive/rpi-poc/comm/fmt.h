@@ -0,0 +1,31 @@
+#ifndef __FMT_H_
+#define __FMT_H_
+
+#include <stdint.h>
+
+/**
+ * Fixed format number to text, for the lines printf used to build.
+ *
+ * Every function writes at out, terminates the text and returns a pointer
+ * to the terminating '\0', so calls chain:
+ *
+ *   p = fmt_float(line, roll, 6);
+ *   p = fmt_char(p, '\t');
+ *
+ * No format string, no varargs, no locale and no libm. fmt_float() prints
+ * what printf("%.*f") prints for any float below FMT_FLOAT_MAX.
+ */
+
+#define FMT_FLOAT_MAX 4294967296.0 // larger magnitudes print as "ovf"
+#define FMT_FLOAT_DECIMALS 9
+#define FMT_INT_SIZE 12            // "-2147483648" and the '\0'
+#define FMT_FLOAT_SIZE(decimals) (13 + (decimals)) // "-4294967295.", the decimals and the '\0'
+
+char *fmt_char(char *out, char c);
+char *fmt_str(char *out, const char *text);
+char *fmt_uint(char *out, uint32_t value);
+char *fmt_int(char *out, int32_t value);
+char *fmt_hex(char *out, uint32_t value);
+char *fmt_float(char *out, float value, int decimals);
+
+#endif
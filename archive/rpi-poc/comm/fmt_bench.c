@@ -0,0 +1,167 @@
+/**
+ * Fixed format text against snprintf.
+ *
+ * Checks fmt_float() against printf("%.*f") digit for digit over random
+ * floats, random bit patterns, halfway cases and the edges, and the integer
+ * formatters against %d, %u and %x. Then times the line main prints per
+ * sample and the line the AVR prints, both ways.
+ *
+ * usage: fmt_bench [-n checks]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+
+#include "fmt.h"
+
+#define BENCH_LINES 1000000
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static uint32_t random32()
+{
+    return (uint32_t)rand() << 16 ^ (uint32_t)rand();
+}
+
+static long mismatches = 0;
+
+static void check_float(float value, int decimals)
+{
+    char expected[64], got[64];
+
+    if (!(fabsf(value) < FMT_FLOAT_MAX))
+        return;
+    snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+    fmt_float(got, value, decimals);
+    if (strcmp(expected, got) != 0 && mismatches++ < 10)
+        fprintf(stderr, "%.9g with %d decimals: printf %s, fmt %s\n", value, decimals, expected, got);
+}
+
+static void check_int(int32_t value)
+{
+    char expected[3][32], got[3][32];
+
+    snprintf(expected[0], sizeof(expected[0]), "%d", value);
+    snprintf(expected[1], sizeof(expected[1]), "%u", (uint32_t)value);
+    snprintf(expected[2], sizeof(expected[2]), "%x", (uint32_t)value);
+    fmt_int(got[0], value);
+    fmt_uint(got[1], value);
+    fmt_hex(got[2], value);
+    if ((strcmp(expected[0], got[0]) || strcmp(expected[1], got[1]) || strcmp(expected[2], got[2])) && mismatches++ < 10)
+        fprintf(stderr, "%d: printf %s %s %s, fmt %s %s %s\n", value, expected[0], expected[1], expected[2],
+                got[0], got[1], got[2]);
+}
+
+int main(int argc, char **argv)
+{
+    static const float edges[] = {0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -2.5f, 0.0000005f, 0.0000015f, 0.125f, 0.375f,
+                                  9.9999995f, 999999.94f, 4294967040.0f, 1e-30f, -1e-30f, 0.1f, 0.7f};
+    long checks = 2000000, i;
+    char line[256], *p;
+    volatile size_t sink = 0;
+    double start, fmtSeconds, printfSeconds;
+    int decimals, opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1)
+    {
+        if (opt == 'n')
+            checks = atol(optarg);
+        else
+        {
+            fprintf(stderr, "usage: %s [-n checks]\n", argv[0]);
+            return 1;
+        }
+    }
+    srand(1);
+
+    for (i = 0; i < (long)(sizeof(edges) / sizeof(edges[0])); i++)
+    {
+        for (decimals = 0; decimals <= FMT_FLOAT_DECIMALS; decimals++)
+            check_float(edges[i], decimals);
+    }
+    for (i = 0; i < checks; i++)
+    {
+        uint32_t bits = random32();
+        float value;
+
+        // angles and rates
+        check_float((random32() / 4294967296.0f - 0.5f) * 720.0f, i % (FMT_FLOAT_DECIMALS + 1));
+        // any bit pattern in range
+        memcpy(&value, &bits, sizeof(value));
+        check_float(value, i % (FMT_FLOAT_DECIMALS + 1));
+        // exact halves at the last decimal
+        decimals = i % 7;
+        check_float((float)((random32() % 2000000) + 0.5) / (float)pow(10, decimals), decimals);
+
+        check_int(random32());
+        check_int((int32_t)(random32() >> (i % 32)));
+    }
+    check_int(0);
+    check_int(INT32_MIN);
+    check_int(INT32_MAX);
+    printf("%ld checks against printf, %ld mismatches\n", checks * 5 + 3 + (long)(sizeof(edges) / sizeof(edges[0])) * (FMT_FLOAT_DECIMALS + 1), mismatches);
+
+    // main's line
+    start = now();
+    for (i = 0; i < BENCH_LINES; i++)
+        sink += snprintf(line, sizeof(line), "%f\t%f\t%f\n", i * 0.001f, -12.345678f, 179.9f);
+    printfSeconds = now() - start;
+    start = now();
+    for (i = 0; i < BENCH_LINES; i++)
+    {
+        p = fmt_float(line, i * 0.001f, 6);
+        p = fmt_char(p, '\t');
+        p = fmt_float(p, -12.345678f, 6);
+        p = fmt_char(p, '\t');
+        p = fmt_float(p, 179.9f, 6);
+        p = fmt_char(p, '\n');
+        sink += p - line;
+    }
+    fmtSeconds = now() - start;
+    printf("pitch roll yaw line:  snprintf %.0f ns, fmt %.0f ns (%.1fx)\n", printfSeconds / BENCH_LINES * 1e9,
+           fmtSeconds / BENCH_LINES * 1e9, printfSeconds / fmtSeconds);
+
+    // the AVR debug line, 3 floats and 9 ints
+    start = now();
+    for (i = 0; i < BENCH_LINES; i++)
+        sink += snprintf(line, sizeof(line), "rpy %f\t%f\t%f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", i * 0.001f,
+                         -12.345678f, 179.9f, (int)i, -250, 16384, -3, 7, 8191, 120, -340, 55);
+    printfSeconds = now() - start;
+    start = now();
+    for (i = 0; i < BENCH_LINES; i++)
+    {
+        static const int16_t values[] = {-250, 16384, -3, 7, 8191, 120, -340, 55};
+        int v;
+
+        p = fmt_str(line, "rpy ");
+        p = fmt_float(p, i * 0.001f, 6);
+        p = fmt_char(p, '\t');
+        p = fmt_float(p, -12.345678f, 6);
+        p = fmt_char(p, '\t');
+        p = fmt_float(p, 179.9f, 6);
+        p = fmt_char(p, '\t');
+        p = fmt_int(p, i);
+        for (v = 0; v < 8; v++)
+        {
+            p = fmt_char(p, '\t');
+            p = fmt_int(p, values[v]);
+        }
+        p = fmt_char(p, '\n');
+        sink += p - line;
+    }
+    fmtSeconds = now() - start;
+    printf("AVR rpy line:         snprintf %.0f ns, fmt %.0f ns (%.1fx)\n", printfSeconds / BENCH_LINES * 1e9,
+           fmtSeconds / BENCH_LINES * 1e9, printfSeconds / fmtSeconds);
+
+    return mismatches != 0;
+}
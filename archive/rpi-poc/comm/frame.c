@@ -0,0 +1,243 @@
+/**
+ * Binary telemetry frames.
+ *
+ * The encoder writes straight into a caller buffer of FRAME_MAX_SIZE bytes,
+ * no allocation and no formatting, the payloads are the packed structs of
+ * frame.h. The decoder takes the byte stream in chunks of any size and
+ * calls a handler per valid frame. After corruption it resynchronises on
+ * its own: a bad CRC drops one byte and the search for the sync word goes
+ * on from there, so a frame that started inside the bad one is still found.
+ */
+
+#include <string.h>
+
+#include "frame.h"
+
+static const uint16_t frameCrcTable[256] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0,
+};
+
+/**
+ * CRC-16/CCITT, table driven.
+ *
+ * @param data Bytes
+ * @param size Number of bytes
+ * @param crc 0xffff to start, or the CRC so far
+ * @return CRC
+ */
+uint16_t frame_crc16(const uint8_t *data, size_t size, uint16_t crc)
+{
+    while (size--)
+        crc = (crc << 8) ^ frameCrcTable[(crc >> 8) ^ *data++];
+    return crc;
+}
+
+/**
+ * Encode one frame.
+ *
+ * @param out At least FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE bytes
+ * @param type FRAME_* type
+ * @param sequence Frame sequence number
+ * @param payload Payload
+ * @param length Payload size
+ * @return Frame size in bytes
+ */
+size_t frame_encode(uint8_t *out, uint8_t type, uint16_t sequence, const void *payload, uint8_t length)
+{
+    uint16_t crc;
+
+    out[0] = FRAME_SYNC0;
+    out[1] = FRAME_SYNC1;
+    out[2] = type;
+    out[3] = length;
+    out[4] = sequence & 0xff;
+    out[5] = sequence >> 8;
+    memcpy(out + FRAME_HEADER_SIZE, payload, length);
+
+    crc = frame_crc16(out + 2, FRAME_HEADER_SIZE - 2 + length, 0xffff);
+    out[FRAME_HEADER_SIZE + length] = crc & 0xff;
+    out[FRAME_HEADER_SIZE + length + 1] = crc >> 8;
+    return FRAME_HEADER_SIZE + length + FRAME_CRC_SIZE;
+}
+
+/**
+ * Encode an attitude frame.
+ *
+ * @param q Quaternion w, x, y, z
+ * @return Frame size in bytes
+ */
+size_t frame_encode_attitude(uint8_t *out, uint16_t sequence, uint64_t time, const float *q, float roll, float pitch, float yaw)
+{
+    struct frame_attitude attitude;
+
+    attitude.time = time;
+    memcpy(attitude.q, q, sizeof(attitude.q));
+    attitude.roll = roll;
+    attitude.pitch = pitch;
+    attitude.yaw = yaw;
+    return frame_encode(out, FRAME_ATTITUDE, sequence, &attitude, sizeof(attitude));
+}
+
+/**
+ * Encode a raw IMU frame from a log record.
+ *
+ * @return Frame size in bytes
+ */
+size_t frame_encode_raw_imu(uint8_t *out, uint16_t sequence, const struct sensor_log_record *record)
+{
+    struct frame_raw_imu raw;
+
+    raw.time = record->time;
+    memcpy(raw.gyro, record->gyro, sizeof(raw.gyro));
+    memcpy(raw.accel, record->accel, sizeof(raw.accel));
+    memcpy(raw.mag, record->mag, sizeof(raw.mag));
+    raw.temp = record->temp;
+    raw.flags = record->flags;
+    return frame_encode(out, FRAME_RAW_IMU, sequence, &raw, sizeof(raw));
+}
+
+/**
+ * Encode a status frame.
+ *
+ * @return Frame size in bytes
+ */
+size_t frame_encode_status(uint8_t *out, uint16_t sequence, const struct frame_status *status)
+{
+    return frame_encode(out, FRAME_STATUS, sequence, status, sizeof(*status));
+}
+
+/**
+ * Encode a loop timing frame.
+ *
+ * @return Frame size in bytes
+ */
+size_t frame_encode_loop_stats(uint8_t *out, uint16_t sequence, const struct frame_loop_stats *stats)
+{
+    return frame_encode(out, FRAME_LOOP_STATS, sequence, stats, sizeof(*stats));
+}
+
+void frame_decoder_init(struct frame_decoder *decoder)
+{
+    memset(decoder, 0, sizeof(*decoder));
+}
+
+/**
+ * Decode what is complete in the buffer, from the start.
+ *
+ * @return Bytes consumed, the rest is a partial frame
+ */
+static size_t frame_decoder_parse(struct frame_decoder *decoder, frame_handler handler, void *context, size_t *frames)
+{
+    const uint8_t *buffer = decoder->buffer;
+    size_t position = 0;
+
+    while (1)
+    {
+        size_t start = position, total;
+        uint16_t crc;
+        struct frame frame;
+
+        // the second sync byte may not be here yet, stop on a lone 0xa5
+        while (position < decoder->fill &&
+               !(buffer[position] == FRAME_SYNC0 && (position + 1 == decoder->fill || buffer[position + 1] == FRAME_SYNC1)))
+            position++;
+        decoder->skipped_bytes += position - start;
+
+        if (decoder->fill - position < FRAME_HEADER_SIZE)
+            return position;
+        total = FRAME_HEADER_SIZE + buffer[position + 3] + FRAME_CRC_SIZE;
+        if (decoder->fill - position < total)
+            return position;
+
+        crc = frame_crc16(buffer + position + 2, total - 2 - FRAME_CRC_SIZE, 0xffff);
+        if ((buffer[position + total - 2] | buffer[position + total - 1] << 8) != crc)
+        {
+            // a sync word inside the payload or a damaged frame, look again
+            // one byte further
+            decoder->crc_errors++;
+            decoder->skipped_bytes++;
+            position++;
+            continue;
+        }
+
+        frame.type = buffer[position + 2];
+        frame.length = buffer[position + 3];
+        frame.sequence = buffer[position + 4] | buffer[position + 5] << 8;
+        frame.payload = buffer + position + FRAME_HEADER_SIZE;
+
+        if (decoder->synced)
+            decoder->lost_frames += (uint16_t)(frame.sequence - decoder->sequence);
+        decoder->synced = 1;
+        decoder->sequence = frame.sequence + 1;
+        decoder->frames++;
+        (*frames)++;
+
+        if (handler)
+            handler(&frame, context);
+        position += total;
+    }
+}
+
+/**
+ * Feed received bytes, in chunks of any size.
+ *
+ * @param decoder Decoder
+ * @param data Received bytes
+ * @param size Number of bytes
+ * @param handler Called for every valid frame, may be NULL
+ * @param context Passed to the handler
+ * @return Number of frames decoded
+ */
+size_t frame_decoder_push(struct frame_decoder *decoder, const uint8_t *data, size_t size, frame_handler handler, void *context)
+{
+    size_t frames = 0;
+
+    while (size > 0)
+    {
+        size_t chunk = sizeof(decoder->buffer) - decoder->fill, used;
+
+        if (chunk > size)
+            chunk = size;
+        memcpy(decoder->buffer + decoder->fill, data, chunk);
+        decoder->fill += chunk;
+        data += chunk;
+        size -= chunk;
+
+        // what is left is shorter than one frame, there is room for more
+        used = frame_decoder_parse(decoder, handler, context, &frames);
+        memmove(decoder->buffer, decoder->buffer + used, decoder->fill - used);
+        decoder->fill -= used;
+    }
+    return frames;
+}
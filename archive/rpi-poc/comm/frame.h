@@ -0,0 +1,116 @@
+#ifndef __FRAME_H_
+#define __FRAME_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../log/sensor_log.h"
+
+/*
+ * Telemetry frame, little endian:
+ *
+ *   0xa5 0x5a | type | length | sequence (2) | payload (length) | crc16 (2)
+ *
+ * The CRC is CRC-16/CCITT (0x1021, init 0xffff) over type to the end of the
+ * payload. The sequence counts every frame sent, a gap tells the reader how
+ * many were lost.
+ */
+#define FRAME_SYNC0 0xa5
+#define FRAME_SYNC1 0x5a
+#define FRAME_HEADER_SIZE 6
+#define FRAME_CRC_SIZE 2
+#define FRAME_MAX_PAYLOAD 255
+#define FRAME_MAX_SIZE (FRAME_HEADER_SIZE + FRAME_MAX_PAYLOAD + FRAME_CRC_SIZE)
+
+// frame types
+#define FRAME_ATTITUDE 0x01
+#define FRAME_RAW_IMU 0x02
+#define FRAME_STATUS 0x03
+#define FRAME_LOOP_STATS 0x04
+
+#define FRAME_LOOP_PHASES 4
+#define FRAME_LOOP_BUCKETS 16
+
+struct frame_attitude
+{
+    uint64_t time;      // ns, CLOCK_MONOTONIC
+    float q[4];
+    float roll, pitch, yaw;
+} __attribute__((packed));
+
+struct frame_raw_imu
+{
+    uint64_t time;
+    int16_t gyro[3];
+    int16_t accel[3];
+    int16_t mag[3];
+    int16_t temp;
+    uint16_t flags;     // SENSOR_LOG_*
+} __attribute__((packed));
+
+struct frame_status
+{
+    uint64_t time;
+    uint32_t samples;
+    uint32_t i2c_errors;
+    uint32_t fifo_overflows;
+    uint32_t dropped;   // log writes and telemetry frames thrown away
+} __attribute__((packed));
+
+/**
+ * Loop timing since the previous frame, see rt/loop_stats.h.
+ */
+struct frame_loop_stats
+{
+    uint64_t time;
+    uint32_t period_ns;                 // target
+    uint32_t iterations;
+    uint32_t min_ns, mean_ns, max_ns;   // iteration, start to done
+    int32_t jitter_min_ns, jitter_max_ns; // start to start less the period
+    uint32_t jitter_mean_ns;            // mean absolute
+    uint32_t phase_mean_ns[FRAME_LOOP_PHASES];
+    uint32_t phase_max_ns[FRAME_LOOP_PHASES];
+    uint32_t buckets[FRAME_LOOP_BUCKETS]; // iteration time over two periods, the top one open
+} __attribute__((packed));
+
+/**
+ * A decoded frame, payload points into the decoder and is only valid in
+ * the handler.
+ */
+struct frame
+{
+    uint8_t type;
+    uint8_t length;
+    uint16_t sequence;
+    const uint8_t *payload;
+};
+
+typedef void (*frame_handler)(const struct frame *frame, void *context);
+
+/**
+ * Incremental decoder state. Twice the largest frame so a partial frame
+ * always fits next to a new chunk.
+ */
+struct frame_decoder
+{
+    uint8_t buffer[2 * FRAME_MAX_SIZE];
+    size_t fill;
+    int synced;             // a frame was seen, sequence is meaningful
+    uint16_t sequence;      // expected sequence of the next frame
+    uint64_t frames;
+    uint64_t crc_errors;
+    uint64_t skipped_bytes; // garbage between frames
+    uint64_t lost_frames;   // sequence gaps
+};
+
+uint16_t frame_crc16(const uint8_t *data, size_t size, uint16_t crc);
+size_t frame_encode(uint8_t *out, uint8_t type, uint16_t sequence, const void *payload, uint8_t length);
+size_t frame_encode_attitude(uint8_t *out, uint16_t sequence, uint64_t time, const float *q, float roll, float pitch, float yaw);
+size_t frame_encode_raw_imu(uint8_t *out, uint16_t sequence, const struct sensor_log_record *record);
+size_t frame_encode_status(uint8_t *out, uint16_t sequence, const struct frame_status *status);
+size_t frame_encode_loop_stats(uint8_t *out, uint16_t sequence, const struct frame_loop_stats *stats);
+
+void frame_decoder_init(struct frame_decoder *decoder);
+size_t frame_decoder_push(struct frame_decoder *decoder, const uint8_t *data, size_t size, frame_handler handler, void *context);
+
+#endif
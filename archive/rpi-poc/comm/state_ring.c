@@ -0,0 +1,217 @@
+/**
+ * Shared memory state ring, see state_ring.h.
+ *
+ * Publishing is a sequence bump, a copy of the snapshot into the slot and
+ * two release stores, no syscall and no lock; readers only ever load from
+ * the mapping so they cost the writer nothing but the cache lines they
+ * share. The copy out of the slot is what makes the read consistent, the
+ * kernel is never involved.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "state_ring.h"
+
+static size_t state_ring_size()
+{
+    return sizeof(struct state_ring_header) + STATE_RING_SLOTS * sizeof(struct state_ring_slot);
+}
+
+static int state_ring_map(const char *name, struct state_ring *ring, int writable)
+{
+    int fd = shm_open(name, writable ? O_RDWR | O_CREAT : O_RDONLY, 0644);
+    void *data;
+
+    memset(ring, 0, sizeof(*ring));
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    ring->size = state_ring_size();
+    if (writable && ftruncate(fd, ring->size) < 0)
+    {
+        fprintf(stderr, "Failed to size %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    data = mmap(NULL, ring->size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+    ring->header = data;
+    ring->slots = (struct state_ring_slot *)((uint8_t *)data + sizeof(struct state_ring_header));
+    return 0;
+}
+
+/**
+ * Create the ring, or take over the one a previous run left. Readers still
+ * attached see it start over.
+ *
+ * @param name Shared memory name, STATE_RING_NAME
+ * @param ring Filled with the mapping
+ * @return 0 on success, -1 on failure
+ */
+int state_ring_create(const char *name, struct state_ring *ring)
+{
+    if (state_ring_map(name, ring, 1) < 0)
+        return -1;
+
+    // fault every page in now, not in the loop
+    memset(ring->slots, 0, STATE_RING_SLOTS * sizeof(struct state_ring_slot));
+    __atomic_store_n(&ring->header->head, 0, __ATOMIC_RELEASE);
+    ring->header->version = STATE_RING_VERSION;
+    ring->header->slot_size = sizeof(struct state_ring_slot);
+    ring->header->slots = STATE_RING_SLOTS;
+    memcpy(ring->header->magic, STATE_RING_MAGIC, sizeof(ring->header->magic));
+    return 0;
+}
+
+/**
+ * Publish one snapshot, never waits.
+ */
+void state_ring_publish(struct state_ring *ring, const struct state_snapshot *snapshot)
+{
+    uint64_t index = ring->header->head;
+    struct state_ring_slot *slot = &ring->slots[index & (STATE_RING_SLOTS - 1)];
+    uint32_t sequence = slot->sequence;
+
+    // odd before any of the data changes
+    __atomic_store_n(&slot->sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    slot->index = index;
+    slot->snapshot = *snapshot;
+
+    // even after all of it
+    __atomic_store_n(&slot->sequence, sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->header->head, index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * Map an existing ring read-only.
+ *
+ * @param name Shared memory name, STATE_RING_NAME
+ * @param ring Filled with the mapping
+ * @return 0 on success, -1 if there is no ring or it is another version
+ */
+int state_ring_attach(const char *name, struct state_ring *ring)
+{
+    struct stat st;
+    int fd = shm_open(name, O_RDONLY, 0);
+
+    // a writer that has not sized it yet
+    if (fd >= 0 && (fstat(fd, &st) < 0 || (size_t)st.st_size < state_ring_size()))
+    {
+        fprintf(stderr, "%s: not a state ring\n", name);
+        close(fd);
+        return -1;
+    }
+    if (fd >= 0)
+        close(fd);
+
+    if (state_ring_map(name, ring, 0) < 0)
+        return -1;
+    if (memcmp(ring->header->magic, STATE_RING_MAGIC, sizeof(ring->header->magic)) != 0 ||
+        ring->header->version != STATE_RING_VERSION ||
+        ring->header->slot_size != sizeof(struct state_ring_slot) ||
+        ring->header->slots != STATE_RING_SLOTS)
+    {
+        fprintf(stderr, "%s: not a state ring\n", name);
+        state_ring_close(ring);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * @return Number of snapshots published so far
+ */
+uint64_t state_ring_head(const struct state_ring *ring)
+{
+    return __atomic_load_n(&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * Copy out one snapshot. Snapshots from head - STATE_RING_SLOTS + 1 to
+ * head - 1 are normally there, the oldest of them may be overwritten while
+ * we look.
+ *
+ * @param ring Attached ring
+ * @param index Snapshot number
+ * @param snapshot Filled on success
+ * @return 0 on success, -1 if the snapshot is not, or no longer, in the ring
+ */
+int state_ring_read(struct state_ring *ring, uint64_t index, struct state_snapshot *snapshot)
+{
+    const struct state_ring_slot *slot = &ring->slots[index & (STATE_RING_SLOTS - 1)];
+    int attempt;
+
+    for (attempt = 0; attempt < STATE_RING_RETRIES; attempt++)
+    {
+        uint32_t before = __atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE), after;
+        uint64_t held;
+
+        if (!(before & 1))
+        {
+            held = slot->index;
+            *snapshot = slot->snapshot;
+
+            // the copy happens before the second look at the sequence
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            after = __atomic_load_n(&slot->sequence, __ATOMIC_RELAXED);
+            if (before == after)
+                return held == index && before != 0 ? 0 : -1;
+        }
+        ring->retries++;
+    }
+    return -1;
+}
+
+/**
+ * Copy out the latest snapshot.
+ *
+ * @param index Set to its number, may be NULL
+ * @return 0 on success, -1 if nothing was published yet
+ */
+int state_ring_latest(struct state_ring *ring, struct state_snapshot *snapshot, uint64_t *index)
+{
+    int attempt;
+
+    // the latest can be overwritten only after a full lap, the next one
+    // back is tried when the writer laps us
+    for (attempt = 0; attempt < STATE_RING_RETRIES; attempt++)
+    {
+        uint64_t head = state_ring_head(ring);
+
+        if (head == 0)
+            return -1;
+        if (state_ring_read(ring, head - 1, snapshot) == 0)
+        {
+            if (index)
+                *index = head - 1;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Unmap, the shared memory object stays for the next run.
+ */
+void state_ring_close(struct state_ring *ring)
+{
+    if (ring->header)
+        munmap(ring->header, ring->size);
+    memset(ring, 0, sizeof(*ring));
+}
@@ -0,0 +1,70 @@
+#ifndef __STATE_RING_H_
+#define __STATE_RING_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "../log/sensor_log.h"
+
+/**
+ * Shared memory ring of state snapshots, one per sample.
+ *
+ * A 64 byte header then STATE_RING_SLOTS slots of 128 bytes, each on its own
+ * cache lines, in /dev/shm. One writer, any number of readers mapping the
+ * same object read-only. Every slot has a sequence lock: odd while the
+ * writer is in it, readers copy the snapshot out and retry if the sequence
+ * moved, the writer never waits for anyone.
+ */
+
+#define STATE_RING_NAME "/icaro-state" // /dev/shm/icaro-state
+#define STATE_RING_MAGIC "ISHM"
+#define STATE_RING_VERSION 1
+#define STATE_RING_SLOTS 1024 // power of 2, about 2 s at 512 Hz
+#define STATE_RING_RETRIES 16 // reader attempts on a slot being written
+
+struct state_snapshot
+{
+    struct sensor_log_record raw;
+    float q[4];
+    float roll, pitch, yaw;
+    uint32_t loop_ns;        // previous loop iteration, sample to sample
+    uint32_t fusion_ns;      // estimator update of this sample
+};
+
+struct __attribute__((aligned(64))) state_ring_header
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t slot_size;
+    uint32_t slots;
+    uint64_t head;           // snapshots published, the latest is head - 1
+};
+
+struct __attribute__((aligned(64))) state_ring_slot
+{
+    uint32_t sequence;       // odd while written
+    uint32_t reserved;
+    uint64_t index;          // snapshot number held
+    struct state_snapshot snapshot;
+};
+
+/**
+ * A mapped ring, writable by its creator only.
+ */
+struct state_ring
+{
+    struct state_ring_header *header;
+    struct state_ring_slot *slots;
+    size_t size;
+    uint64_t retries;        // reader side, slots that moved under the copy
+};
+
+int state_ring_create(const char *name, struct state_ring *ring);
+void state_ring_publish(struct state_ring *ring, const struct state_snapshot *snapshot);
+int state_ring_attach(const char *name, struct state_ring *ring);
+uint64_t state_ring_head(const struct state_ring *ring);
+int state_ring_read(struct state_ring *ring, uint64_t index, struct state_snapshot *snapshot);
+int state_ring_latest(struct state_ring *ring, struct state_snapshot *snapshot, uint64_t *index);
+void state_ring_close(struct state_ring *ring);
+
+#endif
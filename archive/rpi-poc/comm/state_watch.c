@@ -0,0 +1,243 @@
+/**
+ * State ring reader.
+ *
+ * Prints the latest snapshot the running main -s publishes, ten times a
+ * second, or with -n the last snapshots in the ring. Any number of these
+ * can run next to the logger and the ground station bridge.
+ *
+ * -t runs a self test instead: a writer process publishes snapshots whose
+ * every field is derived from their number as fast as it can, while reader
+ * processes copy out the latest and random recent ones and check that no
+ * copy ever mixes two snapshots.
+ *
+ * usage: state_watch [-n count] | -t [-r readers] [-s seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include "state_ring.h"
+
+#define TEST_NAME "/icaro-state-test"
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void print_snapshot(uint64_t index, const struct state_snapshot *s)
+{
+    printf("%llu\t%llu\t%f\t%f\t%f\t%d %d %d\t%d %d %d\tloop %.1f us\tfusion %.1f us\n",
+           (unsigned long long)index, (unsigned long long)s->raw.time, s->pitch, s->roll, s->yaw,
+           s->raw.gyro[0], s->raw.gyro[1], s->raw.gyro[2], s->raw.accel[0], s->raw.accel[1], s->raw.accel[2],
+           s->loop_ns * 1e-3, s->fusion_ns * 1e-3);
+}
+
+int watch(long count)
+{
+    struct state_ring ring;
+    struct state_snapshot snapshot;
+    uint64_t index, last = 0;
+
+    if (state_ring_attach(STATE_RING_NAME, &ring) < 0)
+        return 1;
+
+    if (count > 0)
+    {
+        uint64_t head = state_ring_head(&ring);
+
+        if (count > STATE_RING_SLOTS - 1)
+            count = STATE_RING_SLOTS - 1;
+        for (index = head > (uint64_t)count ? head - count : 0; index < head; index++)
+        {
+            if (state_ring_read(&ring, index, &snapshot) == 0)
+                print_snapshot(index, &snapshot);
+        }
+        state_ring_close(&ring);
+        return 0;
+    }
+
+    while (1)
+    {
+        if (state_ring_latest(&ring, &snapshot, &index) == 0 && index != last)
+        {
+            print_snapshot(index, &snapshot);
+            fflush(stdout);
+            last = index;
+        }
+        usleep(100000);
+    }
+}
+
+static void test_fill(uint64_t index, struct state_snapshot *s)
+{
+    int i;
+
+    s->raw.time = index;
+    for (i = 0; i < 3; i++)
+    {
+        s->raw.gyro[i] = (int16_t)(index + i);
+        s->raw.accel[i] = (int16_t)(index * 3 + i);
+        s->raw.mag[i] = (int16_t)(index * 7 + i);
+    }
+    s->raw.temp = (int16_t)index;
+    s->raw.flags = (uint16_t)(index >> 16);
+    s->raw.reserved = (uint16_t)(index >> 32);
+    for (i = 0; i < 4; i++)
+        s->q[i] = (float)(index & 0xffff) + i;
+    s->roll = s->pitch = s->yaw = (float)(index & 0xfff);
+    s->loop_ns = (uint32_t)index;
+    s->fusion_ns = (uint32_t)~index;
+}
+
+static void test_writer(double seconds)
+{
+    struct state_ring ring;
+    struct state_snapshot snapshot;
+    uint64_t start, end, count = 0, worst = 0;
+
+    if (state_ring_create(TEST_NAME, &ring) < 0)
+        exit(1);
+    start = now_ns();
+    end = start + (uint64_t)(seconds * 1e9);
+    while (1)
+    {
+        uint64_t before, elapsed;
+
+        test_fill(count, &snapshot);
+        before = now_ns();
+        state_ring_publish(&ring, &snapshot);
+        elapsed = now_ns() - before;
+        if (elapsed > worst)
+            worst = elapsed;
+        count++;
+        if ((count & 1023) == 0 && before > end)
+            break;
+    }
+    printf("writer: %llu snapshots, %.1f ns each including the clock reads, slowest %.1f us\n",
+           (unsigned long long)count, (now_ns() - start) / (double)count, worst * 1e-3);
+    state_ring_close(&ring);
+    exit(0);
+}
+
+static void test_reader(int id, double seconds)
+{
+    struct state_ring ring;
+    struct state_snapshot snapshot, expected;
+    uint64_t end = now_ns() + (uint64_t)(seconds * 1e9), reads = 0, missed = 0, torn = 0, index;
+    unsigned int seed = id + 1;
+
+    // the writer may not have created it yet
+    while (state_ring_attach(TEST_NAME, &ring) < 0)
+        usleep(1000);
+    while (state_ring_head(&ring) == 0)
+        ;
+
+    while (now_ns() < end)
+    {
+        // the latest, or one back in the ring, the oldest ones race the writer
+        if (rand_r(&seed) & 1)
+        {
+            if (state_ring_latest(&ring, &snapshot, &index) < 0)
+            {
+                missed++;
+                continue;
+            }
+        }
+        else
+        {
+            uint64_t head = state_ring_head(&ring);
+            uint64_t back = 1 + rand_r(&seed) % (STATE_RING_SLOTS - 1);
+
+            index = head > back ? head - back : 0;
+            if (state_ring_read(&ring, index, &snapshot) < 0)
+            {
+                missed++;
+                continue;
+            }
+        }
+        reads++;
+        memset(&expected, 0, sizeof(expected));
+        test_fill(index, &expected);
+        if (memcmp(&snapshot, &expected, sizeof(snapshot)) != 0)
+            torn++;
+    }
+    printf("reader %d: %llu reads, %llu torn, %llu overwritten or busy, %llu retries\n", id,
+           (unsigned long long)reads, (unsigned long long)torn, (unsigned long long)missed,
+           (unsigned long long)ring.retries);
+    state_ring_close(&ring);
+    exit(torn != 0);
+}
+
+int test(int readers, double seconds)
+{
+    int i, status, failed = 0;
+
+    shm_unlink(TEST_NAME);
+    for (i = 0; i <= readers; i++)
+    {
+        pid_t pid = fork();
+
+        if (pid == 0)
+        {
+            if (i == 0)
+                test_writer(seconds);
+            test_reader(i, seconds);
+        }
+        if (pid < 0)
+        {
+            perror("fork");
+            return 1;
+        }
+    }
+    for (i = 0; i <= readers; i++)
+    {
+        wait(&status);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    shm_unlink(TEST_NAME);
+    if (failed)
+        fprintf(stderr, "FAILED: a reader saw a torn snapshot\n");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    long count = 0;
+    int readers = 3, testing = 0, opt;
+    double seconds = 2.0;
+
+    while ((opt = getopt(argc, argv, "n:tr:s:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'n':
+            count = atol(optarg);
+            break;
+        case 't':
+            testing = 1;
+            break;
+        case 'r':
+            readers = atoi(optarg);
+            break;
+        case 's':
+            seconds = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n count] | -t [-r readers] [-s seconds]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (testing)
+        return test(readers, seconds);
+    return watch(count);
+}
@@ -0,0 +1,273 @@
+/**
+ * Telemetry frame reader.
+ *
+ * Reads the binary frames main sends with -t and prints one line per frame,
+ * the way the old text FIFO looked, plus decoder counters at the end.
+ *
+ * -t runs a self test instead: encodes a stream of every frame type,
+ * damages it (flipped bits, inserted garbage, cut bytes), decodes it in
+ * chunks of random size and checks that every undamaged frame comes out
+ * intact, then times the encoder against the snprintf it replaces.
+ *
+ * usage: teledump [fifo_or_file] | -t
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "frame.h"
+
+#define TEST_FRAMES 60000 // below 65536, sequences stay unique
+#define TEST_DAMAGE_EVERY 97 // frames
+
+struct test_frame
+{
+    size_t offset;
+    size_t size;
+    int damaged;
+};
+
+struct test_state
+{
+    const uint8_t *stream;
+    const struct test_frame *frames;
+    size_t count;
+    size_t matched;
+    size_t mismatched;
+};
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void print_frame(const struct frame *frame, void *context)
+{
+    (void)context;
+
+    switch (frame->type)
+    {
+    case FRAME_ATTITUDE:
+    {
+        struct frame_attitude a;
+        memcpy(&a, frame->payload, sizeof(a));
+        printf("%u\tattitude\t%llu\t%f\t%f\t%f\n", frame->sequence, (unsigned long long)a.time, a.pitch, a.roll, a.yaw);
+        break;
+    }
+    case FRAME_RAW_IMU:
+    {
+        struct frame_raw_imu r;
+        memcpy(&r, frame->payload, sizeof(r));
+        printf("%u\traw\t%llu\t%d %d %d\t%d %d %d\t%d %d %d\t%d\t%#x\n", frame->sequence, (unsigned long long)r.time,
+               r.gyro[0], r.gyro[1], r.gyro[2], r.accel[0], r.accel[1], r.accel[2],
+               r.mag[0], r.mag[1], r.mag[2], r.temp, r.flags);
+        break;
+    }
+    case FRAME_STATUS:
+    {
+        struct frame_status s;
+        memcpy(&s, frame->payload, sizeof(s));
+        printf("%u\tstatus\t%llu\tsamples %u, i2c errors %u, fifo overflows %u, dropped %u\n", frame->sequence,
+               (unsigned long long)s.time, s.samples, s.i2c_errors, s.fifo_overflows, s.dropped);
+        break;
+    }
+    case FRAME_LOOP_STATS:
+    {
+        struct frame_loop_stats l;
+        int i;
+        memcpy(&l, frame->payload, sizeof(l));
+        printf("%u	loop	%llu	%u iterations, %.1f/%.1f/%.1f us, jitter %+.1f/%.1f/%+.1f us, phases", frame->sequence,
+               (unsigned long long)l.time, l.iterations, l.min_ns * 1e-3, l.mean_ns * 1e-3, l.max_ns * 1e-3,
+               l.jitter_min_ns * 1e-3, l.jitter_mean_ns * 1e-3, l.jitter_max_ns * 1e-3);
+        for (i = 0; i < FRAME_LOOP_PHASES; i++)
+            printf(" %.1f/%.1f", l.phase_mean_ns[i] * 1e-3, l.phase_max_ns[i] * 1e-3);
+        printf(" us, histogram");
+        for (i = 0; i < FRAME_LOOP_BUCKETS; i++)
+            printf(" %u", l.buckets[i]);
+        printf("\n");
+        break;
+    }
+    default:
+        printf("%u\ttype %#x, %u bytes\n", frame->sequence, frame->type, frame->length);
+    }
+}
+
+static void print_counters(const struct frame_decoder *decoder)
+{
+    fprintf(stderr, "%llu frames, %llu lost, %llu crc errors, %llu bytes skipped\n",
+            (unsigned long long)decoder->frames, (unsigned long long)decoder->lost_frames,
+            (unsigned long long)decoder->crc_errors, (unsigned long long)decoder->skipped_bytes);
+}
+
+int dump(const char *path)
+{
+    static struct frame_decoder decoder;
+    uint8_t buffer[4096];
+    ssize_t size;
+    int fd = open(path, O_RDONLY);
+
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    frame_decoder_init(&decoder);
+    while ((size = read(fd, buffer, sizeof(buffer))) > 0)
+    {
+        frame_decoder_push(&decoder, buffer, size, print_frame, NULL);
+        fflush(stdout);
+    }
+    close(fd);
+    print_counters(&decoder);
+    return 0;
+}
+
+static void check_frame(const struct frame *frame, void *context)
+{
+    struct test_state *state = context;
+    const struct test_frame *sent = &state->frames[frame->sequence % state->count];
+
+    if (!sent->damaged && memcmp(state->stream + sent->offset, frame->payload - FRAME_HEADER_SIZE, sent->size) == 0)
+        state->matched++;
+    else
+        state->mismatched++;
+}
+
+int test()
+{
+    static struct frame_decoder decoder;
+    static struct test_frame frames[TEST_FRAMES];
+    struct test_state state;
+    uint8_t *stream = malloc((size_t)TEST_FRAMES * (FRAME_MAX_SIZE + 16));
+    size_t size = 0, position, i, intact = 0;
+    struct sensor_log_record record;
+    char text[128];
+    float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    double start, encodeSeconds, textSeconds;
+    volatile size_t sink = 0;
+    int failed = 0;
+
+    if (!stream)
+        return 1;
+    srand(1);
+    memset(&record, 0, sizeof(record));
+
+    for (i = 0; i < TEST_FRAMES; i++)
+    {
+        struct frame_status status = {i, i, i / 3, i / 7, i / 11};
+        struct frame_loop_stats loopStats = {i, 1953125, 512, i, i * 2, i * 3, -(int32_t)i, i, i / 2};
+        size_t frameSize;
+
+        record.time = i * 1000000ULL;
+        record.gyro[0] = rand() - RAND_MAX / 2;
+        record.accel[2] = 8192 + rand() % 64;
+        q[1] = rand() / (float)RAND_MAX;
+
+        frames[i].offset = size;
+        switch (i % 4)
+        {
+        case 0:
+            frameSize = frame_encode_raw_imu(stream + size, i, &record);
+            break;
+        case 1:
+            frameSize = frame_encode_attitude(stream + size, i, record.time, q, 0.1f, 0.2f, 0.3f);
+            break;
+        case 2:
+            loopStats.buckets[i % FRAME_LOOP_BUCKETS] = rand();
+            frameSize = frame_encode_loop_stats(stream + size, i, &loopStats);
+            break;
+        default:
+            frameSize = frame_encode_status(stream + size, i, &status);
+        }
+        frames[i].size = frameSize;
+        frames[i].damaged = 0;
+
+        // damage some frames: a flipped bit or a cut tail loses the frame,
+        // garbage after it must not cost the next one
+        if (i % TEST_DAMAGE_EVERY == TEST_DAMAGE_EVERY - 1)
+        {
+            switch (rand() % 3)
+            {
+            case 0:
+                stream[size + rand() % frameSize] ^= 1 << (rand() % 8);
+                frames[i].damaged = 1;
+                break;
+            case 1:
+                frameSize -= 1 + rand() % (frameSize - 1);
+                frames[i].damaged = 1;
+                break;
+            default:
+            {
+                // looks like the start of a long frame
+                uint8_t garbage[8] = {FRAME_SYNC0, FRAME_SYNC1, FRAME_STATUS, 200, 0, 0, FRAME_SYNC0, 0x00};
+                size_t garbageSize = 1 + rand() % sizeof(garbage);
+
+                memcpy(stream + size + frameSize, garbage, garbageSize);
+                frameSize += garbageSize;
+            }
+            }
+        }
+        size += frameSize;
+        if (!frames[i].damaged)
+            intact++;
+    }
+    state.count = TEST_FRAMES;
+
+    state.stream = stream;
+    state.frames = frames;
+    state.matched = 0;
+    state.mismatched = 0;
+    frame_decoder_init(&decoder);
+    for (position = 0; position < size;)
+    {
+        size_t chunk = 1 + rand() % 700;
+
+        if (chunk > size - position)
+            chunk = size - position;
+        frame_decoder_push(&decoder, stream + position, chunk, check_frame, &state);
+        position += chunk;
+    }
+
+    printf("%zu frames sent, %zu intact, %zu decoded intact, %zu decoded wrong\n",
+           state.count, intact, state.matched, state.mismatched);
+    print_counters(&decoder);
+    if (state.matched != intact || state.mismatched != 0)
+    {
+        fprintf(stderr, "FAILED: the decoder lost intact frames or let damaged ones through\n");
+        failed = 1;
+    }
+
+    // encoder against the text it replaces
+    start = now();
+    for (i = 0; i < TEST_FRAMES; i++)
+        sink += frame_encode_attitude(stream, i, i, q, 0.1f * i, 0.2f, 0.3f);
+    encodeSeconds = now() - start;
+    start = now();
+    for (i = 0; i < TEST_FRAMES; i++)
+        sink += snprintf(text, sizeof(text), "%f\t%f\t%f\n", 0.1f * i, 0.2f, 0.3f);
+    textSeconds = now() - start;
+    printf("attitude frame %.1f ns (%zu bytes), snprintf %.1f ns\n", encodeSeconds / TEST_FRAMES * 1e9,
+           FRAME_HEADER_SIZE + sizeof(struct frame_attitude) + FRAME_CRC_SIZE, textSeconds / TEST_FRAMES * 1e9);
+
+    free(stream);
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 1 && strcmp(argv[1], "-t") == 0)
+        return test();
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [fifo_or_file] | -t\n", argv[0]);
+        return 1;
+    }
+    return dump(argc > 1 ? argv[1] : "/tmp/myfifo");
+}
@@ -0,0 +1,253 @@
+/**
+ * Batched UDP telemetry on localhost.
+ *
+ * Two receiving sockets stand in for a logger, which takes raw IMU at the
+ * full rate, and a ground station, which takes attitude every 20th sample.
+ * Both get status frames. The loop runs at a fixed rate and times the
+ * telemetry part of every iteration: the sends plus one flush. It does the
+ * same again with one sendto() per frame, the way the FIFO wrote one
+ * write() per line. The receivers check the frame sequences for losses.
+ *
+ * usage: udp_bench [-r rate_hz] [-t seconds] [-d attitude_divider]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "udp_sink.h"
+
+#define STATUS_INTERVAL 500 // samples
+
+struct receiver
+{
+    int fd;
+    int port;
+    struct frame_decoder decoder;
+    uint64_t datagrams;
+    uint64_t frames[4];
+};
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void count_frame(const struct frame *frame, void *context)
+{
+    struct receiver *receiver = context;
+
+    if (frame->type < 4)
+        receiver->frames[frame->type]++;
+}
+
+static void receiver_open(struct receiver *receiver)
+{
+    struct sockaddr_in address;
+    socklen_t size = sizeof(address);
+    int buffer = 4 * 1024 * 1024;
+
+    memset(receiver, 0, sizeof(*receiver));
+    receiver->fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    setsockopt(receiver->fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(receiver->fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+        getsockname(receiver->fd, (struct sockaddr *)&address, &size) < 0)
+    {
+        perror("receiver");
+        exit(1);
+    }
+    receiver->port = ntohs(address.sin_port);
+    frame_decoder_init(&receiver->decoder);
+}
+
+static void receiver_drain(struct receiver *receiver)
+{
+    uint8_t datagram[2048];
+    ssize_t size;
+
+    // each datagram is whole frames, a fresh decoder state is not needed
+    while ((size = recv(receiver->fd, datagram, sizeof(datagram), 0)) > 0)
+    {
+        receiver->datagrams++;
+        frame_decoder_push(&receiver->decoder, datagram, size, count_frame, receiver);
+    }
+}
+
+static void receiver_report(const char *name, const struct receiver *receiver, double seconds)
+{
+    printf("%-6s %llu datagrams (%.0f/s), attitude %llu (%.0f Hz), raw %llu (%.0f Hz), status %llu, lost %llu\n", name,
+           (unsigned long long)receiver->datagrams, receiver->datagrams / seconds,
+           (unsigned long long)receiver->frames[FRAME_ATTITUDE], receiver->frames[FRAME_ATTITUDE] / seconds,
+           (unsigned long long)receiver->frames[FRAME_RAW_IMU], receiver->frames[FRAME_RAW_IMU] / seconds,
+           (unsigned long long)receiver->frames[FRAME_STATUS], (unsigned long long)receiver->decoder.lost_frames);
+}
+
+static void report_cost(const char *name, uint64_t *cost, size_t count, double rate)
+{
+    uint64_t total = 0;
+    size_t i;
+
+    for (i = 0; i < count; i++)
+        total += cost[i];
+    qsort(cost, count, sizeof(*cost), compare);
+    printf("%-8s mean %.2f us, p99 %.2f us, max %.2f us per sample, %.2f%% of the loop period\n", name,
+           total / (double)count * 1e-3, cost[count * 99 / 100] * 1e-3, cost[count - 1] * 1e-3,
+           total / (double)count * rate * 1e-7);
+}
+
+int main(int argc, char **argv)
+{
+    double rate = 1000.0, seconds = 3.0;
+    unsigned int attitudeDivider = 20;
+    struct receiver logger, gcs;
+    struct sensor_log_record record;
+    struct udp_sink_stats stats;
+    struct sockaddr_in loggerAddress, gcsAddress;
+    float q[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+    uint64_t *cost, period, next;
+    uint16_t loggerSequence = 0, gcsSequence = 0;
+    char destination[64];
+    size_t count, i;
+    int logId, gcsId, fd, opt, failed;
+
+    while ((opt = getopt(argc, argv, "r:t:d:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'd':
+            attitudeDivider = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-t seconds] [-d attitude_divider]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    count = (size_t)(rate * seconds);
+    period = (uint64_t)(1e9 / rate);
+    cost = malloc(count * sizeof(*cost));
+    if (!cost || count == 0)
+        return 1;
+    memset(&record, 0, sizeof(record));
+
+    receiver_open(&logger);
+    receiver_open(&gcs);
+    if (udp_sink_open(UDP_SINK_MAX_DELAY_NS) < 0)
+        return 1;
+    snprintf(destination, sizeof(destination), "127.0.0.1:%d", logger.port);
+    logId = udp_sink_add_destination(destination);
+    snprintf(destination, sizeof(destination), "localhost:%d", gcs.port);
+    gcsId = udp_sink_add_destination(destination);
+    if (logId < 0 || gcsId < 0)
+        return 1;
+    udp_sink_route(FRAME_RAW_IMU, logId, 1);
+    udp_sink_route(FRAME_STATUS, logId, 1);
+    udp_sink_route(FRAME_ATTITUDE, gcsId, attitudeDivider);
+    udp_sink_route(FRAME_STATUS, gcsId, 1);
+
+    printf("%zu samples at %.0f Hz, raw IMU to the logger, attitude every %u to the ground station\n",
+           count, rate, attitudeDivider);
+
+    // batched
+    next = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        uint64_t start;
+
+        next += period;
+        record.time = next;
+        record.gyro[0] = i;
+
+        start = now_ns();
+        udp_sink_send_raw_imu(&record);
+        udp_sink_send_attitude(record.time, q, 0.1f, 0.2f, 0.3f);
+        if (i % STATUS_INTERVAL == 0)
+        {
+            struct frame_status status = {record.time, i, 0, 0, 0};
+            udp_sink_send_status(&status);
+        }
+        udp_sink_flush(0);
+        cost[i] = now_ns() - start;
+
+        receiver_drain(&logger);
+        receiver_drain(&gcs);
+        while (now_ns() < next)
+            usleep((next - now_ns()) / 1000);
+    }
+    udp_sink_get_stats(&stats);
+    udp_sink_close();
+    usleep(10000);
+    receiver_drain(&logger);
+    receiver_drain(&gcs);
+
+    report_cost("batched", cost, count, rate);
+    printf("sink: %llu frames sent, %llu decimated, %llu dropped, %llu datagrams in %llu sendmmsg calls, %llu errors\n",
+           (unsigned long long)stats.frames_sent, (unsigned long long)stats.frames_decimated,
+           (unsigned long long)stats.frames_dropped, (unsigned long long)stats.datagrams_sent,
+           (unsigned long long)stats.send_calls, (unsigned long long)stats.send_errors);
+    receiver_report("logger", &logger, seconds);
+    receiver_report("gcs", &gcs, seconds);
+    failed = logger.decoder.lost_frames != 0 || gcs.decoder.lost_frames != 0;
+
+    // one sendto per frame, same routing
+    fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    memset(&loggerAddress, 0, sizeof(loggerAddress));
+    loggerAddress.sin_family = AF_INET;
+    loggerAddress.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    gcsAddress = loggerAddress;
+    loggerAddress.sin_port = htons(logger.port);
+    gcsAddress.sin_port = htons(gcs.port);
+    next = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        uint8_t frame[FRAME_MAX_SIZE];
+        uint64_t start;
+        size_t size;
+
+        next += period;
+        record.time = next;
+
+        start = now_ns();
+        size = frame_encode_raw_imu(frame, loggerSequence++, &record);
+        sendto(fd, frame, size, MSG_DONTWAIT, (struct sockaddr *)&loggerAddress, sizeof(loggerAddress));
+        if (i % attitudeDivider == 0)
+        {
+            size = frame_encode_attitude(frame, gcsSequence++, record.time, q, 0.1f, 0.2f, 0.3f);
+            sendto(fd, frame, size, MSG_DONTWAIT, (struct sockaddr *)&gcsAddress, sizeof(gcsAddress));
+        }
+        cost[i] = now_ns() - start;
+
+        receiver_drain(&logger);
+        receiver_drain(&gcs);
+        while (now_ns() < next)
+            usleep((next - now_ns()) / 1000);
+    }
+    close(fd);
+    report_cost("sendto", cost, count, rate);
+
+    free(cost);
+    return failed;
+}
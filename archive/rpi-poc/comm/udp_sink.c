@@ -0,0 +1,435 @@
+/**
+ * Batched UDP telemetry.
+ *
+ * Frames of frame.h are packed back to back into datagrams of up to
+ * UDP_SINK_DATAGRAM bytes, one open datagram per destination. Full
+ * datagrams, and partial ones older than the delay limit, go out together
+ * in one sendmmsg() per udp_sink_flush(), so at 1 kHz the loop makes a
+ * syscall every few tens of samples instead of one per frame.
+ *
+ * Every frame type is routed to any of the destinations with a divider:
+ * raw IMU to a logger at the full rate and attitude to a ground station
+ * every 20th sample, say. A frame nobody takes costs a table lookup and is
+ * never encoded. The socket is non-blocking; when the kernel does not take
+ * the datagrams they stay queued and, once the queue is full, new frames
+ * are dropped and counted. Each destination has its own frame sequence so
+ * a receiver counts what it lost.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "udp_sink.h"
+#include "../metrics/counters.h"
+
+#define UDP_SINK_TYPES 256
+
+struct udp_sink_datagram
+{
+    uint8_t data[UDP_SINK_DATAGRAM];
+    size_t size;
+    int destination;
+    int state;               // UDP_SINK_FREE, _OPEN, _READY
+    uint64_t opened;         // ns
+    uint64_t order;          // creation number, datagrams go out in order
+};
+
+#define UDP_SINK_FREE 0
+#define UDP_SINK_OPEN 1
+#define UDP_SINK_READY 2
+
+struct udp_sink_destination
+{
+    struct sockaddr_storage address;
+    socklen_t addressSize;
+    int open;                // datagram being filled, -1 if none
+    uint16_t sequence;
+};
+
+struct udp_sink_route
+{
+    unsigned int divider[UDP_SINK_DESTINATIONS]; // 0: not sent there
+    unsigned int count;
+};
+
+int udpSocket = -1;
+uint64_t udpMaxDelay = UDP_SINK_MAX_DELAY_NS;
+uint64_t udpOrder = 0;
+int udpDestinationCount = 0;
+struct udp_sink_destination udpDestinations[UDP_SINK_DESTINATIONS];
+struct udp_sink_datagram udpDatagrams[UDP_SINK_DATAGRAMS];
+struct udp_sink_route udpRoutes[UDP_SINK_TYPES];
+struct udp_sink_stats udpStats;
+
+static uint64_t udp_sink_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Create the socket, no destination yet.
+ *
+ * @param maxDelayNs Longest a frame waits for its datagram to fill,
+ *                   UDP_SINK_MAX_DELAY_NS
+ * @return 0 on success, -1 on failure
+ */
+int udp_sink_open(uint64_t maxDelayNs)
+{
+    udpSocket = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (udpSocket >= 0)
+    {
+        // v4 destinations through the same socket
+        int no = 0;
+        setsockopt(udpSocket, IPPROTO_IPV6, IPV6_V6ONLY, &no, sizeof(no));
+    }
+    else
+    {
+        udpSocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    }
+    if (udpSocket < 0)
+    {
+        fprintf(stderr, "Failed to create the telemetry socket: %s\n", strerror(errno));
+        return -1;
+    }
+
+    udpMaxDelay = maxDelayNs;
+    udpOrder = 0;
+    udpDestinationCount = 0;
+    memset(udpDatagrams, 0, sizeof(udpDatagrams));
+    memset(udpRoutes, 0, sizeof(udpRoutes));
+    memset(&udpStats, 0, sizeof(udpStats));
+    return 0;
+}
+
+/**
+ * Add a destination.
+ *
+ * @param hostPort host:port, [v6 address]:port
+ * @return Destination number, -1 on failure
+ */
+int udp_sink_add_destination(const char *hostPort)
+{
+    struct udp_sink_destination *destination;
+    struct addrinfo hints, *result;
+    char host[256];
+    const char *colon = strrchr(hostPort, ':');
+    size_t hostSize;
+    int status;
+
+    if (udpDestinationCount == UDP_SINK_DESTINATIONS || !colon)
+    {
+        fprintf(stderr, "%s: bad or too many destinations\n", hostPort);
+        return -1;
+    }
+    hostSize = colon - hostPort;
+    if (hostSize >= sizeof(host))
+        hostSize = sizeof(host) - 1;
+    memcpy(host, hostPort, hostSize);
+    host[hostSize] = '\0';
+    if (host[0] == '[' && hostSize > 1 && host[hostSize - 1] == ']')
+    {
+        memmove(host, host + 1, hostSize - 2);
+        host[hostSize - 2] = '\0';
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_V4MAPPED | AI_ALL;
+    status = getaddrinfo(host, colon + 1, &hints, &result);
+    if (status != 0)
+    {
+        // no v6 socket, plain v4
+        hints.ai_family = AF_INET;
+        hints.ai_flags = 0;
+        status = getaddrinfo(host, colon + 1, &hints, &result);
+    }
+    if (status != 0)
+    {
+        fprintf(stderr, "%s: %s\n", hostPort, gai_strerror(status));
+        return -1;
+    }
+
+    destination = &udpDestinations[udpDestinationCount];
+    memset(destination, 0, sizeof(*destination));
+    memcpy(&destination->address, result->ai_addr, result->ai_addrlen);
+    destination->addressSize = result->ai_addrlen;
+    destination->open = -1;
+    freeaddrinfo(result);
+    return udpDestinationCount++;
+}
+
+/**
+ * Send every divider-th frame of a type to a destination, 0 stops it.
+ *
+ * @return 0 on success, -1 on a bad destination
+ */
+int udp_sink_route(uint8_t type, int destination, unsigned int divider)
+{
+    if (destination < 0 || destination >= udpDestinationCount)
+        return -1;
+
+    udpRoutes[type].divider[destination] = divider;
+    return 0;
+}
+
+static void udp_sink_close_datagram(int destination)
+{
+    int open = udpDestinations[destination].open;
+
+    if (open >= 0)
+    {
+        udpDatagrams[open].state = UDP_SINK_READY;
+        udpDestinations[destination].open = -1;
+    }
+}
+
+/**
+ * Room for one frame to a destination, for frame types without a
+ * udp_sink_send_* of their own. Every frame reserved must be committed.
+ *
+ * @param destination Destination number
+ * @param sequence Set to the sequence number the frame must carry
+ * @return Where to encode the frame, FRAME_MAX_SIZE bytes, NULL if the
+ *         queue is full
+ */
+uint8_t *udp_sink_reserve(int destination, uint16_t *sequence)
+{
+    struct udp_sink_destination *d = &udpDestinations[destination];
+    struct udp_sink_datagram *datagram;
+    int i;
+
+    if (d->open >= 0 && udpDatagrams[d->open].size + FRAME_MAX_SIZE > UDP_SINK_DATAGRAM)
+        udp_sink_close_datagram(destination);
+
+    if (d->open < 0)
+    {
+        for (i = 0; i < UDP_SINK_DATAGRAMS && udpDatagrams[i].state != UDP_SINK_FREE; i++)
+            ;
+        if (i == UDP_SINK_DATAGRAMS)
+        {
+            // the receiver sees the gap
+            d->sequence++;
+            udpStats.frames_dropped++;
+            counter_add(COUNTER_DROPPED_TELEMETRY, 1);
+            return NULL;
+        }
+        datagram = &udpDatagrams[i];
+        datagram->state = UDP_SINK_OPEN;
+        datagram->size = 0;
+        datagram->destination = destination;
+        datagram->opened = udp_sink_now();
+        datagram->order = udpOrder++;
+        d->open = i;
+    }
+
+    datagram = &udpDatagrams[d->open];
+    *sequence = d->sequence;
+    return datagram->data + datagram->size;
+}
+
+/**
+ * Keep the frame encoded at the reserved place.
+ *
+ * @param size Frame size
+ */
+void udp_sink_commit(int destination, size_t size)
+{
+    struct udp_sink_destination *d = &udpDestinations[destination];
+
+    udpDatagrams[d->open].size += size;
+    d->sequence++;
+    udpStats.frames_sent++;
+}
+
+/**
+ * Count a frame of the type and find where it goes.
+ *
+ * @return Bit mask of the destinations that take this one
+ */
+static unsigned int udp_sink_targets(uint8_t type)
+{
+    struct udp_sink_route *route = &udpRoutes[type];
+    unsigned int targets = 0;
+    int destination;
+
+    for (destination = 0; destination < udpDestinationCount; destination++)
+    {
+        unsigned int divider = route->divider[destination];
+
+        if (divider == 0)
+            continue;
+        if (route->count % divider == 0)
+            targets |= 1 << destination;
+        else
+            udpStats.frames_decimated++;
+    }
+    route->count++;
+    return targets;
+}
+
+void udp_sink_send_attitude(uint64_t time, const float *q, float roll, float pitch, float yaw)
+{
+    unsigned int targets = udp_sink_targets(FRAME_ATTITUDE);
+    int destination;
+
+    for (destination = 0; targets; destination++, targets >>= 1)
+    {
+        uint16_t sequence;
+        uint8_t *out;
+
+        if ((targets & 1) && (out = udp_sink_reserve(destination, &sequence)))
+            udp_sink_commit(destination, frame_encode_attitude(out, sequence, time, q, roll, pitch, yaw));
+    }
+}
+
+void udp_sink_send_raw_imu(const struct sensor_log_record *record)
+{
+    unsigned int targets = udp_sink_targets(FRAME_RAW_IMU);
+    int destination;
+
+    for (destination = 0; targets; destination++, targets >>= 1)
+    {
+        uint16_t sequence;
+        uint8_t *out;
+
+        if ((targets & 1) && (out = udp_sink_reserve(destination, &sequence)))
+            udp_sink_commit(destination, frame_encode_raw_imu(out, sequence, record));
+    }
+}
+
+void udp_sink_send_status(const struct frame_status *status)
+{
+    unsigned int targets = udp_sink_targets(FRAME_STATUS);
+    int destination;
+
+    for (destination = 0; targets; destination++, targets >>= 1)
+    {
+        uint16_t sequence;
+        uint8_t *out;
+
+        if ((targets & 1) && (out = udp_sink_reserve(destination, &sequence)))
+            udp_sink_commit(destination, frame_encode_status(out, sequence, status));
+    }
+}
+
+#ifdef LOOP_STATS
+void udp_sink_send_loop_stats(const struct frame_loop_stats *stats)
+{
+    unsigned int targets = udp_sink_targets(FRAME_LOOP_STATS);
+    int destination;
+
+    for (destination = 0; targets; destination++, targets >>= 1)
+    {
+        uint16_t sequence;
+        uint8_t *out;
+
+        if ((targets & 1) && (out = udp_sink_reserve(destination, &sequence)))
+            udp_sink_commit(destination, frame_encode_loop_stats(out, sequence, stats));
+    }
+}
+#endif
+
+/**
+ * Send the full datagrams and the ones that waited long enough, in one
+ * call, never blocks. Call once per loop iteration.
+ *
+ * @param force Send the partial datagrams as well
+ */
+void udp_sink_flush(int force)
+{
+    struct mmsghdr messages[UDP_SINK_DATAGRAMS];
+    struct iovec iov[UDP_SINK_DATAGRAMS];
+    int ready[UDP_SINK_DATAGRAMS];
+    uint64_t now = udp_sink_now();
+    int count = 0, sent, i, j;
+
+    if (udpSocket < 0)
+        return;
+
+    for (i = 0; i < udpDestinationCount; i++)
+    {
+        int open = udpDestinations[i].open;
+
+        if (open >= 0 && udpDatagrams[open].size > 0 && (force || now - udpDatagrams[open].opened >= udpMaxDelay))
+            udp_sink_close_datagram(i);
+    }
+
+    // oldest first, a destination sees its frames in order
+    for (i = 0; i < UDP_SINK_DATAGRAMS; i++)
+    {
+        if (udpDatagrams[i].state != UDP_SINK_READY)
+            continue;
+        for (j = count; j > 0 && udpDatagrams[ready[j - 1]].order > udpDatagrams[i].order; j--)
+            ready[j] = ready[j - 1];
+        ready[j] = i;
+        count++;
+    }
+    if (count == 0)
+        return;
+
+    memset(messages, 0, sizeof(messages[0]) * count);
+    for (i = 0; i < count; i++)
+    {
+        struct udp_sink_datagram *datagram = &udpDatagrams[ready[i]];
+        struct udp_sink_destination *d = &udpDestinations[datagram->destination];
+
+        iov[i].iov_base = datagram->data;
+        iov[i].iov_len = datagram->size;
+        messages[i].msg_hdr.msg_name = &d->address;
+        messages[i].msg_hdr.msg_namelen = d->addressSize;
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    sent = sendmmsg(udpSocket, messages, count, MSG_DONTWAIT);
+    if (sent < 0)
+    {
+        // the socket buffer is full, try again next time
+        if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return;
+        // no route, refused by a closed port: those datagrams are gone
+        udpStats.send_errors++;
+        sent = 1;
+    }
+    else
+    {
+        udpStats.send_calls++;
+        udpStats.datagrams_sent += sent;
+    }
+    for (i = 0; i < sent; i++)
+        udpDatagrams[ready[i]].state = UDP_SINK_FREE;
+}
+
+/**
+ * Read the counters.
+ */
+void udp_sink_get_stats(struct udp_sink_stats *stats)
+{
+    *stats = udpStats;
+}
+
+/**
+ * Send what is queued and close the socket.
+ */
+void udp_sink_close()
+{
+    if (udpSocket < 0)
+        return;
+
+    udp_sink_flush(1);
+    close(udpSocket);
+    udpSocket = -1;
+}
@@ -0,0 +1,42 @@
+#ifndef __UDP_SINK_H_
+#define __UDP_SINK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "frame.h"
+
+#define UDP_SINK_DESTINATIONS 4
+#define UDP_SINK_DATAGRAM 1400     // payload bytes, below a 1500 byte MTU
+#define UDP_SINK_DATAGRAMS 32      // queued datagrams, sent in one sendmmsg
+#define UDP_SINK_MAX_DELAY_NS 20000000ULL // a partial datagram waits at most this long
+
+/**
+ * Counters, see udp_sink_get_stats().
+ */
+struct udp_sink_stats
+{
+    uint64_t frames_sent;
+    uint64_t frames_decimated;  // skipped by the channel rate
+    uint64_t frames_dropped;    // no datagram free, the socket fell behind
+    uint64_t datagrams_sent;
+    uint64_t send_calls;        // sendmmsg() calls that sent something
+    uint64_t send_errors;
+};
+
+int udp_sink_open(uint64_t maxDelayNs);
+int udp_sink_add_destination(const char *hostPort);
+int udp_sink_route(uint8_t type, int destination, unsigned int divider);
+uint8_t *udp_sink_reserve(int destination, uint16_t *sequence);
+void udp_sink_commit(int destination, size_t size);
+void udp_sink_send_attitude(uint64_t time, const float *q, float roll, float pitch, float yaw);
+void udp_sink_send_raw_imu(const struct sensor_log_record *record);
+void udp_sink_send_status(const struct frame_status *status);
+#ifdef LOOP_STATS
+void udp_sink_send_loop_stats(const struct frame_loop_stats *stats);
+#endif
+void udp_sink_flush(int force);
+void udp_sink_get_stats(struct udp_sink_stats *stats);
+void udp_sink_close();
+
+#endif
@@ -0,0 +1,147 @@
+/**
+ * Attitude estimator pipeline: decode, filtering and fusion of one raw
+ * sample.
+ *
+ * Everything between the sensor read and the attitude goes through here and
+ * takes a sensor log record as input, so the live loop in main.c and the
+ * replay tool run exactly the same code on exactly the same values and a
+ * logged flight replays to the same attitude.
+ */
+
+#include <math.h>
+
+#include "estimator.h"
+#include "../MahonyAHRS.h"
+#include "../filter/biquad.h"
+#include "../filter/spectrum.h"
+#include "../metrics/counters.h"
+
+#define GYRO_CUTOFF 90.0f
+#define ACCEL_CUTOFF 25.0f
+#define NOTCH_STAGE 1 // first of the SPECTRUM_PEAKS stages the analyzer retunes
+
+// sample periods further than this from nominal (stalls, clock steps) fall
+// back to the nominal period
+#define MIN_PERIOD_RATIO 0.5f
+#define MAX_PERIOD_RATIO 2.0f
+
+// build with -DESTIMATOR_THREAD_LOCAL, and the filters and MahonyAHRS.c with
+// theirs, to run one estimator per thread in the analysis tools
+#ifdef ESTIMATOR_THREAD_LOCAL
+#define ESTIMATOR_STATE __thread
+#else
+#define ESTIMATOR_STATE
+#endif
+
+ESTIMATOR_STATE float nominalPeriod;
+ESTIMATOR_STATE uint64_t lastTime = 0;
+ESTIMATOR_STATE int filterResetRequested = 0; // set by fusion, the filter stage acts on it
+
+/**
+ * Reset the filters and the fusion state.
+ *
+ * @param sampleFreq Nominal sample frequency in Hz
+ */
+void estimator_init(float sampleFreq)
+{
+    uint8_t axis;
+
+    biquad_init();
+    for (axis = BIQUAD_GX; axis <= BIQUAD_GZ; axis++)
+        biquad_set_lowpass(0, axis, sampleFreq, GYRO_CUTOFF, 0.7071f);
+    for (axis = BIQUAD_AX; axis <= BIQUAD_AZ; axis++)
+        biquad_set_lowpass(0, axis, sampleFreq, ACCEL_CUTOFF, 0.7071f);
+
+    // gyro notches follow the motor noise found by the analyzer
+    spectrum_init(sampleFreq, 1, NOTCH_STAGE);
+
+    mahony_init();
+    mahony_set_sample_frequency(sampleFreq);
+    nominalPeriod = 1.0f / sampleFreq;
+    lastTime = 0;
+    filterResetRequested = 0;
+}
+
+/**
+ * Run one sample through the pipeline.
+ *
+ * @param record Raw sample, as logged
+ */
+void estimator_update(const struct sensor_log_record *record)
+{
+    float sample[BIQUAD_AXES];
+
+    estimator_filter(record, sample);
+    estimator_fuse(record, sample);
+}
+
+/**
+ * Filter half of estimator_update(): low-pass and notch the raw values
+ * before fusion so motor vibration does not alias into the attitude.
+ *
+ * @param record Raw sample, as logged
+ * @param sample Filled with BIQUAD_AXES filtered values, gyro then accel
+ */
+void estimator_filter(const struct sensor_log_record *record, float *sample)
+{
+    uint8_t axis;
+
+    // the pipeline may run fusion on another thread, so the biquads are only
+    // ever reset here, on the thread that runs them
+    if (__atomic_exchange_n(&filterResetRequested, 0, __ATOMIC_ACQUIRE))
+        biquad_reset();
+    for (axis = 0; axis < 3; axis++)
+    {
+        sample[BIQUAD_GX + axis] = record->gyro[axis];
+        sample[BIQUAD_AX + axis] = record->accel[axis];
+    }
+    spectrum_update(sample);
+    biquad_apply(sample);
+}
+
+/**
+ * Fusion half of estimator_update().
+ *
+ * The integration step comes from the record timestamps, so loop jitter in
+ * the live run is integrated the way it happened and reproduced on replay.
+ *
+ * @param record Raw sample, as logged
+ * @param sample Output of estimator_filter() for the record
+ */
+void estimator_fuse(const struct sensor_log_record *record, const float *sample)
+{
+    float gyroScale = 3.14159f / 180.0f;
+    float period = nominalPeriod;
+    float q[4];
+
+    if (lastTime != 0)
+    {
+        period = (record->time - lastTime) * 1e-9f;
+        if (period < MIN_PERIOD_RATIO * nominalPeriod || period > MAX_PERIOD_RATIO * nominalPeriod)
+            period = nominalPeriod;
+    }
+    lastTime = record->time;
+    mahony_set_sample_frequency(1.0f / period);
+
+    mahony_update_multirate(
+        sample[BIQUAD_GX] * gyroScale,
+        sample[BIQUAD_GY] * gyroScale,
+        sample[BIQUAD_GZ] * gyroScale,
+        sample[BIQUAD_AX],
+        sample[BIQUAD_AY],
+        sample[BIQUAD_AZ],
+        record->mag[0], record->mag[1], record->mag[2],
+        (record->flags & SENSOR_LOG_MAG_FRESH) != 0);
+
+    // a NaN never leaves the quaternion once it is in, start the fusion over
+    // instead of flying on it and have the filters start over with the next
+    // sample they see
+    mahony_get_quaternion(q);
+    if (!isfinite(q[0] + q[1] + q[2] + q[3]))
+    {
+        __atomic_store_n(&filterResetRequested, 1, __ATOMIC_RELEASE);
+        mahony_init();
+        mahony_set_sample_frequency(1.0f / nominalPeriod);
+        counter_add(COUNTER_FILTER_RESETS, 1);
+    }
+}
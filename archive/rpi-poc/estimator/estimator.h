@@ -0,0 +1,13 @@
+#ifndef __ESTIMATOR_H_
+#define __ESTIMATOR_H_
+
+#include <stdint.h>
+
+#include "../log/sensor_log.h"
+
+void estimator_init(float sampleFreq);
+void estimator_update(const struct sensor_log_record *record);
+void estimator_filter(const struct sensor_log_record *record, float *sample);
+void estimator_fuse(const struct sensor_log_record *record, const float *sample);
+
+#endif
@@ -0,0 +1,241 @@
+/**
+ * Replay a binary sensor log through the estimator.
+ *
+ * Feeds every logged record, with its original timestamp, through the same
+ * estimator_update() the live loop uses, as fast as the CPU goes. Prints a
+ * hash of the attitude after every sample, so two estimator builds can be
+ * compared bit for bit, and the throughput. Links the very objects main is
+ * built from, so the replay is the flight code, not a re-compile of it.
+ *
+ * usage: replay [-r runs] [-o attitude.txt] [-s start] [-e end] log | -t
+ *
+ * With -r the log is replayed several times from a fresh estimator and the
+ * hashes must all match. -s and -e replay only a window, in seconds from the
+ * first record, found through the time index without reading what is before.
+ *
+ * -t checks the start-up of the fusion instead: still samples at a few
+ * attitudes go through mahony_update_multirate(), with a magnetometer and
+ * with none. The first correction must align roll and pitch, and yaw with
+ * the mag, and the gain schedule must end in mahony_ready().
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "estimator.h"
+#include "../MahonyAHRS.h"
+#include "../log/sensor_log.h"
+#include "../log/sensor_index.h"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+#define TEST_RATE 512.0f
+#define TEST_SECONDS 10.0f     // past the end of the gain schedule
+#define TEST_TOLERANCE 0.5f    // deg
+#define TEST_FIELD_DIP 60.0f   // deg, magnetic inclination of the test field
+#define TEST_DIVIDER 8         // correction every n samples, the first one aligns
+
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t length)
+{
+    const uint8_t *bytes = data;
+    size_t i;
+
+    for (i = 0; i < length; i++)
+    {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Replay a window of the log once from a fresh estimator.
+ *
+ * @return Hash of the attitude after every sample
+ */
+uint64_t replay(const struct sensor_log_view *view, FILE *output)
+{
+    uint64_t hash = FNV_OFFSET;
+    float q[4];
+    size_t i;
+
+    estimator_init(view->log->header->gyro_rate);
+    for (i = 0; i < view->count; i++)
+    {
+        const struct sensor_log_record *record = sensor_log_view_at(view, i);
+
+        estimator_update(record);
+        mahony_get_quaternion(q);
+        hash = hash_bytes(hash, q, sizeof(q));
+
+        if (output)
+            fprintf(output, "%llu\t%.9g\t%.9g\t%.9g\t%.9g\n",
+                    (unsigned long long)record->time, q[0], q[1], q[2], q[3]);
+    }
+    return hash;
+}
+
+static float angle_error(float a, float b)
+{
+    return fabsf(remainderf(a - b, 360.0f));
+}
+
+/**
+ * Still samples at one attitude, accel and mag as the sensor would see them.
+ *
+ * @return 0 if it aligned and became ready, 1 if not
+ */
+static int test_alignment(float roll, float pitch, float yaw, int mag)
+{
+    float r = roll * 0.0174533f, p = pitch * 0.0174533f, y = yaw * 0.0174533f;
+    float dip = TEST_FIELD_DIP * 0.0174533f;
+    float ax, ay, az, mx = 0.0f, my = 0.0f, mz = 0.0f;
+    float alignedRoll, alignedPitch, alignedYaw;
+    int samples = (int)(TEST_SECONDS * TEST_RATE), i = 0, ready = 0, failed;
+
+    // gravity and the field rotated into the body frame, z down
+    ax = -sinf(p);
+    ay = sinf(r) * cosf(p);
+    az = cosf(r) * cosf(p);
+    if (mag)
+    {
+        float nx = cosf(dip) * cosf(y), ny = -cosf(dip) * sinf(y), nz = sinf(dip);
+
+        mx = cosf(p) * nx - sinf(p) * nz;
+        my = sinf(r) * sinf(p) * nx + cosf(r) * ny + sinf(r) * cosf(p) * nz;
+        mz = cosf(r) * sinf(p) * nx - sinf(r) * ny + cosf(r) * cosf(p) * nz;
+    }
+
+    // no rotation, the gyro adds nothing between the corrections
+    mahony_init();
+    mahony_set_sample_frequency(TEST_RATE);
+    mahony_set_correction_divider(TEST_DIVIDER);
+    for (; i <= TEST_DIVIDER; i++)
+        mahony_update_multirate(0.0f, 0.0f, 0.0f, ax, ay, az, mx, my, mz, 0);
+    alignedRoll = mahony_get_roll();
+    alignedPitch = mahony_get_pitch();
+    alignedYaw = mahony_get_yaw() - 180.0f; // the getter reports 0 to 360
+    for (; i < samples && !ready; i++)
+    {
+        mahony_update_multirate(0.0f, 0.0f, 0.0f, ax, ay, az, mx, my, mz, 0);
+        ready = mahony_ready();
+    }
+
+    failed = angle_error(alignedRoll, roll) > TEST_TOLERANCE || angle_error(alignedPitch, pitch) > TEST_TOLERANCE ||
+             (mag && angle_error(alignedYaw, yaw) > TEST_TOLERANCE) || !ready;
+    printf("%-6s %+6.1f %+6.1f %+7.1f deg: aligned %+6.1f %+6.1f %+7.1f, %s%s\n", mag ? "mag" : "no mag",
+           roll, pitch, yaw, alignedRoll, alignedPitch, alignedYaw,
+           ready ? "ready" : "never ready", failed ? ", FAILED" : "");
+    return failed;
+}
+
+int test()
+{
+    static const float attitudes[][3] = {{0, 0, 0}, {20, -10, 45}, {-35, 25, -120}, {170, 5, 90}};
+    int failed = 0, mag, i;
+
+    for (mag = 1; mag >= 0; mag--)
+    {
+        for (i = 0; i < (int)(sizeof(attitudes) / sizeof(attitudes[0])); i++)
+            failed |= test_alignment(attitudes[i][0], attitudes[i][1], attitudes[i][2], mag);
+    }
+    printf("%s\n", failed ? "FAILED" : "aligned on the first correction and ready, with and without mag");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    struct sensor_log_file log;
+    struct sensor_index_file index;
+    struct sensor_log_view view;
+    struct timespec start, end;
+    double startTime = 0.0, endTime = -1.0;
+    FILE *output = NULL;
+    uint64_t hash, first = 0;
+    int runs = 1, run, failed = 0;
+    double elapsed;
+    int opt;
+
+    if (argc == 2 && strcmp(argv[1], "-t") == 0)
+        return test();
+    while ((opt = getopt(argc, argv, "r:o:s:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            runs = atoi(optarg);
+            break;
+        case 'o':
+            output = fopen(optarg, "w");
+            if (!output)
+            {
+                perror(optarg);
+                return 1;
+            }
+            break;
+        case 's':
+            startTime = atof(optarg);
+            break;
+        case 'e':
+            endTime = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r runs] [-o attitude.txt] [-s start] [-e end] log | -t\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1 || runs < 1)
+    {
+        fprintf(stderr, "usage: %s [-r runs] [-o attitude.txt] [-s start] [-e end] log | -t\n", argv[0]);
+        return 1;
+    }
+
+    if (sensor_log_map(argv[optind], &log) < 0)
+        return 1;
+
+    view.log = &log;
+    view.first = 0;
+    view.count = log.count;
+    if (log.count > 0 && (startTime > 0.0 || endTime >= 0.0))
+    {
+        uint64_t origin = sensor_log_record_at(&log, 0)->time;
+
+        sensor_index_map(argv[optind], &index);
+        sensor_log_view(&log, &index, origin + (uint64_t)(startTime > 0.0 ? startTime * 1e9 : 0.0),
+                        endTime >= 0.0 ? origin + (uint64_t)(endTime * 1e9) : UINT64_MAX, &view);
+        sensor_index_unmap(&index);
+    }
+
+    for (run = 0; run < runs; run++)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        hash = replay(&view, run == 0 ? output : NULL);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+
+        if (run == 0)
+            first = hash;
+        else if (hash != first)
+            failed = 1;
+
+        printf("run %d: %zu samples, hash %016llx, %.3f s, %.0f samples/s (%.0fx real time)\n",
+               run, view.count, (unsigned long long)hash, elapsed, view.count / elapsed,
+               view.count / elapsed / log.header->gyro_rate);
+    }
+
+    if (output)
+        fclose(output);
+    sensor_log_unmap(&log);
+
+    if (failed)
+    {
+        fprintf(stderr, "replay is not deterministic, hashes differ between runs\n");
+        return 1;
+    }
+    return 0;
+}
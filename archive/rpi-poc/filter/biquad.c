@@ -0,0 +1,164 @@
+/**
+ * Biquad filter bank between sensor decode and fusion.
+ *
+ * A cascade of up to BIQUAD_MAX_STAGES second order sections, each one with
+ * its own coefficients per axis, so every axis can have a different low-pass
+ * and notch arrangement (unused sections on an axis are passthrough). All six
+ * axes are kept in one 8 x float vector and run through each section in
+ * transposed direct form II, so a section costs the same few vector
+ * multiply-adds whatever the number of axes.
+ *
+ * Coefficients from the RBJ audio EQ cookbook:
+ * https://www.w3.org/TR/audio-eq-cookbook/
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "biquad.h"
+
+#define BIQUAD_LANES 8
+
+// build with -DBIQUAD_THREAD_LOCAL to give every thread its own filter bank,
+// as MahonyAHRS.c does for the analysis tools
+#ifdef BIQUAD_THREAD_LOCAL
+#define BIQUAD_STATE __thread
+#else
+#define BIQUAD_STATE
+#endif
+
+typedef float vfloat __attribute__((vector_size(BIQUAD_LANES * sizeof(float))));
+
+struct biquad_stage
+{
+    vfloat b0, b1, b2, a1, a2; // normalised by a0
+    vfloat z1, z2;             // transposed direct form II state
+};
+
+BIQUAD_STATE struct biquad_stage stages[BIQUAD_MAX_STAGES];
+BIQUAD_STATE uint8_t stageCount = 0;
+
+/**
+ * Set every section of every axis to passthrough and clear the state.
+ */
+void biquad_init()
+{
+    uint8_t stage, axis;
+
+    memset(stages, 0, sizeof(stages));
+    for (stage = 0; stage < BIQUAD_MAX_STAGES; stage++)
+    {
+        for (axis = 0; axis < BIQUAD_LANES; axis++)
+            stages[stage].b0[axis] = 1.0f;
+    }
+    stageCount = 0;
+}
+
+/**
+ * Clear the filter state, keeps the coefficients.
+ */
+void biquad_reset()
+{
+    uint8_t stage;
+
+    for (stage = 0; stage < BIQUAD_MAX_STAGES; stage++)
+    {
+        stages[stage].z1 = (vfloat){0};
+        stages[stage].z2 = (vfloat){0};
+    }
+}
+
+static void biquad_set(uint8_t stage, uint8_t axis, float b0, float b1, float b2, float a0, float a1, float a2)
+{
+    struct biquad_stage *s;
+
+    if (stage >= BIQUAD_MAX_STAGES || axis >= BIQUAD_AXES)
+        return;
+
+    // the state is left alone, so a section can be retuned while running
+    s = &stages[stage];
+    s->b0[axis] = b0 / a0;
+    s->b1[axis] = b1 / a0;
+    s->b2[axis] = b2 / a0;
+    s->a1[axis] = a1 / a0;
+    s->a2[axis] = a2 / a0;
+
+    if (stage >= stageCount)
+        stageCount = stage + 1;
+}
+
+/**
+ * Make one section of one axis a passthrough.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ */
+void biquad_set_passthrough(uint8_t stage, uint8_t axis)
+{
+    biquad_set(stage, axis, 1.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f);
+}
+
+/**
+ * Make one section of one axis a second order low-pass.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ * @param sampleFreq Sample frequency in Hz
+ * @param cutoff Cutoff frequency in Hz
+ * @param q Quality factor, 0.7071 for Butterworth
+ */
+void biquad_set_lowpass(uint8_t stage, uint8_t axis, float sampleFreq, float cutoff, float q)
+{
+    float w0 = 2.0f * (float)M_PI * cutoff / sampleFreq;
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+
+    biquad_set(stage, axis,
+               (1.0f - cosw0) * 0.5f, 1.0f - cosw0, (1.0f - cosw0) * 0.5f,
+               1.0f + alpha, -2.0f * cosw0, 1.0f - alpha);
+}
+
+/**
+ * Make one section of one axis a notch.
+ *
+ * @param stage Section index
+ * @param axis BIQUAD_GX..BIQUAD_AZ
+ * @param sampleFreq Sample frequency in Hz
+ * @param center Notch center frequency in Hz
+ * @param q Quality factor, center frequency over bandwidth
+ */
+void biquad_set_notch(uint8_t stage, uint8_t axis, float sampleFreq, float center, float q)
+{
+    float w0 = 2.0f * (float)M_PI * center / sampleFreq;
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+
+    biquad_set(stage, axis,
+               1.0f, -2.0f * cosw0, 1.0f,
+               1.0f + alpha, -2.0f * cosw0, 1.0f - alpha);
+}
+
+/**
+ * Filter one sample in place.
+ *
+ * @param sample gx, gy, gz, ax, ay, az
+ */
+void biquad_apply(float *sample)
+{
+    vfloat x = {0}, y;
+    uint8_t i;
+
+    memcpy(&x, sample, BIQUAD_AXES * sizeof(float));
+
+    for (i = 0; i < stageCount; i++)
+    {
+        struct biquad_stage *s = &stages[i];
+
+        y = s->b0 * x + s->z1;
+        s->z1 = s->b1 * x - s->a1 * y + s->z2;
+        s->z2 = s->b2 * x - s->a2 * y;
+        x = y;
+    }
+
+    memcpy(sample, &x, BIQUAD_AXES * sizeof(float));
+}
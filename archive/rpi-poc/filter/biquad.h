@@ -0,0 +1,23 @@
+#ifndef __BIQUAD_H_
+#define __BIQUAD_H_
+
+#include <stdint.h>
+
+#define BIQUAD_AXES 6        // gx, gy, gz, ax, ay, az
+#define BIQUAD_MAX_STAGES 4
+
+#define BIQUAD_GX 0
+#define BIQUAD_GY 1
+#define BIQUAD_GZ 2
+#define BIQUAD_AX 3
+#define BIQUAD_AY 4
+#define BIQUAD_AZ 5
+
+void biquad_init();
+void biquad_set_passthrough(uint8_t stage, uint8_t axis);
+void biquad_set_lowpass(uint8_t stage, uint8_t axis, float sampleFreq, float cutoff, float q);
+void biquad_set_notch(uint8_t stage, uint8_t axis, float sampleFreq, float center, float q);
+void biquad_reset();
+void biquad_apply(float *sample);
+
+#endif
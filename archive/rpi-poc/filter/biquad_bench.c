@@ -0,0 +1,185 @@
+/**
+ * Biquad filter bank benchmark.
+ *
+ * Runs a gyro/accel like signal through the vector filter bank and through a
+ * plain per-axis scalar cascade with the same coefficients, checks they agree
+ * and reports the cost of each in ns and, on x86, TSC cycles per sample.
+ *
+ * usage: biquad_bench [samples]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "biquad.h"
+
+#define SAMPLE_FREQ 1000.0f
+#define STAGES 3
+
+struct scalar_stage
+{
+    float b0, b1, b2, a1, a2, z1, z2;
+};
+
+struct scalar_stage scalar[STAGES][BIQUAD_AXES];
+
+void scalar_lowpass(struct scalar_stage *s, float cutoff, float q)
+{
+    float w0 = 2.0f * (float)M_PI * cutoff / SAMPLE_FREQ;
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+    float a0 = 1.0f + alpha;
+
+    s->b0 = (1.0f - cosw0) * 0.5f / a0;
+    s->b1 = (1.0f - cosw0) / a0;
+    s->b2 = s->b0;
+    s->a1 = -2.0f * cosw0 / a0;
+    s->a2 = (1.0f - alpha) / a0;
+}
+
+void scalar_notch(struct scalar_stage *s, float center, float q)
+{
+    float w0 = 2.0f * (float)M_PI * center / SAMPLE_FREQ;
+    float cosw0 = cosf(w0);
+    float alpha = sinf(w0) / (2.0f * q);
+    float a0 = 1.0f + alpha;
+
+    s->b0 = 1.0f / a0;
+    s->b1 = -2.0f * cosw0 / a0;
+    s->b2 = s->b0;
+    s->a1 = s->b1;
+    s->a2 = (1.0f - alpha) / a0;
+}
+
+void scalar_apply(float *sample)
+{
+    int stage, axis;
+
+    for (axis = 0; axis < BIQUAD_AXES; axis++)
+    {
+        float x = sample[axis];
+        for (stage = 0; stage < STAGES; stage++)
+        {
+            struct scalar_stage *s = &scalar[stage][axis];
+            float y = s->b0 * x + s->z1;
+            s->z1 = s->b1 * x - s->a1 * y + s->z2;
+            s->z2 = s->b2 * x - s->a2 * y;
+            x = y;
+        }
+        sample[axis] = x;
+    }
+}
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static unsigned long long cycles()
+{
+#ifdef HAVE_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+int main(int argc, char **argv)
+{
+    long count = argc > 1 ? atol(argv[1]) : 10000000L;
+    float *signal = malloc(1024 * BIQUAD_AXES * sizeof(float));
+    float maxDiff = 0.0f, checksum = 0.0f;
+    double start, vectorTime, scalarTime;
+    unsigned long long startCycles, vectorCycles, scalarCycles;
+    long n;
+    int axis, pass;
+
+    // gyro: 80 Hz low-pass + notch at 170 Hz + 120 Hz low-pass, accel: 2 x 25 Hz low-pass
+    biquad_init();
+    for (axis = 0; axis < BIQUAD_AXES; axis++)
+    {
+        if (axis < 3)
+        {
+            biquad_set_lowpass(0, axis, SAMPLE_FREQ, 80.0f, 0.7071f);
+            biquad_set_notch(1, axis, SAMPLE_FREQ, 170.0f, 3.0f);
+            biquad_set_lowpass(2, axis, SAMPLE_FREQ, 120.0f, 0.7071f);
+            scalar_lowpass(&scalar[0][axis], 80.0f, 0.7071f);
+            scalar_notch(&scalar[1][axis], 170.0f, 3.0f);
+            scalar_lowpass(&scalar[2][axis], 120.0f, 0.7071f);
+        }
+        else
+        {
+            biquad_set_lowpass(0, axis, SAMPLE_FREQ, 25.0f, 0.7071f);
+            biquad_set_lowpass(1, axis, SAMPLE_FREQ, 25.0f, 0.7071f);
+            biquad_set_passthrough(2, axis);
+            scalar_lowpass(&scalar[0][axis], 25.0f, 0.7071f);
+            scalar_lowpass(&scalar[1][axis], 25.0f, 0.7071f);
+            scalar[2][axis].b0 = 1.0f;
+        }
+    }
+
+    for (n = 0; n < 1024; n++)
+    {
+        for (axis = 0; axis < BIQUAD_AXES; axis++)
+            signal[n * BIQUAD_AXES + axis] = 1000.0f * sinf(n * 0.05f * (axis + 1)) + 300.0f * sinf(n * 1.07f);
+    }
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        float vectorSample[BIQUAD_AXES], scalarSample[BIQUAD_AXES];
+
+        start = now();
+        startCycles = cycles();
+        for (n = 0; n < count; n++)
+        {
+            float *in = &signal[(n & 1023) * BIQUAD_AXES];
+            for (axis = 0; axis < BIQUAD_AXES; axis++)
+                vectorSample[axis] = in[axis];
+            biquad_apply(vectorSample);
+            checksum += vectorSample[0];
+        }
+        vectorCycles = cycles() - startCycles;
+        vectorTime = now() - start;
+
+        start = now();
+        startCycles = cycles();
+        for (n = 0; n < count; n++)
+        {
+            float *in = &signal[(n & 1023) * BIQUAD_AXES];
+            for (axis = 0; axis < BIQUAD_AXES; axis++)
+                scalarSample[axis] = in[axis];
+            scalar_apply(scalarSample);
+            checksum += scalarSample[0];
+        }
+        scalarCycles = cycles() - startCycles;
+        scalarTime = now() - start;
+
+        if (pass == 0)
+            continue;
+
+        // both run the same input, so the last outputs must match
+        for (axis = 0; axis < BIQUAD_AXES; axis++)
+            maxDiff = fmaxf(maxDiff, fabsf(vectorSample[axis] - scalarSample[axis]));
+    }
+
+    printf("%d axes, %d stages, %ld samples\n", BIQUAD_AXES, STAGES, count);
+    printf("vector: %6.2f ns/sample", vectorTime / count * 1e9);
+#ifdef HAVE_TSC
+    printf(", %6.1f cycles/sample", (double)vectorCycles / count);
+#endif
+    printf("\nscalar: %6.2f ns/sample", scalarTime / count * 1e9);
+#ifdef HAVE_TSC
+    printf(", %6.1f cycles/sample", (double)scalarCycles / count);
+#endif
+    printf("\nmax difference %g (checksum %g)\n", maxDiff, checksum);
+
+    return maxDiff < 1e-2f ? 0 : 1;
+}
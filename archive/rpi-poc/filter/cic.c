@@ -0,0 +1,90 @@
+/**
+ * CIC decimator for the oversampled gyro.
+ *
+ * Takes the 8 kHz FIFO gyro down to the control rate. CIC_ORDER integrators
+ * run at the input rate, CIC_ORDER combs at the output rate, no multiplies,
+ * and the nulls of the sinc^CIC_ORDER response land on every multiple of the
+ * output rate, which is exactly where the bands that would alias onto DC and
+ * the control band sit. Averaging decimation * CIC_ORDER samples also cuts
+ * white gyro noise by roughly sqrt(decimation).
+ *
+ * The integrators are allowed to wrap: with two's complement arithmetic the
+ * combs take the wrap back out as long as the output fits in 32 bits, i.e.
+ * 16 + CIC_ORDER * log2(decimation) <= 32. The passband droop (about -1.4 dB
+ * at 0.18 of the output rate for order 3) is left to the biquad bank.
+ */
+
+#include <string.h>
+
+#include "cic.h"
+
+uint32_t cicIntegrator[CIC_ORDER][CIC_AXES];
+uint32_t cicComb[CIC_ORDER][CIC_AXES];
+uint8_t cicDecimation = 1, cicPhase = 0;
+float cicGain = 1.0f;
+
+/**
+ * Clear the state and set the rate change.
+ *
+ * @param decimation Input samples per output sample, 1..CIC_MAX_DECIMATION
+ */
+void cic_init(uint8_t decimation)
+{
+    uint8_t i;
+
+    memset(cicIntegrator, 0, sizeof(cicIntegrator));
+    memset(cicComb, 0, sizeof(cicComb));
+    cicPhase = 0;
+
+    if (decimation < 1)
+        decimation = 1;
+    if (decimation > CIC_MAX_DECIMATION)
+        decimation = CIC_MAX_DECIMATION;
+    cicDecimation = decimation;
+
+    // DC gain is decimation ^ CIC_ORDER
+    cicGain = 1.0f;
+    for (i = 0; i < CIC_ORDER; i++)
+        cicGain *= decimation;
+    cicGain = 1.0f / cicGain;
+}
+
+/**
+ * Push one input sample.
+ *
+ * @param gyro gx, gy, gz at the input rate
+ * @param out gx, gy, gz at the output rate, in the input units
+ * @return 1 when out holds a new output sample, 0 otherwise
+ */
+int cic_push(const int16_t *gyro, float *out)
+{
+    uint8_t stage, axis;
+
+    for (axis = 0; axis < CIC_AXES; axis++)
+    {
+        uint32_t x = (uint32_t)(int32_t)gyro[axis];
+        for (stage = 0; stage < CIC_ORDER; stage++)
+        {
+            cicIntegrator[stage][axis] += x;
+            x = cicIntegrator[stage][axis];
+        }
+    }
+
+    if (++cicPhase < cicDecimation)
+        return 0;
+    cicPhase = 0;
+
+    for (axis = 0; axis < CIC_AXES; axis++)
+    {
+        uint32_t x = cicIntegrator[CIC_ORDER - 1][axis];
+        for (stage = 0; stage < CIC_ORDER; stage++)
+        {
+            uint32_t previous = cicComb[stage][axis];
+            cicComb[stage][axis] = x;
+            x -= previous;
+        }
+        out[axis] = (int32_t)x * cicGain;
+    }
+
+    return 1;
+}
@@ -0,0 +1,13 @@
+#ifndef __CIC_H_
+#define __CIC_H_
+
+#include <stdint.h>
+
+#define CIC_ORDER 3          // integrator/comb pairs
+#define CIC_AXES 3           // gx, gy, gz
+#define CIC_MAX_DECIMATION 32  // keeps 16 + CIC_ORDER * log2(decimation) in 32 bits
+
+void cic_init(uint8_t decimation);
+int cic_push(const int16_t *gyro, float *out);
+
+#endif
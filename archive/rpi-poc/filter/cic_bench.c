@@ -0,0 +1,101 @@
+/**
+ * CIC decimator check and benchmark.
+ *
+ * Simulates an 8 kHz gyro with slow body motion, white noise and a motor
+ * vibration that folds into the control band when decimated, then compares
+ * taking every Nth sample (what reading once per loop amounts to) with the
+ * CIC decimator: noise and alias level at the output rate, and cost per
+ * input sample.
+ *
+ * usage: cic_bench [decimation]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "cic.h"
+
+#define INPUT_FREQ 8000.0f
+#define SECONDS 10
+#define MOTION_FREQ 2.0f
+#define MOTION 2000.0f
+#define VIBRATION 600.0f
+#define NOISE 100.0f
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static float gaussian()
+{
+    float u = ((float)rand() + 1.0f) / ((float)RAND_MAX + 2.0f);
+    float v = (float)rand() / RAND_MAX;
+    return sqrtf(-2.0f * logf(u)) * cosf(2.0f * (float)M_PI * v);
+}
+
+int main(int argc, char **argv)
+{
+    int decimation = argc > 1 ? atoi(argv[1]) : 16;
+    long count = (long)(INPUT_FREQ * SECONDS), n, outputs = 0;
+    float outputFreq = INPUT_FREQ / decimation;
+    // lands 20 Hz above a multiple of the output rate, aliases to 20 Hz
+    float vibration = 3.0f * outputFreq + 20.0f;
+    int16_t *input = malloc(count * 3 * sizeof(int16_t));
+    double pickError = 0.0, cicError = 0.0, start, elapsed;
+    float out[CIC_AXES];
+    // a CIC of order N over R samples delays by N * (R - 1) / 2 input samples
+    float delay = CIC_ORDER * (decimation - 1) / 2.0f / INPUT_FREQ;
+    int axis;
+
+    srand(1);
+    for (n = 0; n < count; n++)
+    {
+        float t = n / INPUT_FREQ;
+        for (axis = 0; axis < 3; axis++)
+            input[n * 3 + axis] = lrintf(MOTION * sinf(2.0f * (float)M_PI * MOTION_FREQ * t) +
+                                         VIBRATION * sinf(2.0f * (float)M_PI * vibration * t) +
+                                         NOISE * gaussian());
+    }
+
+    // error against the body motion alone, over the second half
+    for (n = 0; n < count; n += decimation)
+    {
+        float t = n / INPUT_FREQ;
+        float e = input[n * 3] - MOTION * sinf(2.0f * (float)M_PI * MOTION_FREQ * t);
+        if (n >= count / 2)
+            pickError += e * e;
+    }
+
+    cic_init(decimation);
+    start = now();
+    for (n = 0; n < count; n++)
+    {
+        if (cic_push(&input[n * 3], out))
+        {
+            float t = n / INPUT_FREQ - delay;
+            float e = out[0] - MOTION * sinf(2.0f * (float)M_PI * MOTION_FREQ * t);
+            if (n >= count / 2)
+            {
+                cicError += e * e;
+                outputs++;
+            }
+        }
+    }
+    elapsed = now() - start;
+
+    pickError = sqrt(pickError / outputs);
+    cicError = sqrt(cicError / outputs);
+    printf("8 kHz -> %.0f Hz, %.0f Hz vibration aliasing to 20 Hz, white noise %.0f LSB\n",
+           outputFreq, vibration, NOISE);
+    printf("every %dth sample: %7.1f LSB rms error\n", decimation, pickError);
+    printf("cic order %d:      %7.1f LSB rms error (%+.1f dB)\n", CIC_ORDER, cicError,
+           20.0 * log10(cicError / pickError));
+    printf("cic_push: %.1f ns per input sample\n", elapsed / count * 1e9);
+
+    return cicError < pickError ? 0 : 1;
+}
@@ -0,0 +1,317 @@
+/**
+ * Gyro vibration analyzer with dynamic notch tracking.
+ *
+ * The raw gyro is decimated into a ring of SPECTRUM_SIZE samples per axis.
+ * Every SPECTRUM_HOP samples a Hann windowed real FFT of the ring is taken,
+ * the strongest peaks in the search range are picked per axis and the notch
+ * sections of the biquad bank (see biquad.c) are retuned onto them.
+ *
+ * The work is split in a state machine that does one slice per
+ * spectrum_update() call (window, one radix-2 pass, magnitudes, peak search),
+ * so no single loop iteration pays for a whole FFT. The real FFT is done as a
+ * complex FFT of half the size on the even/odd samples, with the three axes
+ * in the lanes of one 4 x float vector.
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "spectrum.h"
+#include "biquad.h"
+
+#define SPECTRUM_HALF (SPECTRUM_SIZE / 2)
+#define SPECTRUM_PEAK_RATIO 4.0f    // peak power over mean power in range
+#define SPECTRUM_SMOOTHING 0.3f     // center frequency low-pass per frame
+#define SPECTRUM_NOTCH_Q 3.0f
+
+// build with -DSPECTRUM_THREAD_LOCAL to give every thread its own tracker,
+// it retunes the biquad bank of the thread it runs on
+#ifdef SPECTRUM_THREAD_LOCAL
+#define SPECTRUM_STATE __thread
+#else
+#define SPECTRUM_STATE
+#endif
+
+typedef float vfloat __attribute__((vector_size(4 * sizeof(float))));
+
+enum spectrum_state
+{
+    SPECTRUM_IDLE,
+    SPECTRUM_WINDOW,
+    SPECTRUM_FFT,
+    SPECTRUM_POWER,
+    SPECTRUM_PEAK
+};
+
+SPECTRUM_STATE vfloat ring[SPECTRUM_SIZE];
+SPECTRUM_STATE vfloat re[SPECTRUM_HALF], im[SPECTRUM_HALF];
+SPECTRUM_STATE vfloat power[SPECTRUM_HALF];
+SPECTRUM_STATE vfloat accumulator;
+
+SPECTRUM_STATE float window[SPECTRUM_SIZE];
+SPECTRUM_STATE float cosTable[SPECTRUM_HALF], sinTable[SPECTRUM_HALF];
+SPECTRUM_STATE uint16_t bitReverse[SPECTRUM_HALF];
+
+SPECTRUM_STATE float center[SPECTRUM_AXES][SPECTRUM_PEAKS];
+SPECTRUM_STATE float filterFreq, binWidth;
+SPECTRUM_STATE uint16_t minBin, maxBin;
+SPECTRUM_STATE uint16_t ringHead = 0, sinceFrame = 0, fftLength;
+SPECTRUM_STATE uint8_t decimation, decimationCount = 0, firstNotchStage;
+SPECTRUM_STATE enum spectrum_state state = SPECTRUM_IDLE;
+
+/**
+ * Set up the tables and start tracking.
+ *
+ * @param sampleFreq Gyro (and biquad bank) sample frequency in Hz
+ * @param decimationFactor Gyro samples averaged into one analyzer sample
+ * @param notchStage First biquad section to retune, SPECTRUM_PEAKS are used
+ */
+void spectrum_init(float sampleFreq, uint8_t decimationFactor, uint8_t notchStage)
+{
+    uint16_t i, j, bits;
+
+    memset(ring, 0, sizeof(ring));
+    memset(center, 0, sizeof(center));
+    ringHead = 0;
+    sinceFrame = 0;
+    decimationCount = 0;
+    accumulator = (vfloat){0};
+    state = SPECTRUM_IDLE;
+
+    filterFreq = sampleFreq;
+    decimation = decimationFactor ? decimationFactor : 1;
+    firstNotchStage = notchStage;
+    binWidth = sampleFreq / decimation / SPECTRUM_SIZE;
+
+    for (i = 0; i < SPECTRUM_SIZE; i++)
+        window[i] = 0.5f - 0.5f * cosf(2.0f * (float)M_PI * i / SPECTRUM_SIZE);
+    for (i = 0; i < SPECTRUM_HALF; i++)
+    {
+        cosTable[i] = cosf(2.0f * (float)M_PI * i / SPECTRUM_SIZE);
+        sinTable[i] = sinf(2.0f * (float)M_PI * i / SPECTRUM_SIZE);
+
+        for (j = 0, bits = 1; bits < SPECTRUM_HALF; bits <<= 1)
+            j = (j << 1) | ((i & bits) ? 1 : 0);
+        bitReverse[i] = j;
+    }
+
+    // skip the frame rotor harmonics below ~40 Hz and the aliased top end
+    spectrum_set_range(40.0f, 0.45f * sampleFreq / decimation);
+}
+
+/**
+ * Limit the peak search to a frequency band.
+ *
+ * @param minFreq Lowest frequency in Hz
+ * @param maxFreq Highest frequency in Hz
+ */
+void spectrum_set_range(float minFreq, float maxFreq)
+{
+    minBin = (uint16_t)(minFreq / binWidth);
+    maxBin = (uint16_t)(maxFreq / binWidth);
+    if (minBin < 1)
+        minBin = 1;
+    if (maxBin > SPECTRUM_HALF - 2)
+        maxBin = SPECTRUM_HALF - 2;
+}
+
+/**
+ * @return Tracked notch center in Hz, 0 until a peak has been seen
+ */
+float spectrum_get_peak(uint8_t axis, uint8_t peak)
+{
+    if (axis >= SPECTRUM_AXES || peak >= SPECTRUM_PEAKS)
+        return 0.0f;
+    return center[axis][peak];
+}
+
+/**
+ * Window the ring, oldest sample first, into the even/odd packed complex
+ * buffer in bit reversed order.
+ */
+static void spectrum_window()
+{
+    uint16_t n, start = ringHead;
+
+    for (n = 0; n < SPECTRUM_HALF; n++)
+    {
+        uint16_t even = (start + 2 * n) & (SPECTRUM_SIZE - 1);
+        uint16_t odd = (start + 2 * n + 1) & (SPECTRUM_SIZE - 1);
+
+        re[bitReverse[n]] = ring[even] * window[2 * n];
+        im[bitReverse[n]] = ring[odd] * window[2 * n + 1];
+    }
+}
+
+/**
+ * One radix-2 decimation in time pass over all butterflies of a length.
+ */
+static void spectrum_fft_pass(uint16_t length)
+{
+    uint16_t half = length / 2;
+    uint16_t step = 2 * (SPECTRUM_HALF / length); // in SPECTRUM_SIZE twiddles
+    uint16_t i, j;
+
+    for (i = 0; i < SPECTRUM_HALF; i += length)
+    {
+        for (j = 0; j < half; j++)
+        {
+            float c = cosTable[j * step], s = sinTable[j * step];
+            uint16_t a = i + j, b = i + j + half;
+            vfloat tr = re[b] * c + im[b] * s;
+            vfloat ti = im[b] * c - re[b] * s;
+
+            re[b] = re[a] - tr;
+            im[b] = im[a] - ti;
+            re[a] += tr;
+            im[a] += ti;
+        }
+    }
+}
+
+/**
+ * Split the half size complex transform into the real spectrum power.
+ */
+static void spectrum_power()
+{
+    uint16_t k;
+
+    for (k = 1; k < SPECTRUM_HALF; k++)
+    {
+        uint16_t m = SPECTRUM_HALF - k;
+        vfloat evenRe = (re[k] + re[m]) * 0.5f;
+        vfloat evenIm = (im[k] - im[m]) * 0.5f;
+        vfloat oddRe = (im[k] + im[m]) * 0.5f;
+        vfloat oddIm = (re[m] - re[k]) * 0.5f;
+        vfloat xr = evenRe + oddRe * cosTable[k] + oddIm * sinTable[k];
+        vfloat xi = evenIm + oddIm * cosTable[k] - oddRe * sinTable[k];
+
+        power[k] = xr * xr + xi * xi;
+    }
+}
+
+/**
+ * Pick the strongest peaks of one axis and move its notches towards them.
+ */
+static void spectrum_track(uint8_t axis)
+{
+    float peakFreq[SPECTRUM_PEAKS], peakPower[SPECTRUM_PEAKS];
+    float mean = 0.0f, tmp;
+    uint16_t k;
+    uint8_t p, found = 0;
+
+    for (k = minBin; k <= maxBin; k++)
+        mean += power[k][axis];
+    mean /= maxBin - minBin + 1;
+
+    for (k = minBin; k <= maxBin; k++)
+    {
+        float left = power[k - 1][axis], mid = power[k][axis], right = power[k + 1][axis];
+        float curve, delta;
+
+        if (mid <= left || mid < right || mid < SPECTRUM_PEAK_RATIO * mean)
+            continue;
+
+        // keep the SPECTRUM_PEAKS strongest, sorted by power
+        if (found == SPECTRUM_PEAKS)
+        {
+            if (mid <= peakPower[SPECTRUM_PEAKS - 1])
+                continue;
+            found--;
+        }
+        for (p = found; p > 0 && peakPower[p - 1] < mid; p--)
+        {
+            peakPower[p] = peakPower[p - 1];
+            peakFreq[p] = peakFreq[p - 1];
+        }
+
+        // parabolic interpolation between bins
+        curve = left - 2.0f * mid + right;
+        delta = curve < 0.0f ? 0.5f * (left - right) / curve : 0.0f;
+        peakPower[p] = mid;
+        peakFreq[p] = (k + delta) * binWidth;
+        found++;
+    }
+
+    // assign by frequency so a notch doesn't jump between two peaks, a lone
+    // peak goes to the nearest notch already tracking
+#if SPECTRUM_PEAKS > 1
+    if (found == 2 && peakFreq[0] > peakFreq[1])
+    {
+        tmp = peakFreq[0];
+        peakFreq[0] = peakFreq[1];
+        peakFreq[1] = tmp;
+    }
+#endif
+    for (p = 0; p < found; p++)
+    {
+        uint8_t notch = p;
+        float *c;
+
+#if SPECTRUM_PEAKS > 1
+        if (found == 1 && center[axis][1] != 0.0f &&
+            fabsf(peakFreq[0] - center[axis][1]) < fabsf(peakFreq[0] - center[axis][0]))
+            notch = 1;
+#endif
+
+        c = &center[axis][notch];
+        if (*c == 0.0f)
+            *c = peakFreq[p];
+        else
+            *c += SPECTRUM_SMOOTHING * (peakFreq[p] - *c);
+
+        biquad_set_notch(firstNotchStage + notch, BIQUAD_GX + axis, filterFreq, *c, SPECTRUM_NOTCH_Q);
+    }
+}
+
+/**
+ * Feed one gyro sample and do the next slice of analysis work.
+ *
+ * @param gyro gx, gy, gz before filtering, so the notches don't hide the
+ *             peaks they track
+ */
+void spectrum_update(const float *gyro)
+{
+    uint8_t axis;
+
+    accumulator += (vfloat){gyro[0], gyro[1], gyro[2], 0.0f};
+    if (++decimationCount >= decimation)
+    {
+        ring[ringHead] = accumulator / (float)decimation;
+        ringHead = (ringHead + 1) & (SPECTRUM_SIZE - 1);
+        accumulator = (vfloat){0};
+        decimationCount = 0;
+        sinceFrame++;
+    }
+
+    switch (state)
+    {
+    case SPECTRUM_IDLE:
+        if (sinceFrame >= SPECTRUM_HOP)
+        {
+            sinceFrame = 0;
+            state = SPECTRUM_WINDOW;
+        }
+        break;
+    case SPECTRUM_WINDOW:
+        spectrum_window();
+        fftLength = 2;
+        state = SPECTRUM_FFT;
+        break;
+    case SPECTRUM_FFT:
+        spectrum_fft_pass(fftLength);
+        fftLength <<= 1;
+        if (fftLength > SPECTRUM_HALF)
+            state = SPECTRUM_POWER;
+        break;
+    case SPECTRUM_POWER:
+        spectrum_power();
+        state = SPECTRUM_PEAK;
+        break;
+    case SPECTRUM_PEAK:
+        for (axis = 0; axis < SPECTRUM_AXES; axis++)
+            spectrum_track(axis);
+        state = SPECTRUM_IDLE;
+        break;
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __SPECTRUM_H_
+#define __SPECTRUM_H_
+
+#include <stdint.h>
+
+#define SPECTRUM_SIZE 256    // real samples per frame, power of two
+#define SPECTRUM_HOP 64      // new frame every SPECTRUM_HOP decimated samples
+#define SPECTRUM_PEAKS 2     // notches tracked per gyro axis, at most 2
+#define SPECTRUM_AXES 3      // gx, gy, gz
+
+void spectrum_init(float sampleFreq, uint8_t decimation, uint8_t notchStage);
+void spectrum_set_range(float minFreq, float maxFreq);
+void spectrum_update(const float *gyro);
+float spectrum_get_peak(uint8_t axis, uint8_t peak);
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * Vibration analyzer check and benchmark.
+ *
+ * Feeds a synthetic gyro signal, slow body motion plus motor tones and noise,
+ * through the analyzer and the biquad bank for a few seconds, prints the
+ * notch centers it settled on, the tone attenuation and the cost of
+ * spectrum_update(), worst case included since that is what the control loop
+ * has to budget for.
+ *
+ * usage: spectrum_bench [seconds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "biquad.h"
+#include "spectrum.h"
+
+#define SAMPLE_FREQ 1000.0f
+#define DECIMATION 2
+#define NOTCH_STAGE 1
+
+// two motor tones per axis, Hz
+const float tones[SPECTRUM_AXES][SPECTRUM_PEAKS] = {{170.0f, 0.0f}, {135.0f, 205.0f}, {110.0f, 190.0f}};
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+int main(int argc, char **argv)
+{
+    float seconds = argc > 1 ? atof(argv[1]) : 5.0f;
+    long count = (long)(seconds * SAMPLE_FREQ), n;
+    double total = 0.0, worst = 0.0, start, elapsed;
+    float toneIn[SPECTRUM_AXES] = {0}, toneOut[SPECTRUM_AXES] = {0};
+    int axis, p, failed = 0;
+
+    srand(1);
+    biquad_init();
+    for (axis = 0; axis < BIQUAD_AXES; axis++)
+        biquad_set_lowpass(0, axis, SAMPLE_FREQ, 250.0f, 0.7071f);
+    spectrum_init(SAMPLE_FREQ, DECIMATION, NOTCH_STAGE);
+
+    for (n = 0; n < count; n++)
+    {
+        float t = n / SAMPLE_FREQ;
+        float sample[BIQUAD_AXES] = {0};
+        float tone[SPECTRUM_AXES];
+
+        for (axis = 0; axis < SPECTRUM_AXES; axis++)
+        {
+            tone[axis] = 0.0f;
+            for (p = 0; p < SPECTRUM_PEAKS; p++)
+            {
+                if (tones[axis][p] > 0.0f)
+                    tone[axis] += 20.0f * sinf(2.0f * (float)M_PI * tones[axis][p] * t);
+            }
+            sample[axis] = 50.0f * sinf(2.0f * (float)M_PI * 0.7f * (axis + 1) * t) + tone[axis] +
+                           4.0f * ((float)rand() / RAND_MAX - 0.5f);
+        }
+
+        start = now();
+        spectrum_update(sample);
+        elapsed = now() - start;
+        total += elapsed;
+        if (elapsed > worst)
+            worst = elapsed;
+
+        biquad_apply(sample);
+
+        // tone power in and out over the last second, body motion removed
+        if (n >= count - (long)SAMPLE_FREQ)
+        {
+            for (axis = 0; axis < SPECTRUM_AXES; axis++)
+            {
+                float out = sample[axis] - 50.0f * sinf(2.0f * (float)M_PI * 0.7f * (axis + 1) * t);
+                toneIn[axis] += tone[axis] * tone[axis];
+                toneOut[axis] += out * out;
+            }
+        }
+    }
+
+    for (axis = 0; axis < SPECTRUM_AXES; axis++)
+    {
+        printf("axis %d notches", axis);
+        for (p = 0; p < SPECTRUM_PEAKS; p++)
+        {
+            float tracked = spectrum_get_peak(axis, p);
+            float expected = tones[axis][p] > 0.0f ? tones[axis][p] : tones[axis][0];
+
+            printf(" %6.1f Hz (tone %5.1f)", tracked, tones[axis][p]);
+            if (tones[axis][p] > 0.0f && fabsf(tracked - expected) > 3.0f)
+                failed = 1;
+        }
+        printf(", tones %+.1f dB\n", 10.0f * log10f(toneOut[axis] / toneIn[axis]));
+    }
+    printf("spectrum_update: %.0f ns mean, %.0f ns worst over %ld samples\n",
+           total / count * 1e9, worst * 1e9, count);
+
+    return failed;
+}
@@ -59,6 +59,7 @@ int8_t read_byte(uint8_t dev_addr, uint8_t reg_addr, uint8_t *data);
 int8_t read_word(uint8_t dev_addr, uint8_t reg_addr, uint16_t *data);
 int8_t read_bytes(uint8_t dev_addr, uint8_t reg_addr, uint8_t length, uint8_t *data);
 int8_t read_words(uint8_t dev_addr, uint8_t reg_addr, uint8_t length, uint16_t *data);
+int read_block(uint8_t dev_addr, uint8_t reg_addr, uint16_t length, uint8_t *data);
 
 int write_bit(uint8_t dev_addr, uint8_t reg_addr, uint8_t bit_num, uint8_t data);
 int write_bit_word(uint8_t dev_addr, uint8_t reg_addr, uint8_t bit_num, uint16_t data);
@@ -0,0 +1,324 @@
+/**
+ * Asynchronous buffered file writer for the acquisition loop.
+ *
+ * The caller fills one of bufferCount page aligned buffers; a full buffer is
+ * handed to an I/O thread and the caller goes on in the next one. The hot
+ * path is a memcpy and, once per buffer, two atomic stores and a semaphore
+ * post. The I/O thread writes whole buffers at buffer aligned offsets (so
+ * O_DIRECT works where the filesystem has it) and keeps the file
+ * preallocated ASYNC_WRITER_PREALLOCATE bytes ahead with fallocate(), so
+ * block allocation never happens in the middle of a burst.
+ *
+ * Buffers are used in a fixed ring: the caller owns buffer filled, the I/O
+ * thread the ones from written to filled - 1. When a slow disk lets all of
+ * them queue up, a write is dropped whole, never split, and counted; the
+ * queue depth is bounded by bufferCount and the loop never blocks. Offline
+ * tools that produce faster than any disk open with ASYNC_WRITER_WAIT and
+ * wait for a buffer instead.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "async_writer.h"
+
+struct async_writer
+{
+    int fd;
+    int direct;
+    int wait;
+    size_t bufferSize;
+    unsigned int bufferCount;
+    uint8_t *buffers;
+    size_t fill;             // bytes in the caller's buffer
+    unsigned long filled;    // buffers handed to the I/O thread
+    unsigned long written;   // buffers the I/O thread is done with
+    uint64_t offset;         // file offset of the next buffer, I/O thread only
+    uint64_t allocated;      // preallocated up to, I/O thread only
+    int closing;
+    int failed;
+    async_writer_pwrite pwrite;
+    pthread_t thread;
+    sem_t wake;
+    sem_t space;             // posted per buffer written, ASYNC_WRITER_WAIT only
+    struct async_writer_stats stats;
+};
+
+static uint64_t async_writer_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static int async_writer_put(struct async_writer *writer, const uint8_t *data, size_t size, uint64_t offset)
+{
+    while (size > 0)
+    {
+        ssize_t done = writer->pwrite(writer->fd, data, size, offset);
+
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done <= 0)
+            return -1;
+        data += done;
+        size -= done;
+        offset += done;
+    }
+    return 0;
+}
+
+static void *async_writer_run(void *arg)
+{
+    struct async_writer *writer = arg;
+
+    while (1)
+    {
+        unsigned long filled;
+
+        sem_wait(&writer->wake);
+        while (writer->written != (filled = __atomic_load_n(&writer->filled, __ATOMIC_ACQUIRE)))
+        {
+            uint8_t *buffer = writer->buffers + (writer->written % writer->bufferCount) * writer->bufferSize;
+            uint64_t start, elapsed;
+
+            // stay ahead of the data, KEEP_SIZE so readers never see the
+            // reserved space as records
+            if (writer->offset + writer->bufferSize > writer->allocated)
+            {
+                if (fallocate(writer->fd, FALLOC_FL_KEEP_SIZE, writer->allocated, ASYNC_WRITER_PREALLOCATE) == 0)
+                    writer->allocated += ASYNC_WRITER_PREALLOCATE;
+                else
+                    writer->allocated = UINT64_MAX; // not supported here, stop trying
+            }
+
+            start = async_writer_now();
+            if (!writer->failed && async_writer_put(writer, buffer, writer->bufferSize, writer->offset) < 0)
+            {
+                fprintf(stderr, "Failed to write log buffer: %s\n", strerror(errno));
+                writer->failed = 1;
+            }
+            elapsed = async_writer_now() - start;
+
+            if (elapsed > writer->stats.max_write_ns)
+                __atomic_store_n(&writer->stats.max_write_ns, elapsed, __ATOMIC_RELAXED);
+            if (!writer->failed)
+            {
+                writer->offset += writer->bufferSize;
+                __atomic_add_fetch(&writer->stats.buffers_written, 1, __ATOMIC_RELAXED);
+                __atomic_add_fetch(&writer->stats.bytes_written, writer->bufferSize, __ATOMIC_RELAXED);
+            }
+
+            // hand the buffer back to the caller
+            __atomic_store_n(&writer->written, writer->written + 1, __ATOMIC_RELEASE);
+            if (writer->wait)
+                sem_post(&writer->space);
+        }
+
+        if (__atomic_load_n(&writer->closing, __ATOMIC_ACQUIRE) &&
+            writer->written == __atomic_load_n(&writer->filled, __ATOMIC_ACQUIRE))
+            break;
+    }
+    return NULL;
+}
+
+/**
+ * Create a file and start its I/O thread.
+ *
+ * @param path File path, truncated if it exists
+ * @param bufferSize Size of each buffer, rounded up to ASYNC_WRITER_ALIGN
+ * @param bufferCount Number of buffers, at least 2
+ * @param flags ASYNC_WRITER_DIRECT, ASYNC_WRITER_WAIT
+ * @return Writer, NULL on failure
+ */
+struct async_writer *async_writer_open(const char *path, size_t bufferSize, unsigned int bufferCount, int flags)
+{
+    struct async_writer *writer = calloc(1, sizeof(*writer));
+
+    if (!writer)
+        return NULL;
+
+    writer->bufferSize = (bufferSize + ASYNC_WRITER_ALIGN - 1) & ~(size_t)(ASYNC_WRITER_ALIGN - 1);
+    writer->bufferCount = bufferCount < 2 ? 2 : bufferCount;
+    writer->wait = (flags & ASYNC_WRITER_WAIT) != 0;
+    writer->pwrite = pwrite;
+
+    // O_DIRECT is refused by some filesystems (tmpfs), the page cache is
+    // the fallback
+    writer->fd = -1;
+    if (flags & ASYNC_WRITER_DIRECT)
+    {
+        writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+        writer->direct = writer->fd >= 0;
+    }
+    if (writer->fd < 0)
+        writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (writer->fd < 0)
+    {
+        fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+        free(writer);
+        return NULL;
+    }
+    writer->stats.direct = writer->direct;
+
+    if (posix_memalign((void **)&writer->buffers, ASYNC_WRITER_ALIGN, writer->bufferSize * writer->bufferCount) != 0)
+    {
+        fprintf(stderr, "Failed to allocate buffers for %s\n", path);
+        close(writer->fd);
+        free(writer);
+        return NULL;
+    }
+    // touch the buffers now, not on the first pass of the loop
+    memset(writer->buffers, 0, writer->bufferSize * writer->bufferCount);
+
+    sem_init(&writer->wake, 0, 0);
+    sem_init(&writer->space, 0, 0);
+    if (pthread_create(&writer->thread, NULL, async_writer_run, writer) != 0)
+    {
+        fprintf(stderr, "Failed to start the writer of %s\n", path);
+        sem_destroy(&writer->wake);
+        sem_destroy(&writer->space);
+        close(writer->fd);
+        free(writer->buffers);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+/**
+ * Append data, never blocks unless opened with ASYNC_WRITER_WAIT. The data
+ * goes in whole or, when every buffer is waiting for the disk, not at all.
+ *
+ * @param writer Writer
+ * @param data Data to append
+ * @param size Its size
+ * @return 0 on success, -1 if the data was dropped
+ */
+int async_writer_write(struct async_writer *writer, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    unsigned long handOff = (writer->fill + size) / writer->bufferSize;
+    unsigned long written = __atomic_load_n(&writer->written, __ATOMIC_ACQUIRE);
+
+    // the buffer the caller ends up in must be free as well
+    while (writer->wait && handOff < writer->bufferCount && writer->filled + handOff - written >= writer->bufferCount)
+    {
+        sem_wait(&writer->space);
+        written = __atomic_load_n(&writer->written, __ATOMIC_ACQUIRE);
+    }
+    if (writer->filled + handOff - written >= writer->bufferCount)
+    {
+        __atomic_add_fetch(&writer->stats.dropped_writes, 1, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&writer->stats.dropped_bytes, size, __ATOMIC_RELAXED);
+        return -1;
+    }
+
+    while (size > 0)
+    {
+        uint8_t *buffer = writer->buffers + (writer->filled % writer->bufferCount) * writer->bufferSize;
+        size_t chunk = writer->bufferSize - writer->fill;
+
+        if (chunk > size)
+            chunk = size;
+        memcpy(buffer + writer->fill, bytes, chunk);
+        writer->fill += chunk;
+        bytes += chunk;
+        size -= chunk;
+
+        if (writer->fill == writer->bufferSize)
+        {
+            unsigned int depth = writer->filled + 1 - written;
+
+            writer->fill = 0;
+            __atomic_store_n(&writer->filled, writer->filled + 1, __ATOMIC_RELEASE);
+            __atomic_store_n(&writer->stats.queue_depth, depth, __ATOMIC_RELAXED);
+            if (depth > writer->stats.max_queue_depth)
+                __atomic_store_n(&writer->stats.max_queue_depth, depth, __ATOMIC_RELAXED);
+            sem_post(&writer->wake);
+        }
+    }
+    return 0;
+}
+
+/**
+ * Read the counters.
+ */
+void async_writer_get_stats(struct async_writer *writer, struct async_writer_stats *stats)
+{
+    stats->buffers_written = __atomic_load_n(&writer->stats.buffers_written, __ATOMIC_RELAXED);
+    stats->bytes_written = __atomic_load_n(&writer->stats.bytes_written, __ATOMIC_RELAXED);
+    stats->dropped_writes = __atomic_load_n(&writer->stats.dropped_writes, __ATOMIC_RELAXED);
+    stats->dropped_bytes = __atomic_load_n(&writer->stats.dropped_bytes, __ATOMIC_RELAXED);
+    stats->queue_depth = __atomic_load_n(&writer->filled, __ATOMIC_RELAXED) -
+                         __atomic_load_n(&writer->written, __ATOMIC_RELAXED);
+    stats->max_queue_depth = __atomic_load_n(&writer->stats.max_queue_depth, __ATOMIC_RELAXED);
+    stats->max_write_ns = __atomic_load_n(&writer->stats.max_write_ns, __ATOMIC_RELAXED);
+    stats->direct = writer->direct;
+}
+
+/**
+ * Replace the write function of the I/O thread, for testing against a slow
+ * or failing disk. Call right after async_writer_open().
+ */
+void async_writer_set_pwrite(struct async_writer *writer, async_writer_pwrite function)
+{
+    writer->pwrite = function;
+}
+
+/**
+ * Write everything queued and the last partial buffer, release the
+ * preallocated space past the end and close the file.
+ *
+ * @return 0 if everything written made it to the file, -1 otherwise
+ */
+int async_writer_close(struct async_writer *writer)
+{
+    uint8_t *buffer;
+    size_t size;
+    int result;
+
+    __atomic_store_n(&writer->closing, 1, __ATOMIC_RELEASE);
+    sem_post(&writer->wake);
+    pthread_join(writer->thread, NULL);
+
+    // O_DIRECT writes whole aligned blocks, the padding is cut off after
+    buffer = writer->buffers + (writer->filled % writer->bufferCount) * writer->bufferSize;
+    size = writer->direct ? (writer->fill + ASYNC_WRITER_ALIGN - 1) & ~(size_t)(ASYNC_WRITER_ALIGN - 1) : writer->fill;
+    memset(buffer + writer->fill, 0, size - writer->fill);
+    if (!writer->failed && size > 0 && async_writer_put(writer, buffer, size, writer->offset) < 0)
+    {
+        fprintf(stderr, "Failed to write log buffer: %s\n", strerror(errno));
+        writer->failed = 1;
+    }
+    if (!writer->failed)
+    {
+        writer->offset += writer->fill;
+        writer->stats.bytes_written += writer->fill;
+        if (ftruncate(writer->fd, writer->offset) < 0)
+            writer->failed = 1;
+        if (writer->allocated != UINT64_MAX && writer->allocated > writer->offset)
+            fallocate(writer->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                      writer->offset, writer->allocated - writer->offset);
+    }
+
+    result = writer->failed ? -1 : 0;
+    if (fdatasync(writer->fd) < 0 && errno != EINVAL)
+        result = -1;
+    close(writer->fd);
+    sem_destroy(&writer->wake);
+    sem_destroy(&writer->space);
+    free(writer->buffers);
+    free(writer);
+    return result;
+}
@@ -0,0 +1,43 @@
+#ifndef __ASYNC_WRITER_H_
+#define __ASYNC_WRITER_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define ASYNC_WRITER_ALIGN 4096                      // buffer and O_DIRECT alignment
+#define ASYNC_WRITER_PREALLOCATE (16 * 1024 * 1024)  // reserved ahead of the data
+
+// open flags
+#define ASYNC_WRITER_DIRECT 0x01 // bypass the page cache if the filesystem allows it
+#define ASYNC_WRITER_WAIT 0x02   // block when every buffer is queued instead of dropping, for offline tools
+
+/**
+ * Counters of one writer, safe to read while it runs.
+ */
+struct async_writer_stats
+{
+    uint64_t buffers_written;
+    uint64_t bytes_written;
+    uint64_t dropped_writes;       // writes thrown away because every buffer was queued
+    uint64_t dropped_bytes;
+    unsigned int queue_depth;      // full buffers waiting for the disk
+    unsigned int max_queue_depth;
+    uint64_t max_write_ns;         // slowest single write() on the I/O thread
+    int direct;                    // O_DIRECT is in use
+};
+
+/**
+ * Write function of the I/O thread, pwrite() unless replaced for tests.
+ */
+typedef ssize_t (*async_writer_pwrite)(int fd, const void *data, size_t size, off_t offset);
+
+struct async_writer;
+
+struct async_writer *async_writer_open(const char *path, size_t bufferSize, unsigned int bufferCount, int flags);
+int async_writer_write(struct async_writer *writer, const void *data, size_t size);
+void async_writer_get_stats(struct async_writer *writer, struct async_writer_stats *stats);
+void async_writer_set_pwrite(struct async_writer *writer, async_writer_pwrite function);
+int async_writer_close(struct async_writer *writer);
+
+#endif
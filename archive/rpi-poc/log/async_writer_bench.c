@@ -0,0 +1,192 @@
+/**
+ * Async log writer benchmark against a fake slow disk.
+ *
+ * Writes 32 byte records at a fixed rate, the way the acquisition loop
+ * does, first through a synchronous 64 kB buffer that calls write() inline
+ * when full (what stdio does), then through the async writer. The disk is
+ * a real file behind a pwrite() that sleeps to a given bandwidth and stalls
+ * now and then, the way an SD card does while it erases. Reports the
+ * latency of the record write call as seen by the loop, and the drops.
+ *
+ * usage: async_writer_bench [-r rate_hz] [-t seconds] [-w disk_kB_per_s]
+ *                           [-s stall_ms] [-e stall_every] [-n buffers] [file]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+
+#include "async_writer.h"
+#include "sensor_log.h"
+
+#define BUFFER_SIZE (64 * 1024)
+
+double diskBandwidth = 1024.0 * 1024.0; // bytes/s
+long stallMs = 250;
+long stallEvery = 16;
+unsigned long diskWrites = 0;
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void sleep_ns(uint64_t ns)
+{
+    struct timespec t = {ns / 1000000000ULL, ns % 1000000000ULL};
+
+    while (nanosleep(&t, &t) != 0)
+        ;
+}
+
+/**
+ * The fake slow disk: real write, then wait out the bandwidth and the
+ * occasional erase stall.
+ */
+static ssize_t slow_pwrite(int fd, const void *data, size_t size, off_t offset)
+{
+    ssize_t done = pwrite(fd, data, size, offset);
+    unsigned long count = __atomic_add_fetch(&diskWrites, 1, __ATOMIC_RELAXED);
+
+    sleep_ns((uint64_t)(size / diskBandwidth * 1e9));
+    if (stallEvery > 0 && count % stallEvery == 0)
+        sleep_ns(stallMs * 1000000ULL);
+    return done;
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t *latency, size_t count, unsigned long long dropped)
+{
+    qsort(latency, count, sizeof(*latency), compare);
+    printf("%-6s p50 %7.2f us  p99 %7.2f us  p99.9 %9.2f us  max %9.2f us  dropped %llu\n", name,
+           latency[count / 2] * 1e-3, latency[count * 99 / 100] * 1e-3,
+           latency[count * 999 / 1000] * 1e-3, latency[count - 1] * 1e-3, dropped);
+}
+
+int main(int argc, char **argv)
+{
+    const char *path = "/tmp/async_writer_bench.ilog";
+    double rate = 8000.0, seconds = 5.0;
+    unsigned int buffers = 8;
+    struct sensor_log_record record;
+    struct async_writer_stats stats;
+    struct async_writer *writer;
+    static uint8_t syncBuffer[BUFFER_SIZE];
+    uint64_t *latency, period, next;
+    size_t count, i, fill = 0;
+    off_t offset = 0;
+    int fd, opt;
+
+    while ((opt = getopt(argc, argv, "r:t:w:s:e:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'w':
+            diskBandwidth = atof(optarg) * 1024.0;
+            break;
+        case 's':
+            stallMs = atol(optarg);
+            break;
+        case 'e':
+            stallEvery = atol(optarg);
+            break;
+        case 'n':
+            buffers = atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-t seconds] [-w disk_kB_per_s] "
+                            "[-s stall_ms] [-e stall_every] [-n buffers] [file]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind < argc)
+        path = argv[optind];
+
+    count = (size_t)(rate * seconds);
+    period = (uint64_t)(1e9 / rate);
+    latency = malloc(count * sizeof(*latency));
+    if (!latency || count == 0)
+        return 1;
+    memset(&record, 0, sizeof(record));
+
+    printf("%zu records at %.0f Hz (%.0f kB/s), disk %.0f kB/s with a %ld ms stall every %ld writes\n",
+           count, rate, rate * sizeof(record) / 1024.0, diskBandwidth / 1024.0, stallMs, stallEvery);
+
+    // synchronous: the loop pays for the disk every BUFFER_SIZE bytes
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror(path);
+        return 1;
+    }
+    next = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        uint64_t start;
+
+        next += period;
+        record.time = next;
+        start = now_ns();
+        memcpy(syncBuffer + fill, &record, sizeof(record));
+        fill += sizeof(record);
+        if (fill == sizeof(syncBuffer))
+        {
+            slow_pwrite(fd, syncBuffer, fill, offset);
+            offset += fill;
+            fill = 0;
+        }
+        latency[i] = now_ns() - start;
+
+        // a late loop catches up, as the real one would
+        if (now_ns() < next)
+            sleep_ns(next - now_ns());
+    }
+    close(fd);
+    report("sync", latency, count, 0);
+
+    // async: the loop only copies, the I/O thread pays for the disk
+    writer = async_writer_open(path, BUFFER_SIZE, buffers, ASYNC_WRITER_DIRECT);
+    if (!writer)
+        return 1;
+    async_writer_set_pwrite(writer, slow_pwrite);
+    next = now_ns();
+    for (i = 0; i < count; i++)
+    {
+        uint64_t start;
+
+        next += period;
+        record.time = next;
+        start = now_ns();
+        async_writer_write(writer, &record, sizeof(record));
+        latency[i] = now_ns() - start;
+
+        if (now_ns() < next)
+            sleep_ns(next - now_ns());
+    }
+    async_writer_get_stats(writer, &stats);
+    report("async", latency, count, (unsigned long long)stats.dropped_writes);
+    printf("async: %u x %d kB buffers, max queue depth %u, slowest disk write %.1f ms, O_DIRECT %s\n",
+           buffers, BUFFER_SIZE / 1024, stats.max_queue_depth, stats.max_write_ns * 1e-6,
+           stats.direct ? "yes" : "no");
+    async_writer_close(writer);
+
+    free(latency);
+    return 0;
+}
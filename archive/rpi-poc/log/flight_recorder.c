@@ -0,0 +1,282 @@
+/**
+ * In-RAM flight recorder.
+ *
+ * Keeps the last FLIGHT_RECORDER_SAMPLES raw samples and estimator states in
+ * a ring allocated at start. The acquisition loop writes one entry per sample
+ * with no allocation, no lock and no syscall. When a trigger fires (detected
+ * here on every sample, or flight_recorder_trigger()) recording goes on for
+ * FLIGHT_RECORDER_POST samples, then the ring freezes and a flusher thread is
+ * woken to save it, so the seconds before and after the event end up on disk
+ * while the loop never waits for storage.
+ *
+ * The loop and the flusher only share the ring, the frozen flag and a
+ * semaphore. While frozen the loop skips the ring, the flusher copies it out
+ * and unfreezes before writing, so the gap is a memcpy long.
+ *
+ * After a dump the recorder stays disarmed for FLIGHT_RECORDER_HOLDOFF
+ * samples, so the next dump holds none of the samples of the previous one,
+ * and after FLIGHT_RECORDER_MAX_DUMPS it stays disarmed for the rest of the
+ * run: a trigger that keeps firing, a saturated sensor or a dead bus, costs
+ * a bounded amount of disk and flusher time.
+ *
+ * A dump is a regular sensor log, flight-N.ilog, readable by logdump and
+ * replay, next to flight-N.state with the estimator state of each sample.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "flight_recorder.h"
+
+#define SATURATION_LIMIT 32000
+#define I2C_ERROR_BURST 8 // errors within I2C_ERROR_WINDOW samples
+#define I2C_ERROR_WINDOW 64
+#define ATTITUDE_JUMP 0.1f // rad between two samples, ~3000 deg/s at 512 Hz
+
+struct flight_record *recorderRing = NULL;
+struct flight_record *recorderSnapshot = NULL;
+unsigned long recorderHead = 0; // entries ever written
+unsigned long recorderPost = 0; // samples left before freezing
+unsigned long recorderHoldoff = 0; // samples left before re-arming
+unsigned long recorderFreezes = 0; // dumps started, loop side
+unsigned long recorderDumps = 0;
+uint8_t recorderPendingReason = 0, recorderArmed = 0;
+int recorderFrozen = 0; // set by the loop, cleared by the flusher
+int recorderRunning = 0;
+uint8_t recorderGap = 0; // samples were skipped while frozen
+unsigned int recorderI2cErrors = 0;
+float recorderPreviousQ[4] = {1.0f, 0.0f, 0.0f, 0.0f};
+
+const char *recorderDirectory;
+struct sensor_log_header recorderHeader;
+uint8_t recorderReason;
+pthread_t recorderFlusher;
+sem_t recorderFlushRequest;
+
+static void flight_recorder_save(unsigned long count, unsigned long first)
+{
+    char path[512];
+    FILE *log, *state;
+    unsigned long i;
+
+    snprintf(path, sizeof(path), "%s/flight-%lu.ilog", recorderDirectory, recorderDumps);
+    log = fopen(path, "wb");
+    snprintf(path, sizeof(path), "%s/flight-%lu.state", recorderDirectory, recorderDumps);
+    state = fopen(path, "w");
+    if (!log || !state)
+    {
+        perror(path);
+        if (log)
+            fclose(log);
+        if (state)
+            fclose(state);
+        return;
+    }
+
+    fwrite(&recorderHeader, sizeof(recorderHeader), 1, log);
+    fprintf(state, "# trigger %#x, time q0 q1 q2 q3 integral_fb_x integral_fb_y integral_fb_z\n", recorderReason);
+    for (i = 0; i < count; i++)
+    {
+        const struct flight_record *r = &recorderSnapshot[(first + i) & (FLIGHT_RECORDER_SAMPLES - 1)];
+
+        fwrite(&r->raw, sizeof(r->raw), 1, log);
+        fprintf(state, "%llu\t%.7f\t%.7f\t%.7f\t%.7f\t%.7g\t%.7g\t%.7g\n",
+                (unsigned long long)r->raw.time, r->q[0], r->q[1], r->q[2], r->q[3],
+                r->integral_fb[0], r->integral_fb[1], r->integral_fb[2]);
+    }
+
+    fclose(log);
+    fclose(state);
+    fprintf(stderr, "flight recorder: trigger %#x, %lu samples saved to %s/flight-%lu.*\n",
+            recorderReason, count, recorderDirectory, recorderDumps);
+}
+
+static void *flight_recorder_flush(void *arg)
+{
+    (void)arg;
+
+    while (1)
+    {
+        unsigned long head, count;
+
+        sem_wait(&recorderFlushRequest);
+        if (!__atomic_load_n(&recorderFrozen, __ATOMIC_ACQUIRE))
+        {
+            if (!__atomic_load_n(&recorderRunning, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+
+        // the loop does not touch the ring while frozen
+        head = recorderHead;
+        count = head < FLIGHT_RECORDER_SAMPLES ? head : FLIGHT_RECORDER_SAMPLES;
+        memcpy(recorderSnapshot, recorderRing, sizeof(*recorderRing) * FLIGHT_RECORDER_SAMPLES);
+        __atomic_store_n(&recorderFrozen, 0, __ATOMIC_RELEASE);
+
+        flight_recorder_save(count, head - count);
+        __atomic_add_fetch(&recorderDumps, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+/**
+ * Allocate the ring and start the flusher thread.
+ *
+ * @param directory Where dumps are written
+ * @param header Header for the dumped logs, ranges and rates
+ * @return 0 on success, -1 on failure
+ */
+int flight_recorder_start(const char *directory, const struct sensor_log_header *header)
+{
+    recorderRing = calloc(FLIGHT_RECORDER_SAMPLES, sizeof(*recorderRing));
+    recorderSnapshot = calloc(FLIGHT_RECORDER_SAMPLES, sizeof(*recorderSnapshot));
+    if (!recorderRing || !recorderSnapshot)
+    {
+        fprintf(stderr, "flight recorder: out of memory\n");
+        return -1;
+    }
+
+    recorderDirectory = directory;
+    recorderHeader = *header;
+    recorderHead = 0;
+    recorderPost = 0;
+    recorderHoldoff = 0;
+    recorderFreezes = 0;
+    recorderArmed = 1;
+    recorderFrozen = 0;
+    recorderRunning = 1;
+    sem_init(&recorderFlushRequest, 0, 0);
+
+    if (pthread_create(&recorderFlusher, NULL, flight_recorder_flush, NULL) != 0)
+    {
+        fprintf(stderr, "flight recorder: failed to start the flusher\n");
+        recorderRunning = 0;
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Fire a trigger, the ring freezes FLIGHT_RECORDER_POST samples later.
+ * Ignored while a previous dump is still pending, during the hold-off after
+ * it and once FLIGHT_RECORDER_MAX_DUMPS dumps were made.
+ *
+ * @param reason FLIGHT_RECORDER_* trigger reason
+ */
+void flight_recorder_trigger(uint8_t reason)
+{
+    if (!recorderArmed)
+        return;
+
+    recorderArmed = 0;
+    recorderPendingReason = reason;
+    recorderPost = FLIGHT_RECORDER_POST;
+}
+
+static uint8_t flight_recorder_check(const struct sensor_log_record *raw, const float *q)
+{
+    uint8_t reason = 0;
+    float dot;
+    int i;
+
+    for (i = 0; i < 3; i++)
+    {
+        if (abs(raw->gyro[i]) >= SATURATION_LIMIT || abs(raw->accel[i]) >= SATURATION_LIMIT)
+            reason |= FLIGHT_RECORDER_SATURATION;
+    }
+
+    // leaky count of failed reads
+    if (raw->flags & SENSOR_LOG_I2C_ERROR)
+        recorderI2cErrors += I2C_ERROR_WINDOW;
+    else if (recorderI2cErrors > 0)
+        recorderI2cErrors--;
+    if (recorderI2cErrors >= I2C_ERROR_BURST * I2C_ERROR_WINDOW)
+    {
+        reason |= FLIGHT_RECORDER_I2C_ERRORS;
+        recorderI2cErrors = 0;
+    }
+
+    // rotation angle between consecutive attitudes is 2 acos(|q1 . q2|)
+    dot = fabsf(q[0] * recorderPreviousQ[0] + q[1] * recorderPreviousQ[1] + q[2] * recorderPreviousQ[2] + q[3] * recorderPreviousQ[3]);
+    if (recorderHead > 0 && !recorderGap && dot < cosf(0.5f * ATTITUDE_JUMP))
+        reason |= FLIGHT_RECORDER_ATTITUDE_JUMP;
+    memcpy(recorderPreviousQ, q, sizeof(recorderPreviousQ));
+    recorderGap = 0;
+
+    return reason;
+}
+
+/**
+ * Record one sample, called from the acquisition loop.
+ *
+ * @param raw Raw sample
+ * @param q Attitude quaternion after the sample
+ * @param integralFB Estimated gyro bias after the sample
+ */
+void flight_recorder_record(const struct sensor_log_record *raw, const float *q, const float *integralFB)
+{
+    struct flight_record *entry;
+    uint8_t reason;
+
+    if (!recorderRunning)
+        return;
+    if (__atomic_load_n(&recorderFrozen, __ATOMIC_ACQUIRE))
+    {
+        recorderGap = 1;
+        return;
+    }
+
+    reason = flight_recorder_check(raw, q);
+    if (reason)
+        flight_recorder_trigger(reason);
+
+    entry = &recorderRing[recorderHead & (FLIGHT_RECORDER_SAMPLES - 1)];
+    entry->raw = *raw;
+    memcpy(entry->q, q, sizeof(entry->q));
+    memcpy(entry->integral_fb, integralFB, sizeof(entry->integral_fb));
+    recorderHead++;
+
+    if (!recorderArmed && recorderPost > 0 && --recorderPost == 0)
+    {
+        recorderReason = recorderPendingReason;
+        if (++recorderFreezes < FLIGHT_RECORDER_MAX_DUMPS)
+            recorderHoldoff = FLIGHT_RECORDER_HOLDOFF;
+        else
+            fprintf(stderr, "flight recorder: %d dumps, no more triggers this run\n", FLIGHT_RECORDER_MAX_DUMPS);
+        __atomic_store_n(&recorderFrozen, 1, __ATOMIC_RELEASE);
+        sem_post(&recorderFlushRequest);
+    }
+    else if (recorderHoldoff > 0 && --recorderHoldoff == 0)
+    {
+        recorderArmed = 1;
+    }
+}
+
+/**
+ * @return Number of dumps written so far
+ */
+unsigned long flight_recorder_get_dumps()
+{
+    return __atomic_load_n(&recorderDumps, __ATOMIC_RELAXED);
+}
+
+/**
+ * Stop the flusher, a frozen ring is saved first.
+ */
+void flight_recorder_stop()
+{
+    if (!recorderRunning)
+        return;
+
+    __atomic_store_n(&recorderRunning, 0, __ATOMIC_RELEASE);
+    sem_post(&recorderFlushRequest);
+    pthread_join(recorderFlusher, NULL);
+    sem_destroy(&recorderFlushRequest);
+    free(recorderRing);
+    free(recorderSnapshot);
+    recorderRing = recorderSnapshot = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef __FLIGHT_RECORDER_H_
+#define __FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+
+#include "sensor_log.h"
+
+#define FLIGHT_RECORDER_SAMPLES 4096 // power of two, 8 s at 512 Hz
+#define FLIGHT_RECORDER_POST 1024    // samples kept after the trigger
+#define FLIGHT_RECORDER_HOLDOFF (FLIGHT_RECORDER_SAMPLES - FLIGHT_RECORDER_POST) // samples before re-arming
+#define FLIGHT_RECORDER_MAX_DUMPS 16 // per run, a trigger that keeps firing does not fill the disk
+
+// trigger reasons
+#define FLIGHT_RECORDER_SATURATION 0x01    // raw gyro or accel at full scale
+#define FLIGHT_RECORDER_I2C_ERRORS 0x02    // burst of failed sensor reads
+#define FLIGHT_RECORDER_ATTITUDE_JUMP 0x04 // attitude moved faster than the airframe can
+#define FLIGHT_RECORDER_MANUAL 0x08
+
+/**
+ * One sample as the recorder keeps it, the raw input and the estimator
+ * state after it.
+ */
+struct flight_record
+{
+    struct sensor_log_record raw;
+    float q[4];
+    float integral_fb[3];
+};
+
+int flight_recorder_start(const char *directory, const struct sensor_log_header *header);
+void flight_recorder_record(const struct sensor_log_record *raw, const float *q, const float *integralFB);
+void flight_recorder_trigger(uint8_t reason);
+unsigned long flight_recorder_get_dumps();
+void flight_recorder_stop();
+
+#endif
@@ -0,0 +1,108 @@
+/**
+ * Print a binary sensor log as text.
+ *
+ * One record per line: index, time since the first record in seconds, raw
+ * gx gy gz ax ay az mx my mz temp and the record flags in hex. Jumps
+ * straight to the first requested record through the mmap reader, or with
+ * -s/-e to a time window, in seconds from the first record, through the time
+ * index.
+ *
+ * usage: logdump [-H] [-f first] [-n count] [-s start] [-e end] log
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "sensor_log.h"
+#include "sensor_index.h"
+
+int main(int argc, char **argv)
+{
+    struct sensor_log_file log;
+    struct sensor_index_file index;
+    const struct sensor_log_header *h;
+    const struct sensor_log_record *first;
+    size_t start = 0, count = (size_t)-1, i;
+    double startTime = -1.0, endTime = -1.0;
+    int headerOnly = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "Hf:n:s:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'H':
+            headerOnly = 1;
+            break;
+        case 'f':
+            start = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            count = strtoul(optarg, NULL, 0);
+            break;
+        case 's':
+            startTime = atof(optarg);
+            break;
+        case 'e':
+            endTime = atof(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-H] [-f first] [-n count] [-s start] [-e end] log\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "usage: %s [-H] [-f first] [-n count] [-s start] [-e end] log\n", argv[0]);
+        return 1;
+    }
+
+    if (sensor_log_map(argv[optind], &log) < 0)
+        return 1;
+    sensor_index_map(argv[optind], &index);
+
+    h = log.header;
+    printf("# version %u, %zu records of %u bytes\n", h->version, log.count, h->record_size);
+    printf("# gyro %.0f deg/s at %.1f Hz, accel %.0f g at %.1f Hz, mag %.2f gauss at %.1f Hz\n",
+           h->gyro_range, h->gyro_rate, h->accel_range, h->accel_rate, h->mag_range, h->mag_rate);
+    if (index.header)
+        printf("# index %zu entries, one every %u records\n", index.count, index.header->interval);
+    else
+        printf("# no index\n");
+    if (headerOnly || log.count == 0)
+    {
+        sensor_index_unmap(&index);
+        sensor_log_unmap(&log);
+        return 0;
+    }
+
+    first = sensor_log_record_at(&log, 0);
+    if (startTime >= 0.0 || endTime >= 0.0)
+    {
+        struct sensor_log_view view;
+        uint64_t from = first->time + (uint64_t)(startTime > 0.0 ? startTime * 1e9 : 0.0);
+        uint64_t to = endTime >= 0.0 ? first->time + (uint64_t)(endTime * 1e9) : UINT64_MAX;
+
+        sensor_log_view(&log, &index, from, to, &view);
+        start = view.first;
+        if (view.count < count)
+            count = view.count;
+    }
+
+    for (i = start; i < log.count && i - start < count; i++)
+    {
+        const struct sensor_log_record *r = sensor_log_record_at(&log, i);
+
+        printf("%zu\t%.6f\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%#x\n",
+               i, (r->time - first->time) * 1e-9,
+               r->gyro[0], r->gyro[1], r->gyro[2],
+               r->accel[0], r->accel[1], r->accel[2],
+               r->mag[0], r->mag[1], r->mag[2],
+               r->temp, r->flags);
+    }
+
+    sensor_index_unmap(&index);
+    sensor_log_unmap(&log);
+    return 0;
+}
@@ -0,0 +1,253 @@
+/**
+ * Compress, decompress and check binary sensor logs.
+ *
+ *   logpack in.ilog out.ilpk     compress through the streaming writer
+ *   logpack -d in.ilpk out.ilog  decompress back to the raw format, with
+ *                                -s/-e only a window in seconds from the
+ *                                first record, seeking through the index
+ *   logpack -t in.ilog           round trip in memory, check it is lossless
+ *                                and report ratio and encode/decode MB/s
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "sensor_log.h"
+#include "sensor_pack.h"
+#include "async_writer.h"
+#include "sensor_index.h"
+
+#define BENCH_MIN_SECONDS 0.5
+
+static double now()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void usage(const char *name)
+{
+    fprintf(stderr, "usage: %s in.ilog out.ilpk | -d [-s start] [-e end] in.ilpk out.ilog | -t in.ilog\n", name);
+    exit(1);
+}
+
+int compress(const char *in, const char *out)
+{
+    struct sensor_log_file log;
+    size_t i;
+
+    if (sensor_log_map(in, &log) < 0)
+        return 1;
+    if (sensor_pack_open(out, log.header, ASYNC_WRITER_DIRECT | ASYNC_WRITER_WAIT) < 0)
+        return 1;
+
+    for (i = 0; i < log.count; i++)
+    {
+        if (sensor_pack_write(sensor_log_record_at(&log, i)) < 0)
+        {
+            fprintf(stderr, "%s: failed to write block at record %zu\n", out, i);
+            return 1;
+        }
+    }
+    sensor_pack_close();
+    sensor_log_unmap(&log);
+    return 0;
+}
+
+int decompress(const char *in, const char *out, double startTime, double endTime)
+{
+    static struct sensor_log_record records[SENSOR_PACK_BLOCK_RECORDS];
+    static uint8_t payload[SENSOR_PACK_MAX_BLOCK_BYTES];
+    struct sensor_log_header header;
+    struct sensor_index_file index;
+    char magic[4];
+    uint32_t blockHeader[2];
+    size_t blocks = 0, decoded = 0, count = 0;
+    uint64_t from = 0, to = UINT64_MAX;
+    int windowed = startTime > 0.0 || endTime >= 0.0, done = 0;
+    FILE *file = fopen(in, "rb");
+
+    if (!file)
+    {
+        perror(in);
+        return 1;
+    }
+    if (fread(magic, sizeof(magic), 1, file) != 1 || memcmp(magic, SENSOR_PACK_MAGIC, 4) != 0 ||
+        fread(&header, sizeof(header), 1, file) != 1)
+    {
+        fprintf(stderr, "%s: not a compressed sensor log\n", in);
+        return 1;
+    }
+    if (sensor_log_open(out, &header, ASYNC_WRITER_DIRECT | ASYNC_WRITER_WAIT) < 0)
+        return 1;
+
+    // jump to the block holding the start of the window, without an index
+    // the blocks before it are decoded and skipped
+    if (windowed && sensor_index_map(in, &index) == 0 && index.count > 0)
+    {
+        size_t entry;
+
+        from = index.entries[0].time + (uint64_t)(startTime > 0.0 ? startTime * 1e9 : 0.0);
+        if (endTime >= 0.0)
+            to = index.entries[0].time + (uint64_t)(endTime * 1e9);
+        entry = sensor_index_find(&index, from);
+        if (fseek(file, index.entries[entry].offset, SEEK_SET) == 0)
+            blocks = entry;
+        windowed = 0;
+        sensor_index_unmap(&index);
+    }
+
+    // a torn last block is dropped, everything before it is kept
+    while (!done && fread(blockHeader, sizeof(blockHeader), 1, file) == 1)
+    {
+        uint32_t i;
+
+        if (blockHeader[0] > sizeof(payload) || blockHeader[1] == 0 || blockHeader[1] > SENSOR_PACK_BLOCK_RECORDS ||
+            fread(payload, blockHeader[0], 1, file) != 1 ||
+            sensor_pack_decode_block(payload, blockHeader[0], records, blockHeader[1]) != blockHeader[0])
+        {
+            fprintf(stderr, "%s: block %zu is corrupt, stopping there\n", in, blocks);
+            break;
+        }
+        if (windowed)
+        {
+            from = records[0].time + (uint64_t)(startTime > 0.0 ? startTime * 1e9 : 0.0);
+            if (endTime >= 0.0)
+                to = records[0].time + (uint64_t)(endTime * 1e9);
+            windowed = 0;
+        }
+        for (i = 0; i < blockHeader[1]; i++)
+        {
+            if (records[i].time >= to)
+            {
+                done = 1;
+                break;
+            }
+            if (records[i].time >= from)
+            {
+                sensor_log_write(&records[i]);
+                count++;
+            }
+        }
+        blocks++;
+        decoded++;
+    }
+
+    sensor_log_close();
+    fclose(file);
+    fprintf(stderr, "%zu records in %zu blocks\n", count, decoded);
+    return 0;
+}
+
+int test(const char *in)
+{
+    struct sensor_log_file log;
+    const struct sensor_log_record *records;
+    struct sensor_log_record *decoded;
+    uint8_t *packed;
+    uint32_t *sizes;
+    size_t blockCount, packedBytes = 0, rawBytes, b;
+    double start, encodeTime, decodeTime;
+    int encodeRuns = 0, decodeRuns = 0;
+
+    if (sensor_log_map(in, &log) < 0)
+        return 1;
+    if (log.count == 0 || log.header->record_size != sizeof(struct sensor_log_record))
+    {
+        fprintf(stderr, "%s: nothing to test\n", in);
+        return 1;
+    }
+
+    records = sensor_log_record_at(&log, 0);
+    rawBytes = log.count * sizeof(struct sensor_log_record);
+    blockCount = (log.count + SENSOR_PACK_BLOCK_RECORDS - 1) / SENSOR_PACK_BLOCK_RECORDS;
+    packed = malloc(blockCount * SENSOR_PACK_MAX_BLOCK_BYTES);
+    sizes = malloc(blockCount * sizeof(*sizes));
+    decoded = malloc(rawBytes);
+
+    start = now();
+    do
+    {
+        packedBytes = 0;
+        for (b = 0; b < blockCount; b++)
+        {
+            size_t first = b * SENSOR_PACK_BLOCK_RECORDS;
+            uint32_t count = log.count - first < SENSOR_PACK_BLOCK_RECORDS ? log.count - first : SENSOR_PACK_BLOCK_RECORDS;
+
+            sizes[b] = sensor_pack_encode_block(&records[first], count, packed + b * SENSOR_PACK_MAX_BLOCK_BYTES);
+            packedBytes += sizes[b];
+        }
+        encodeRuns++;
+    } while ((encodeTime = now() - start) < BENCH_MIN_SECONDS);
+
+    start = now();
+    do
+    {
+        for (b = 0; b < blockCount; b++)
+        {
+            size_t first = b * SENSOR_PACK_BLOCK_RECORDS;
+            uint32_t count = log.count - first < SENSOR_PACK_BLOCK_RECORDS ? log.count - first : SENSOR_PACK_BLOCK_RECORDS;
+
+            if (sensor_pack_decode_block(packed + b * SENSOR_PACK_MAX_BLOCK_BYTES, sizes[b], &decoded[first], count) != sizes[b])
+            {
+                fprintf(stderr, "block %zu failed to decode\n", b);
+                return 1;
+            }
+        }
+        decodeRuns++;
+    } while ((decodeTime = now() - start) < BENCH_MIN_SECONDS);
+
+    if (memcmp(records, decoded, rawBytes) != 0)
+    {
+        fprintf(stderr, "round trip is not lossless\n");
+        return 1;
+    }
+
+    printf("%zu records, %zu -> %zu bytes (%.1f%%, %.1f bytes/record)\n",
+           log.count, rawBytes, packedBytes, 100.0 * packedBytes / rawBytes, (double)packedBytes / log.count);
+    printf("encode %.0f MB/s, decode %.0f MB/s (raw bytes), round trip lossless\n",
+           rawBytes * encodeRuns / encodeTime * 1e-6, rawBytes * decodeRuns / decodeTime * 1e-6);
+
+    free(packed);
+    free(sizes);
+    free(decoded);
+    sensor_log_unmap(&log);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    double startTime = 0.0, endTime = -1.0;
+    int opt, mode = 0;
+
+    while ((opt = getopt(argc, argv, "dts:e:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'd':
+        case 't':
+            mode = opt;
+            break;
+        case 's':
+            startTime = atof(optarg);
+            break;
+        case 'e':
+            endTime = atof(optarg);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (mode == 't' && optind == argc - 1)
+        return test(argv[optind]);
+    if (optind != argc - 2)
+        usage(argv[0]);
+    if (mode == 'd')
+        return decompress(argv[optind], argv[optind + 1], startTime, endTime);
+    return compress(argv[optind], argv[optind + 1]);
+}
@@ -0,0 +1,174 @@
+/**
+ * Writer and mmap reader for the sparse sensor log time index.
+ *
+ * The writers of the raw and the compressed log each keep their own index
+ * stream and append an entry whenever a new interval or block starts, one
+ * 24 byte copy into an async writer buffer every few hundred records.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sensor_index.h"
+#include "async_writer.h"
+
+_Static_assert(sizeof(struct sensor_index_header) == 16, "sensor index header layout changed");
+_Static_assert(sizeof(struct sensor_index_entry) == 24, "sensor index entry layout changed");
+
+static char *sensor_index_path(const char *logPath)
+{
+    char *path = malloc(strlen(logPath) + sizeof(SENSOR_INDEX_SUFFIX));
+
+    if (path)
+    {
+        strcpy(path, logPath);
+        strcat(path, SENSOR_INDEX_SUFFIX);
+    }
+    return path;
+}
+
+/**
+ * Create the index of a log and write its header.
+ *
+ * @param logPath Path of the log, the index goes to logPath.idx
+ * @param interval Records between two entries
+ * @param flags ASYNC_WRITER_* flags
+ * @return Index writer, NULL on failure
+ */
+struct async_writer *sensor_index_create(const char *logPath, uint32_t interval, int flags)
+{
+    struct sensor_index_header header;
+    char *path = sensor_index_path(logPath);
+    struct async_writer *writer;
+
+    if (!path)
+        return NULL;
+
+    writer = async_writer_open(path, SENSOR_INDEX_BUFFER, SENSOR_INDEX_BUFFERS, flags);
+    free(path);
+    if (!writer)
+        return NULL;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SENSOR_INDEX_MAGIC, sizeof(header.magic));
+    header.version = SENSOR_INDEX_VERSION;
+    header.entry_size = sizeof(struct sensor_index_entry);
+    header.interval = interval;
+
+    async_writer_write(writer, &header, sizeof(header));
+    return writer;
+}
+
+/**
+ * Append one entry.
+ *
+ * A dropped entry only makes the search around it a little longer.
+ *
+ * @param writer Index writer from sensor_index_create()
+ * @param time Time of the first record covered, ns
+ * @param record Number of that record
+ * @param offset Byte offset in the log where it starts
+ * @return 0 on success, -1 if the entry was dropped
+ */
+int sensor_index_append(struct async_writer *writer, uint64_t time, uint64_t record, uint64_t offset)
+{
+    struct sensor_index_entry entry = {time, record, offset};
+
+    return async_writer_write(writer, &entry, sizeof(entry));
+}
+
+/**
+ * Map the index of a log and check its header.
+ *
+ * @param logPath Path of the log, not of the index
+ * @param index Filled in on success
+ * @return 0 on success, -1 if there is no usable index
+ */
+int sensor_index_map(const char *logPath, struct sensor_index_file *index)
+{
+    struct stat st;
+    const struct sensor_index_header *header;
+    char *path = sensor_index_path(logPath);
+
+    memset(index, 0, sizeof(*index));
+    index->fd = path ? open(path, O_RDONLY) : -1;
+    free(path);
+    if (index->fd < 0)
+        return -1;
+
+    if (fstat(index->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct sensor_index_header))
+    {
+        close(index->fd);
+        index->fd = -1;
+        return -1;
+    }
+
+    index->size = st.st_size;
+    index->data = mmap(NULL, index->size, PROT_READ, MAP_SHARED, index->fd, 0);
+    if (index->data == MAP_FAILED)
+    {
+        close(index->fd);
+        memset(index, 0, sizeof(*index));
+        index->fd = -1;
+        return -1;
+    }
+
+    header = (const struct sensor_index_header *)index->data;
+    if (memcmp(header->magic, SENSOR_INDEX_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SENSOR_INDEX_VERSION ||
+        header->entry_size != sizeof(struct sensor_index_entry))
+    {
+        fprintf(stderr, "%s: ignoring index, not version %d\n", logPath, SENSOR_INDEX_VERSION);
+        sensor_index_unmap(index);
+        return -1;
+    }
+
+    index->header = header;
+    index->entries = (const struct sensor_index_entry *)(index->data + sizeof(*header));
+    index->count = (index->size - sizeof(*header)) / header->entry_size;
+    return 0;
+}
+
+/**
+ * Binary search for the entry to start reading from to find a time.
+ *
+ * @param index Mapped index, at least one entry
+ * @param time Time looked for, ns
+ * @return Last entry at or before time, 0 if time is before the first one
+ */
+size_t sensor_index_find(const struct sensor_index_file *index, uint64_t time)
+{
+    size_t low = 0, high = index->count;
+
+    // entries[low].time <= time < entries[high].time
+    while (high - low > 1)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (index->entries[middle].time <= time)
+            low = middle;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Unmap an index.
+ */
+void sensor_index_unmap(struct sensor_index_file *index)
+{
+    if (index->data && index->data != MAP_FAILED)
+        munmap((void *)index->data, index->size);
+    if (index->fd >= 0)
+        close(index->fd);
+
+    memset(index, 0, sizeof(*index));
+    index->fd = -1;
+}
@@ -0,0 +1,65 @@
+#ifndef __SENSOR_INDEX_H_
+#define __SENSOR_INDEX_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Sparse time index of a sensor log, kept next to it as <log>.idx.
+ *
+ * A 16 byte header followed by one 24 byte entry every few hundred records
+ * (every SENSOR_INDEX_INTERVAL records of a raw log, every block of a
+ * compressed one): the time of the first record covered, its record number
+ * and the byte offset in the log where it starts. Entries are appended as
+ * the log grows, so a reader finds a time with a binary search over a file
+ * a few thousand times smaller than the log. An index cut short by a crash
+ * still covers the log up to its last entry.
+ */
+
+#define SENSOR_INDEX_MAGIC "IIDX"
+#define SENSOR_INDEX_VERSION 1
+#define SENSOR_INDEX_SUFFIX ".idx"
+#define SENSOR_INDEX_INTERVAL 256 // raw log records between two entries
+#define SENSOR_INDEX_BUFFER 4096  // async writer buffers, ~170 entries each
+#define SENSOR_INDEX_BUFFERS 2
+
+struct __attribute__((packed)) sensor_index_header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t entry_size;
+    uint32_t interval; // records between entries
+    uint32_t reserved;
+};
+
+struct __attribute__((packed)) sensor_index_entry
+{
+    uint64_t time;   // time of the first record, ns
+    uint64_t record; // number of the first record
+    uint64_t offset; // byte offset in the log
+};
+
+/**
+ * An index mapped read-only.
+ */
+struct sensor_index_file
+{
+    int fd;
+    size_t size;
+    const uint8_t *data;
+    const struct sensor_index_header *header;
+    const struct sensor_index_entry *entries;
+    size_t count;
+};
+
+struct async_writer;
+
+struct async_writer *sensor_index_create(const char *logPath, uint32_t interval, int flags);
+int sensor_index_append(struct async_writer *writer, uint64_t time, uint64_t record, uint64_t offset);
+
+int sensor_index_map(const char *logPath, struct sensor_index_file *index);
+size_t sensor_index_find(const struct sensor_index_file *index, uint64_t time);
+void sensor_index_unmap(struct sensor_index_file *index);
+
+#endif
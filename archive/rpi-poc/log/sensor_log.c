@@ -0,0 +1,148 @@
+/**
+ * Streaming writer for the binary raw sensor log.
+ *
+ * Records are copied into the buffers of an async writer, the acquisition
+ * loop never waits for a write() or for block allocation; an I/O thread
+ * writes SENSOR_LOG_BUFFER bytes at a time. When the disk falls more than
+ * SENSOR_LOG_BUFFERS buffers behind records are dropped, counted, and the
+ * next record that makes it is flagged SENSOR_LOG_DROPPED. Every
+ * SENSOR_INDEX_INTERVAL records an entry goes to the time index next to it.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "sensor_log.h"
+#include "sensor_index.h"
+#include "async_writer.h"
+
+#define SENSOR_LOG_BUFFER (64 * 1024) // 2 s at 1 kHz
+#define SENSOR_LOG_BUFFERS 8
+
+_Static_assert(sizeof(struct sensor_log_header) == 64, "sensor log header layout changed");
+_Static_assert(sizeof(struct sensor_log_record) == 32, "sensor log record layout changed");
+
+struct async_writer *logWriter = NULL;
+struct async_writer *logIndex = NULL;
+uint64_t logRecords = 0;
+uint16_t logDropped = 0;
+
+/**
+ * Fill in the fixed part of a header, ranges and rates are left to the caller.
+ */
+void sensor_log_header_init(struct sensor_log_header *header)
+{
+    struct timespec t;
+
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, SENSOR_LOG_MAGIC, sizeof(header->magic));
+    header->version = SENSOR_LOG_VERSION;
+    header->header_size = sizeof(struct sensor_log_header);
+    header->record_size = sizeof(struct sensor_log_record);
+
+    clock_gettime(CLOCK_REALTIME, &t);
+    header->start_time = t.tv_sec * 1000000000ULL + t.tv_nsec;
+    header->start_monotonic = sensor_log_now();
+}
+
+/**
+ * @return CLOCK_MONOTONIC in ns, the record time base
+ */
+uint64_t sensor_log_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Create a log and write its header.
+ *
+ * @param path Log file path, truncated if it exists
+ * @param header Header to write
+ * @param flags ASYNC_WRITER_* flags, ASYNC_WRITER_DIRECT in the loop,
+ *              ASYNC_WRITER_WAIT in offline tools
+ * @return 0 on success, -1 on failure
+ */
+int sensor_log_open(const char *path, const struct sensor_log_header *header, int flags)
+{
+    logWriter = async_writer_open(path, SENSOR_LOG_BUFFER, SENSOR_LOG_BUFFERS, flags);
+    if (!logWriter)
+        return -1;
+
+    // the buffers are empty, the header always fits
+    async_writer_write(logWriter, header, sizeof(*header));
+    logRecords = 0;
+    logDropped = 0;
+
+    // the log is still usable without its index, a reader falls back to
+    // searching the records
+    logIndex = sensor_index_create(path, SENSOR_INDEX_INTERVAL, flags & ASYNC_WRITER_WAIT);
+    return 0;
+}
+
+/**
+ * Append one record, never blocks.
+ *
+ * @return 0 on success, -1 if the record was dropped or no log is open
+ */
+int sensor_log_write(const struct sensor_log_record *record)
+{
+    struct sensor_log_record flagged;
+
+    if (!logWriter)
+        return -1;
+
+    if (logDropped)
+    {
+        flagged = *record;
+        flagged.flags |= logDropped;
+        record = &flagged;
+    }
+    if (async_writer_write(logWriter, record, sizeof(*record)) < 0)
+    {
+        logDropped = SENSOR_LOG_DROPPED;
+        return -1;
+    }
+    logDropped = 0;
+
+    if (logIndex && logRecords % SENSOR_INDEX_INTERVAL == 0)
+        sensor_index_append(logIndex, record->time, logRecords,
+                            sizeof(struct sensor_log_header) + logRecords * sizeof(*record));
+    logRecords++;
+    return 0;
+}
+
+/**
+ * Read the writer counters, records written and dropped, queue depth.
+ *
+ * @return 0 on success, -1 when no log is open
+ */
+int sensor_log_get_stats(struct async_writer_stats *stats)
+{
+    if (!logWriter)
+        return -1;
+
+    async_writer_get_stats(logWriter, stats);
+    return 0;
+}
+
+/**
+ * Write what is queued and close the log.
+ */
+void sensor_log_close()
+{
+    if (!logWriter)
+        return;
+
+    if (async_writer_close(logWriter) < 0)
+        fprintf(stderr, "Log is incomplete, writes failed\n");
+    logWriter = NULL;
+    if (logIndex)
+    {
+        async_writer_close(logIndex);
+        logIndex = NULL;
+    }
+}
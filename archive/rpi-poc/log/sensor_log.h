@@ -0,0 +1,97 @@
+#ifndef __SENSOR_LOG_H_
+#define __SENSOR_LOG_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Binary raw sensor log.
+ *
+ * A 64 byte header followed by fixed size 32 byte records, little-endian as
+ * written by the Pi, so record i is at header_size + i * record_size and the
+ * file can be mapped and indexed directly. A record cut short by a crash is
+ * ignored by the reader.
+ */
+
+#define SENSOR_LOG_MAGIC "ILOG"
+#define SENSOR_LOG_VERSION 1
+
+// record flags
+#define SENSOR_LOG_MAG_FRESH 0x0001      // new magnetometer sample in this record
+#define SENSOR_LOG_I2C_ERROR 0x0002      // a sensor read failed, values are stale
+#define SENSOR_LOG_FIFO_OVERFLOW 0x0004  // gyro samples were dropped before this one
+#define SENSOR_LOG_DECIMATED 0x0008      // gyro is the CIC output, not a raw sample
+#define SENSOR_LOG_DROPPED 0x0010        // records were dropped before this one, the disk fell behind
+
+struct __attribute__((packed)) sensor_log_header
+{
+    char magic[4];
+    uint16_t version;
+    uint16_t header_size;
+    uint16_t record_size;
+    uint16_t flags;
+    float gyro_range;        // full scale, deg/s
+    float accel_range;       // full scale, g
+    float mag_range;         // full scale, gauss
+    float gyro_rate;         // record rate, Hz
+    float accel_rate;        // Hz
+    float mag_rate;          // Hz
+    uint64_t start_time;     // CLOCK_REALTIME at the first record, ns
+    uint64_t start_monotonic; // CLOCK_MONOTONIC at the same instant, ns
+    uint8_t reserved[12];
+};
+
+struct __attribute__((packed)) sensor_log_record
+{
+    uint64_t time;           // CLOCK_MONOTONIC, ns
+    int16_t gyro[3];
+    int16_t accel[3];
+    int16_t mag[3];
+    int16_t temp;
+    uint16_t flags;
+    uint16_t reserved;
+};
+
+/**
+ * A log mapped read-only, records are used in place.
+ */
+struct sensor_log_file
+{
+    int fd;
+    size_t size;
+    const uint8_t *data;
+    const struct sensor_log_header *header;
+    size_t count;
+};
+
+/**
+ * A time window of a mapped log, records first to first + count - 1. A view
+ * only reads the mapping, so threads can each walk their own view of the
+ * same log.
+ */
+struct sensor_log_view
+{
+    const struct sensor_log_file *log;
+    size_t first;
+    size_t count;
+};
+
+struct sensor_index_file;
+struct async_writer_stats;
+
+void sensor_log_header_init(struct sensor_log_header *header);
+uint64_t sensor_log_now();
+int sensor_log_open(const char *path, const struct sensor_log_header *header, int flags);
+int sensor_log_write(const struct sensor_log_record *record);
+int sensor_log_get_stats(struct async_writer_stats *stats);
+void sensor_log_close();
+
+int sensor_log_map(const char *path, struct sensor_log_file *log);
+const struct sensor_log_record *sensor_log_record_at(const struct sensor_log_file *log, size_t index);
+void sensor_log_unmap(struct sensor_log_file *log);
+size_t sensor_log_seek(const struct sensor_log_file *log, const struct sensor_index_file *index, uint64_t time);
+void sensor_log_view(const struct sensor_log_file *log, const struct sensor_index_file *index,
+                     uint64_t start, uint64_t end, struct sensor_log_view *view);
+const struct sensor_log_record *sensor_log_view_at(const struct sensor_log_view *view, size_t index);
+
+#endif
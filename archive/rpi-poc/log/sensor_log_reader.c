@@ -0,0 +1,179 @@
+/**
+ * mmap reader for the binary raw sensor log.
+ *
+ * The whole file is mapped read-only and records are returned as pointers
+ * into the mapping, random access by sample index with no copy and no read
+ * buffer, the page cache does the rest. Seeks by time go through the sparse
+ * index next to the log when there is one, so finding a window in a
+ * multi-hour log touches a few index pages and one block of records instead
+ * of a page per step of a binary search over the whole file.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "sensor_log.h"
+#include "sensor_index.h"
+
+/**
+ * Map a log and check its header.
+ *
+ * @param path Log file path
+ * @param log Filled in on success
+ * @return 0 on success, -1 on failure
+ */
+int sensor_log_map(const char *path, struct sensor_log_file *log)
+{
+    struct stat st;
+    const struct sensor_log_header *header;
+
+    memset(log, 0, sizeof(*log));
+    log->fd = open(path, O_RDONLY);
+    if (log->fd < 0)
+    {
+        fprintf(stderr, "Failed to open log %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (fstat(log->fd, &st) < 0 || (size_t)st.st_size < sizeof(struct sensor_log_header))
+    {
+        fprintf(stderr, "%s: not a sensor log\n", path);
+        close(log->fd);
+        return -1;
+    }
+
+    log->size = st.st_size;
+    log->data = mmap(NULL, log->size, PROT_READ, MAP_SHARED, log->fd, 0);
+    if (log->data == MAP_FAILED)
+    {
+        fprintf(stderr, "Failed to map log %s: %s\n", path, strerror(errno));
+        close(log->fd);
+        return -1;
+    }
+
+    header = (const struct sensor_log_header *)log->data;
+    if (memcmp(header->magic, SENSOR_LOG_MAGIC, sizeof(header->magic)) != 0 ||
+        header->version != SENSOR_LOG_VERSION ||
+        header->header_size < sizeof(struct sensor_log_header) ||
+        header->header_size > log->size ||
+        header->record_size < sizeof(struct sensor_log_record))
+    {
+        fprintf(stderr, "%s: not a version %d sensor log\n", path, SENSOR_LOG_VERSION);
+        sensor_log_unmap(log);
+        return -1;
+    }
+
+    // sequential scans are the common case, let the kernel read ahead
+    madvise((void *)log->data, log->size, MADV_SEQUENTIAL);
+
+    log->header = header;
+    log->count = (log->size - header->header_size) / header->record_size;
+    return 0;
+}
+
+/**
+ * @return Record at index, NULL past the end
+ */
+const struct sensor_log_record *sensor_log_record_at(const struct sensor_log_file *log, size_t index)
+{
+    if (index >= log->count)
+        return NULL;
+
+    return (const struct sensor_log_record *)(log->data + log->header->header_size + index * log->header->record_size);
+}
+
+/**
+ * Unmap a log.
+ */
+void sensor_log_unmap(struct sensor_log_file *log)
+{
+    if (log->data && log->data != MAP_FAILED)
+        munmap((void *)log->data, log->size);
+    if (log->fd >= 0)
+        close(log->fd);
+
+    memset(log, 0, sizeof(*log));
+    log->fd = -1;
+}
+
+/**
+ * Find the first record at or after a time, records are in time order.
+ *
+ * @param log Mapped log
+ * @param index Its mapped index, or NULL to search the whole log
+ * @param time CLOCK_MONOTONIC time, ns
+ * @return Record index, log->count if every record is earlier
+ */
+size_t sensor_log_seek(const struct sensor_log_file *log, const struct sensor_index_file *index, uint64_t time)
+{
+    size_t low = 0, high = log->count;
+
+    // the answer lies between the entry at or before time and the next one,
+    // entries past the end of a torn log are not trusted
+    if (index && index->count > 0)
+    {
+        size_t entry = sensor_index_find(index, time);
+
+        if (index->entries[entry].time <= time && index->entries[entry].record < log->count)
+            low = index->entries[entry].record;
+        if (entry + 1 < index->count && index->entries[entry + 1].record < high)
+            high = index->entries[entry + 1].record;
+    }
+
+    while (low < high)
+    {
+        size_t middle = low + (high - low) / 2;
+
+        if (sensor_log_record_at(log, middle)->time < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    return low;
+}
+
+/**
+ * Make a view of the records in [start, end) and ask the kernel to read it
+ * in ahead of the caller.
+ *
+ * @param log Mapped log
+ * @param index Its mapped index, or NULL
+ * @param start First time included, ns
+ * @param end First time excluded, ns
+ * @param view Filled in, empty if no record is in the window
+ */
+void sensor_log_view(const struct sensor_log_file *log, const struct sensor_index_file *index,
+                     uint64_t start, uint64_t end, struct sensor_log_view *view)
+{
+    size_t last;
+
+    view->log = log;
+    view->first = sensor_log_seek(log, index, start);
+    last = end > start ? sensor_log_seek(log, index, end) : view->first;
+    view->count = last - view->first;
+
+    if (view->count > 0)
+    {
+        long page = sysconf(_SC_PAGESIZE);
+        size_t from = log->header->header_size + view->first * log->header->record_size;
+        size_t to = log->header->header_size + last * log->header->record_size;
+
+        from &= ~(size_t)(page - 1);
+        madvise((void *)(log->data + from), to - from, MADV_WILLNEED);
+    }
+}
+
+/**
+ * @return Record at index within the view, NULL past its end
+ */
+const struct sensor_log_record *sensor_log_view_at(const struct sensor_log_view *view, size_t index)
+{
+    if (index >= view->count)
+        return NULL;
+
+    return sensor_log_record_at(view->log, view->first + index);
+}
@@ -0,0 +1,301 @@
+/**
+ * Delta + zigzag varint codec for the raw sensor log.
+ *
+ * Sensor channels move little from one sample to the next, so the residual
+ * against the previous sample is small and, zigzag mapped, fits one or two
+ * varint bytes instead of the two raw bytes plus the timestamp's eight. A 32
+ * byte record typically packs to 12-16 bytes. Blocks are independent so a
+ * torn tail only loses the last block and a reader can seek by block, the
+ * time index next to the log has an entry for every block. Blocks go out
+ * through an async writer like the raw log, a block the disk has no room
+ * for is dropped whole and the first record of the next one is flagged
+ * SENSOR_LOG_DROPPED.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "sensor_pack.h"
+#include "sensor_index.h"
+#include "async_writer.h"
+
+#define SENSOR_PACK_BUFFER (64 * 1024)
+#define SENSOR_PACK_BUFFERS 8
+
+struct async_writer *packWriter = NULL;
+struct async_writer *packIndex = NULL;
+uint64_t packRecordsWritten = 0;
+uint64_t packOffset = 0;
+uint16_t packDropped = 0;
+struct sensor_log_record packRecords[SENSOR_PACK_BLOCK_RECORDS];
+uint32_t packCount = 0;
+uint8_t packBuffer[2 * sizeof(uint32_t) + SENSOR_PACK_MAX_BLOCK_BYTES]; // block header and payload
+
+static inline uint32_t zigzag16(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag16(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline uint64_t zigzag64(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t unzigzag64(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+static inline uint8_t *put_varint(uint8_t *out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        *out++ = (uint8_t)value | 0x80;
+        value >>= 7;
+    }
+    *out++ = (uint8_t)value;
+    return out;
+}
+
+/**
+ * @return Position after the varint, NULL if it runs past end
+ */
+static inline const uint8_t *get_varint(const uint8_t *in, const uint8_t *end, uint64_t *value)
+{
+    uint64_t result = 0;
+    int shift = 0;
+
+    // one byte is by far the common case
+    if (in < end && *in < 0x80)
+    {
+        *value = *in;
+        return in + 1;
+    }
+    while (in < end && shift < 64)
+    {
+        uint8_t byte = *in++;
+        result |= (uint64_t)(byte & 0x7f) << shift;
+        if (byte < 0x80)
+        {
+            *value = result;
+            return in;
+        }
+        shift += 7;
+    }
+    return NULL;
+}
+
+/**
+ * Encode one block.
+ *
+ * @param records Records to encode
+ * @param count Number of records, 1..SENSOR_PACK_BLOCK_RECORDS
+ * @param out At least SENSOR_PACK_MAX_BLOCK_BYTES
+ * @return Payload size in bytes
+ */
+size_t sensor_pack_encode_block(const struct sensor_log_record *records, uint32_t count, uint8_t *out)
+{
+    uint8_t *start = out;
+    int16_t previous[SENSOR_PACK_CHANNELS], channels[SENSOR_PACK_CHANNELS];
+    uint64_t previousTime, previousDelta = 0;
+    uint16_t previousFlags, previousReserved;
+    uint32_t i;
+    int c;
+
+    if (count == 0)
+        return 0;
+
+    memcpy(out, &records[0], sizeof(records[0]));
+    out += sizeof(records[0]);
+    memcpy(previous, records[0].gyro, sizeof(previous));
+    previousTime = records[0].time;
+    previousFlags = records[0].flags;
+    previousReserved = records[0].reserved;
+
+    for (i = 1; i < count; i++)
+    {
+        const struct sensor_log_record *r = &records[i];
+        uint64_t delta = r->time - previousTime;
+
+        out = put_varint(out, zigzag64((int64_t)(delta - previousDelta)));
+        previousDelta = delta;
+        previousTime = r->time;
+
+        memcpy(channels, r->gyro, sizeof(channels));
+        for (c = 0; c < SENSOR_PACK_CHANNELS; c++)
+        {
+            out = put_varint(out, zigzag16((int16_t)(channels[c] - previous[c])));
+            previous[c] = channels[c];
+        }
+
+        out = put_varint(out, (uint16_t)(r->flags ^ previousFlags));
+        out = put_varint(out, (uint16_t)(r->reserved ^ previousReserved));
+        previousFlags = r->flags;
+        previousReserved = r->reserved;
+    }
+
+    return out - start;
+}
+
+/**
+ * Decode one block.
+ *
+ * @param in Payload
+ * @param size Payload size in bytes
+ * @param records Filled with count records
+ * @param count Number of records in the block
+ * @return Bytes consumed, 0 if the payload is corrupt
+ */
+size_t sensor_pack_decode_block(const uint8_t *in, size_t size, struct sensor_log_record *records, uint32_t count)
+{
+    const uint8_t *start = in, *end = in + size;
+    int16_t previous[SENSOR_PACK_CHANNELS];
+    uint64_t previousDelta = 0, value;
+    uint32_t i;
+    int c;
+
+    if (count == 0 || size < sizeof(records[0]))
+        return 0;
+
+    memcpy(&records[0], in, sizeof(records[0]));
+    in += sizeof(records[0]);
+    memcpy(previous, records[0].gyro, sizeof(previous));
+
+    for (i = 1; i < count; i++)
+    {
+        struct sensor_log_record *r = &records[i];
+
+        if (!(in = get_varint(in, end, &value)))
+            return 0;
+        previousDelta += unzigzag64(value);
+        r->time = records[i - 1].time + previousDelta;
+
+        for (c = 0; c < SENSOR_PACK_CHANNELS; c++)
+        {
+            if (!(in = get_varint(in, end, &value)))
+                return 0;
+            previous[c] = (int16_t)(previous[c] + unzigzag16((uint32_t)value));
+        }
+        memcpy(r->gyro, previous, sizeof(previous));
+
+        if (!(in = get_varint(in, end, &value)))
+            return 0;
+        r->flags = records[i - 1].flags ^ (uint16_t)value;
+        if (!(in = get_varint(in, end, &value)))
+            return 0;
+        r->reserved = records[i - 1].reserved ^ (uint16_t)value;
+    }
+
+    return in - start;
+}
+
+static int sensor_pack_flush()
+{
+    uint32_t blockHeader[2];
+    size_t size;
+
+    if (packCount == 0)
+        return 0;
+
+    packRecords[0].flags |= packDropped;
+    blockHeader[0] = sensor_pack_encode_block(packRecords, packCount, packBuffer + sizeof(blockHeader));
+    blockHeader[1] = packCount;
+    memcpy(packBuffer, blockHeader, sizeof(blockHeader));
+    size = sizeof(blockHeader) + blockHeader[0];
+
+    // header and payload in one write, a block is dropped whole or not at all
+    if (async_writer_write(packWriter, packBuffer, size) < 0)
+    {
+        packDropped = SENSOR_LOG_DROPPED;
+        packCount = 0;
+        return -1;
+    }
+    packDropped = 0;
+
+    if (packIndex)
+        sensor_index_append(packIndex, packRecords[0].time, packRecordsWritten, packOffset);
+    packRecordsWritten += packCount;
+    packOffset += size;
+    packCount = 0;
+    return 0;
+}
+
+/**
+ * Create a compressed log and write its header.
+ *
+ * @param path Log file path, truncated if it exists
+ * @param header Header of the raw log
+ * @param flags ASYNC_WRITER_* flags, see sensor_log_open()
+ * @return 0 on success, -1 on failure
+ */
+int sensor_pack_open(const char *path, const struct sensor_log_header *header, int flags)
+{
+    packWriter = async_writer_open(path, SENSOR_PACK_BUFFER, SENSOR_PACK_BUFFERS, flags);
+    if (!packWriter)
+        return -1;
+    packCount = 0;
+    packDropped = 0;
+
+    async_writer_write(packWriter, SENSOR_PACK_MAGIC, 4);
+    async_writer_write(packWriter, header, sizeof(*header));
+    packRecordsWritten = 0;
+    packOffset = 4 + sizeof(*header);
+
+    packIndex = sensor_index_create(path, SENSOR_PACK_BLOCK_RECORDS, flags & ASYNC_WRITER_WAIT);
+    return 0;
+}
+
+/**
+ * Append one record, a block is encoded and written every
+ * SENSOR_PACK_BLOCK_RECORDS records.
+ *
+ * @return 0 on success, -1 if a block was dropped or no log is open
+ */
+int sensor_pack_write(const struct sensor_log_record *record)
+{
+    if (!packWriter)
+        return -1;
+
+    packRecords[packCount++] = *record;
+    if (packCount == SENSOR_PACK_BLOCK_RECORDS)
+        return sensor_pack_flush();
+    return 0;
+}
+
+/**
+ * Read the writer counters, see sensor_log_get_stats().
+ *
+ * @return 0 on success, -1 when no log is open
+ */
+int sensor_pack_get_stats(struct async_writer_stats *stats)
+{
+    if (!packWriter)
+        return -1;
+
+    async_writer_get_stats(packWriter, stats);
+    return 0;
+}
+
+/**
+ * Write the last partial block and what is queued, close the log.
+ */
+void sensor_pack_close()
+{
+    if (!packWriter)
+        return;
+
+    sensor_pack_flush();
+    if (async_writer_close(packWriter) < 0)
+        fprintf(stderr, "Log is incomplete, writes failed\n");
+    packWriter = NULL;
+    if (packIndex)
+    {
+        async_writer_close(packIndex);
+        packIndex = NULL;
+    }
+}
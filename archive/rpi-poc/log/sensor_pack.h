@@ -0,0 +1,35 @@
+#ifndef __SENSOR_PACK_H_
+#define __SENSOR_PACK_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sensor_log.h"
+
+/**
+ * Compressed sensor log.
+ *
+ * A 4 byte magic, the original sensor_log_header, then blocks of up to
+ * SENSOR_PACK_BLOCK_RECORDS records. Each block is a uint32 payload size, a
+ * uint32 record count and the payload, and decodes on its own: the first
+ * record is stored raw, the others as zigzag varint residuals against the
+ * previous record (delta of delta for the timestamp, delta for the int16
+ * channels and flags).
+ */
+
+#define SENSOR_PACK_MAGIC "IPAK"
+#define SENSOR_PACK_BLOCK_RECORDS 256
+#define SENSOR_PACK_CHANNELS 10 // gx gy gz ax ay az mx my mz temp
+
+// worst case: raw first record, then 10 + 10 * 3 + 2 * 3 bytes a record
+#define SENSOR_PACK_MAX_BLOCK_BYTES (SENSOR_PACK_BLOCK_RECORDS * 46 + sizeof(struct sensor_log_record))
+
+size_t sensor_pack_encode_block(const struct sensor_log_record *records, uint32_t count, uint8_t *out);
+size_t sensor_pack_decode_block(const uint8_t *in, size_t size, struct sensor_log_record *records, uint32_t count);
+
+int sensor_pack_open(const char *path, const struct sensor_log_header *header, int flags);
+int sensor_pack_write(const struct sensor_log_record *record);
+int sensor_pack_get_stats(struct async_writer_stats *stats);
+void sensor_pack_close();
+
+#endif
@@ -1,41 +1,823 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
+#include <unistd.h>
+#include <signal.h>
 
 #include "sensors/mpu6050.h"
+#include "sensors/mpu6050_registers.h"
 #include "sensors/hcm5883l.h"
 #include "MahonyAHRS.h"
+#include "comm/comm.h"
+#include "comm/state_ring.h"
+#include "comm/udp_sink.h"
+#include "comm/fmt.h"
+#include "filter/cic.h"
+#include "log/sensor_log.h"
+#include "log/sensor_pack.h"
+#include "log/flight_recorder.h"
+#include "log/async_writer.h"
+#include "estimator/estimator.h"
+#include "rt/rt_loop.h"
+#include "rt/scheduler.h"
+#include "rt/loop_stats.h"
+#include "pipeline/pipeline.h"
+#include "metrics/counters.h"
 
 #define ACCELEROMETER_SENSITIVITY 8192.0
 #define GYROSCOPE_SENSITIVITY 65.536
 
 #define dt 0.01 // 10 ms sample rate!
 
+#define SAMPLE_FREQ 512.0f // nominal loop rate
+
+// oversampled mode: gyro FIFO at 2 kHz, CIC down to 500 Hz. Three axes at
+// 2 kHz is 12 kB/s of FIFO data, which leaves room on the 400 kHz bus the
+// MPU6050 is specified for. Built with -DGYRO_FIFO_8KHZ the FIFO runs at the
+// full 8 kHz instead, 48 kB/s, more than 400 kHz carries: that needs the bus
+// at 1 MHz (dtparam=i2c_arm_baudrate=1000000), over the sensor's spec.
+#define GYRO_FIFO_RATE 8000.0f
+#ifdef GYRO_FIFO_8KHZ
+#define GYRO_FIFO_DIVIDER 0 // SMPLRT_DIV, 8 kHz / (1 + divider)
+#define GYRO_FIFO_DECIMATION 16
+#else
+#define GYRO_FIFO_DIVIDER 3
+#define GYRO_FIFO_DECIMATION 4
+#endif
+#define GYRO_FIFO_SAMPLES (MPU6050_FIFO_SIZE / 6)
+
+// sensor set-up in mpu6050_initialize() and hcm5883l_initialize()
+#define GYRO_RANGE 250.0f  // deg/s
+#define ACCEL_RANGE 2.0f   // g
+#define ACCEL_RATE 1000.0f // Hz
+#define MAG_RANGE 1.3f     // gauss
+#define MAG_RATE 15.0f     // Hz
+
+#define GCS_ATTITUDE_RATE 50.0f       // Hz, attitude to the ground station
+
+// scheduler table, rates in Hz below the sample rate, phases in ticks so no
+// two of the slow tasks start on the same tick, budgets in us
+#define MAG_TASK_RATE 75       // the HMC5883L maximum, polls data ready
+#define MAG_TASK_PHASE 1
+#define MAG_TASK_BUDGET 400
+#define TELEMETRY_TASK_RATE 50 // FIFO telemetry
+#define TELEMETRY_TASK_PHASE 2
+#define TELEMETRY_TASK_BUDGET 200
+#define PRINT_TASK_RATE 10     // attitude to stdout
+#define PRINT_TASK_PHASE 4
+#define PRINT_TASK_BUDGET 200
+#define STATUS_TASK_RATE 1     // status frames
+#define STATUS_TASK_PHASE 6
+#define STATUS_TASK_BUDGET 200
+#define IMU_TASK_BUDGET 1000   // the pipeline stages that run in the loop, for one tick
+
+// loop phases timed with -DLOOP_STATS
+#define LOOP_PHASE_IMU 0       // tick start to the sample through the stages of the loop
+#define LOOP_PHASE_TASKS 1     // the slower tasks due on the tick
+#define LOOP_PHASES 2
+
 short accData[3], gyrData[3];
-float pitch, roll;
+int16_t mx, my, mz;
+int logging = 0;
+int telemetry = 0;
+int streaming = 0;
+int sharing = 0;
+struct state_ring stateRing;
+uint64_t previousSampleTime = 0;
+int packLog = 0;
+int recording = 0;
+int oversample = 0;
+char magFresh = 0; // set by the mag task, taken by the next sample
+volatile sig_atomic_t running = 1;
+volatile sig_atomic_t manualTrigger = 0;
+#ifdef LOOP_STATS
+const char *loopPhaseNames[LOOP_PHASES] = {"imu", "tasks"};
+#endif
+
+// udp_sink is only ever called from the publish stage, which -P may put on
+// another thread than the loop: the status task hands its frames over here
+// and the publish stage sends them with the next sample.
+struct frame_status udpStatus;
+#ifdef LOOP_STATS
+struct frame_loop_stats udpLoopStats;
+#endif
+int udpStatusPending = 0;  // set by the status task, cleared by publish
+uint64_t udpDropped = 0;   // frames_dropped as publish last saw it
+
+void stop(int signal)
+{
+  (void)signal;
+  running = 0;
+}
+
+void trigger(int signal)
+{
+  (void)signal;
+  manualTrigger = 1;
+}
+
+/**
+ * The magnetometer runs at 15 Hz, only read it when a new sample is ready
+ * and let that drive the accel/mag correction.
+ *
+ * @return 1 if mx, my, mz were updated
+ */
+char read_mag()
+{
+  char magFresh = hcm5883l_data_ready();
+  if (magFresh)
+  {
+    getHeading(&mx, &my, &mz);
+  }
+  return magFresh;
+}
+
+/**
+ * Counters for the status frame, drops of every output summed.
+ */
+void get_status(struct frame_status *status, uint64_t time)
+{
+  struct async_writer_stats logStats;
+  struct comm_stats commStats;
+  uint64_t counters[COUNTERS];
+
+  counters_get(counters);
+  status->time = time;
+  status->samples = counters[COUNTER_SAMPLES];
+  status->i2c_errors = counters[COUNTER_I2C_ERRORS];
+  status->fifo_overflows = counters[COUNTER_FIFO_OVERFLOWS];
+  status->dropped = 0;
+  if (logging && (packLog ? sensor_pack_get_stats(&logStats) : sensor_log_get_stats(&logStats)) == 0)
+  {
+    status->dropped += logStats.dropped_writes;
+  }
+  if (telemetry)
+  {
+    comm_get_stats(&commStats);
+    status->dropped += commStats.dropped_frames;
+  }
+  if (streaming)
+  {
+    status->dropped += __atomic_load_n(&udpDropped, __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * Telemetry task: latest sample and attitude out of the pipeline to the FIFO.
+ */
+void send_telemetry(uint64_t now)
+{
+  struct pipeline_sample sample;
+
+  (void)now;
+  if (pipeline_latest(&sample) < 0)
+  {
+    return;
+  }
+  comm_send_raw_imu(&sample.record);
+  comm_send_attitude(sample.record.time, sample.q, sample.roll, sample.pitch, sample.yaw);
+}
+
+/**
+ * Status task: counters to the FIFO and, through the publish stage, over
+ * UDP, and the loop timing of the second since the previous status.
+ */
+void send_status(uint64_t now)
+{
+  struct frame_status status;
+#ifdef LOOP_STATS
+  struct frame_loop_stats loopStats;
+#endif
 
-void calculate_pitch_roll_yaw()
+  get_status(&status, now);
+  if (telemetry)
+  {
+    comm_send_status(&status);
+  }
+#ifdef LOOP_STATS
+  loop_stats_frame(&loopStats, now);
+  if (telemetry)
+  {
+    comm_send_loop_stats(&loopStats);
+  }
+#endif
+  if (streaming)
+  {
+    // publish has not taken the previous one, no sample went through for a
+    // whole status period
+    if (__atomic_load_n(&udpStatusPending, __ATOMIC_ACQUIRE))
+    {
+      counter_add(COUNTER_DROPPED_TELEMETRY, 1);
+      return;
+    }
+    udpStatus = status;
+#ifdef LOOP_STATS
+    udpLoopStats = loopStats;
+#endif
+    __atomic_store_n(&udpStatusPending, 1, __ATOMIC_RELEASE);
+  }
+}
+
+/**
+ * Every sample over UDP, the routes set in main() pick what goes where and
+ * how often, and the status frames send_status() handed over. One flush
+ * per sample sends whatever datagrams are due.
+ */
+void stream_telemetry(const struct pipeline_sample *sample)
 {
-  int16_t ax, ay, az, gx, gy, gz, mx, my, mz;
-  mpu6050_get_motion_6(&ax, &ay, &az, &gx, &gy, &gz);
-  getHeading(&mx, &my, &mz);
-  float gyroScale = 3.14159f / 180.0f;
-  mahony_update(gx * gyroScale, gy * gyroScale, gz * gyroScale, ax, ay, az, mx, my, mz);
+  struct udp_sink_stats stats;
 
-  printf("%f\t%f\t%f\n",
-    mahony_get_pitch(),
-    mahony_get_roll(),
-    mahony_get_yaw()
-  );
+  udp_sink_send_raw_imu(&sample->record);
+  udp_sink_send_attitude(sample->record.time, sample->q, sample->roll, sample->pitch, sample->yaw);
+  if (__atomic_load_n(&udpStatusPending, __ATOMIC_ACQUIRE))
+  {
+    udp_sink_send_status(&udpStatus);
+#ifdef LOOP_STATS
+    udp_sink_send_loop_stats(&udpLoopStats);
+#endif
+    __atomic_store_n(&udpStatusPending, 0, __ATOMIC_RELEASE);
+  }
+  udp_sink_flush(0);
+  udp_sink_get_stats(&stats);
+  __atomic_store_n(&udpDropped, stats.frames_dropped, __ATOMIC_RELAXED);
 }
 
-int main(void)
+/**
+ * Latest state to the shared memory ring, for local readers.
+ */
+void publish_state(const struct pipeline_sample *sample)
 {
+  struct state_snapshot snapshot;
+
+  snapshot.raw = sample->record;
+  memcpy(snapshot.q, sample->q, sizeof(snapshot.q));
+  snapshot.roll = sample->roll;
+  snapshot.pitch = sample->pitch;
+  snapshot.yaw = sample->yaw;
+  snapshot.loop_ns = previousSampleTime ? sample->record.time - previousSampleTime : 0;
+  snapshot.fusion_ns = sample->fusion_ns;
+  state_ring_publish(&stateRing, &snapshot);
+}
+
+/**
+ * Print task: pitch, roll and yaw to stdout, what printf("%f\t%f\t%f\n")
+ * printed without parsing a format every time.
+ */
+void print_attitude(uint64_t now)
+{
+  struct pipeline_sample sample;
+  char line[3 * (FMT_FLOAT_SIZE(6) + 1)];
+  char *p = line;
+
+  (void)now;
+  if (pipeline_latest(&sample) < 0)
+  {
+    return;
+  }
+  p = fmt_float(p, sample.pitch, 6);
+  p = fmt_char(p, '\t');
+  p = fmt_float(p, sample.roll, 6);
+  p = fmt_char(p, '\t');
+  p = fmt_float(p, sample.yaw, 6);
+  p = fmt_char(p, '\n');
+  fwrite(line, 1, p - line, stdout);
+}
+
+/**
+ * Mag task. The magnetometer runs at 15 Hz, polling its data ready at
+ * 75 Hz instead of on every sample keeps the bus free for the IMU.
+ */
+void poll_mag(uint64_t now)
+{
+  (void)now;
+  if (read_mag())
+  {
+    magFresh = 1;
+  }
+}
+
+/**
+ * @return 1 if the mag task read a new sample since the last call
+ */
+char take_mag()
+{
+  char fresh = magFresh;
+
+  magFresh = 0;
+  return fresh;
+}
+
+/**
+ * Acquire stage, in the loop: the IMU burst, undecoded, and the latest
+ * mag reading. A failed read repeats the previous burst, flagged. Samples
+ * from the oversampled FIFO arrive acquired and decoded.
+ */
+int stage_acquire(struct pipeline_sample *sample)
+{
+  static uint8_t raw[MPU6050_MOTION_7_SIZE];
+
+  if (sample->flags & PIPELINE_DECODED)
+  {
+    return 0;
+  }
+  if (mpu6050_read_motion_7(raw) < 0)
+  {
+    sample->record.flags |= SENSOR_LOG_I2C_ERROR;
+  }
+  memcpy(sample->raw, raw, sizeof(sample->raw));
+  if (take_mag())
+  {
+    sample->record.flags |= SENSOR_LOG_MAG_FRESH;
+  }
+  sample->record.mag[0] = mx;
+  sample->record.mag[1] = my;
+  sample->record.mag[2] = mz;
+  return 0;
+}
+
+/**
+ * Decode stage: register bytes to the record that gets logged.
+ */
+int stage_decode(struct pipeline_sample *sample)
+{
+  struct sensor_log_record *record = &sample->record;
+  int16_t ax, ay, az, gx, gy, gz, temp;
+
+  if (sample->flags & PIPELINE_DECODED)
+  {
+    return 0;
+  }
+  mpu6050_decode_motion_7(sample->raw, &ax, &ay, &az, &gx, &gy, &gz, &temp);
+  record->gyro[0] = gx;
+  record->gyro[1] = gy;
+  record->gyro[2] = gz;
+  record->accel[0] = ax;
+  record->accel[1] = ay;
+  record->accel[2] = az;
+  record->temp = temp;
+  return 0;
+}
+
+/**
+ * Filter stage: notches and low-pass.
+ */
+int stage_filter(struct pipeline_sample *sample)
+{
+  estimator_filter(&sample->record, sample->filtered);
+  return 0;
+}
+
+/**
+ * Fuse stage: Mahony update, the attitude goes on with the sample so later
+ * stages and other threads never read the filter state.
+ */
+int stage_fuse(struct pipeline_sample *sample)
+{
+  uint64_t start = sensor_log_now();
+
+  estimator_fuse(&sample->record, sample->filtered);
+  sample->fusion_ns = sensor_log_now() - start;
+  mahony_get_quaternion(sample->q);
+  mahony_get_integral_feedback(sample->integral_fb);
+  sample->roll = mahony_get_roll();
+  sample->pitch = mahony_get_pitch();
+  sample->yaw = mahony_get_yaw();
+  return 0;
+}
+
+/**
+ * Publish stage: log, UDP, shared memory and flight recorder. The log gets
+ * the record the estimator saw, so it replays to the same attitude.
+ */
+int stage_publish(struct pipeline_sample *sample)
+{
+  const struct sensor_log_record *record = &sample->record;
+
+  if (logging)
+  {
+    if (packLog)
+    {
+      sensor_pack_write(record);
+    }
+    else
+    {
+      sensor_log_write(record);
+    }
+  }
+  counter_add(COUNTER_SAMPLES, 1);
+  if (record->flags & SENSOR_LOG_I2C_ERROR)
+  {
+    counter_add(COUNTER_I2C_ERRORS, 1);
+  }
+
+  if (streaming)
+  {
+    stream_telemetry(sample);
+  }
+  if (sharing)
+  {
+    publish_state(sample);
+  }
+  previousSampleTime = record->time;
+
+  if (recording)
+  {
+    if (manualTrigger)
+    {
+      flight_recorder_trigger(FLIGHT_RECORDER_MANUAL);
+      manualTrigger = 0;
+    }
+    flight_recorder_record(record, sample->q, sample->integral_fb);
+  }
+  return 0;
+}
+
+const pipeline_stage sampleStages[PIPELINE_STAGES] = {stage_acquire, stage_decode, stage_filter, stage_fuse, stage_publish};
+
+/**
+ * Drain the gyro FIFO in one burst and feed every decimated sample in. The
+ * accelerometer only runs at 1 kHz, the latest reading is used.
+ */
+void acquire_oversampled(uint64_t time)
+{
+  static int16_t gyro[GYRO_FIFO_SAMPLES * 3];
+  static int16_t ax, ay, az, temp;
+  static uint16_t pendingFlags = 0;
+  int16_t gx, gy, gz;
+  float rate[CIC_AXES];
+  int samples, i;
+
+  samples = mpu6050_read_gyro_fifo(gyro, GYRO_FIFO_SAMPLES);
+  if (samples < 0)
+  {
+    counter_add(COUNTER_FIFO_OVERFLOWS, 1);
+    fprintf(stderr, "gyro fifo overflow (%llu)\n", (unsigned long long)counters_get_one(COUNTER_FIFO_OVERFLOWS));
+    pendingFlags |= SENSOR_LOG_FIFO_OVERFLOW;
+    return;
+  }
+
+  if (samples > 0)
+  {
+    // only the accel and temperature are used, the gyro comes from the FIFO
+    if (mpu6050_get_motion_7(&ax, &ay, &az, &gx, &gy, &gz, &temp) < 0)
+    {
+      pendingFlags |= SENSOR_LOG_I2C_ERROR;
+    }
+  }
+  for (i = 0; i < samples; i++)
+  {
+    if (cic_push(&gyro[i * 3], rate))
+    {
+      struct pipeline_sample sample;
+      struct sensor_log_record *record = &sample.record;
+
+      memset(&sample, 0, sizeof(sample));
+      sample.flags = PIPELINE_DECODED;
+      sample.stamp[0] = time;
+      record->flags = pendingFlags | SENSOR_LOG_DECIMATED;
+      if (take_mag())
+      {
+        record->flags |= SENSOR_LOG_MAG_FRESH;
+      }
+      pendingFlags = 0;
+
+      // samples in the burst are 1 / GYRO_FIFO_RATE apart, the last one is
+      // now. The CIC output is rounded to the int16 that gets logged, half
+      // an LSB is far below the gyro noise.
+      record->time = time - (uint64_t)((samples - 1 - i) * 1e9 / GYRO_FIFO_RATE * (1 + GYRO_FIFO_DIVIDER));
+      record->gyro[0] = lrintf(rate[0]);
+      record->gyro[1] = lrintf(rate[1]);
+      record->gyro[2] = lrintf(rate[2]);
+      record->accel[0] = ax;
+      record->accel[1] = ay;
+      record->accel[2] = az;
+      record->mag[0] = mx;
+      record->mag[1] = my;
+      record->mag[2] = mz;
+      record->temp = temp;
+      pipeline_submit(&sample);
+    }
+  }
+}
+
+/**
+ * IMU task, every tick: one sample into the pipeline, or in oversampled
+ * mode the FIFO burst of one decimated sample. There is no data ready
+ * interrupt wired, the read starts on the tick and stands for data ready
+ * in the latencies.
+ */
+void acquire(uint64_t now)
+{
+  uint64_t time = sensor_log_now();
+  struct pipeline_sample sample;
+
+  (void)now;
+  if (oversample)
+  {
+    acquire_oversampled(time);
+  }
+  else
+  {
+    memset(&sample, 0, sizeof(sample));
+    sample.stamp[0] = time;
+    sample.record.time = time;
+    pipeline_submit(&sample);
+  }
+  LOOP_STATS_MARK(LOOP_PHASE_IMU);
+}
+
+int main(int argc, char **argv)
+{
+  float sampleFreq = SAMPLE_FREQ;
+  const char *logPath = NULL;
+  const char *recorderPath = NULL;
+  const char *loggerAddress = NULL;
+  const char *gcsAddress = NULL;
+  const char *countersPath = NULL;
+  struct sensor_log_header header;
+  struct rt_loop_config rtConfig;
+  struct pipeline_config pipelineConfig;
+  struct rt_loop loop;
+  int opt, i;
+
+  rt_loop_config_init(&rtConfig);
+  pipeline_config_init(&pipelineConfig);
+  while ((opt = getopt(argc, argv, "ol:zr:tsu:g:R:c:mP:C:")) != -1)
+  {
+    switch (opt)
+    {
+    case 'o':
+      oversample = 1;
+      break;
+    case 'l':
+      logPath = optarg;
+      break;
+    case 'z':
+      packLog = 1;
+      break;
+    case 'r':
+      recorderPath = optarg;
+      break;
+    case 't':
+      telemetry = 1;
+      break;
+    case 's':
+      sharing = 1;
+      break;
+    case 'u':
+      loggerAddress = optarg;
+      break;
+    case 'g':
+      gcsAddress = optarg;
+      break;
+    case 'R':
+      rtConfig.priority = atoi(optarg);
+      break;
+    case 'c':
+      rtConfig.cpu = atoi(optarg);
+      break;
+    case 'm':
+      rtConfig.lock_memory = 1;
+      rtConfig.stack_prefault = RT_LOOP_STACK_PREFAULT;
+      break;
+    case 'P':
+      if (pipeline_parse_placement(&pipelineConfig, optarg) < 0)
+      {
+        return 1;
+      }
+      break;
+    case 'C':
+      countersPath = optarg;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-o] [-l log [-z]] [-r recorder_dir] [-t] [-s] [-u logger_host:port] [-g gcs_host:port] "
+        "[-R fifo_priority] [-c cpu] [-m] [-P stage_threads] [-C counters_socket]\n", argv[0]);
+      return 1;
+    }
+  }
+
   mpu6050_initialize();
   hcm5883l_initialize();
-  while (1)
+
+  if (oversample)
+  {
+    sampleFreq = GYRO_FIFO_RATE / (1 + GYRO_FIFO_DIVIDER) / GYRO_FIFO_DECIMATION;
+    mpu6050_enable_gyro_fifo(GYRO_FIFO_DIVIDER);
+    cic_init(GYRO_FIFO_DECIMATION);
+  }
+  estimator_init(sampleFreq);
+
+  sensor_log_header_init(&header);
+  header.gyro_range = GYRO_RANGE;
+  header.accel_range = ACCEL_RANGE;
+  header.mag_range = MAG_RANGE;
+  header.gyro_rate = sampleFreq;
+  header.accel_rate = ACCEL_RATE;
+  header.mag_rate = MAG_RATE;
+
+  if (logPath)
+  {
+    if ((packLog ? sensor_pack_open(logPath, &header, ASYNC_WRITER_DIRECT) : sensor_log_open(logPath, &header, ASYNC_WRITER_DIRECT)) < 0)
+    {
+      err(logPath);
+    }
+    logging = 1;
+  }
+
+  // keep the last seconds in RAM and save them around anomalies, or on
+  // SIGUSR1
+  if (recorderPath)
+  {
+    if (flight_recorder_start(recorderPath, &header) < 0)
+    {
+      err("flight recorder");
+    }
+    signal(SIGUSR1, trigger);
+    recording = 1;
+  }
+
+  // binary frames to /tmp/myfifo, readers can come and go
+  if (telemetry)
+  {
+    comm_open(COMM_FIFO);
+  }
+
+  // every sample to /dev/shm for any number of local readers
+  if (sharing)
+  {
+    if (state_ring_create(STATE_RING_NAME, &stateRing) < 0)
+    {
+      err("state ring");
+    }
+  }
+
+  // UDP: every raw sample to a logger, attitude at GCS_ATTITUDE_RATE to a
+  // ground station, status to both
+  if (loggerAddress || gcsAddress)
+  {
+    int destination;
+
+    if (udp_sink_open(UDP_SINK_MAX_DELAY_NS) < 0)
+    {
+      err("udp");
+    }
+    if (loggerAddress)
+    {
+      if ((destination = udp_sink_add_destination(loggerAddress)) < 0)
+      {
+        err(loggerAddress);
+      }
+      udp_sink_route(FRAME_RAW_IMU, destination, 1);
+      udp_sink_route(FRAME_STATUS, destination, 1);
+#ifdef LOOP_STATS
+      udp_sink_route(FRAME_LOOP_STATS, destination, 1);
+#endif
+    }
+    if (gcsAddress)
+    {
+      if ((destination = udp_sink_add_destination(gcsAddress)) < 0)
+      {
+        err(gcsAddress);
+      }
+      udp_sink_route(FRAME_ATTITUDE, destination, sampleFreq > GCS_ATTITUDE_RATE ? lrintf(sampleFreq / GCS_ATTITUDE_RATE) : 1);
+      udp_sink_route(FRAME_STATUS, destination, 1);
+#ifdef LOOP_STATS
+      udp_sink_route(FRAME_LOOP_STATS, destination, 1);
+#endif
+    }
+    streaming = 1;
+  }
+
+  // counters for soak tests, served on a Unix socket by a SCHED_IDLE
+  // thread: -C /tmp/icaro_counters is where metrics/scrape looks
+  if (countersPath)
+  {
+    if (counters_serve(countersPath) < 0)
+    {
+      err(countersPath);
+    }
+  }
+
+  // finish the loop iteration and flush the log on Ctrl-C
+  signal(SIGINT, stop);
+  signal(SIGTERM, stop);
+
+  // acquire to publish, thread 0 is the loop. The other threads get the
+  // priority of the loop, and the CPUs after its own when it is pinned.
+  for (i = 1; i < PIPELINE_THREADS; i++)
   {
-    calculate_pitch_roll_yaw();
+    pipelineConfig.rt[i].priority = rtConfig.priority;
+    pipelineConfig.rt[i].stack_prefault = rtConfig.stack_prefault;
+    if (rtConfig.cpu != RT_LOOP_NO_CPU)
+    {
+      pipelineConfig.rt[i].cpu = rtConfig.cpu + i;
+    }
+  }
+  if (pipeline_start(sampleStages, &pipelineConfig) < 0)
+  {
+    err("pipeline");
+  }
+
+  // one tick per sample, the slower work spread over the ticks between
+  scheduler_init(lrintf(sampleFreq), NULL);
+  scheduler_add("imu", acquire, lrintf(sampleFreq), 0, IMU_TASK_BUDGET * 1000ULL);
+  scheduler_add("mag", poll_mag, MAG_TASK_RATE, MAG_TASK_PHASE, MAG_TASK_BUDGET * 1000ULL);
+  scheduler_add("print", print_attitude, PRINT_TASK_RATE, PRINT_TASK_PHASE, PRINT_TASK_BUDGET * 1000ULL);
+  if (telemetry)
+  {
+    scheduler_add("telemetry", send_telemetry, TELEMETRY_TASK_RATE, TELEMETRY_TASK_PHASE, TELEMETRY_TASK_BUDGET * 1000ULL);
+  }
+  if (telemetry || streaming)
+  {
+    scheduler_add("status", send_status, STATUS_TASK_RATE, STATUS_TASK_PHASE, STATUS_TASK_BUDGET * 1000ULL);
+  }
+
+  // everything is open, so the loop goes SCHED_FIFO, on its own core if
+  // asked. The pipeline threads above already run at its priority on the
+  // CPUs after it, the log writer keeps the default scheduling and the
+  // counters thread runs SCHED_IDLE.
+  // In oversampled mode a tick is one decimated sample's worth of FIFO,
+  // which keeps the FIFO drained without polling the bus.
+  rt_loop_setup(&rtConfig);
+  rt_loop_start(&loop, scheduler_tick_ns());
+  scheduler_start(loop.deadline_ns);
+#ifdef LOOP_STATS
+  loop_stats_init(scheduler_tick_ns(), loopPhaseNames, LOOP_PHASES);
+#endif
+  while (running)
+  {
+    LOOP_STATS_BEGIN();
+    scheduler_run();
+    LOOP_STATS_MARK(LOOP_PHASE_TASKS);
+    LOOP_STATS_END();
+    rt_loop_wait(&loop);
+  }
+  pipeline_stop();
+  counters_stop();
+
+  {
+    struct rt_loop_stats stats;
+
+    rt_loop_get_stats(&loop, &stats);
+    fprintf(stderr, "loop: %llu cycles, %llu overruns, %llu periods skipped, worst wake-up %.1f us, longest iteration %.1f us\n",
+      (unsigned long long)stats.cycles, (unsigned long long)stats.overruns, (unsigned long long)stats.skipped,
+      stats.max_late_ns * 1e-3, stats.max_busy_ns * 1e-3);
+  }
+  {
+    struct scheduler_task_stats stats;
+    int i;
+
+    for (i = 0; scheduler_get_task_stats(i, &stats) == 0; i++)
+    {
+      fprintf(stderr, "task %s: %llu runs at %u Hz, %llu missed, %llu over the %.0f us budget, longest %.1f us, mean %.1f us\n",
+        stats.name, (unsigned long long)stats.runs, stats.rate, (unsigned long long)stats.missed,
+        (unsigned long long)stats.overruns, stats.budget_ns * 1e-3, stats.max_ns * 1e-3,
+        stats.runs ? stats.total_ns * 1e-3 / stats.runs : 0.0);
+    }
+  }
+  pipeline_report(stderr);
+#ifdef LOOP_STATS
+  loop_stats_report(stderr);
+#endif
+
+  if (logging)
+  {
+    struct async_writer_stats stats;
+
+    if ((packLog ? sensor_pack_get_stats(&stats) : sensor_log_get_stats(&stats)) == 0)
+    {
+      fprintf(stderr, "log: %llu bytes written, %llu writes dropped, max queue depth %u, slowest write %.1f ms\n",
+        (unsigned long long)stats.bytes_written, (unsigned long long)stats.dropped_writes,
+        stats.max_queue_depth, stats.max_write_ns * 1e-6);
+    }
+  }
+  sensor_log_close();
+  sensor_pack_close();
+  flight_recorder_stop();
+  if (sharing)
+  {
+    state_ring_close(&stateRing);
+  }
+  if (streaming)
+  {
+    struct udp_sink_stats stats;
+
+    udp_sink_get_stats(&stats);
+    fprintf(stderr, "udp: %llu frames sent in %llu datagrams, %llu dropped, %llu send errors\n",
+      (unsigned long long)stats.frames_sent, (unsigned long long)stats.datagrams_sent,
+      (unsigned long long)stats.frames_dropped, (unsigned long long)stats.send_errors);
+    udp_sink_close();
+  }
+  if (telemetry)
+  {
+    struct comm_stats stats;
+
+    comm_get_stats(&stats);
+    fprintf(stderr, "telemetry: %llu frames sent, %llu dropped, %llu readers\n",
+      (unsigned long long)stats.sent_frames, (unsigned long long)stats.dropped_frames,
+      (unsigned long long)stats.reconnects);
+    comm_close();
   }
 
   return 0;
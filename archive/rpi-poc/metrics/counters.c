@@ -0,0 +1,259 @@
+/**
+ * Per-thread counter registry and its socket server, see counters.h.
+ *
+ * A thread finds its block through a thread-local pointer, set the first
+ * time it counts by claiming the next free block with an atomic add, the
+ * one atomic read-modify-write a thread ever does. The blocks are static,
+ * so a reader that sees a claim before the first store reads zeroes.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+#include "counters.h"
+
+struct counters_block
+{
+    uint64_t value[COUNTERS];
+} __attribute__((aligned(64)));
+
+struct counters_info
+{
+    const char *name;
+    const char *help;
+};
+
+static const struct counters_info countersInfo[COUNTERS] = {
+    {"samples", "Samples acquired."},
+    {"i2c_errors", "Sensor reads that failed on the I2C bus."},
+    {"fifo_overflows", "Gyro FIFO overflows, samples lost in the sensor."},
+    {"dropped_telemetry", "Telemetry frames dropped, FIFO and UDP."},
+    {"loop_overruns", "Loop iterations that ran past the next deadline."},
+    {"filter_resets", "Estimator restarts after a non-finite attitude."},
+};
+
+struct counters_block countersBlocks[COUNTERS_THREADS];
+struct counters_block countersShared; // threads beyond COUNTERS_THREADS, atomic adds
+int countersClaimed = 0;              // blocks handed out, may pass COUNTERS_THREADS
+__thread struct counters_block *countersBlock = NULL;
+
+pthread_t countersThread;
+int countersServing = 0;
+int countersRunning = 0;
+int countersFd = -1;
+char countersPath[sizeof(((struct sockaddr_un *)0)->sun_path)];
+
+/**
+ * Count, from any thread.
+ *
+ * @param id Counter
+ * @param n Amount to add
+ */
+void counter_add(enum counter_id id, uint64_t n)
+{
+    struct counters_block *block = countersBlock;
+
+    if (!block)
+    {
+        int claimed = __atomic_fetch_add(&countersClaimed, 1, __ATOMIC_RELEASE);
+
+        block = claimed < COUNTERS_THREADS ? &countersBlocks[claimed] : &countersShared;
+        countersBlock = block;
+    }
+    if (block == &countersShared)
+        __atomic_fetch_add(&block->value[id], n, __ATOMIC_RELAXED);
+    else
+        __atomic_store_n(&block->value[id], block->value[id] + n, __ATOMIC_RELAXED);
+}
+
+/**
+ * Sum over every thread, from any thread.
+ *
+ * @param totals Filled with COUNTERS values, by enum counter_id
+ */
+void counters_get(uint64_t *totals)
+{
+    int threads = counters_get_threads(), i, id;
+
+    for (id = 0; id < COUNTERS; id++)
+        totals[id] = __atomic_load_n(&countersShared.value[id], __ATOMIC_RELAXED);
+    for (i = 0; i < threads; i++)
+    {
+        for (id = 0; id < COUNTERS; id++)
+            totals[id] += __atomic_load_n(&countersBlocks[i].value[id], __ATOMIC_RELAXED);
+    }
+}
+
+/**
+ * @param id Counter
+ * @return Sum over every thread
+ */
+uint64_t counters_get_one(enum counter_id id)
+{
+    uint64_t totals[COUNTERS];
+
+    counters_get(totals);
+    return totals[id];
+}
+
+/**
+ * @return Threads with a block of their own
+ */
+int counters_get_threads()
+{
+    int claimed = __atomic_load_n(&countersClaimed, __ATOMIC_ACQUIRE);
+
+    return claimed < COUNTERS_THREADS ? claimed : COUNTERS_THREADS;
+}
+
+/**
+ * The totals as exposition text.
+ *
+ * @param out Where to write, COUNTERS_TEXT_SIZE is enough
+ * @param size Size of out
+ * @return Length of the text, without the '\0'
+ */
+size_t counters_format(char *out, size_t size)
+{
+    uint64_t totals[COUNTERS];
+    size_t length = 0;
+    int id, n;
+
+    counters_get(totals);
+    for (id = 0; id < COUNTERS; id++)
+    {
+        n = snprintf(out + length, size - length, "# HELP icaro_%s_total %s\n# TYPE icaro_%s_total counter\nicaro_%s_total %llu\n",
+                     countersInfo[id].name, countersInfo[id].help, countersInfo[id].name, countersInfo[id].name,
+                     (unsigned long long)totals[id]);
+        if (n < 0 || (size_t)n >= size - length)
+            return length;
+        length += n;
+    }
+    n = snprintf(out + length, size - length, "# HELP icaro_counter_threads Threads counting in blocks of their own.\n"
+                 "# TYPE icaro_counter_threads gauge\nicaro_counter_threads %d\n", counters_get_threads());
+    if (n > 0 && (size_t)n < size - length)
+        length += n;
+    return length;
+}
+
+/**
+ * Write the text to a client, never waits for a slow one for long.
+ */
+static void counters_reply(int client)
+{
+    char text[COUNTERS_TEXT_SIZE];
+    size_t length = counters_format(text, sizeof(text)), sent = 0;
+    struct timeval timeout = {1, 0};
+
+    setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    while (sent < length)
+    {
+        ssize_t n = send(client, text + sent, length - sent, MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        sent += n;
+    }
+    close(client);
+}
+
+static void *counters_server(void *arg)
+{
+    struct sched_param param = {0};
+    struct pollfd pfd;
+
+    (void)arg;
+    // only runs on time nobody else wants, the loop never waits for it
+    pthread_setschedparam(pthread_self(), SCHED_IDLE, &param);
+
+    pfd.fd = countersFd;
+    pfd.events = POLLIN;
+    while (__atomic_load_n(&countersRunning, __ATOMIC_ACQUIRE))
+    {
+        int client;
+
+        if (poll(&pfd, 1, COUNTERS_POLL_MS) <= 0)
+            continue;
+        client = accept(countersFd, NULL, NULL);
+        if (client >= 0)
+            counters_reply(client);
+    }
+    return NULL;
+}
+
+/**
+ * Serve the totals on a Unix domain socket, one reply per connection. A
+ * socket file left by an earlier run is replaced.
+ *
+ * @param path Socket path, COUNTERS_SOCKET
+ * @return 0 on success, -1 on failure
+ */
+int counters_serve(const char *path)
+{
+    struct sockaddr_un address;
+
+    if (strlen(path) >= sizeof(address.sun_path))
+    {
+        fprintf(stderr, "counters: socket path too long: %s\n", path);
+        return -1;
+    }
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    countersFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+    if (countersFd < 0)
+    {
+        perror("counters: socket");
+        return -1;
+    }
+    unlink(path);
+    if (bind(countersFd, (struct sockaddr *)&address, sizeof(address)) < 0 || listen(countersFd, 8) < 0)
+    {
+        fprintf(stderr, "counters: %s: %s\n", path, strerror(errno));
+        close(countersFd);
+        countersFd = -1;
+        return -1;
+    }
+    strcpy(countersPath, path);
+
+    countersRunning = 1;
+    if (pthread_create(&countersThread, NULL, counters_server, NULL) != 0)
+    {
+        fprintf(stderr, "counters: failed to start the server thread\n");
+        countersRunning = 0;
+        close(countersFd);
+        countersFd = -1;
+        unlink(path);
+        return -1;
+    }
+    countersServing = 1;
+    return 0;
+}
+
+/**
+ * Stop serving and remove the socket. The counters stay.
+ */
+void counters_stop()
+{
+    if (!countersServing)
+        return;
+    __atomic_store_n(&countersRunning, 0, __ATOMIC_RELEASE);
+    pthread_join(countersThread, NULL);
+    close(countersFd);
+    countersFd = -1;
+    unlink(countersPath);
+    countersServing = 0;
+}
@@ -0,0 +1,55 @@
+#ifndef __COUNTERS_H_
+#define __COUNTERS_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Lock-free per-thread counter registry.
+ *
+ * Every thread that counts gets a block of its own on its first
+ * counter_add(), one cache line per block, and is the only writer of it:
+ * an increment is a load and a relaxed store, no lock, no atomic
+ * read-modify-write and no line shared with another writer. Readers sum
+ * the blocks with relaxed loads at any time; a sum may miss an increment
+ * made while it runs, never counts one twice, and never goes backwards.
+ * Blocks outlive their threads, so what a finished thread counted stays in
+ * the totals. Threads beyond COUNTERS_THREADS share one block with atomic
+ * adds.
+ *
+ * counters_serve() starts a SCHED_IDLE thread that sums the blocks for
+ * every client of a Unix domain socket and writes them in the plain text
+ * exposition format Prometheus scrapes:
+ *
+ *   # HELP icaro_samples_total Samples acquired.
+ *   # TYPE icaro_samples_total counter
+ *   icaro_samples_total 1536000
+ *
+ * The counting threads never wait for it.
+ */
+
+#define COUNTERS_THREADS 16                   // own blocks, later threads share one
+#define COUNTERS_SOCKET "/tmp/icaro_counters" // default socket path
+#define COUNTERS_POLL_MS 200                  // how soon the server notices counters_stop()
+#define COUNTERS_TEXT_SIZE 4096               // exposition text, all counters fit
+
+enum counter_id
+{
+    COUNTER_SAMPLES,
+    COUNTER_I2C_ERRORS,
+    COUNTER_FIFO_OVERFLOWS,
+    COUNTER_DROPPED_TELEMETRY,
+    COUNTER_LOOP_OVERRUNS,
+    COUNTER_FILTER_RESETS,
+    COUNTERS
+};
+
+void counter_add(enum counter_id id, uint64_t n);
+void counters_get(uint64_t *totals);
+uint64_t counters_get_one(enum counter_id id);
+int counters_get_threads();
+size_t counters_format(char *out, size_t size);
+int counters_serve(const char *path);
+void counters_stop();
+
+#endif
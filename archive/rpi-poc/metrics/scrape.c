@@ -0,0 +1,227 @@
+/**
+ * Counter scraper.
+ *
+ * Connects to the counters socket main serves with -C and prints the
+ * exposition text, what a Prometheus scrape through a socket proxy would
+ * see.
+ *
+ * -t runs a self test instead: threads count as fast as they can while
+ * the registry serves on a temporary socket and is scraped over and over;
+ * every scrape must parse, no counter may go backwards and the final
+ * totals must be exact, also with more threads than COUNTERS_THREADS.
+ * Then one counter_add() is timed against an atomic add on a counter all
+ * threads share.
+ *
+ * usage: scrape [socket] | -t [threads]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "counters.h"
+
+#define TEST_ADDS 2000000 // per thread and counter id
+#define TEST_SOCKET "/tmp/icaro_counters_test"
+#define TEST_MAX_THREADS (2 * COUNTERS_THREADS) // past the own blocks, the rest share one
+
+uint64_t sharedCounter = 0;
+int testThreads = 4;
+
+static double now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/**
+ * @return Bytes of the reply in text, -1 if the socket is not there
+ */
+static ssize_t scrape(const char *path, char *text, size_t size)
+{
+    struct sockaddr_un address;
+    size_t length = 0;
+    ssize_t n;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) < 0)
+    {
+        perror(path);
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    while (length < size - 1 && (n = read(fd, text + length, size - 1 - length)) > 0)
+        length += n;
+    text[length] = '\0';
+    close(fd);
+    return length;
+}
+
+/**
+ * Value of a counter in exposition text.
+ *
+ * @return 0 on success, -1 if it is not there
+ */
+static int parse(const char *text, const char *name, uint64_t *value)
+{
+    size_t length = strlen(name);
+    const char *line = text;
+
+    while (line && *line)
+    {
+        if (strncmp(line, name, length) == 0 && line[length] == ' ')
+        {
+            *value = strtoull(line + length + 1, NULL, 10);
+            return 0;
+        }
+        line = strchr(line, '\n');
+        if (line)
+            line++;
+    }
+    return -1;
+}
+
+static void *count(void *arg)
+{
+    int i, id;
+
+    (void)arg;
+    for (i = 0; i < TEST_ADDS; i++)
+    {
+        for (id = 0; id < COUNTERS; id++)
+            counter_add(id, 1);
+    }
+    return NULL;
+}
+
+static void *count_shared(void *arg)
+{
+    int i, id;
+
+    (void)arg;
+    for (i = 0; i < TEST_ADDS; i++)
+    {
+        for (id = 0; id < COUNTERS; id++)
+            __atomic_fetch_add(&sharedCounter, 1, __ATOMIC_RELAXED);
+    }
+    return NULL;
+}
+
+static double run_threads(void *(*function)(void *))
+{
+    pthread_t threads[TEST_MAX_THREADS];
+    double start = now();
+    int i;
+
+    for (i = 0; i < testThreads; i++)
+        pthread_create(&threads[i], NULL, function, NULL);
+    for (i = 0; i < testThreads; i++)
+        pthread_join(threads[i], NULL);
+    return now() - start;
+}
+
+struct scraper
+{
+    int running;
+    int scrapes;
+    int failures;
+};
+
+static void *scrape_loop(void *arg)
+{
+    struct scraper *scraper = arg;
+    static char text[COUNTERS_TEXT_SIZE];
+    uint64_t previous = 0, value;
+
+    while (__atomic_load_n(&scraper->running, __ATOMIC_ACQUIRE))
+    {
+        if (scrape(TEST_SOCKET, text, sizeof(text)) < 0 || parse(text, "icaro_samples_total", &value) < 0 || value < previous)
+            scraper->failures++;
+        else
+            previous = value;
+        scraper->scrapes++;
+        usleep(1000);
+    }
+    return NULL;
+}
+
+int test()
+{
+    static char text[COUNTERS_TEXT_SIZE];
+    struct scraper scraper = {1, 0, 0};
+    pthread_t scrapeThread;
+    uint64_t expected = (uint64_t)testThreads * TEST_ADDS, value;
+    double ownSeconds, sharedSeconds;
+    int failed = 0, id;
+
+    if (counters_serve(TEST_SOCKET) < 0)
+        return 1;
+    pthread_create(&scrapeThread, NULL, scrape_loop, &scraper);
+    ownSeconds = run_threads(count);
+    __atomic_store_n(&scraper.running, 0, __ATOMIC_RELEASE);
+    pthread_join(scrapeThread, NULL);
+
+    if (scrape(TEST_SOCKET, text, sizeof(text)) < 0)
+        failed = 1;
+    else
+        fputs(text, stdout);
+    counters_stop();
+
+    for (id = 0; id < COUNTERS; id++)
+    {
+        if (counters_get_one(id) != expected)
+        {
+            fprintf(stderr, "FAILED: counter %d at %llu, want %llu\n", id, (unsigned long long)counters_get_one(id),
+                    (unsigned long long)expected);
+            failed = 1;
+        }
+    }
+    if (parse(text, "icaro_filter_resets_total", &value) < 0 || value != expected)
+    {
+        fprintf(stderr, "FAILED: the scraped text does not have the totals\n");
+        failed = 1;
+    }
+    printf("%d threads, %d scrapes while counting, %d bad\n", testThreads, scraper.scrapes, scraper.failures);
+    if (scraper.failures)
+        failed = 1;
+
+    sharedSeconds = run_threads(count_shared);
+    printf("per add over all threads: counter_add %.2f ns, atomic add on a shared counter %.2f ns\n",
+           ownSeconds / ((double)expected * COUNTERS) * 1e9, sharedSeconds / ((double)expected * COUNTERS) * 1e9);
+    printf("%s\n", failed ? "FAILED" : "every scrape parsed, none went backwards, totals exact");
+    return failed;
+}
+
+int main(int argc, char **argv)
+{
+    static char text[COUNTERS_TEXT_SIZE * 4];
+
+    if (argc > 1 && strcmp(argv[1], "-t") == 0)
+    {
+        if (argc > 2)
+            testThreads = atoi(argv[2]);
+        if (testThreads < 1 || testThreads > TEST_MAX_THREADS)
+            testThreads = 4;
+        return test();
+    }
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: %s [socket] | -t [threads]\n", argv[0]);
+        return 1;
+    }
+    if (scrape(argc > 1 ? argv[1] : COUNTERS_SOCKET, text, sizeof(text)) < 0)
+        return 1;
+    fputs(text, stdout);
+    return 0;
+}
@@ -0,0 +1,377 @@
+/**
+ * Staged sample pipeline, see pipeline.h.
+ *
+ * Each counter has a single writer: the latencies and the latest sample
+ * are written by the thread running the last stage, a drop by the thread
+ * of the stage, a full queue by the thread feeding it. The statistics are
+ * read after pipeline_stop() has joined the threads, the latest sample
+ * through a sequence lock at any time.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+#include "pipeline.h"
+
+struct pipeline_thread
+{
+    pthread_t thread;
+    sem_t ready;                 // posted once per queued sample
+    struct spsc_queue queue;     // samples into the first stage of the thread
+    int first, last;             // stages run here
+    struct rt_loop_config rt;
+};
+
+const char *pipelineStageNames[PIPELINE_STAGES] = {"acquire", "decode", "filter", "fuse", "publish"};
+
+pipeline_stage pipelineStages[PIPELINE_STAGES];
+struct pipeline_thread pipelineThreads[PIPELINE_THREADS];
+int pipelineThreadCount = 0;
+int pipelineRunning = 0;
+struct pipeline_stats pipelineStats;
+
+uint32_t pipelineLatestSequence = 0; // odd while written
+struct pipeline_sample pipelineLatest;
+
+static uint64_t pipeline_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Histogram bucket: exact below 16 ns, then 16 buckets per power of two.
+ */
+static int pipeline_bucket(uint64_t ns)
+{
+    int exponent, bucket;
+
+    if (ns < 16)
+        return ns;
+    exponent = 63 - __builtin_clzll(ns);
+    bucket = (exponent - 3) * 16 + ((ns >> (exponent - 4)) & 15);
+    return bucket < PIPELINE_BUCKETS ? bucket : PIPELINE_BUCKETS - 1;
+}
+
+/**
+ * @return Middle of a bucket in ns
+ */
+static uint64_t pipeline_bucket_value(int bucket)
+{
+    int exponent;
+
+    if (bucket < 16)
+        return bucket;
+    exponent = bucket / 16 + 3;
+    return ((uint64_t)(16 + bucket % 16) << (exponent - 4)) + (1ULL << (exponent - 4)) / 2;
+}
+
+static void pipeline_record(struct pipeline_latency *latency, uint64_t ns)
+{
+    latency->buckets[pipeline_bucket(ns)]++;
+    latency->count++;
+    if (ns > latency->max_ns)
+        latency->max_ns = ns;
+}
+
+/**
+ * Last stage done: account the latencies, make the sample the latest.
+ */
+static void pipeline_complete(const struct pipeline_sample *sample)
+{
+    uint32_t sequence = pipelineLatestSequence;
+    int i;
+
+    for (i = 0; i < PIPELINE_STAGES; i++)
+        pipeline_record(&pipelineStats.stage[i], sample->stamp[i + 1] - sample->stamp[i]);
+    pipeline_record(&pipelineStats.total, sample->stamp[PIPELINE_STAGES] - sample->stamp[0]);
+    pipelineStats.completed++;
+
+    __atomic_store_n(&pipelineLatestSequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    pipelineLatest = *sample;
+    __atomic_store_n(&pipelineLatestSequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+/**
+ * Run the stages of one thread on a sample, then hand it to the next
+ * thread or complete it.
+ */
+static int pipeline_run(int thread, struct pipeline_sample *sample)
+{
+    struct pipeline_thread *t = &pipelineThreads[thread];
+    int stage;
+
+    for (stage = t->first; stage <= t->last; stage++)
+    {
+        if (pipelineStages[stage](sample) < 0)
+        {
+            pipelineStats.dropped[stage]++;
+            return -1;
+        }
+        sample->stamp[stage + 1] = pipeline_now();
+    }
+
+    if (thread + 1 == pipelineThreadCount)
+    {
+        pipeline_complete(sample);
+        return 0;
+    }
+    if (spsc_queue_push(&pipelineThreads[thread + 1].queue, sample) < 0)
+    {
+        pipelineStats.queue_full[thread + 1]++;
+        return -1;
+    }
+    sem_post(&pipelineThreads[thread + 1].ready);
+    return 0;
+}
+
+static void *pipeline_worker(void *arg)
+{
+    int thread = (int)(intptr_t)arg;
+    struct pipeline_thread *t = &pipelineThreads[thread];
+    struct pipeline_sample sample;
+
+    rt_loop_setup(&t->rt);
+    while (1)
+    {
+        sem_wait(&t->ready);
+        if (spsc_queue_pop(&t->queue, &sample) < 0)
+        {
+            // posted with nothing queued, only pipeline_stop() does that
+            if (!__atomic_load_n(&pipelineRunning, __ATOMIC_ACQUIRE))
+                break;
+            continue;
+        }
+        pipeline_run(thread, &sample);
+    }
+    return NULL;
+}
+
+/**
+ * Every stage on thread 0, default scheduling for the other threads.
+ *
+ * @param config Filled with the defaults
+ */
+void pipeline_config_init(struct pipeline_config *config)
+{
+    int i;
+
+    memset(config, 0, sizeof(*config));
+    for (i = 0; i < PIPELINE_THREADS; i++)
+        rt_loop_config_init(&config->rt[i]);
+    config->queue_slots = PIPELINE_QUEUE_SLOTS;
+}
+
+/**
+ * Read a placement, the thread of each stage in order, "0,0,1,1,2" runs
+ * acquire and decode in the loop, filter and fuse in a second thread and
+ * publish in a third.
+ *
+ * @param config Placement to fill
+ * @param text PIPELINE_STAGES thread numbers separated by commas
+ * @return 0 on success, -1 on a malformed placement
+ */
+int pipeline_parse_placement(struct pipeline_config *config, const char *text)
+{
+    const char *p = text;
+    int i;
+
+    for (i = 0; i < PIPELINE_STAGES; i++)
+    {
+        char *end;
+        long thread = strtol(p, &end, 10);
+        int previous = i > 0 ? config->thread[i - 1] : 0;
+
+        if (end == p || thread < previous || thread > (i > 0 ? previous + 1 : 0) || thread >= PIPELINE_THREADS ||
+            *end != (i < PIPELINE_STAGES - 1 ? ',' : '\0'))
+        {
+            fprintf(stderr, "pipeline: bad placement %s, want %d thread numbers from 0, each the same as or one above the previous\n",
+                    text, PIPELINE_STAGES);
+            return -1;
+        }
+        config->thread[i] = thread;
+        p = end + 1;
+    }
+    return 0;
+}
+
+/**
+ * Start the threads of a placement.
+ *
+ * @param stages PIPELINE_STAGES stage functions, in order
+ * @param config Placement and scheduling
+ * @return 0 on success, -1 on failure
+ */
+int pipeline_start(const pipeline_stage *stages, const struct pipeline_config *config)
+{
+    int i;
+
+    memset(&pipelineStats, 0, sizeof(pipelineStats));
+    memset(pipelineThreads, 0, sizeof(pipelineThreads));
+    memcpy(pipelineStages, stages, sizeof(pipelineStages));
+    pipelineLatestSequence = 0;
+
+    pipelineThreadCount = config->thread[PIPELINE_STAGES - 1] + 1;
+    for (i = 0; i < pipelineThreadCount; i++)
+        pipelineThreads[i].first = PIPELINE_STAGES;
+    for (i = 0; i < PIPELINE_STAGES; i++)
+    {
+        struct pipeline_thread *t = &pipelineThreads[config->thread[i]];
+
+        if (i < t->first)
+            t->first = i;
+        t->last = i;
+    }
+
+    pipelineRunning = 1;
+    for (i = 1; i < pipelineThreadCount; i++)
+    {
+        struct pipeline_thread *t = &pipelineThreads[i];
+
+        t->rt = config->rt[i];
+        if (spsc_queue_init(&t->queue, sizeof(struct pipeline_sample), config->queue_slots) < 0)
+        {
+            fprintf(stderr, "pipeline: cannot allocate the queue of thread %d\n", i);
+            pipelineThreadCount = i;
+            pipeline_stop();
+            return -1;
+        }
+        sem_init(&t->ready, 0, 0);
+        if (pthread_create(&t->thread, NULL, pipeline_worker, (void *)(intptr_t)i) != 0)
+        {
+            fprintf(stderr, "pipeline: failed to start thread %d\n", i);
+            sem_destroy(&t->ready);
+            spsc_queue_free(&t->queue);
+            pipelineThreadCount = i;
+            pipeline_stop();
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Feed a sample in, from thread 0. The stages of thread 0 run now, the
+ * rest later on their threads.
+ *
+ * @param sample Sample with stamp[0] set, copied if queued
+ * @return 0 if passed on or completed, -1 if dropped
+ */
+int pipeline_submit(struct pipeline_sample *sample)
+{
+    return pipeline_run(0, sample);
+}
+
+/**
+ * Copy of the last sample out of the pipeline, from any thread.
+ *
+ * @param sample Filled with the sample
+ * @return 0 on success, -1 if nothing completed yet or it kept changing
+ */
+int pipeline_latest(struct pipeline_sample *sample)
+{
+    int attempt;
+
+    for (attempt = 0; attempt < 16; attempt++)
+    {
+        uint32_t before = __atomic_load_n(&pipelineLatestSequence, __ATOMIC_ACQUIRE);
+
+        if (before == 0)
+            return -1;
+        if (before & 1)
+            continue;
+        memcpy(sample, &pipelineLatest, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&pipelineLatestSequence, __ATOMIC_RELAXED) == before)
+            return 0;
+    }
+    return -1;
+}
+
+/**
+ * Stop the threads once they have run what is queued.
+ */
+void pipeline_stop()
+{
+    int i;
+
+    __atomic_store_n(&pipelineRunning, 0, __ATOMIC_RELEASE);
+    // in order, a thread drains into the next before that one is told to go
+    for (i = 1; i < pipelineThreadCount; i++)
+    {
+        sem_post(&pipelineThreads[i].ready);
+        pthread_join(pipelineThreads[i].thread, NULL);
+        sem_destroy(&pipelineThreads[i].ready);
+        spsc_queue_free(&pipelineThreads[i].queue);
+    }
+    pipelineThreadCount = 0;
+}
+
+/**
+ * @return Counters and latencies, stable after pipeline_stop()
+ */
+const struct pipeline_stats *pipeline_get_stats()
+{
+    return &pipelineStats;
+}
+
+/**
+ * @param latency Histogram
+ * @param fraction 0.5 for the median, 0.99 for p99
+ * @return Latency in ns, to 1/32 octave, 0 if empty
+ */
+uint64_t pipeline_percentile(const struct pipeline_latency *latency, double fraction)
+{
+    uint64_t rank = (uint64_t)(fraction * latency->count), seen = 0;
+    int i;
+
+    if (latency->count == 0)
+        return 0;
+    if (rank >= latency->count)
+        rank = latency->count - 1;
+    for (i = 0; i < PIPELINE_BUCKETS; i++)
+    {
+        seen += latency->buckets[i];
+        if (seen > rank)
+        {
+            uint64_t value = pipeline_bucket_value(i);
+            return value < latency->max_ns ? value : latency->max_ns;
+        }
+    }
+    return latency->max_ns;
+}
+
+/**
+ * Per stage and end to end p50, p99 and max, and where samples were lost.
+ *
+ * @param out Where to print
+ */
+void pipeline_report(FILE *out)
+{
+    const struct pipeline_stats *stats = &pipelineStats;
+    int i;
+
+    fprintf(out, "pipeline: %llu samples\n", (unsigned long long)stats->completed);
+    for (i = 0; i <= PIPELINE_STAGES; i++)
+    {
+        const struct pipeline_latency *latency = i < PIPELINE_STAGES ? &stats->stage[i] : &stats->total;
+
+        fprintf(out, "  %-8s p50 %9.2f us  p99 %9.2f us  max %9.2f us", i < PIPELINE_STAGES ? pipelineStageNames[i] : "total",
+                pipeline_percentile(latency, 0.5) * 1e-3, pipeline_percentile(latency, 0.99) * 1e-3, latency->max_ns * 1e-3);
+        if (i < PIPELINE_STAGES && stats->dropped[i])
+            fprintf(out, "  dropped %llu", (unsigned long long)stats->dropped[i]);
+        fprintf(out, "\n");
+    }
+    for (i = 1; i < PIPELINE_THREADS; i++)
+    {
+        if (stats->queue_full[i])
+            fprintf(out, "  queue into thread %d full %llu times\n", i, (unsigned long long)stats->queue_full[i]);
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef __PIPELINE_H_
+#define __PIPELINE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../log/sensor_log.h"
+#include "../rt/rt_loop.h"
+#include "spsc_queue.h"
+
+/**
+ * Staged sample pipeline: acquire, decode, filter, fuse, publish.
+ *
+ * Every sample is a struct pipeline_sample, stamped on CLOCK_MONOTONIC
+ * when it is read and again as each stage finishes, so the time from
+ * sensor read to attitude published is known per stage. Stages sit on
+ * threads by configuration, each thread running a run of consecutive
+ * stages: stages sharing a thread hand the sample on directly, a stage on
+ * the next thread gets it through a bounded lock-free queue. Thread 0 is
+ * whoever calls pipeline_submit(), the loop; with every stage on thread 0
+ * the pipeline is a plain function call chain.
+ *
+ * A stage that runs in a thread of its own pays for the queue and the
+ * wake-up, which shows in its latency: the time of a stage is from the end
+ * of the previous one to its own end.
+ */
+
+#define PIPELINE_STAGES 5
+#define PIPELINE_THREADS 4           // thread 0 included
+#define PIPELINE_QUEUE_SLOTS 64      // per thread boundary, 128 ms at 500 Hz
+#define PIPELINE_BUCKETS 720         // latency histogram, 1/16 octave up to ~39 h
+
+enum pipeline_stage_id
+{
+    PIPELINE_ACQUIRE,
+    PIPELINE_DECODE,
+    PIPELINE_FILTER,
+    PIPELINE_FUSE,
+    PIPELINE_PUBLISH
+};
+
+// pipeline_sample flags
+#define PIPELINE_DECODED 0x01        // acquired as values, the decode stage passes it on
+
+struct pipeline_sample
+{
+    uint64_t stamp[PIPELINE_STAGES + 1]; // [0] read started, [i + 1] stage i done
+    uint8_t flags;
+    uint8_t raw[14];                 // MPU6050 burst from ACCEL_XOUT_H, big endian
+    struct sensor_log_record record; // decoded, as logged
+    float filtered[6];               // gyro and accel after the notches and low-pass
+    float q[4];
+    float integral_fb[3];
+    float roll, pitch, yaw;
+    uint32_t fusion_ns;
+};
+
+/**
+ * A stage. Returns 0 to pass the sample on, -1 to drop it.
+ */
+typedef int (*pipeline_stage)(struct pipeline_sample *sample);
+
+struct pipeline_config
+{
+    int thread[PIPELINE_STAGES];                 // thread of each stage, never decreasing
+    struct rt_loop_config rt[PIPELINE_THREADS];  // scheduling of threads 1 and up
+    uint32_t queue_slots;
+};
+
+struct pipeline_latency
+{
+    uint64_t count;
+    uint64_t max_ns;
+    uint32_t buckets[PIPELINE_BUCKETS];
+};
+
+struct pipeline_stats
+{
+    uint64_t completed;
+    uint64_t dropped[PIPELINE_STAGES];       // stage returned -1
+    uint64_t queue_full[PIPELINE_THREADS];   // refused at the queue into the thread
+    struct pipeline_latency stage[PIPELINE_STAGES];
+    struct pipeline_latency total;           // read to published
+};
+
+void pipeline_config_init(struct pipeline_config *config);
+int pipeline_parse_placement(struct pipeline_config *config, const char *text);
+int pipeline_start(const pipeline_stage *stages, const struct pipeline_config *config);
+int pipeline_submit(struct pipeline_sample *sample);
+int pipeline_latest(struct pipeline_sample *sample);
+void pipeline_stop();
+const struct pipeline_stats *pipeline_get_stats();
+uint64_t pipeline_percentile(const struct pipeline_latency *latency, double fraction);
+void pipeline_report(FILE *out);
+
+#endif
@@ -0,0 +1,215 @@
+/**
+ * Pipeline placement benchmark.
+ *
+ * Feeds synthetic MPU6050 bursts, a slow rotation plus gravity, through the
+ * flight pipeline at a fixed rate: decode, filter and fuse are the very
+ * objects main links, acquire waits out the time an I2C burst read takes
+ * and publish copies the sample out. Every placement runs the same samples
+ * with the same timestamps from a fresh estimator and prints the per stage
+ * latencies; the final attitude must be bit identical across placements
+ * and no sample may be lost, else the bench fails.
+ *
+ * usage: pipeline_bench [-r rate_hz] [-t seconds] [-a acquire_us]
+ *                       [-p fifo_priority] [-P stage_threads]...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "../rt/rt_loop.h"
+#include "../estimator/estimator.h"
+#include "../sensors/mpu6050.h"
+#include "../MahonyAHRS.h"
+
+#define MAX_PLACEMENTS 8
+
+const char *defaultPlacements[] = {"0,0,0,0,0", "0,0,1,1,1", "0,1,1,2,2", "0,1,2,3,3"};
+
+double rate = 500.0;
+long acquireUs = 350; // 14 bytes and the register address at 400 kHz
+uint64_t sampleIndex = 0;
+uint64_t timeBase = 1000000000ULL;
+uint8_t publishedCopy[sizeof(struct pipeline_sample)];
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void put16(uint8_t *p, int16_t value)
+{
+    p[0] = (uint16_t)value >> 8;
+    p[1] = value & 0xff;
+}
+
+/**
+ * Acquire: the burst a board turning at 30 deg/s about a wobbling axis
+ * would give, after an I2C-long wait.
+ */
+static int bench_acquire(struct pipeline_sample *sample)
+{
+    double t = sampleIndex / rate;
+    uint64_t end = sample->stamp[0] + acquireUs * 1000;
+
+    put16(sample->raw + 0, lrint(8192.0 * 0.1 * sin(t)));
+    put16(sample->raw + 2, lrint(8192.0 * 0.1 * cos(t)));
+    put16(sample->raw + 4, 8192);
+    put16(sample->raw + 6, 1200);
+    put16(sample->raw + 8, lrint(65.536 * 5.0 * sin(2.0 * t)));
+    put16(sample->raw + 10, lrint(65.536 * 5.0 * cos(3.0 * t)));
+    put16(sample->raw + 12, lrint(65.536 * 30.0));
+    sample->record.time = timeBase + (uint64_t)(sampleIndex * 1e9 / rate);
+    sampleIndex++;
+
+    while (now_ns() < end)
+        ;
+    return 0;
+}
+
+static int bench_decode(struct pipeline_sample *sample)
+{
+    struct sensor_log_record *record = &sample->record;
+    int16_t ax, ay, az, gx, gy, gz, temp;
+
+    mpu6050_decode_motion_7(sample->raw, &ax, &ay, &az, &gx, &gy, &gz, &temp);
+    record->gyro[0] = gx;
+    record->gyro[1] = gy;
+    record->gyro[2] = gz;
+    record->accel[0] = ax;
+    record->accel[1] = ay;
+    record->accel[2] = az;
+    record->temp = temp;
+    return 0;
+}
+
+static int bench_filter(struct pipeline_sample *sample)
+{
+    estimator_filter(&sample->record, sample->filtered);
+    return 0;
+}
+
+static int bench_fuse(struct pipeline_sample *sample)
+{
+    estimator_fuse(&sample->record, sample->filtered);
+    mahony_get_quaternion(sample->q);
+    sample->roll = mahony_get_roll();
+    sample->pitch = mahony_get_pitch();
+    sample->yaw = mahony_get_yaw();
+    return 0;
+}
+
+static int bench_publish(struct pipeline_sample *sample)
+{
+    memcpy(publishedCopy, sample, sizeof(*sample));
+    return 0;
+}
+
+const pipeline_stage benchStages[PIPELINE_STAGES] = {bench_acquire, bench_decode, bench_filter, bench_fuse, bench_publish};
+
+/**
+ * @return 0 if every sample made it, the final attitude in q
+ */
+static int run(const char *placement, int priority, double seconds, float *q)
+{
+    struct pipeline_config config;
+    struct pipeline_sample sample;
+    struct rt_loop loop;
+    size_t count = (size_t)(rate * seconds), i;
+    int lost;
+
+    pipeline_config_init(&config);
+    if (pipeline_parse_placement(&config, placement) < 0)
+        return -1;
+    for (i = 1; i < PIPELINE_THREADS; i++)
+        config.rt[i].priority = priority;
+
+    estimator_init(rate);
+    sampleIndex = 0;
+    if (pipeline_start(benchStages, &config) < 0)
+        return -1;
+    rt_loop_start(&loop, (long)(1e9 / rate));
+    for (i = 0; i < count; i++)
+    {
+        memset(&sample, 0, sizeof(sample));
+        sample.stamp[0] = now_ns();
+        pipeline_submit(&sample);
+        rt_loop_wait(&loop);
+    }
+    pipeline_stop();
+
+    printf("placement %s\n", placement);
+    pipeline_report(stdout);
+    memcpy(&sample, publishedCopy, sizeof(sample));
+    memcpy(q, sample.q, sizeof(sample.q));
+    lost = pipeline_get_stats()->completed != count;
+    if (lost)
+        printf("  lost %llu of %zu samples\n", (unsigned long long)(count - pipeline_get_stats()->completed), count);
+    return lost ? -1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *placements[MAX_PLACEMENTS];
+    double seconds = 5.0;
+    float q[4], first[4];
+    int count = 0, priority = 0, failed = 0, opt, i;
+    struct rt_loop_config config;
+
+    rt_loop_config_init(&config);
+    while ((opt = getopt(argc, argv, "r:t:a:p:P:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'a':
+            acquireUs = atol(optarg);
+            break;
+        case 'p':
+            priority = atoi(optarg);
+            break;
+        case 'P':
+            if (count < MAX_PLACEMENTS)
+                placements[count++] = optarg;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-t seconds] [-a acquire_us] [-p fifo_priority] [-P stage_threads]...\n", argv[0]);
+            return 1;
+        }
+    }
+    if (count == 0)
+    {
+        for (i = 0; i < (int)(sizeof(defaultPlacements) / sizeof(*defaultPlacements)); i++)
+            placements[count++] = defaultPlacements[i];
+    }
+
+    config.priority = priority;
+    rt_loop_setup(&config);
+    printf("%.0f samples at %.0f Hz, %ld us acquire\n", rate * seconds, rate, acquireUs);
+    for (i = 0; i < count; i++)
+    {
+        if (run(placements[i], priority, seconds, q) < 0)
+            failed = 1;
+        if (i == 0)
+            memcpy(first, q, sizeof(first));
+        else if (memcmp(first, q, sizeof(q)) != 0)
+        {
+            printf("  attitude differs from placement %s\n", placements[0]);
+            failed = 1;
+        }
+    }
+    printf("%s\n", failed ? "FAILED" : "same attitude, no sample lost, in every placement");
+    return failed;
+}
@@ -0,0 +1,89 @@
+/**
+ * Single producer, single consumer queue, see spsc_queue.h.
+ *
+ * Head and tail are free running counters, the slot is the counter masked.
+ * The producer publishes an item with a release store of the head after
+ * copying it in, the consumer frees the slot with a release store of the
+ * tail after copying it out; the acquire loads on the other side make the
+ * copies visible. Works the same when both sides are the same thread.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "spsc_queue.h"
+
+/**
+ * @param queue Queue to set up
+ * @param itemSize Bytes per item
+ * @param slots Capacity, a power of 2
+ * @return 0 on success, -1 on a bad size or out of memory
+ */
+int spsc_queue_init(struct spsc_queue *queue, size_t itemSize, uint32_t slots)
+{
+    memset(queue, 0, sizeof(*queue));
+    if (slots == 0 || (slots & (slots - 1)) != 0 || itemSize == 0)
+        return -1;
+
+    // allocated and touched now, not on the first push
+    queue->slots = calloc(slots, itemSize);
+    if (!queue->slots)
+        return -1;
+    queue->item_size = itemSize;
+    queue->mask = slots - 1;
+    return 0;
+}
+
+/**
+ * Producer side.
+ *
+ * @param queue Queue
+ * @param item Item to copy in
+ * @return 0 on success, -1 if the queue is full
+ */
+int spsc_queue_push(struct spsc_queue *queue, const void *item)
+{
+    uint32_t head = queue->head;
+
+    if (head - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE) > queue->mask)
+        return -1;
+    memcpy(queue->slots + (size_t)(head & queue->mask) * queue->item_size, item, queue->item_size);
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * Consumer side.
+ *
+ * @param queue Queue
+ * @param item Filled with the oldest item
+ * @return 0 on success, -1 if the queue is empty
+ */
+int spsc_queue_pop(struct spsc_queue *queue, void *item)
+{
+    uint32_t tail = queue->tail;
+
+    if (__atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) == tail)
+        return -1;
+    memcpy(item, queue->slots + (size_t)(tail & queue->mask) * queue->item_size, queue->item_size);
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/**
+ * @param queue Queue
+ * @return Items queued, approximate from a third thread
+ */
+uint32_t spsc_queue_depth(const struct spsc_queue *queue)
+{
+    return __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+}
+
+/**
+ * @param queue Queue to release, nobody may use it any more
+ */
+void spsc_queue_free(struct spsc_queue *queue)
+{
+    free(queue->slots);
+    queue->slots = NULL;
+}
@@ -0,0 +1,31 @@
+#ifndef __SPSC_QUEUE_H_
+#define __SPSC_QUEUE_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Bounded single producer, single consumer queue of fixed size items.
+ *
+ * Items are copied in and out of a power of two ring. The producer only
+ * writes the head and the consumer only the tail, each on its own cache
+ * line, so neither ever waits for the other: a push to a full queue and a
+ * pop from an empty one fail at once.
+ */
+
+struct spsc_queue
+{
+    uint8_t *slots;
+    size_t item_size;
+    uint32_t mask;
+    uint32_t head __attribute__((aligned(64)));  // next slot written, producer side
+    uint32_t tail __attribute__((aligned(64)));  // next slot read, consumer side
+};
+
+int spsc_queue_init(struct spsc_queue *queue, size_t itemSize, uint32_t slots);
+int spsc_queue_push(struct spsc_queue *queue, const void *item);
+int spsc_queue_pop(struct spsc_queue *queue, void *item);
+uint32_t spsc_queue_depth(const struct spsc_queue *queue);
+void spsc_queue_free(struct spsc_queue *queue);
+
+#endif
@@ -0,0 +1,230 @@
+/**
+ * Loop iteration timing, see loop_stats.h.
+ *
+ * An iteration costs one clock_gettime() per stamp, a vDSO call of a few
+ * tens of ns, and the adds into both windows; the divisions of the means
+ * only run when a frame or the report is made.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "loop_stats.h"
+
+uint64_t loopStatsPeriod = 0;
+uint64_t loopStatsStart = 0;          // current iteration
+uint64_t loopStatsMark = 0;           // end of the previous phase
+uint64_t loopStatsPreviousStart = 0;  // 0 before the first iteration
+const char *loopStatsNames[LOOP_STATS_PHASES];
+int loopStatsPhases = 0;
+struct loop_stats_window loopStatsTotal;
+struct loop_stats_window loopStatsWindow;
+
+static uint64_t loop_stats_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void loop_stats_reset(struct loop_stats_window *window)
+{
+    int i;
+
+    memset(window, 0, sizeof(*window));
+    window->iteration.min_ns = UINT64_MAX;
+    for (i = 0; i < LOOP_STATS_PHASES; i++)
+        window->phase[i].min_ns = UINT64_MAX;
+    window->jitter_min_ns = INT64_MAX;
+    window->jitter_max_ns = INT64_MIN;
+}
+
+static void loop_stats_time(struct loop_stats_timing *timing, uint64_t ns)
+{
+    timing->count++;
+    timing->total_ns += ns;
+    if (ns < timing->min_ns)
+        timing->min_ns = ns;
+    if (ns > timing->max_ns)
+        timing->max_ns = ns;
+}
+
+static void loop_stats_jitter(struct loop_stats_window *window, int64_t ns)
+{
+    window->jitter_count++;
+    window->jitter_total_ns += llabs(ns);
+    if (ns < window->jitter_min_ns)
+        window->jitter_min_ns = ns;
+    if (ns > window->jitter_max_ns)
+        window->jitter_max_ns = ns;
+}
+
+static uint32_t loop_stats_clamp(uint64_t ns)
+{
+    return ns > UINT32_MAX ? UINT32_MAX : ns;
+}
+
+static int32_t loop_stats_clamp_signed(int64_t ns)
+{
+    if (ns > INT32_MAX)
+        return INT32_MAX;
+    return ns < INT32_MIN ? INT32_MIN : ns;
+}
+
+/**
+ * Start over, before the loop.
+ *
+ * @param periodNs Target iteration period
+ * @param phaseNames Names of the phases, for the report
+ * @param phases Number of phases, at most LOOP_STATS_PHASES
+ */
+void loop_stats_init(uint64_t periodNs, const char **phaseNames, int phases)
+{
+    int i;
+
+    loopStatsPeriod = periodNs;
+    loopStatsPreviousStart = 0;
+    loopStatsPhases = phases < LOOP_STATS_PHASES ? phases : LOOP_STATS_PHASES;
+    for (i = 0; i < loopStatsPhases; i++)
+        loopStatsNames[i] = phaseNames[i];
+    loop_stats_reset(&loopStatsTotal);
+    loop_stats_reset(&loopStatsWindow);
+}
+
+/**
+ * An iteration starts, right after the wake-up.
+ */
+void loop_stats_begin()
+{
+    loopStatsStart = loop_stats_now();
+    loopStatsMark = loopStatsStart;
+
+    // the first iteration has nothing to be jitter against
+    if (loopStatsPreviousStart)
+    {
+        int64_t jitter = (int64_t)(loopStatsStart - loopStatsPreviousStart) - (int64_t)loopStatsPeriod;
+
+        loop_stats_jitter(&loopStatsTotal, jitter);
+        loop_stats_jitter(&loopStatsWindow, jitter);
+    }
+    loopStatsPreviousStart = loopStatsStart;
+}
+
+/**
+ * A phase ends, it ran from the previous mark or the start.
+ *
+ * @param phase 0 to LOOP_STATS_PHASES - 1
+ */
+void loop_stats_mark(int phase)
+{
+    uint64_t now = loop_stats_now();
+
+    loop_stats_time(&loopStatsTotal.phase[phase], now - loopStatsMark);
+    loop_stats_time(&loopStatsWindow.phase[phase], now - loopStatsMark);
+    loopStatsMark = now;
+}
+
+/**
+ * The iteration is done, the loop goes to sleep.
+ */
+void loop_stats_end()
+{
+    uint64_t elapsed = loop_stats_now() - loopStatsStart;
+    uint64_t bucket = loopStatsPeriod ? elapsed * (LOOP_STATS_BUCKETS / 2) / loopStatsPeriod : 0;
+
+    if (bucket > LOOP_STATS_BUCKETS - 1)
+        bucket = LOOP_STATS_BUCKETS - 1;
+    loopStatsTotal.buckets[bucket]++;
+    loopStatsWindow.buckets[bucket]++;
+    loop_stats_time(&loopStatsTotal.iteration, elapsed);
+    loop_stats_time(&loopStatsWindow.iteration, elapsed);
+}
+
+/**
+ * Telemetry frame of the window since the previous call, then start a
+ * new window. Times of an empty window are 0.
+ *
+ * @param frame Filled in
+ * @param time Frame time stamp
+ */
+void loop_stats_frame(struct frame_loop_stats *frame, uint64_t time)
+{
+    const struct loop_stats_window *window = &loopStatsWindow;
+    const struct loop_stats_timing *iteration = &window->iteration;
+    int i;
+
+    memset(frame, 0, sizeof(*frame));
+    frame->time = time;
+    frame->period_ns = loop_stats_clamp(loopStatsPeriod);
+    frame->iterations = loop_stats_clamp(iteration->count);
+    if (iteration->count)
+    {
+        frame->min_ns = loop_stats_clamp(iteration->min_ns);
+        frame->mean_ns = loop_stats_clamp(iteration->total_ns / iteration->count);
+        frame->max_ns = loop_stats_clamp(iteration->max_ns);
+    }
+    if (window->jitter_count)
+    {
+        frame->jitter_min_ns = loop_stats_clamp_signed(window->jitter_min_ns);
+        frame->jitter_max_ns = loop_stats_clamp_signed(window->jitter_max_ns);
+        frame->jitter_mean_ns = loop_stats_clamp(window->jitter_total_ns / window->jitter_count);
+    }
+    for (i = 0; i < LOOP_STATS_PHASES; i++)
+    {
+        const struct loop_stats_timing *phase = &window->phase[i];
+
+        if (phase->count)
+        {
+            frame->phase_mean_ns[i] = loop_stats_clamp(phase->total_ns / phase->count);
+            frame->phase_max_ns[i] = loop_stats_clamp(phase->max_ns);
+        }
+    }
+    for (i = 0; i < LOOP_STATS_BUCKETS; i++)
+        frame->buckets[i] = loop_stats_clamp(window->buckets[i]);
+    loop_stats_reset(&loopStatsWindow);
+}
+
+/**
+ * @return Everything since loop_stats_init()
+ */
+const struct loop_stats_window *loop_stats_get_total()
+{
+    return &loopStatsTotal;
+}
+
+static void loop_stats_print_timing(FILE *out, const char *name, const struct loop_stats_timing *timing)
+{
+    if (timing->count == 0)
+        return;
+    fprintf(out, "  %-10s min %9.2f us  mean %9.2f us  max %9.2f us\n", name, timing->min_ns * 1e-3,
+            timing->total_ns * 1e-3 / timing->count, timing->max_ns * 1e-3);
+}
+
+/**
+ * Iteration, phase and jitter numbers and the histogram since the start.
+ *
+ * @param out Where to print
+ */
+void loop_stats_report(FILE *out)
+{
+    const struct loop_stats_window *total = &loopStatsTotal;
+    int i;
+
+    fprintf(out, "loop timing: %llu iterations, %.1f us period\n", (unsigned long long)total->iteration.count,
+            loopStatsPeriod * 1e-3);
+    loop_stats_print_timing(out, "iteration", &total->iteration);
+    for (i = 0; i < loopStatsPhases; i++)
+        loop_stats_print_timing(out, loopStatsNames[i], &total->phase[i]);
+    if (total->jitter_count)
+    {
+        fprintf(out, "  %-10s min %+9.2f us  mean %9.2f us  max %+9.2f us\n", "jitter", total->jitter_min_ns * 1e-3,
+                total->jitter_total_ns * 1e-3 / total->jitter_count, total->jitter_max_ns * 1e-3);
+    }
+    fprintf(out, "  histogram, %.1f us buckets:", loopStatsPeriod * 1e-3 / (LOOP_STATS_BUCKETS / 2));
+    for (i = 0; i < LOOP_STATS_BUCKETS; i++)
+        fprintf(out, " %llu", (unsigned long long)total->buckets[i]);
+    fprintf(out, "\n");
+}
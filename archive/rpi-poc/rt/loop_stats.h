@@ -0,0 +1,68 @@
+#ifndef __LOOP_STATS_H_
+#define __LOOP_STATS_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "../comm/frame.h"
+
+/**
+ * Loop iteration timing.
+ *
+ * The loop stamps CLOCK_MONOTONIC when an iteration starts, at the end of
+ * each of its phases and when it is done, before it sleeps. From that come
+ * min/mean/max of the iteration time and of every phase, a histogram of
+ * the iteration time and the jitter of the start to start interval
+ * against the target period. The histogram spans two periods in
+ * LOOP_STATS_BUCKETS buckets from 0, the top one takes anything longer.
+ *
+ * Everything is kept twice: since loop_stats_init() for the report at the
+ * end, and since the previous loop_stats_frame() for telemetry, so a
+ * status frame shows the last window instead of the whole run. Only the
+ * loop thread writes, its tasks read.
+ *
+ * Built with -DLOOP_STATS the LOOP_STATS_* macros call in, without they
+ * are empty and the loop carries no instrumentation at all; main then
+ * links neither this nor the loop-stats senders of comm and udp_sink.
+ */
+
+#define LOOP_STATS_PHASES FRAME_LOOP_PHASES
+#define LOOP_STATS_BUCKETS FRAME_LOOP_BUCKETS
+
+struct loop_stats_timing
+{
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+};
+
+struct loop_stats_window
+{
+    struct loop_stats_timing iteration;         // start to done
+    struct loop_stats_timing phase[LOOP_STATS_PHASES];
+    uint64_t jitter_count;
+    int64_t jitter_min_ns, jitter_max_ns;       // start to start less the period
+    uint64_t jitter_total_ns;                   // absolute
+    uint64_t buckets[LOOP_STATS_BUCKETS];
+};
+
+void loop_stats_init(uint64_t periodNs, const char **phaseNames, int phases);
+void loop_stats_begin();
+void loop_stats_mark(int phase);
+void loop_stats_end();
+void loop_stats_frame(struct frame_loop_stats *frame, uint64_t time);
+const struct loop_stats_window *loop_stats_get_total();
+void loop_stats_report(FILE *out);
+
+#ifdef LOOP_STATS
+#define LOOP_STATS_BEGIN() loop_stats_begin()
+#define LOOP_STATS_MARK(phase) loop_stats_mark(phase)
+#define LOOP_STATS_END() loop_stats_end()
+#else
+#define LOOP_STATS_BEGIN()
+#define LOOP_STATS_MARK(phase)
+#define LOOP_STATS_END()
+#endif
+
+#endif
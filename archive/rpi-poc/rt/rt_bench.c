@@ -0,0 +1,178 @@
+/**
+ * Loop runner benchmark.
+ *
+ * Runs a busy loop body at a fixed rate, first paced the way a loop with a
+ * usleep() at the end is, sleeping one period minus the body each time,
+ * then with rt_loop_wait() to absolute deadlines. Reports the achieved rate,
+ * the drift from the nominal schedule, and the wake-up latency after each
+ * deadline. Every -e cycles the body runs 2.5 periods long to exercise the
+ * overrun handling. The absolute loop is timed with loop_stats the way
+ * main times its own, the body in two halves, and the cost of a stamp is
+ * measured first.
+ *
+ * Without privileges the real-time settings are reported as unavailable and
+ * the bench runs as a normal thread.
+ *
+ * usage: rt_bench [-r rate_hz] [-t seconds] [-b body_us] [-e overrun_every]
+ *                 [-p fifo_priority] [-c cpu] [-m]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "rt_loop.h"
+#include "loop_stats.h"
+
+#define STAMP_RUNS 1000000
+
+const char *phaseNames[2] = {"first", "second"};
+
+static uint64_t now_ns()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+static void spin_ns(uint64_t ns)
+{
+    uint64_t end = now_ns() + ns;
+
+    while (now_ns() < end)
+        ;
+}
+
+static int compare(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static void report(const char *name, uint64_t *late, size_t count, uint64_t start, uint64_t end, long period)
+{
+    double seconds = (end - start) * 1e-9;
+
+    qsort(late, count, sizeof(*late), compare);
+    printf("%-9s %8.2f Hz  drift %+9.3f ms  late p50 %7.2f us  p99 %7.2f us  max %8.2f us\n", name,
+           count / seconds, ((double)(end - start) - (double)count * period) * 1e-6,
+           late[count / 2] * 1e-3, late[count * 99 / 100] * 1e-3, late[count - 1] * 1e-3);
+}
+
+int main(int argc, char **argv)
+{
+    double rate = 512.0, seconds = 5.0;
+    long bodyUs = 200, overrunEvery = 0, period;
+    struct rt_loop_config config;
+    struct rt_loop_stats stats;
+    struct rt_loop loop;
+    uint64_t *late, start, deadline, stampStart;
+    size_t count, i;
+    int applied, opt;
+
+    rt_loop_config_init(&config);
+    while ((opt = getopt(argc, argv, "r:t:b:e:p:c:m")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            rate = atof(optarg);
+            break;
+        case 't':
+            seconds = atof(optarg);
+            break;
+        case 'b':
+            bodyUs = atol(optarg);
+            break;
+        case 'e':
+            overrunEvery = atol(optarg);
+            break;
+        case 'p':
+            config.priority = atoi(optarg);
+            break;
+        case 'c':
+            config.cpu = atoi(optarg);
+            break;
+        case 'm':
+            config.lock_memory = 1;
+            config.stack_prefault = RT_LOOP_STACK_PREFAULT;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate_hz] [-t seconds] [-b body_us] [-e overrun_every] "
+                            "[-p fifo_priority] [-c cpu] [-m]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    period = (long)(1e9 / rate);
+    count = (size_t)(rate * seconds);
+    late = malloc(count * sizeof(*late));
+    if (!late || count == 0 || bodyUs * 1000 >= period)
+    {
+        fprintf(stderr, "need a body shorter than the %ld us period\n", period / 1000);
+        return 1;
+    }
+
+    applied = rt_loop_setup(&config);
+    printf("%zu cycles at %.0f Hz, %ld us body, fifo %s, locked %s, pinned %s\n", count, rate, bodyUs,
+           applied & RT_LOOP_FIFO ? "yes" : "no", applied & RT_LOOP_LOCKED ? "yes" : "no",
+           applied & RT_LOOP_PINNED ? "yes" : "no");
+
+    // relative: the sleep starts after the body, its overshoot adds up
+    start = now_ns();
+    deadline = start;
+    for (i = 0; i < count; i++)
+    {
+        struct timespec t;
+        uint64_t wake;
+
+        spin_ns(bodyUs * 1000);
+        t.tv_sec = 0;
+        t.tv_nsec = period - bodyUs * 1000;
+        nanosleep(&t, NULL);
+        wake = now_ns();
+        deadline += period;
+        late[i] = wake > deadline ? wake - deadline : 0;
+    }
+    report("relative", late, count, start, now_ns(), period);
+
+    // what the instrumentation adds to an iteration, per stamp
+    loop_stats_init(period, phaseNames, 2);
+    loop_stats_begin();
+    stampStart = now_ns();
+    for (i = 0; i < STAMP_RUNS; i++)
+        loop_stats_mark(0);
+    printf("loop_stats stamp %.1f ns\n", (double)(now_ns() - stampStart) / STAMP_RUNS);
+
+    // absolute: every deadline is start + n periods
+    loop_stats_init(period, phaseNames, 2);
+    rt_loop_start(&loop, period);
+    start = loop.deadline_ns;
+    for (i = 0; i < count; i++)
+    {
+        loop_stats_begin();
+        if (overrunEvery > 0 && i % overrunEvery == overrunEvery - 1)
+            spin_ns(period * 5 / 2);
+        else
+            spin_ns(bodyUs * 500);
+        loop_stats_mark(0);
+        spin_ns(bodyUs * 500);
+        loop_stats_mark(1);
+        loop_stats_end();
+        rt_loop_wait(&loop);
+        late[i] = loop.wake_ns - loop.deadline_ns;
+    }
+    report("absolute", late, count, start, now_ns(), period);
+
+    rt_loop_get_stats(&loop, &stats);
+    printf("absolute: %llu overruns, %llu deadlines skipped, mean late %.2f us, longest body %.2f us\n",
+           (unsigned long long)stats.overruns, (unsigned long long)stats.skipped,
+           stats.cycles > stats.overruns ? stats.total_late_ns * 1e-3 / (stats.cycles - stats.overruns) : 0.0,
+           stats.max_busy_ns * 1e-3);
+    loop_stats_report(stdout);
+
+    free(late);
+    return 0;
+}
@@ -0,0 +1,182 @@
+/**
+ * Fixed period loop runner, see rt_loop.h.
+ *
+ * Deadlines are kept in nanoseconds since the CLOCK_MONOTONIC epoch, the
+ * clock sensor_log_now() stamps samples with, and only turned into a
+ * timespec for the sleep.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include "rt_loop.h"
+#include "../metrics/counters.h"
+
+static uint64_t rt_loop_now()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Touch size bytes below the current frame so the stack pages are mapped
+ * (and locked, after mlockall) before the loop needs them.
+ */
+static void __attribute__((noinline)) rt_loop_prefault_stack(size_t size)
+{
+    char stack[size];
+
+    memset(stack, 0, size);
+    __asm__ volatile("" : : "r"(stack) : "memory");
+}
+
+/**
+ * Everything off: a plain SCHED_OTHER thread, free to migrate.
+ *
+ * @param config Filled with the defaults
+ */
+void rt_loop_config_init(struct rt_loop_config *config)
+{
+    config->priority = 0;
+    config->lock_memory = 0;
+    config->stack_prefault = 0;
+    config->cpu = RT_LOOP_NO_CPU;
+}
+
+/**
+ * Apply the scheduling and memory settings to the calling thread. Settings
+ * that fail are reported on stderr and skipped, the thread keeps running
+ * with what it got.
+ *
+ * @param config What to ask for
+ * @return RT_LOOP_* flags of the settings applied
+ */
+int rt_loop_setup(const struct rt_loop_config *config)
+{
+    int applied = 0, error;
+
+    if (config->lock_memory)
+    {
+        // keep freed heap mapped and serve large allocations from it, so a
+        // free() in the loop cannot give pages back to be faulted in again
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+        if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0)
+            applied |= RT_LOOP_LOCKED;
+        else
+            fprintf(stderr, "rt: cannot lock memory (%s), page faults can stall the loop\n", strerror(errno));
+    }
+
+    if (config->stack_prefault > 0)
+    {
+        rt_loop_prefault_stack(config->stack_prefault);
+        applied |= RT_LOOP_PREFAULTED;
+    }
+
+    if (config->cpu != RT_LOOP_NO_CPU)
+    {
+        cpu_set_t cpus;
+
+        CPU_ZERO(&cpus);
+        error = EINVAL;
+        if (config->cpu >= 0 && config->cpu < CPU_SETSIZE)
+        {
+            CPU_SET(config->cpu, &cpus);
+            error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+        }
+        if (error == 0)
+            applied |= RT_LOOP_PINNED;
+        else
+            fprintf(stderr, "rt: cannot pin to CPU %d (%s), running on any\n", config->cpu, strerror(error));
+    }
+
+    if (config->priority > 0)
+    {
+        struct sched_param param;
+
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = config->priority;
+        error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (error == 0)
+            applied |= RT_LOOP_FIFO;
+        else
+            fprintf(stderr, "rt: cannot use SCHED_FIFO %d (%s), running SCHED_OTHER\n", config->priority, strerror(error));
+    }
+
+    return applied;
+}
+
+/**
+ * Start the first period now.
+ *
+ * @param loop Loop state, reset
+ * @param period_ns Period
+ */
+void rt_loop_start(struct rt_loop *loop, long period_ns)
+{
+    memset(loop, 0, sizeof(*loop));
+    loop->period_ns = period_ns;
+    loop->deadline_ns = rt_loop_now();
+    loop->wake_ns = loop->deadline_ns;
+}
+
+/**
+ * End the current period: sleep to the start of the next one, or return at
+ * once if it has already begun.
+ *
+ * @param loop Loop state
+ */
+void rt_loop_wait(struct rt_loop *loop)
+{
+    uint64_t now = rt_loop_now();
+    uint64_t busy = now - loop->wake_ns;
+
+    if (busy > loop->stats.max_busy_ns)
+        loop->stats.max_busy_ns = busy;
+
+    loop->deadline_ns += loop->period_ns;
+    if (now >= loop->deadline_ns)
+    {
+        uint64_t missed = (now - loop->deadline_ns) / loop->period_ns;
+
+        // late: run the next period now, and drop the ones already gone
+        // so the loop keeps its phase instead of running back to back
+        loop->stats.overruns++;
+        counter_add(COUNTER_LOOP_OVERRUNS, 1);
+        loop->stats.skipped += missed;
+        loop->deadline_ns += missed * loop->period_ns;
+        loop->wake_ns = now;
+    }
+    else
+    {
+        struct timespec deadline = {loop->deadline_ns / 1000000000ULL, loop->deadline_ns % 1000000000ULL};
+        uint64_t late;
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+            ;
+        loop->wake_ns = rt_loop_now();
+        late = loop->wake_ns - loop->deadline_ns;
+        loop->stats.total_late_ns += late;
+        if (late > loop->stats.max_late_ns)
+            loop->stats.max_late_ns = late;
+    }
+    loop->stats.cycles++;
+}
+
+/**
+ * @param loop Loop state
+ * @param stats Filled with the counters so far
+ */
+void rt_loop_get_stats(const struct rt_loop *loop, struct rt_loop_stats *stats)
+{
+    *stats = loop->stats;
+}
@@ -0,0 +1,66 @@
+#ifndef __RT_LOOP_H_
+#define __RT_LOOP_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Fixed period loop runner.
+ *
+ * Sleeps to absolute deadlines with clock_nanosleep(TIMER_ABSTIME) on
+ * CLOCK_MONOTONIC, so the time spent in the loop body and the sleep
+ * overshoot never accumulate into drift. A body that runs past the next
+ * deadline is an overrun; the loop starts the next period at once, and a
+ * loop more than a full period late skips the missed deadlines instead of
+ * bursting to catch up, keeping its phase.
+ *
+ * rt_loop_setup() optionally makes the calling thread SCHED_FIFO, locks the
+ * process memory, pre-faults the stack and pins the thread to a CPU. Each
+ * of these needs privileges (CAP_SYS_NICE, CAP_IPC_LOCK or a matching
+ * RLIMIT) the loop can live without: a failure is reported and the loop
+ * runs as a normal thread.
+ */
+
+#define RT_LOOP_PRIORITY 80              // SCHED_FIFO, above the kernel threads at 50
+#define RT_LOOP_STACK_PREFAULT (256 * 1024)
+#define RT_LOOP_NO_CPU -1
+
+// what rt_loop_setup() got
+#define RT_LOOP_FIFO 0x01
+#define RT_LOOP_LOCKED 0x02
+#define RT_LOOP_PREFAULTED 0x04
+#define RT_LOOP_PINNED 0x08
+
+struct rt_loop_config
+{
+    int priority;            // SCHED_FIFO priority, 0 to stay SCHED_OTHER
+    int lock_memory;         // mlockall() and no heap trimming
+    size_t stack_prefault;   // bytes of stack to touch, 0 for none
+    int cpu;                 // CPU to pin to, RT_LOOP_NO_CPU for any
+};
+
+struct rt_loop_stats
+{
+    uint64_t cycles;
+    uint64_t overruns;       // bodies that ran past the next deadline
+    uint64_t skipped;        // deadlines dropped to resynchronise
+    uint64_t max_late_ns;    // wake-up after the deadline, worst
+    uint64_t total_late_ns;
+    uint64_t max_busy_ns;    // body, wake-up to the next wait, worst
+};
+
+struct rt_loop
+{
+    uint64_t deadline_ns;    // CLOCK_MONOTONIC start of the current period
+    long period_ns;
+    uint64_t wake_ns;        // when the current period started running
+    struct rt_loop_stats stats;
+};
+
+void rt_loop_config_init(struct rt_loop_config *config);
+int rt_loop_setup(const struct rt_loop_config *config);
+void rt_loop_start(struct rt_loop *loop, long period_ns);
+void rt_loop_wait(struct rt_loop *loop);
+void rt_loop_get_stats(const struct rt_loop *loop, struct rt_loop_stats *stats);
+
+#endif
@@ -0,0 +1,251 @@
+/**
+ * Scheduler simulation on the simulated clock.
+ *
+ * Runs a task table like the flight one, IMU 1 kHz, fusion 500 Hz, mag
+ * 75 Hz, telemetry 50 Hz and log flush 10 Hz on a 1 kHz tick, with every
+ * task taking a fixed simulated time. The loop is modelled the way
+ * rt_loop_wait() paces it: the next tick starts at its deadline, or at
+ * once if the tasks ran past it. Prints what each task got and the load of
+ * the worst tick, without and with phase offsets.
+ *
+ * -t checks the scheduling decisions instead: exact rates over a second,
+ * rate monotonic order within a tick, phases, budgets and missed ticks.
+ * Exits non-zero on a failure.
+ *
+ * usage: sched_sim [-s seconds] [-x cost_scale] [-t]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+
+#define SIM_TASKS 5
+#define TICK_RATE 1000
+#define TICK_NS (1000000000ULL / TICK_RATE)
+#define TRACE_SIZE 64
+
+struct sim_task
+{
+    const char *name;
+    unsigned int rate;
+    unsigned int phase;
+    uint64_t cost_ns;
+    uint64_t budget_ns;
+};
+
+// the 1 kHz table, phases spread the slow tasks over different ticks
+const struct sim_task simTasks[SIM_TASKS] = {
+    {"imu", 1000, 0, 250000, 400000},
+    {"fusion", 500, 1, 120000, 200000},
+    {"mag", 75, 2, 180000, 300000},
+    {"telemetry", 50, 4, 150000, 250000},
+    {"log", 10, 6, 200000, 400000},
+};
+
+double costScale = 1.0;
+int trace[TRACE_SIZE];
+int traceLength = 0;
+uint64_t extraCost = 0; // added to the next task run, for the budget check
+
+static void sim_run(int task)
+{
+    if (traceLength < TRACE_SIZE)
+        trace[traceLength++] = task;
+    scheduler_sim_advance((uint64_t)(simTasks[task].cost_ns * costScale) + extraCost);
+}
+
+static void sim_imu(uint64_t now) { (void)now; sim_run(0); }
+static void sim_fusion(uint64_t now) { (void)now; sim_run(1); }
+static void sim_mag(uint64_t now) { (void)now; sim_run(2); }
+static void sim_telemetry(uint64_t now) { (void)now; sim_run(3); }
+static void sim_log(uint64_t now) { (void)now; sim_run(4); }
+
+const scheduler_function simFunctions[SIM_TASKS] = {sim_imu, sim_fusion, sim_mag, sim_telemetry, sim_log};
+
+static void sim_setup(int phases)
+{
+    int i;
+
+    scheduler_init(TICK_RATE, scheduler_sim_clock);
+    // added slowest first, the table sorts them
+    for (i = SIM_TASKS - 1; i >= 0; i--)
+        scheduler_add(simTasks[i].name, simFunctions[i], simTasks[i].rate, phases ? simTasks[i].phase : 0,
+                      (uint64_t)(simTasks[i].budget_ns * costScale));
+}
+
+/**
+ * One loop iteration: wait for the deadline if it is still ahead, run.
+ */
+static int sim_tick(uint64_t deadline)
+{
+    if (scheduler_sim_clock() < deadline)
+        scheduler_sim_set(deadline);
+    traceLength = 0;
+    return scheduler_run();
+}
+
+static void simulate(int phases, double seconds)
+{
+    uint64_t ticks = (uint64_t)(seconds * TICK_RATE), t;
+    struct scheduler_task_stats task;
+    struct scheduler_stats stats;
+    int i, most = 0;
+
+    sim_setup(phases);
+    for (t = 0; t < ticks; t++)
+    {
+        int ran = sim_tick(t * TICK_NS);
+
+        if (ran > most)
+            most = ran;
+    }
+
+    scheduler_get_stats(&stats);
+    printf("%s phases: %llu ticks, %llu skipped, %llu overran, worst tick %.0f us with %d tasks\n",
+           phases ? "with" : "without", (unsigned long long)stats.ticks, (unsigned long long)stats.skipped_ticks,
+           (unsigned long long)stats.overruns, stats.max_tick_ns * 1e-3, most);
+    for (i = 0; scheduler_get_task_stats(i, &task) == 0; i++)
+    {
+        printf("  %-10s %4u Hz  phase %u  %7.2f Hz  missed %5llu  over budget %5llu  max %6.1f us\n",
+               task.name, task.rate, task.phase, task.runs / seconds, (unsigned long long)task.missed,
+               (unsigned long long)task.overruns, task.max_ns * 1e-3);
+    }
+}
+
+static int check(int ok, const char *what)
+{
+    printf("%-60s %s\n", what, ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
+
+static int self_test()
+{
+    uint64_t t;
+    struct scheduler_task_stats task;
+    struct scheduler_stats stats;
+    int failed = 0, ordered = 1, all = 0, phased = 1, i;
+    unsigned int firstRun[SIM_TASKS];
+
+    // one second, no phases: every task exactly at its rate, fastest first
+    sim_setup(0);
+    for (t = 0; t < TICK_RATE; t++)
+    {
+        sim_tick(t * TICK_NS);
+        for (i = 1; i < traceLength; i++)
+        {
+            if (simTasks[trace[i]].rate > simTasks[trace[i - 1]].rate)
+                ordered = 0;
+        }
+    }
+    for (i = 0; i < SIM_TASKS; i++)
+    {
+        scheduler_get_task_stats(i, &task);
+        if (task.runs != task.rate || task.missed != 0)
+            failed += check(0, task.name);
+    }
+    failed += check(1, "every task runs rate times in one second");
+    failed += check(ordered, "due tasks run fastest first");
+    scheduler_get_stats(&stats);
+    failed += check(stats.skipped_ticks == 0 && stats.overruns == 0, "the table fits in the tick");
+
+    // phases: each task first runs on its phase tick, and the slow tasks
+    // never all land on one tick
+    sim_setup(1);
+    for (i = 0; i < SIM_TASKS; i++)
+        firstRun[i] = ~0u;
+    for (t = 0; t < 10 * TICK_RATE; t++)
+    {
+        int slow = 0;
+
+        sim_tick(t * TICK_NS);
+        for (i = 0; i < traceLength; i++)
+        {
+            if (firstRun[trace[i]] == ~0u)
+                firstRun[trace[i]] = t;
+            if (simTasks[trace[i]].rate < 100)
+                slow++;
+        }
+        if (slow == 3)
+            all = 1;
+    }
+    for (i = 0; i < SIM_TASKS; i++)
+    {
+        if (firstRun[i] != simTasks[i].phase)
+            phased = 0;
+    }
+    failed += check(phased, "first run on the phase tick");
+    failed += check(!all, "phases keep the slow tasks on different ticks");
+    for (i = 0; i < SIM_TASKS; i++)
+    {
+        scheduler_get_task_stats(i, &task);
+        if (task.runs != 10 * task.rate)
+            failed += check(0, task.name);
+    }
+    failed += check(1, "phases do not change the rates");
+
+    // a task over its budget is counted, the tick still completes
+    sim_setup(1);
+    sim_tick(0);
+    extraCost = 800000;
+    sim_tick(TICK_NS);
+    extraCost = 0;
+    scheduler_get_task_stats(0, &task);
+    failed += check(task.overruns == 1 && task.runs == 2, "a run over budget counts as an overrun");
+    scheduler_get_stats(&stats);
+    failed += check(stats.overruns == 1, "a tick past its period counts as a tick overrun");
+
+    // the loop stalls, ticks 1 to 9 never run: every fast task runs once
+    // and counts the rest as missed, the slow ones run when due
+    sim_setup(0);
+    sim_tick(0);
+    sim_tick(10 * TICK_NS);
+    scheduler_get_stats(&stats);
+    failed += check(stats.skipped_ticks == 9, "skipped ticks are detected from the clock");
+    scheduler_get_task_stats(0, &task);
+    failed += check(task.runs == 2 && task.missed == 9, "a stalled 1 kHz task runs once, misses 9");
+    scheduler_get_task_stats(1, &task);
+    failed += check(task.runs == 2 && task.missed == 4, "a stalled 500 Hz task runs once, misses 4");
+    scheduler_get_task_stats(4, &task);
+    failed += check(task.runs == 1 && task.missed == 0, "the 10 Hz task is not due yet");
+
+    // the same tick twice does nothing
+    failed += check(sim_tick(10 * TICK_NS) == 0, "a second call in the same tick runs nothing");
+
+    printf("%s\n", failed ? "FAILED" : "all checks passed");
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = 10.0;
+    int test = 0, opt;
+
+    while ((opt = getopt(argc, argv, "s:x:t")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            seconds = atof(optarg);
+            break;
+        case 'x':
+            costScale = atof(optarg);
+            break;
+        case 't':
+            test = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s seconds] [-x cost_scale] [-t]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    if (test)
+        return self_test();
+
+    simulate(0, seconds);
+    simulate(1, seconds);
+    return 0;
+}
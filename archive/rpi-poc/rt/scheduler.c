@@ -0,0 +1,221 @@
+/**
+ * Multi-rate cooperative scheduler, see scheduler.h.
+ *
+ * Every task keeps an accumulator, Bresenham style: each tick adds the task
+ * rate, and the task is due whenever it reaches the tick rate, which is
+ * taken off again. Over tickRate ticks a task is due exactly rate times,
+ * with no drift and no floating point. The phase starts the accumulator
+ * that many ticks short.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+struct scheduler_entry
+{
+    scheduler_function run;
+    int64_t accumulator;
+    struct scheduler_task_stats stats;
+};
+
+struct scheduler_entry schedulerTasks[SCHEDULER_TASKS];
+int schedulerCount = 0;
+unsigned int schedulerRate = 1;
+uint64_t (*schedulerClock)(void);
+uint64_t schedulerStart = 0;
+int schedulerStarted = 0;
+int64_t schedulerLastTick = -1;
+struct scheduler_stats schedulerStats;
+uint64_t schedulerSimNow = 0;
+
+static uint64_t scheduler_monotonic()
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1000000000ULL + t.tv_nsec;
+}
+
+/**
+ * Empty the table.
+ *
+ * @param tickRate Ticks per second, how often the loop calls scheduler_run()
+ * @param clock Time source in ns, NULL for CLOCK_MONOTONIC or
+ *              scheduler_sim_clock for the simulated one
+ */
+void scheduler_init(unsigned int tickRate, uint64_t (*clock)(void))
+{
+    memset(schedulerTasks, 0, sizeof(schedulerTasks));
+    memset(&schedulerStats, 0, sizeof(schedulerStats));
+    schedulerCount = 0;
+    schedulerRate = tickRate > 0 ? tickRate : 1;
+    schedulerClock = clock ? clock : scheduler_monotonic;
+    schedulerStarted = 0;
+    schedulerLastTick = -1;
+    schedulerSimNow = 0;
+}
+
+/**
+ * Pin tick 0 to a given time, the first deadline of the loop calling
+ * scheduler_run(), so every wake-up lands inside the tick it was woken for.
+ * Without it tick 0 is the first scheduler_run().
+ *
+ * @param time Start of tick 0, on the scheduler clock
+ */
+void scheduler_start(uint64_t time)
+{
+    schedulerStart = time;
+    schedulerStarted = 1;
+}
+
+/**
+ * Register a task. Tasks are kept in rate order, fastest first, equal
+ * rates in the order they were added.
+ *
+ * @param name Name for the statistics, not copied
+ * @param run Task function, gets the time it starts at
+ * @param rate Runs per second, 1 to the tick rate
+ * @param phase Ticks to wait before the first run
+ * @param budgetNs Expected worst run time, longer runs are overruns
+ * @return 0 on success, -1 if the table is full or the rate out of range
+ */
+int scheduler_add(const char *name, scheduler_function run, unsigned int rate, unsigned int phase, uint64_t budgetNs)
+{
+    struct scheduler_entry *entry;
+    int i;
+
+    if (schedulerCount == SCHEDULER_TASKS || rate == 0 || rate > schedulerRate || !run)
+    {
+        fprintf(stderr, "scheduler: cannot add %s at %u Hz\n", name, rate);
+        return -1;
+    }
+
+    for (i = schedulerCount; i > 0 && schedulerTasks[i - 1].stats.rate < rate; i--)
+        schedulerTasks[i] = schedulerTasks[i - 1];
+    entry = &schedulerTasks[i];
+    memset(entry, 0, sizeof(*entry));
+    entry->run = run;
+    entry->accumulator = (int64_t)schedulerRate - (int64_t)(phase + 1) * rate;
+    entry->stats.name = name;
+    entry->stats.rate = rate;
+    entry->stats.phase = phase;
+    entry->stats.budget_ns = budgetNs;
+    schedulerCount++;
+    return 0;
+}
+
+/**
+ * Run the tasks due this tick. The tick is worked out from the clock,
+ * calls within the same tick do nothing.
+ *
+ * @return Number of tasks run
+ */
+int scheduler_run()
+{
+    uint64_t now = schedulerClock(), tickStart = now, tickNs;
+    int64_t tick, elapsed;
+    int i, ran = 0;
+
+    if (!schedulerStarted)
+        scheduler_start(now);
+    if (now < schedulerStart)
+        return 0;
+    tick = (now - schedulerStart) * schedulerRate / 1000000000ULL;
+    if (tick <= schedulerLastTick)
+        return 0;
+    elapsed = tick - schedulerLastTick;
+    schedulerLastTick = tick;
+    schedulerStats.ticks++;
+    schedulerStats.skipped_ticks += elapsed - 1;
+
+    for (i = 0; i < schedulerCount; i++)
+    {
+        struct scheduler_entry *entry = &schedulerTasks[i];
+        uint64_t start, ns;
+        int64_t due;
+
+        entry->accumulator += elapsed * entry->stats.rate;
+        if (entry->accumulator < (int64_t)schedulerRate)
+            continue;
+        due = entry->accumulator / schedulerRate;
+        entry->accumulator -= due * schedulerRate;
+        entry->stats.missed += due - 1;
+
+        start = schedulerClock();
+        entry->run(start);
+        ns = schedulerClock() - start;
+        entry->stats.runs++;
+        entry->stats.total_ns += ns;
+        if (ns > entry->stats.max_ns)
+            entry->stats.max_ns = ns;
+        if (entry->stats.budget_ns && ns > entry->stats.budget_ns)
+            entry->stats.overruns++;
+        ran++;
+    }
+
+    tickNs = schedulerClock() - tickStart;
+    if (tickNs > schedulerStats.max_tick_ns)
+        schedulerStats.max_tick_ns = tickNs;
+    if (tickNs > scheduler_tick_ns())
+        schedulerStats.overruns++;
+    return ran;
+}
+
+/**
+ * @return Tick period in ns, rounded
+ */
+uint64_t scheduler_tick_ns()
+{
+    return (1000000000ULL + schedulerRate / 2) / schedulerRate;
+}
+
+/**
+ * @param task Position in the table, 0 is the fastest task
+ * @param stats Filled with the task counters
+ * @return 0 on success, -1 past the end of the table
+ */
+int scheduler_get_task_stats(int task, struct scheduler_task_stats *stats)
+{
+    if (task < 0 || task >= schedulerCount)
+        return -1;
+    *stats = schedulerTasks[task].stats;
+    return 0;
+}
+
+/**
+ * @param stats Filled with the tick counters
+ */
+void scheduler_get_stats(struct scheduler_stats *stats)
+{
+    *stats = schedulerStats;
+}
+
+/**
+ * Simulated clock, pass to scheduler_init() and move it with
+ * scheduler_sim_advance(), from tasks to model their run time.
+ *
+ * @return Simulated time in ns
+ */
+uint64_t scheduler_sim_clock()
+{
+    return schedulerSimNow;
+}
+
+/**
+ * @param ns Time to move the simulated clock forward by
+ */
+void scheduler_sim_advance(uint64_t ns)
+{
+    schedulerSimNow += ns;
+}
+
+/**
+ * @param ns New simulated time, never earlier than the current one
+ */
+void scheduler_sim_set(uint64_t ns)
+{
+    schedulerSimNow = ns;
+}
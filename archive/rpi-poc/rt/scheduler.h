@@ -0,0 +1,65 @@
+#ifndef __SCHEDULER_H_
+#define __SCHEDULER_H_
+
+#include <stdint.h>
+
+/**
+ * Table driven multi-rate cooperative scheduler.
+ *
+ * Tasks are registered with an integer rate in Hz, at most the tick rate,
+ * and run from scheduler_run() called once per tick by the loop. A task
+ * with a rate that does not divide the tick rate runs on the nearest ticks
+ * and keeps its average exactly, a 75 Hz task on a 1 kHz tick runs every
+ * 13 or 14 ticks. The phase delays the first run by that many ticks, so
+ * slow tasks of equal rate can be spread over different ticks instead of
+ * piling up on the same one.
+ *
+ * Within a tick due tasks run rate monotonic, fastest first, each to
+ * completion. A task that runs past its budget is counted, not stopped.
+ * Ticks the loop missed are detected from the clock: a task due more than
+ * once runs once and counts the others as missed.
+ *
+ * The clock is CLOCK_MONOTONIC, or a simulated one advanced by hand, which
+ * makes every decision reproducible off target. Ticks are counted from the
+ * clock, so a tick rate with a whole number of ns per tick, 500, 512 or
+ * 1000 Hz, keeps them on the deadlines of a loop paced by rt_loop_wait().
+ */
+
+#define SCHEDULER_TASKS 16
+
+typedef void (*scheduler_function)(uint64_t now);
+
+struct scheduler_task_stats
+{
+    const char *name;
+    unsigned int rate;
+    unsigned int phase;
+    uint64_t budget_ns;
+    uint64_t runs;
+    uint64_t missed;         // due again before it could run
+    uint64_t overruns;       // runs longer than the budget
+    uint64_t max_ns;
+    uint64_t total_ns;
+};
+
+struct scheduler_stats
+{
+    uint64_t ticks;          // ticks run
+    uint64_t skipped_ticks;  // ticks the loop never called in
+    uint64_t overruns;       // ticks whose tasks outlasted the tick
+    uint64_t max_tick_ns;
+};
+
+void scheduler_init(unsigned int tickRate, uint64_t (*clock)(void));
+void scheduler_start(uint64_t time);
+int scheduler_add(const char *name, scheduler_function run, unsigned int rate, unsigned int phase, uint64_t budgetNs);
+int scheduler_run();
+uint64_t scheduler_tick_ns();
+int scheduler_get_task_stats(int task, struct scheduler_task_stats *stats);
+void scheduler_get_stats(struct scheduler_stats *stats);
+
+uint64_t scheduler_sim_clock();
+void scheduler_sim_advance(uint64_t ns);
+void scheduler_sim_set(uint64_t ns);
+
+#endif
@@ -59,6 +59,22 @@ void hcm5883l_initialize()
 
 uint8_t buffer[6];
 
+/** Get data ready status.
+ * This bit is set when data is written to all six data registers, and cleared
+ * when the device initiates a write to the data output registers and after one
+ * or more of the data output registers are written to.
+ * @return Data ready status
+ * @see HMC5883L_STATUS
+ * @see HMC5883L_STATUS_READY_BIT
+ */
+uint8_t hcm5883l_data_ready()
+{
+    uint8_t status = 0;
+    if (read_byte(HMC5883L_ADDRESS, HMC5883L_STATUS, &status) < 0)
+        return 0;
+    return (status >> HMC5883L_STATUS_READY_BIT) & 1;
+}
+
 /** Get 3-axis heading measurements.
  * In the event the ADC reading overflows or underflows for the given channel,
  * or if there is a math overflow during the bias measurement, this data
@@ -2,6 +2,7 @@
 #define __HCM5883L_H_
 
 void hcm5883l_initialize();
+uint8_t hcm5883l_data_ready();
 void getHeading(int16_t *x, int16_t *y, int16_t *z);
 
 #endif
\ No newline at end of file
@@ -147,6 +147,189 @@ void mpu6050_set_I2C_bypass_enabled(bool enabled)
         enabled);
 }
 
+/**
+ * Set digital low-pass filter configuration.
+ * 
+ * MPU6050_DLPF_BW_256 turns the filter off, which is the only setting where
+ * the gyro output rate is 8 kHz instead of 1 kHz.
+ * 
+ * @param mode New DLFP configuration setting
+ * @see MPU6050_CONFIG
+ * @see MPU6050_CONFIG_DLPF_CFG_BIT
+ * @see MPU6050_CONFIG_DLPF_CFG_LENGTH
+ */
+void mpu6050_set_dlpf_mode(uint8_t mode)
+{
+    write_bits(
+        MPU6050_ADDRESS,
+        MPU6050_CONFIG,
+        MPU6050_CONFIG_DLPF_CFG_BIT,
+        MPU6050_CONFIG_DLPF_CFG_LENGTH,
+        mode);
+}
+
+/**
+ * Set gyroscope sample rate divider.
+ * 
+ * Sample Rate = Gyroscope Output Rate / (1 + SMPLRT_DIV), this is the rate
+ * samples are written to the FIFO.
+ * 
+ * @param divider New sample rate divider
+ * @see MPU6050_SMPLRT_DIV
+ */
+void mpu6050_set_rate(uint8_t divider)
+{
+    write_byte(MPU6050_ADDRESS, MPU6050_SMPLRT_DIV, divider);
+}
+
+/**
+ * Reset the FIFO, drops its content and restarts sample alignment.
+ * 
+ * @see MPU6050_USER_CTRL
+ * @see MPU6050_USER_CTRL_FIFO_RESET_BIT
+ */
+void mpu6050_reset_fifo()
+{
+    write_bit(
+        MPU6050_ADDRESS,
+        MPU6050_USER_CTRL,
+        MPU6050_USER_CTRL_FIFO_RESET_BIT,
+        true);
+}
+
+/**
+ * Stream the gyro through the FIFO at the full output rate.
+ * 
+ * Turns the DLPF off so the gyro runs at 8 kHz, puts only the three gyro
+ * axes in the FIFO (6 bytes per sample) and enables it. The accelerometer
+ * still runs at 1 kHz and is read directly.
+ * 
+ * @param divider Sample rate divider, 0 for 8 kHz
+ * @see mpu6050_read_gyro_fifo()
+ */
+void mpu6050_enable_gyro_fifo(uint8_t divider)
+{
+    mpu6050_set_dlpf_mode(MPU6050_DLPF_BW_256);
+    mpu6050_set_rate(divider);
+    write_byte(
+        MPU6050_ADDRESS,
+        MPU6050_FIFO_EN,
+        (1 << MPU6050_FIFO_EN_XG_BIT) | (1 << MPU6050_FIFO_EN_YG_BIT) | (1 << MPU6050_FIFO_EN_ZG_BIT));
+    write_bit(
+        MPU6050_ADDRESS,
+        MPU6050_USER_CTRL,
+        MPU6050_USER_CTRL_FIFO_EN_BIT,
+        true);
+    mpu6050_reset_fifo();
+}
+
+/**
+ * Get current FIFO buffer size.
+ * 
+ * @return Number of bytes in the FIFO, 0 on a bus error
+ * @see MPU6050_FIFO_COUNTH
+ */
+uint16_t mpu6050_get_fifo_count()
+{
+    uint8_t buffer[2];
+
+    if (read_block(MPU6050_ADDRESS, MPU6050_FIFO_COUNTH, 2, buffer) != 2)
+        return 0;
+
+    return (((uint16_t)buffer[0]) << 8) | buffer[1];
+}
+
+/**
+ * Drain gyro samples from the FIFO in one burst.
+ * 
+ * A full FIFO means samples were dropped and the 6 byte framing can no
+ * longer be trusted, so it is reset and the call reports an overflow.
+ * 
+ * @param gyro Container for up to max_samples x, y, z triples
+ * @param max_samples Capacity of gyro in samples
+ * @return Number of samples read, -1 on overflow or bus error
+ */
+int mpu6050_read_gyro_fifo(int16_t *gyro, uint16_t max_samples)
+{
+    static uint8_t buffer[MPU6050_FIFO_SIZE];
+    uint16_t count = mpu6050_get_fifo_count();
+    uint16_t samples, i;
+
+    if (count >= MPU6050_FIFO_SIZE - 6)
+    {
+        mpu6050_reset_fifo();
+        return -1;
+    }
+
+    samples = count / 6;
+    if (samples > max_samples)
+        samples = max_samples;
+    if (samples == 0)
+        return 0;
+
+    if (read_block(MPU6050_ADDRESS, MPU6050_FIFO_R_W, samples * 6, buffer) < 0)
+        return -1;
+
+    for (i = 0; i < samples * 3; i++)
+        gyro[i] = (((int16_t)buffer[2 * i]) << 8) | buffer[2 * i + 1];
+
+    return samples;
+}
+
+/**
+ * Get raw 6-axis motion sensor readings and the die temperature.
+ * 
+ * Same burst read as mpu6050_get_motion_6(), the temperature sits between
+ * the accelerometer and the gyro registers so it comes for free.
+ * Temperature in degrees C is temp / 340 + 36.53.
+ * 
+ * @param temp 16-bit signed integer container for the temperature value
+ * @return 0 on success, -1 if the read failed and the values are unchanged
+ * @see mpu6050_get_motion_6()
+ * @see MPU6050_TEMP_OUT_H
+ */
+int8_t mpu6050_get_motion_7(int16_t *ax, int16_t *ay, int16_t *az, int16_t *gx, int16_t *gy, int16_t *gz, int16_t *temp)
+{
+    uint8_t buffer[MPU6050_MOTION_7_SIZE];
+
+    if (mpu6050_read_motion_7(buffer) < 0)
+        return -1;
+    mpu6050_decode_motion_7(buffer, ax, ay, az, gx, gy, gz, temp);
+    return 0;
+}
+
+/**
+ * Burst read of the accel, temperature and gyro registers, undecoded, for
+ * callers that decode later or elsewhere.
+ *
+ * @param buffer MPU6050_MOTION_7_SIZE bytes from MPU6050_ACCEL_XOUT_H
+ * @return 0 on success, -1 if the read failed
+ * @see mpu6050_decode_motion_7()
+ */
+int8_t mpu6050_read_motion_7(uint8_t *buffer)
+{
+    if (read_bytes(MPU6050_ADDRESS, MPU6050_ACCEL_XOUT_H, MPU6050_MOTION_7_SIZE, buffer) != MPU6050_MOTION_7_SIZE)
+        return -1;
+    return 0;
+}
+
+/**
+ * Decode a mpu6050_read_motion_7() burst, big endian registers.
+ *
+ * @param buffer MPU6050_MOTION_7_SIZE bytes from MPU6050_ACCEL_XOUT_H
+ * @see mpu6050_get_motion_7()
+ */
+void mpu6050_decode_motion_7(const uint8_t *buffer, int16_t *ax, int16_t *ay, int16_t *az, int16_t *gx, int16_t *gy, int16_t *gz, int16_t *temp)
+{
+    *ax = (((int16_t)buffer[0]) << 8) | buffer[1];
+    *ay = (((int16_t)buffer[2]) << 8) | buffer[3];
+    *az = (((int16_t)buffer[4]) << 8) | buffer[5];
+    *temp = (((int16_t)buffer[6]) << 8) | buffer[7];
+    *gx = (((int16_t)buffer[8]) << 8) | buffer[9];
+    *gy = (((int16_t)buffer[10]) << 8) | buffer[11];
+    *gz = (((int16_t)buffer[12]) << 8) | buffer[13];
+}
+
 /**
  * base on https://github.com/kriswiner/MPU6050/blob/master/MPU6050IMU.ino#L723
  */
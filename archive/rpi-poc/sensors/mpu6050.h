@@ -4,7 +4,16 @@
 #include <stdlib.h>
 #include <stdint.h>
 
+#define MPU6050_MOTION_7_SIZE 14 // accel, temperature and gyro registers
+
 void mpu6050_initialize();
 void mpu6050_get_motion_6(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz);
+int8_t mpu6050_get_motion_7(int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* temp);
+int8_t mpu6050_read_motion_7(uint8_t* buffer);
+void mpu6050_decode_motion_7(const uint8_t* buffer, int16_t* ax, int16_t* ay, int16_t* az, int16_t* gx, int16_t* gy, int16_t* gz, int16_t* temp);
+void mpu6050_enable_gyro_fifo(uint8_t divider);
+void mpu6050_reset_fifo();
+uint16_t mpu6050_get_fifo_count();
+int mpu6050_read_gyro_fifo(int16_t* gyro, uint16_t max_samples);
 
 #endif
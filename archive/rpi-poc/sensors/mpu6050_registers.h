@@ -8,8 +8,19 @@
 #define MPU6050_SELF_TEST_Z                             0x0F
 #define MPU6050_SELF_TEST_A                             0x10
 #define MPU6050_SMPLRT_DIV                              0x19
+
+// start config
 #define MPU6050_CONFIG                                  0x1A
 
+#define MPU6050_CONFIG_DLPF_CFG_BIT                     2
+#define MPU6050_CONFIG_DLPF_CFG_LENGTH                  3
+
+#define MPU6050_DLPF_BW_256                             0x00 // gyro output at 8 kHz
+#define MPU6050_DLPF_BW_188                             0x01
+#define MPU6050_DLPF_BW_98                              0x02
+#define MPU6050_DLPF_BW_42                              0x03
+// ends config
+
 // start gyro config
 #define MPU6050_GYRO_CONFIG                             0x1B
 
@@ -34,7 +45,13 @@
 #define MPU6050_ACCEL_FS_16                             0X03
 // ends accel config
 
+// start fifo enable
 #define MPU6050_FIFO_EN                                 0x23
+
+#define MPU6050_FIFO_EN_XG_BIT                          6
+#define MPU6050_FIFO_EN_YG_BIT                          5
+#define MPU6050_FIFO_EN_ZG_BIT                          4
+// ends fifo enable
 #define MPU6050_I2C_MST_CTRL                            0x24
 #define MPU6050_I2C_SLV0_ADDR                           0x25
 #define MPU6050_I2C_SLV0_REG                            0x26
@@ -64,6 +81,8 @@
 #define MPU6050_INT_ENABLE                              0x38
 #define MPU6050_INT_STATUS                              0x3A
 
+#define MPU6050_INT_STATUS_FIFO_OFLOW_BIT               4
+
 #define MPU6050_ACCEL_XOUT_H                            0x3B
 #define MPU6050_ACCEL_XOUT_L                            0x3C
 #define MPU6050_ACCEL_YOUT_H                            0x3D
@@ -115,7 +134,9 @@
 // start user ctrl
 #define MPU6050_USER_CTRL                               0x6A
 
+#define MPU6050_USER_CTRL_FIFO_EN_BIT                   6
 #define MPU6050_USER_CTRL_I2C_MST_EN_BIT                5
+#define MPU6050_USER_CTRL_FIFO_RESET_BIT                2
 // ends user ctrl
 
 // start power managment 1
@@ -135,6 +156,8 @@
 #define MPU6050_FIFO_COUNTH                             0x72
 #define MPU6050_FIFO_COUNTL                             0x73
 #define MPU6050_FIFO_R_W                                0x74
+
+#define MPU6050_FIFO_SIZE                               1024
 #define MPU6050_WHO_AM_I                                0x75
 
 #endif /* MPU6050_REGISTERS_H_ */
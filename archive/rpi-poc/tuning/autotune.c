@@ -0,0 +1,573 @@
+/**
+ * Mahony gain auto-tuner.
+ *
+ * Loads recorded sensor logs, runs a grid of twoKp/twoKi candidates through
+ * the multi-instance filter in mahony_lanes.c on a pool of threads, scores
+ * each candidate on convergence time, static drift and response lag against
+ * the reference attitude in the logs, and writes the Pareto-best gains as a
+ * header the firmware can include (see MAHONY_TUNED_GAINS in MahonyAHRS.c).
+ *
+ * The candidates run the multi-rate filter of the vehicle with its
+ * alignment and start-up gain schedule, so twoKp is the cruise gain the
+ * schedule ends on, the one twoKpDef sets. Drift and lag are only scored
+ * after -w seconds, by default once the schedule is done.
+ *
+ * A binary sensor log, *.ilog, goes through the biquads and notches of the
+ * estimator first, as on the vehicle. Its reference attitude is read from
+ * the .state file next to it, as the flight recorder writes it or
+ * replay -o does, one "time q0 q1 q2 q3 ..." line per record.
+ *
+ * Any other log is text, one sample per line, tab or space separated, '#'
+ * comments:
+ *
+ *   gx gy gz ax ay az mx my mz q0 q1 q2 q3
+ *
+ * gx..mz are the readings as fed to mahony_update_multirate(), a mag that
+ * differs from the previous line counts as fresh, and q0..q3 is the
+ * reference attitude (motion capture, or a long converged run), at -r Hz.
+ *
+ * -c checks the lanes against the flight filter instead of tuning: one batch
+ * of gains runs through mahony_lanes_run() and each of its gains through
+ * mahony_update_multirate() on every log, and the final attitudes have to
+ * agree to within CHECK_TOLERANCE.
+ *
+ * usage: autotune [-r rate] [-p kpmin:kpmax:steps] [-i kimin:kimax:steps]
+ *                 [-t threads] [-e error_deg] [-s still_dps] [-w settle_s]
+ *                 [-o header] [-c] log...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "mahony_lanes.h"
+#include "../MahonyAHRS.h"
+#include "../comm/comm.h"
+#include "../estimator/estimator.h"
+#include "../filter/biquad.h"
+#include "../log/sensor_log.h"
+
+#define CHECK_TOLERANCE 0.01 // deg between a lane and the flight filter
+
+struct sensor_log
+{
+    const char *path;
+    struct mahony_sample *samples;
+    struct mahony_quaternion *reference;
+    unsigned long count;
+    float rate; // Hz
+};
+
+struct candidate
+{
+    struct mahony_gains gains;
+    struct mahony_metrics metrics;
+    char pareto;
+};
+
+struct sensor_log *logs;
+int logCount;
+struct candidate *candidates;
+unsigned int candidateCount;
+// correction divider, start gain and schedule as the defaults in MahonyAHRS.c
+struct mahony_sweep_config config = {512.0f, 8, 2.0f * 5.0f, 5.0f, 0.0349066f, 0.0174533f, 5.0f};
+unsigned int nextBatch = 0;
+
+/**
+ * Load a text sensor log.
+ *
+ * @param path Log file path
+ * @param log Log to fill in
+ */
+void load_text_log(const char *path, struct sensor_log *log)
+{
+    char line[512];
+    unsigned long capacity = 4096;
+    FILE *file = fopen(path, "r");
+
+    if (!file)
+        err(path);
+
+    log->path = path;
+    log->count = 0;
+    log->samples = malloc(capacity * sizeof(*log->samples));
+    log->reference = malloc(capacity * sizeof(*log->reference));
+
+    while (fgets(line, sizeof(line), file))
+    {
+        struct mahony_sample *s;
+        struct mahony_quaternion *r;
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+
+        if (log->count == capacity)
+        {
+            capacity *= 2;
+            log->samples = realloc(log->samples, capacity * sizeof(*log->samples));
+            log->reference = realloc(log->reference, capacity * sizeof(*log->reference));
+        }
+        if (!log->samples || !log->reference)
+            err("out of memory");
+
+        s = &log->samples[log->count];
+        r = &log->reference[log->count];
+        if (sscanf(line, "%f %f %f %f %f %f %f %f %f %f %f %f %f",
+                   &s->gx, &s->gy, &s->gz,
+                   &s->ax, &s->ay, &s->az,
+                   &s->mx, &s->my, &s->mz,
+                   &r->q0, &r->q1, &r->q2, &r->q3) != 13)
+        {
+            fprintf(stderr, "%s:%lu: expected 13 columns\n", path, log->count + 1);
+            exit(1);
+        }
+        if (log->count == 0)
+            s->magFresh = !((s->mx == 0.0f) && (s->my == 0.0f) && (s->mz == 0.0f));
+        else
+            s->magFresh = s->mx != s[-1].mx || s->my != s[-1].my || s->mz != s[-1].mz;
+        log->count++;
+    }
+
+    log->rate = config.sampleFreq;
+    fclose(file);
+}
+
+/**
+ * Reference attitude of a binary log from its .state file, one line per
+ * record with the record time first.
+ */
+void load_reference(const char *path, const struct sensor_log_file *file, struct sensor_log *log)
+{
+    char statePath[512], line[512];
+    unsigned long long time;
+    size_t length = strlen(path) - strlen(".ilog");
+    unsigned long n = 0;
+    FILE *state;
+
+    snprintf(statePath, sizeof(statePath), "%.*s.state", (int)length, path);
+    state = fopen(statePath, "r");
+    if (!state)
+        err(statePath);
+
+    while (fgets(line, sizeof(line), state))
+    {
+        struct mahony_quaternion *r = &log->reference[n];
+
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (n == log->count || sscanf(line, "%llu %f %f %f %f", &time, &r->q0, &r->q1, &r->q2, &r->q3) != 5 ||
+            time != sensor_log_record_at(file, n)->time)
+        {
+            fprintf(stderr, "%s:%lu: not the attitude of record %lu of %s\n", statePath, n + 1, n, path);
+            exit(1);
+        }
+        n++;
+    }
+    if (n != log->count)
+    {
+        fprintf(stderr, "%s: %lu attitudes for %lu records\n", statePath, n, log->count);
+        exit(1);
+    }
+    fclose(state);
+}
+
+/**
+ * Load a binary sensor log, filtered the way estimator_update() filters it
+ * before fusion.
+ *
+ * @param path Log file path
+ * @param log Log to fill in
+ */
+void load_binary_log(const char *path, struct sensor_log *log)
+{
+    struct sensor_log_file file;
+    float gyroScale = 3.14159f / 180.0f; // as estimator_fuse()
+    float filtered[BIQUAD_AXES];
+    unsigned long n;
+    int axis;
+
+    if (sensor_log_map(path, &file) < 0)
+        exit(1);
+
+    log->path = path;
+    log->count = file.count;
+    log->rate = file.header->gyro_rate;
+    log->samples = malloc((file.count ? file.count : 1) * sizeof(*log->samples));
+    log->reference = malloc((file.count ? file.count : 1) * sizeof(*log->reference));
+    if (!log->samples || !log->reference)
+        err("out of memory");
+
+    estimator_init(log->rate);
+    for (n = 0; n < file.count; n++)
+    {
+        const struct sensor_log_record *record = sensor_log_record_at(&file, n);
+        struct mahony_sample *s = &log->samples[n];
+        float *gyro = &s->gx, *accel = &s->ax, *mag = &s->mx;
+
+        estimator_filter(record, filtered);
+        for (axis = 0; axis < 3; axis++)
+        {
+            gyro[axis] = filtered[BIQUAD_GX + axis] * gyroScale;
+            accel[axis] = filtered[BIQUAD_AX + axis];
+            mag[axis] = record->mag[axis];
+        }
+        s->magFresh = (record->flags & SENSOR_LOG_MAG_FRESH) != 0;
+    }
+
+    load_reference(path, &file, log);
+    sensor_log_unmap(&file);
+}
+
+void load_log(const char *path, struct sensor_log *log)
+{
+    size_t length = strlen(path);
+
+    if (length > strlen(".ilog") && strcmp(path + length - strlen(".ilog"), ".ilog") == 0)
+        load_binary_log(path, log);
+    else
+        load_text_log(path, log);
+}
+
+/**
+ * Worker thread, takes the next batch of MAHONY_LANES candidates until none
+ * are left and scores it over every log. Batches are independent so there is
+ * nothing to share but the batch counter.
+ */
+void *tune_worker(void *arg)
+{
+    struct mahony_gains gains[MAHONY_LANES];
+    struct mahony_metrics metrics[MAHONY_LANES];
+    struct mahony_metrics total[MAHONY_LANES];
+    unsigned int batch, first, lane;
+    int i;
+
+    (void)arg;
+    while ((batch = __atomic_fetch_add(&nextBatch, 1, __ATOMIC_RELAXED)) * MAHONY_LANES < candidateCount)
+    {
+        first = batch * MAHONY_LANES;
+        for (lane = 0; lane < MAHONY_LANES; lane++)
+        {
+            unsigned int c = first + lane < candidateCount ? first + lane : candidateCount - 1;
+            gains[lane] = candidates[c].gains;
+        }
+        memset(total, 0, sizeof(total));
+
+        // worst convergence over the logs, mean drift and lag
+        for (i = 0; i < logCount; i++)
+        {
+            struct mahony_sweep_config logConfig = config;
+
+            logConfig.sampleFreq = logs[i].rate;
+            mahony_lanes_run(logs[i].samples, logs[i].reference, logs[i].count, &logConfig, gains, metrics, NULL);
+            for (lane = 0; lane < MAHONY_LANES; lane++)
+            {
+                total[lane].rms_error += metrics[lane].rms_error / logCount;
+                total[lane].max_error = fmaxf(total[lane].max_error, metrics[lane].max_error);
+                total[lane].final_error += metrics[lane].final_error / logCount;
+                total[lane].convergence_time = fmaxf(total[lane].convergence_time, metrics[lane].convergence_time);
+                total[lane].static_drift += metrics[lane].static_drift / logCount;
+                total[lane].response_lag += metrics[lane].response_lag / logCount;
+            }
+        }
+
+        for (lane = 0; lane < MAHONY_LANES && first + lane < candidateCount; lane++)
+            candidates[first + lane].metrics = total[lane];
+    }
+    return NULL;
+}
+
+/**
+ * Run the flight filter over a log with the same gains, divider and schedule
+ * as a lane.
+ *
+ * @param log Log to run
+ * @param gains Cruise gains
+ * @param q Final attitude
+ */
+void scalar_run(const struct sensor_log *log, const struct mahony_gains *gains, struct mahony_quaternion *q)
+{
+    const struct mahony_sample *s;
+    float final[4];
+    unsigned long i;
+
+    mahony_init();
+    mahony_set_sample_frequency(log->rate);
+    mahony_set_correction_divider(config.correctionDivider);
+    mahony_set_gain_schedule(config.startGain, gains->twoKp, config.scheduleTime);
+    mahony_set_integral_gain(gains->twoKi);
+    for (i = 0; i < log->count; i++)
+    {
+        s = &log->samples[i];
+        mahony_update_multirate(s->gx, s->gy, s->gz, s->ax, s->ay, s->az, s->mx, s->my, s->mz, s->magFresh);
+    }
+    mahony_get_quaternion(final);
+    q->q0 = final[0];
+    q->q1 = final[1];
+    q->q2 = final[2];
+    q->q3 = final[3];
+}
+
+/**
+ * Check that every lane ends on the attitude the flight filter ends on with
+ * its gains. The gains cover the tuning range, half the lanes with the
+ * integral term off.
+ *
+ * @return 0 if all lanes agree on all logs
+ */
+int check_lanes()
+{
+    struct mahony_gains gains[MAHONY_LANES];
+    struct mahony_metrics metrics[MAHONY_LANES];
+    struct mahony_quaternion lanes[MAHONY_LANES], scalar;
+    double dot, angle, worst = 0.0;
+    unsigned int lane;
+    int i, failed = 0;
+
+    for (lane = 0; lane < MAHONY_LANES; lane++)
+    {
+        gains[lane].twoKp = 0.5f + 9.5f * lane / (MAHONY_LANES - 1);
+        gains[lane].twoKi = lane & 1 ? 0.1f * lane : 0.0f;
+    }
+
+    for (i = 0; i < logCount; i++)
+    {
+        struct mahony_sweep_config logConfig = config;
+
+        logConfig.sampleFreq = logs[i].rate;
+        mahony_lanes_run(logs[i].samples, logs[i].reference, logs[i].count, &logConfig, gains, metrics, lanes);
+        for (lane = 0; lane < MAHONY_LANES; lane++)
+        {
+            scalar_run(&logs[i], &gains[lane], &scalar);
+            const struct mahony_quaternion *q = &lanes[lane];
+
+            // neither quaternion is exactly unit length after the fast normalisation
+            dot = (double)q->q0 * scalar.q0 + (double)q->q1 * scalar.q1 +
+                  (double)q->q2 * scalar.q2 + (double)q->q3 * scalar.q3;
+            dot /= sqrt(((double)q->q0 * q->q0 + (double)q->q1 * q->q1 + (double)q->q2 * q->q2 + (double)q->q3 * q->q3) *
+                        ((double)scalar.q0 * scalar.q0 + (double)scalar.q1 * scalar.q1 +
+                         (double)scalar.q2 * scalar.q2 + (double)scalar.q3 * scalar.q3));
+            angle = 2.0 * asin(sqrt(fmax(1.0 - dot * dot, 0.0))) * 57.29578;
+            worst = fmax(worst, angle);
+            if (angle > CHECK_TOLERANCE)
+            {
+                fprintf(stderr, "%s: lane %u (twoKp %.3f twoKi %.3f) ends %.4f deg off the flight filter\n",
+                        logs[i].path, lane, gains[lane].twoKp, gains[lane].twoKi, angle);
+                failed = 1;
+            }
+        }
+    }
+
+    if (failed)
+        return 1;
+    printf("%d lanes match mahony_update_multirate() on %d logs, worst %.6f deg\n", MAHONY_LANES, logCount, worst);
+    return 0;
+}
+
+/**
+ * @return 1 if a is no worse than b on every objective and better on one
+ */
+int dominates(const struct mahony_metrics *a, const struct mahony_metrics *b)
+{
+    if (a->convergence_time > b->convergence_time ||
+        a->static_drift > b->static_drift ||
+        a->response_lag > b->response_lag)
+        return 0;
+    return a->convergence_time < b->convergence_time ||
+           a->static_drift < b->static_drift ||
+           a->response_lag < b->response_lag;
+}
+
+/**
+ * Mark the Pareto front and pick the front member with the lowest sum of
+ * objectives, each scaled by its largest value on the front.
+ *
+ * @return Index of the chosen candidate
+ */
+unsigned int pareto_select()
+{
+    float maxConvergence = 0.0f, maxDrift = 0.0f, maxLag = 0.0f;
+    float bestScore = INFINITY;
+    unsigned int i, j, best = 0;
+
+    for (i = 0; i < candidateCount; i++)
+    {
+        candidates[i].pareto = 1;
+        for (j = 0; j < candidateCount && candidates[i].pareto; j++)
+        {
+            if (j != i && dominates(&candidates[j].metrics, &candidates[i].metrics))
+                candidates[i].pareto = 0;
+        }
+        if (candidates[i].pareto)
+        {
+            maxConvergence = fmaxf(maxConvergence, candidates[i].metrics.convergence_time);
+            maxDrift = fmaxf(maxDrift, candidates[i].metrics.static_drift);
+            maxLag = fmaxf(maxLag, candidates[i].metrics.response_lag);
+        }
+    }
+
+    for (i = 0; i < candidateCount; i++)
+    {
+        const struct mahony_metrics *m = &candidates[i].metrics;
+        float score;
+
+        if (!candidates[i].pareto)
+            continue;
+        score = (maxConvergence > 0.0f ? m->convergence_time / maxConvergence : 0.0f) +
+                (maxDrift > 0.0f ? m->static_drift / maxDrift : 0.0f) +
+                (maxLag > 0.0f ? m->response_lag / maxLag : 0.0f);
+        if (score < bestScore)
+        {
+            bestScore = score;
+            best = i;
+        }
+    }
+    return best;
+}
+
+void write_header(const char *path, unsigned int best)
+{
+    const struct candidate *c = &candidates[best];
+    FILE *file = path ? fopen(path, "w") : stdout;
+    unsigned int i;
+    int l;
+
+    if (!file)
+        err(path);
+
+    fprintf(file, "/**\n * Generated by tuning/autotune from");
+    for (l = 0; l < logCount; l++)
+        fprintf(file, " %s", logs[l].path);
+    fprintf(file, "\n *\n * Pareto front (twoKp twoKi convergence_s drift_rad/s lag_s):\n");
+    for (i = 0; i < candidateCount; i++)
+    {
+        if (candidates[i].pareto)
+            fprintf(file, " *   %8.4f %8.4f %8.3f %10.6f %8.4f%s\n",
+                    candidates[i].gains.twoKp, candidates[i].gains.twoKi,
+                    candidates[i].metrics.convergence_time,
+                    candidates[i].metrics.static_drift,
+                    candidates[i].metrics.response_lag,
+                    i == best ? "  <-" : "");
+    }
+    fprintf(file, " */\n");
+    fprintf(file, "#ifndef __MAHONY_GAINS_H_\n#define __MAHONY_GAINS_H_\n\n");
+    fprintf(file, "#define twoKpDef %.6ff // 2 * proportional gain once the gain schedule is done\n", c->gains.twoKp);
+    fprintf(file, "#define twoKiDef %.6ff // 2 * integral gain\n", c->gains.twoKi);
+    fprintf(file, "\n#endif\n");
+
+    if (path)
+        fclose(file);
+}
+
+/**
+ * Parse "min:max:steps" into a grid axis.
+ */
+void parse_range(const char *arg, float *min, float *max, unsigned int *steps)
+{
+    if (sscanf(arg, "%f:%f:%u", min, max, steps) != 3 || *steps == 0)
+        err("range must be min:max:steps");
+}
+
+int main(int argc, char **argv)
+{
+    float kpMin = 0.1f, kpMax = 10.0f, kiMin = 0.0f, kiMax = 1.0f;
+    unsigned int kpSteps = 64, kiSteps = 16;
+    long threadCount = sysconf(_SC_NPROCESSORS_ONLN);
+    const char *output = NULL;
+    pthread_t *threads;
+    struct timespec start, end;
+    unsigned long samples = 0;
+    unsigned int i, j, best;
+    double elapsed;
+    long t;
+    int opt, check = 0;
+
+    while ((opt = getopt(argc, argv, "r:p:i:t:e:s:w:o:c")) != -1)
+    {
+        switch (opt)
+        {
+        case 'r':
+            config.sampleFreq = atof(optarg);
+            break;
+        case 'p':
+            parse_range(optarg, &kpMin, &kpMax, &kpSteps);
+            break;
+        case 'i':
+            parse_range(optarg, &kiMin, &kiMax, &kiSteps);
+            break;
+        case 't':
+            threadCount = atol(optarg);
+            break;
+        case 'e':
+            config.convergedError = atof(optarg) * 0.0174533f;
+            break;
+        case 's':
+            config.staticRate = atof(optarg) * 0.0174533f;
+            break;
+        case 'w':
+            config.settleTime = atof(optarg);
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        case 'c':
+            check = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-r rate] [-p kpmin:kpmax:steps] [-i kimin:kimax:steps] "
+                            "[-t threads] [-e error_deg] [-s still_dps] [-w settle_s] [-o header] [-c] log...\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (optind >= argc)
+        err("no logs given");
+    if (threadCount < 1)
+        threadCount = 1;
+
+    logCount = argc - optind;
+    logs = calloc(logCount, sizeof(*logs));
+    for (i = 0; i < (unsigned int)logCount; i++)
+    {
+        load_log(argv[optind + i], &logs[i]);
+        samples += logs[i].count;
+    }
+    if (check)
+        return check_lanes();
+
+    candidateCount = kpSteps * kiSteps;
+    candidates = calloc(candidateCount, sizeof(*candidates));
+    for (i = 0; i < kpSteps; i++)
+    {
+        for (j = 0; j < kiSteps; j++)
+        {
+            struct candidate *c = &candidates[i * kiSteps + j];
+            c->gains.twoKp = kpSteps > 1 ? kpMin + (kpMax - kpMin) * i / (kpSteps - 1) : kpMin;
+            c->gains.twoKi = kiSteps > 1 ? kiMin + (kiMax - kiMin) * j / (kiSteps - 1) : kiMin;
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    threads = malloc(threadCount * sizeof(*threads));
+    for (t = 0; t < threadCount; t++)
+    {
+        if (pthread_create(&threads[t], NULL, tune_worker, NULL) != 0)
+            err("pthread_create");
+    }
+    for (t = 0; t < threadCount; t++)
+        pthread_join(threads[t], NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+    fprintf(stderr, "%u candidates x %lu samples on %ld threads (%d lanes) in %.3f s, %.1f M filter steps/s\n",
+            candidateCount, samples, threadCount, MAHONY_LANES, elapsed,
+            candidateCount * (double)samples / elapsed * 1e-6);
+
+    best = pareto_select();
+    write_header(output, best);
+
+    return 0;
+}
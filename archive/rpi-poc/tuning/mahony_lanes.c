@@ -0,0 +1,456 @@
+/**
+ * Vectorised copy of mahony_update_multirate() from MahonyAHRS.c, the path
+ * the vehicle runs, with its alignment and start-up gain schedule.
+ *
+ * The filter state lives in GCC vector types, one filter instance per lane,
+ * so the same source compiles to SSE, AVX2, AVX-512 or NEON depending on the
+ * target flags. Every branch in the original filter depends only on the
+ * input sample (zero mag, zero accel, fresh mag) and the sample count,
+ * which are shared by all lanes, so the lanes never diverge except for the
+ * per-lane integral gain test, which is done with a mask.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+#include "mahony_lanes.h"
+
+typedef float vfloat __attribute__((vector_size(MAHONY_LANES * sizeof(float))));
+typedef int32_t vint __attribute__((vector_size(MAHONY_LANES * sizeof(int32_t))));
+
+/**
+ * Same fast inverse square root as mahony_invSqrt(), so the shared accel and
+ * mag normalisation matches the scalar filter.
+ */
+static inline float scalar_inv_sqrt(float x)
+{
+    union
+    {
+        float f;
+        int32_t i;
+    } u;
+    float halfx = 0.5f * x;
+    float y;
+    u.f = x;
+    u.i = 0x5f3759df - (u.i >> 1);
+    y = u.f;
+    y = y * (1.5f - (halfx * y * y));
+    y = y * (1.5f - (halfx * y * y));
+    return y;
+}
+
+/**
+ * Same fast inverse square root as mahony_invSqrt(), lane by lane.
+ */
+static inline vfloat lanes_inv_sqrt(vfloat x)
+{
+    vfloat halfx = 0.5f * x;
+    vint i = (vint)x;
+    i = 0x5f3759df - (i >> 1);
+    vfloat y = (vfloat)i;
+    y = y * (1.5f - (halfx * y * y));
+    y = y * (1.5f - (halfx * y * y));
+    return y;
+}
+
+static inline vfloat lanes_sqrt(vfloat x)
+{
+    vfloat y;
+    int lane;
+
+    for (lane = 0; lane < MAHONY_LANES; lane++)
+        y[lane] = sqrtf(x[lane]);
+    return y;
+}
+
+static inline vfloat lanes_select(vint mask, vfloat a, vfloat b)
+{
+    return (vfloat)(((vint)a & mask) | ((vint)b & ~mask));
+}
+
+static inline vfloat lanes_max(vfloat a, vfloat b)
+{
+    return lanes_select(a > b, a, b);
+}
+
+/**
+ * Squared sine of half the angle between the filter and reference attitude,
+ * 1 - (q . r)^2 / (|q|^2 |r|^2), which does not care about the quaternion
+ * sign. The norms matter, the fast inverse square root leaves |q| about 1e-5
+ * away from one, which would otherwise read as a 0.5 degree error.
+ */
+static inline vfloat lanes_error(vfloat q0, vfloat q1, vfloat q2, vfloat q3, const struct mahony_quaternion *r)
+{
+    vfloat dot = q0 * r->q0 + q1 * r->q1 + q2 * r->q2 + q3 * r->q3;
+    vfloat qq = q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3;
+    float rr = r->q0 * r->q0 + r->q1 * r->q1 + r->q2 * r->q2 + r->q3 * r->q3;
+    return 1.0f - dot * dot / (qq * rr);
+}
+
+static inline float error_to_angle(float e)
+{
+    if (e < 0.0f)
+        e = 0.0f;
+    if (e > 1.0f)
+        e = 1.0f;
+    return 2.0f * asinf(sqrtf(e));
+}
+
+/**
+ * Same initial alignment as mahony_align(), on the shared first sample.
+ */
+static void scalar_align(float ax, float ay, float az, float mx, float my, float mz, float *q)
+{
+    float alignRoll, alignPitch, alignYaw = 0.0f;
+    float sr, cr, sp, cp, sy, cy;
+
+    alignRoll = atan2f(ay, az);
+    alignPitch = atan2f(-ax, sqrtf(ay * ay + az * az));
+
+    if (!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)))
+    {
+        float sinRoll = sinf(alignRoll), cosRoll = cosf(alignRoll);
+        float sinPitch = sinf(alignPitch), cosPitch = cosf(alignPitch);
+        float hx = mx * cosPitch + (my * sinRoll + mz * cosRoll) * sinPitch;
+        float hy = my * cosRoll - mz * sinRoll;
+        alignYaw = atan2f(-hy, hx);
+    }
+
+    sr = sinf(0.5f * alignRoll);
+    cr = cosf(0.5f * alignRoll);
+    sp = sinf(0.5f * alignPitch);
+    cp = cosf(0.5f * alignPitch);
+    sy = sinf(0.5f * alignYaw);
+    cy = cosf(0.5f * alignYaw);
+    q[0] = cr * cp * cy + sr * sp * sy;
+    q[1] = sr * cp * cy - cr * sp * sy;
+    q[2] = cr * sp * cy + sr * cp * sy;
+    q[3] = cr * cp * sy - sr * sp * cy;
+}
+
+/**
+ * Run MAHONY_LANES filter instances over the whole input stream.
+ *
+ * Each lane is mahony_update_multirate() from a fresh mahony_init(): the
+ * first correction with a valid accel aligns, then twoKp ramps from
+ * config->startGain down to the lane's gain over config->scheduleTime.
+ * Alignment, schedule and correction instants only depend on the shared
+ * input, so they are the same for every lane.
+ *
+ * @param samples Shared input stream
+ * @param reference Reference attitude for each sample, NULL to skip metrics
+ * @param count Number of samples
+ * @param config Sample frequency, correction rate, gain schedule and scoring thresholds
+ * @param gains MAHONY_LANES gain pairs, one per instance, twoKp is the cruise gain
+ * @param metrics MAHONY_LANES results, one per instance
+ * @param final MAHONY_LANES attitudes after the last sample, or NULL
+ */
+void mahony_lanes_run(
+    const struct mahony_sample *samples,
+    const struct mahony_quaternion *reference,
+    unsigned long count,
+    const struct mahony_sweep_config *config,
+    const struct mahony_gains *gains,
+    struct mahony_metrics *metrics,
+    struct mahony_quaternion *final)
+{
+    vfloat twoKp, twoKpCruise, twoKi;
+    vfloat q0 = {0}, q1 = {0}, q2 = {0}, q3 = {0};
+    vfloat integralFBx = {0}, integralFBy = {0}, integralFBz = {0};
+    vfloat fbx = {0}, fby = {0}, fbz = {0};
+    vfloat errorSum = {0}, errorMax = {0}, error = {0};
+    vfloat lastUnconverged = {0};
+    vfloat angle = {0}, segmentStart = {0}, driftSum = {0};
+    vfloat lagNumerator = {0};
+    vint integralEnabled;
+    float invSampleFreq = 1.0f / config->sampleFreq;
+    float convergedError, lagDenominator = 0.0f, staticTime = 0.0f;
+    float scheduleTime = 0.0f;
+    unsigned int samplesSinceCorrection = 0;
+    unsigned long n, settleSamples;
+    char wasStatic = 0, aligned = 0;
+    int lane;
+
+    // compare against sin^2(error / 2), which is what lanes_error() returns
+    convergedError = sinf(0.5f * config->convergedError);
+    convergedError *= convergedError;
+    settleSamples = (unsigned long)(config->settleTime * config->sampleFreq);
+
+    for (lane = 0; lane < MAHONY_LANES; lane++)
+    {
+        twoKpCruise[lane] = gains[lane].twoKp;
+        twoKi[lane] = gains[lane].twoKi;
+    }
+    twoKp = (vfloat){0} + config->startGain;
+    q0 += 1.0f;
+    integralEnabled = twoKi > 0.0f;
+
+    for (n = 0; n < count; n++)
+    {
+        const struct mahony_sample *s = &samples[n];
+        float ax = s->ax, ay = s->ay, az = s->az;
+        float mx = s->mx, my = s->my, mz = s->mz;
+        float recipNorm;
+        vfloat gx, gy, gz;
+        vfloat qa, qb, qc, qNorm;
+
+        // Correct on fresh magnetometer data or once every correctionDivider samples
+        if (s->magFresh || samplesSinceCorrection >= config->correctionDivider)
+        {
+            float correctionPeriod = invSampleFreq * (samplesSinceCorrection > 0 ? samplesSinceCorrection : 1);
+
+            samplesSinceCorrection = 0;
+            if ((ax == 0.0f) && (ay == 0.0f) && (az == 0.0f))
+            {
+                // nothing to correct against, the integral term only
+                fbx = integralFBx;
+                fby = integralFBy;
+                fbz = integralFBz;
+            }
+            else if (!aligned)
+            {
+                float q[4];
+
+                scalar_align(ax, ay, az, mx, my, mz, q);
+                q0 = (vfloat){0} + q[0];
+                q1 = (vfloat){0} + q[1];
+                q2 = (vfloat){0} + q[2];
+                q3 = (vfloat){0} + q[3];
+                integralFBx = integralFBy = integralFBz = (vfloat){0};
+                fbx = fby = fbz = (vfloat){0};
+                scheduleTime = 0.0f;
+                twoKp = (vfloat){0} + config->startGain;
+                aligned = 1;
+            }
+            else
+            {
+                vfloat halfvx, halfvy, halfvz;
+                vfloat halfex, halfey, halfez;
+
+                // Normalise accelerometer measurement, same for every lane
+                recipNorm = scalar_inv_sqrt(ax * ax + ay * ay + az * az);
+                ax *= recipNorm;
+                ay *= recipNorm;
+                az *= recipNorm;
+
+                // Estimated direction of gravity
+                halfvx = q1 * q3 - q0 * q2;
+                halfvy = q0 * q1 + q2 * q3;
+                halfvz = q0 * q0 - 0.5f + q3 * q3;
+
+                halfex = (ay * halfvz - az * halfvy);
+                halfey = (az * halfvx - ax * halfvz);
+                halfez = (ax * halfvy - ay * halfvx);
+
+                // Add magnetic field error when the magnetometer measurement is valid
+                if (!((mx == 0.0f) && (my == 0.0f) && (mz == 0.0f)))
+                {
+                    vfloat q0q1, q0q2, q0q3, q1q1, q1q2, q1q3, q2q2, q2q3, q3q3;
+                    vfloat hx, hy, bx, bz;
+                    vfloat halfwx, halfwy, halfwz;
+
+                    recipNorm = scalar_inv_sqrt(mx * mx + my * my + mz * mz);
+                    mx *= recipNorm;
+                    my *= recipNorm;
+                    mz *= recipNorm;
+
+                    q0q1 = q0 * q1;
+                    q0q2 = q0 * q2;
+                    q0q3 = q0 * q3;
+                    q1q1 = q1 * q1;
+                    q1q2 = q1 * q2;
+                    q1q3 = q1 * q3;
+                    q2q2 = q2 * q2;
+                    q2q3 = q2 * q3;
+                    q3q3 = q3 * q3;
+
+                    // Reference direction of Earth's magnetic field
+                    hx = 2.0f * (mx * (0.5f - q2q2 - q3q3) + my * (q1q2 - q0q3) + mz * (q1q3 + q0q2));
+                    hy = 2.0f * (mx * (q1q2 + q0q3) + my * (0.5f - q1q1 - q3q3) + mz * (q2q3 - q0q1));
+                    bx = lanes_sqrt(hx * hx + hy * hy);
+                    bz = 2.0f * (mx * (q1q3 - q0q2) + my * (q2q3 + q0q1) + mz * (0.5f - q1q1 - q2q2));
+
+                    // Estimated direction of magnetic field
+                    halfwx = bx * (0.5f - q2q2 - q3q3) + bz * (q1q3 - q0q2);
+                    halfwy = bx * (q1q2 - q0q3) + bz * (q0q1 + q2q3);
+                    halfwz = bx * (q0q2 + q1q3) + bz * (0.5f - q1q1 - q2q2);
+
+                    halfex += (my * halfwz - mz * halfwy);
+                    halfey += (mz * halfwx - mx * halfwz);
+                    halfez += (mx * halfwy - my * halfwx);
+                }
+
+                // Integral feedback over the samples since the last
+                // correction, only on lanes with Ki > 0, the others are
+                // held at zero to prevent windup
+                integralFBx = lanes_select(integralEnabled, integralFBx + twoKi * halfex * correctionPeriod, (vfloat){0});
+                integralFBy = lanes_select(integralEnabled, integralFBy + twoKi * halfey * correctionPeriod, (vfloat){0});
+                integralFBz = lanes_select(integralEnabled, integralFBz + twoKi * halfez * correctionPeriod, (vfloat){0});
+
+                // Hold integral and proportional feedback until the next correction
+                fbx = integralFBx + twoKp * halfex;
+                fby = integralFBy + twoKp * halfey;
+                fbz = integralFBz + twoKp * halfez;
+            }
+        }
+
+        // Start-up gain decays to cruise, as mahony_schedule_gain()
+        if (aligned && scheduleTime < config->scheduleTime)
+        {
+            scheduleTime += invSampleFreq;
+            if (scheduleTime >= config->scheduleTime)
+                twoKp = twoKpCruise;
+            else
+                twoKp = config->startGain + (twoKpCruise - config->startGain) * (scheduleTime / config->scheduleTime);
+        }
+
+        // Convert gyroscope degrees/sec to radians/sec and apply held feedback
+        gx = (vfloat){0} + s->gx * 0.0174533f + fbx;
+        gy = (vfloat){0} + s->gy * 0.0174533f + fby;
+        gz = (vfloat){0} + s->gz * 0.0174533f + fbz;
+
+        // Integrate rate of change of quaternion
+        gx *= (0.5f * invSampleFreq);
+        gy *= (0.5f * invSampleFreq);
+        gz *= (0.5f * invSampleFreq);
+        qa = q0;
+        qb = q1;
+        qc = q2;
+        q0 += (-qb * gx - qc * gy - q3 * gz);
+        q1 += (qa * gx + qc * gz - q3 * gy);
+        q2 += (qa * gy - qb * gz + q3 * gx);
+        q3 += (qa * gz + qb * gy - qc * gx);
+
+        // Normalise quaternion
+        qNorm = lanes_inv_sqrt(q0 * q0 + q1 * q1 + q2 * q2 + q3 * q3);
+        q0 *= qNorm;
+        q1 *= qNorm;
+        q2 *= qNorm;
+        q3 *= qNorm;
+        samplesSinceCorrection++;
+
+        if (reference)
+        {
+            float rate = 0.0f;
+            char isStatic;
+
+            error = lanes_error(q0, q1, q2, q3, &reference[n]);
+            errorSum += error;
+            errorMax = lanes_max(errorMax, error);
+            lastUnconverged = lanes_select(error > convergedError, (vfloat){0} + (float)(n + 1), lastUnconverged);
+
+            if (n < settleSamples)
+                continue;
+
+            // reference angular rate from consecutive reference samples
+            if (n > 0)
+            {
+                const struct mahony_quaternion *r = &reference[n];
+                const struct mahony_quaternion *p = &reference[n - 1];
+                float dot = r->q0 * p->q0 + r->q1 * p->q1 + r->q2 * p->q2 + r->q3 * p->q3;
+                float rr = (r->q0 * r->q0 + r->q1 * r->q1 + r->q2 * r->q2 + r->q3 * r->q3) *
+                           (p->q0 * p->q0 + p->q1 * p->q1 + p->q2 * p->q2 + p->q3 * p->q3);
+                rate = 2.0f * sqrtf(fmaxf(1.0f - dot * dot / rr, 0.0f)) * config->sampleFreq;
+            }
+            isStatic = rate < config->staticRate;
+
+            // error angle, 2 * sin(error / 2) is close enough for both metrics
+            angle = 2.0f * lanes_sqrt(lanes_max(error, (vfloat){0}));
+
+            // static drift: how far the error wanders over each still segment
+            if (isStatic && !wasStatic)
+                segmentStart = angle;
+            if (isStatic)
+            {
+                staticTime += invSampleFreq;
+            }
+            else if (wasStatic)
+            {
+                vfloat wander = angle - segmentStart;
+                driftSum += lanes_max(wander, -wander);
+            }
+            wasStatic = isStatic;
+
+            // response lag: error ~ lag * rate while moving, fitted by least squares
+            if (!isStatic)
+            {
+                lagNumerator += angle * rate;
+                lagDenominator += rate * rate;
+            }
+        }
+    }
+
+    // close a still segment running up to the end of the stream
+    if (reference && wasStatic)
+    {
+        vfloat wander = angle - segmentStart;
+        driftSum += lanes_max(wander, -wander);
+    }
+
+    for (lane = 0; lane < MAHONY_LANES; lane++)
+    {
+        if (final)
+        {
+            final[lane].q0 = q0[lane];
+            final[lane].q1 = q1[lane];
+            final[lane].q2 = q2[lane];
+            final[lane].q3 = q3[lane];
+        }
+        if (reference && count > 0)
+        {
+            // 2 * sqrt(1 - dot^2) is the attitude error angle for small errors
+            metrics[lane].rms_error = 2.0f * sqrtf(fmaxf(errorSum[lane], 0.0f) / count);
+            metrics[lane].max_error = error_to_angle(errorMax[lane]);
+            metrics[lane].final_error = error_to_angle(error[lane]);
+            metrics[lane].convergence_time = lastUnconverged[lane] * invSampleFreq;
+            metrics[lane].static_drift = staticTime > 0.0f ? driftSum[lane] / staticTime : 0.0f;
+            metrics[lane].response_lag = lagDenominator > 0.0f ? lagNumerator[lane] / lagDenominator : 0.0f;
+        }
+        else
+        {
+            memset(&metrics[lane], 0, sizeof(metrics[lane]));
+        }
+    }
+}
+
+/**
+ * Evaluate any number of gain pairs, MAHONY_LANES at a time.
+ *
+ * The last batch is padded by repeating the last gain pair.
+ *
+ * @param samples Shared input stream
+ * @param reference Reference attitude for each sample, NULL to skip metrics
+ * @param count Number of samples
+ * @param config Sample frequency, correction rate, gain schedule and scoring thresholds
+ * @param gains Gain pairs to evaluate
+ * @param instances Number of gain pairs
+ * @param metrics One result per gain pair
+ */
+void mahony_lanes_sweep(
+    const struct mahony_sample *samples,
+    const struct mahony_quaternion *reference,
+    unsigned long count,
+    const struct mahony_sweep_config *config,
+    const struct mahony_gains *gains,
+    unsigned int instances,
+    struct mahony_metrics *metrics)
+{
+    struct mahony_gains batchGains[MAHONY_LANES];
+    struct mahony_metrics batchMetrics[MAHONY_LANES];
+    unsigned int first, lane;
+
+    for (first = 0; first < instances; first += MAHONY_LANES)
+    {
+        for (lane = 0; lane < MAHONY_LANES; lane++)
+        {
+            unsigned int i = first + lane < instances ? first + lane : instances - 1;
+            batchGains[lane] = gains[i];
+        }
+
+        mahony_lanes_run(samples, reference, count, config, batchGains, batchMetrics, NULL);
+
+        for (lane = 0; lane < MAHONY_LANES && first + lane < instances; lane++)
+            metrics[first + lane] = batchMetrics[lane];
+    }
+}
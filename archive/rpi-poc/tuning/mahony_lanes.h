@@ -0,0 +1,89 @@
+/**
+ * Multi-instance Mahony filter for offline gain sweeps.
+ *
+ * Runs MAHONY_LANES independent copies of the multi-rate filter in
+ * MahonyAHRS.c at once, one per SIMD lane, each one with its own cruise
+ * gains, over the same recorded input stream. The lane count follows the instruction set the
+ * file is compiled for (AVX-512: 16, AVX/AVX2: 8, SSE/NEON: 4).
+ */
+#ifndef __MAHONY_LANES_H_
+#define __MAHONY_LANES_H_
+
+#if defined(__AVX512F__)
+#define MAHONY_LANES 16
+#elif defined(__AVX__)
+#define MAHONY_LANES 8
+#else
+#define MAHONY_LANES 4
+#endif
+
+/**
+ * One input sample, in the same units mahony_update_multirate() takes them:
+ * gyro in degrees/sec, accel and mag in any consistent scale (they get
+ * normalised).
+ */
+struct mahony_sample
+{
+    float gx, gy, gz;
+    float ax, ay, az;
+    float mx, my, mz;
+    int magFresh; // new mag reading, corrects right away
+};
+
+struct mahony_quaternion
+{
+    float q0, q1, q2, q3;
+};
+
+struct mahony_gains
+{
+    float twoKp; // once the gain schedule is done
+    float twoKi;
+};
+
+/**
+ * How the filter runs and how a run is scored against the reference.
+ */
+struct mahony_sweep_config
+{
+    float sampleFreq;     // Hz
+    unsigned int correctionDivider; // accel/mag correction every n samples
+    float startGain;      // twoKp right after alignment
+    float scheduleTime;   // s from startGain down to the cruise twoKp
+    float convergedError; // error below which the filter counts as converged (rad)
+    float staticRate;     // reference rate below which the vehicle counts as still (rad/s)
+    float settleTime;     // start-up time left out of the drift and lag metrics (s)
+};
+
+/**
+ * Score of one instance against the reference. Errors are in radians.
+ */
+struct mahony_metrics
+{
+    float rms_error;
+    float max_error;
+    float final_error;
+    float convergence_time; // time until the error stays below convergedError (s)
+    float static_drift;     // error wander while the reference is still (rad/s)
+    float response_lag;     // least-squares lag of the estimate behind the reference (s)
+};
+
+void mahony_lanes_run(
+    const struct mahony_sample *samples,
+    const struct mahony_quaternion *reference,
+    unsigned long count,
+    const struct mahony_sweep_config *config,
+    const struct mahony_gains *gains,
+    struct mahony_metrics *metrics,
+    struct mahony_quaternion *final);
+
+void mahony_lanes_sweep(
+    const struct mahony_sample *samples,
+    const struct mahony_quaternion *reference,
+    unsigned long count,
+    const struct mahony_sweep_config *config,
+    const struct mahony_gains *gains,
+    unsigned int instances,
+    struct mahony_metrics *metrics);
+
+#endif